@@ -0,0 +1,153 @@
+#!/usr/bin/env python2
+from __future__ import with_statement
+import glob
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+tester_dir = os.path.dirname(os.path.abspath(__file__))
+jacc = os.environ.get('JACC', os.path.join(tester_dir, 'jacc'))
+
+OPERATORS = ['+', '-', '*', '/', '%', '<<', '>>', '<', '<=', '>', '>=',
+             '==', '!=', '&', '^', '|', '&&', '||']
+
+def expr_chain(length, rnd):
+    parts = ['a']
+    for i in range(length):
+        parts.append(rnd.choice(OPERATORS))
+        parts.append(rnd.choice(['a', 'b', '1', '2']))
+    return ' '.join(parts)
+
+def bench_expr_chains(statements=2000, length=100):
+    rnd = random.Random(1)
+    lines = ['int main()', '{', '    int a, b;']
+    for i in range(statements):
+        lines.append('    a = %s;' % expr_chain(length, rnd))
+    lines.append('}')
+    return '\n'.join(lines)
+
+def bench_primaries(statements=200000):
+    lines = ['int main()', '{', '    int a;']
+    lines.extend(['    a;'] * statements)
+    lines.append('}')
+    return '\n'.join(lines)
+
+def bench_functions(functions=2000, statements=50):
+    rnd = random.Random(1)
+    lines = []
+    for i in range(functions):
+        lines.extend(['int f%d(int a, int b)' % i, '{'])
+        for j in range(statements):
+            lines.append('    a = %s;' % expr_chain(10, rnd))
+        lines.extend(['    return a;', '}'])
+    return '\n'.join(lines)
+
+def bench_static_functions(functions=2000, statements=50):
+    # only every tenth helper is called from main
+    source = bench_functions(functions, statements).replace('int f', 'static int f')
+    calls = ['    f%d(1, 2);' % i for i in range(0, functions, 10)]
+    return '%s\nint main()\n{\n%s\n}\n' % (source, '\n'.join(calls))
+
+benchmarks = {
+    'expr_chains': (bench_expr_chains, ['stats']),
+    'primaries': (bench_primaries, ['stats']),
+    'functions': (bench_functions, ['stats']),
+    'functions_j4': (bench_functions, ['stats', '-j4']),
+    'functions_tree': (bench_functions, ['parse']),
+    'functions_json': (bench_functions, ['json']),
+    'static_functions': (bench_static_functions, ['compile']),
+    'static_functions_lazy': (bench_static_functions, ['compile', '-lazy']),
+}
+
+def run(args, path, repeat):
+    best = None
+    with open(os.devnull, 'w') as devnull:
+        for i in range(repeat):
+            started_at = time.time()
+            ret_code = subprocess.call([jacc] + args + [path], stdout=devnull, stderr=devnull)
+            elapsed = time.time() - started_at
+            if ret_code != 0:
+                return None
+            if best is None or elapsed < best:
+                best = elapsed
+    return best
+
+def run_pipeline(commands, repeat):
+    best = None
+    with open(os.devnull, 'w') as devnull:
+        for i in range(repeat):
+            started_at = time.time()
+            for command in commands:
+                if subprocess.call(command, stdout=devnull, stderr=devnull) != 0:
+                    return None
+            elapsed = time.time() - started_at
+            if best is None or elapsed < best:
+                best = elapsed
+    return best
+
+# compiling and executing the generator tests in process against assembling and linking them
+def bench_run_latency(work_dir, repeat):
+    programs = sorted(glob.glob(os.path.join(tester_dir, 'tests', 'generator', '*.in')))
+    obj = os.path.join(work_dir, 'program.o')
+    exe = os.path.join(work_dir, 'program')
+    in_process = separate = 0
+    for program in programs:
+        elapsed = run_pipeline([[jacc, 'run', program]], repeat)
+        linked = run_pipeline([['sh', '-c', '"%s" object --target=x86_64-linux "%s" > "%s"' % (jacc, program, obj)],
+                               ['cc', '-o', exe, obj], [exe]], repeat)
+        if elapsed is None or linked is None:
+            print("run_latency: FAIL on %s" % os.path.basename(program))
+            return
+        in_process += elapsed
+        separate += linked
+    print("run_latency: %d us per program, %d us linked with cc" % (
+        in_process * 1e6 / len(programs), separate * 1e6 / len(programs)))
+
+def run_time(command, program, repeat):
+    best = None
+    with open(os.devnull, 'w') as devnull:
+        for i in range(repeat):
+            process = subprocess.Popen([jacc, command, '-time', program], stdout=devnull, stderr=subprocess.PIPE)
+            report = process.communicate()[1]
+            if process.returncode != 0:
+                return None
+            elapsed = int(report.split()[-2])
+            if best is None or elapsed < best:
+                best = elapsed
+    return best
+
+# time spent running the generator tests as bytecode against running them compiled
+def bench_vm_throughput(repeat):
+    programs = sorted(glob.glob(os.path.join(tester_dir, 'tests', 'generator', '*.in')))
+    interpreted = native = 0
+    for program in programs:
+        vm = run_time('vm', program, repeat)
+        jit = run_time('run', program, repeat)
+        if vm is None or jit is None:
+            print("vm_throughput: FAIL on %s" % os.path.basename(program))
+            return
+        interpreted += vm
+        native += jit
+    print("vm_throughput: %d us interpreted, %d us native" % (interpreted, native))
+
+if __name__ == '__main__':
+    repeat = int(sys.argv[1]) if len(sys.argv) > 1 else 5
+    work_dir = tempfile.mkdtemp(prefix='jacc_bench')
+    try:
+        for name, (generator, args) in sorted(benchmarks.items()):
+            path = os.path.join(work_dir, name + '.c')
+            with open(path, 'w') as f:
+                f.write(generator())
+            elapsed = run(args, path, repeat)
+            if elapsed is None:
+                print("%s: FAIL" % name)
+            else:
+                print("%s: %.3f seconds" % (name, elapsed))
+        bench_run_latency(work_dir, repeat)
+        bench_vm_throughput(repeat)
+    finally:
+        shutil.rmtree(work_dir)
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "ast.h"
+
+static void *ensure_capacity(void *data, int *capacity, int needed, int item_size)
+{
+    if (needed <= *capacity) {
+        return data;
+    }
+    int new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+    if (new_capacity < needed) {
+        new_capacity = needed;
+    }
+    *capacity = new_capacity;
+    return jacc_realloc(data, new_capacity * item_size);
+}
+
+static ast_index_t alloc_node(ast_t ast, enum node_type type, struct symbol *type_sym)
+{
+    if (ast->count + 1 > ast->capacity) {
+        int capacity = ast->capacity;
+        ast->kind = ensure_capacity(ast->kind, &capacity, ast->count + 1, sizeof(*ast->kind));
+        capacity = ast->capacity;
+        ast->type_sym = ensure_capacity(ast->type_sym, &capacity, ast->count + 1, sizeof(*ast->type_sym));
+        capacity = ast->capacity;
+        ast->first = ensure_capacity(ast->first, &capacity, ast->count + 1, sizeof(*ast->first));
+        ast->capacity = capacity;
+    }
+    ast_index_t index = ast->count++;
+    ast->kind[index] = type;
+    ast->type_sym[index] = type_sym;
+    ast->first[index] = 0;
+    return index;
+}
+
+static int alloc_links(ast_t ast, int count)
+{
+    int first = ast->links_count;
+    ast->links = ensure_capacity(ast->links, &ast->links_capacity,
+        ast->links_count + count, sizeof(*ast->links));
+    ast->links_count += count;
+    return first;
+}
+
+static int alloc_value(ast_t ast)
+{
+    ast->values = ensure_capacity(ast->values, &ast->values_capacity,
+        ast->values_count + 1, sizeof(*ast->values));
+    return ast->values_count++;
+}
+
+static void add_scope(ast_t ast, ast_index_t index, symtable_t symtable)
+{
+    ast->scopes = ensure_capacity(ast->scopes, &ast->scopes_capacity,
+        ast->scopes_count + 1, sizeof(*ast->scopes));
+    ast->scopes[ast->scopes_count].node = index;
+    ast->scopes[ast->scopes_count].symtable = symtable;
+    ast->scopes_count++;
+}
+
+extern ast_t ast_create(int capacity)
+{
+    ast_t ast = jacc_calloc(1, sizeof(*ast));
+    /* index 0 is reserved for AST_NONE */
+    alloc_node(ast, NT_UNKNOWN, NULL);
+    if (capacity > ast->capacity) {
+        ast->kind = jacc_realloc(ast->kind, capacity * sizeof(*ast->kind));
+        ast->type_sym = jacc_realloc(ast->type_sym, capacity * sizeof(*ast->type_sym));
+        ast->first = jacc_realloc(ast->first, capacity * sizeof(*ast->first));
+        ast->capacity = capacity;
+    }
+    return ast;
+}
+
+extern void ast_destroy(ast_t ast)
+{
+    if (ast == NULL) {
+        return;
+    }
+    jacc_free(ast->kind);
+    jacc_free(ast->type_sym);
+    jacc_free(ast->first);
+    jacc_free(ast->links);
+    jacc_free(ast->values);
+    jacc_free(ast->scopes);
+    jacc_free(ast);
+}
+
+/* copies a node without its operands, leaving their links to be filled */
+static ast_index_t add_node(ast_t ast, struct node *node)
+{
+    ast_index_t index = alloc_node(ast, node->type, node->type_sym);
+    if (node->symtable != NULL) {
+        add_scope(ast, index, node->symtable);
+    }
+
+    int value;
+    switch (node->type) {
+    case NT_INT:
+        value = alloc_value(ast);
+        ast->values[value].int_val = ((struct int_node*)node)->value;
+        ast->first[index] = value;
+        return index;
+    case NT_DOUBLE:
+        value = alloc_value(ast);
+        ast->values[value].double_val = ((struct double_node*)node)->value;
+        ast->first[index] = value;
+        return index;
+    case NT_STRING:
+    case NT_IDENT:
+        value = alloc_value(ast);
+        ast->values[value].str_val = ((struct string_node*)node)->value;
+        ast->first[index] = value;
+        return index;
+    case NT_VARIABLE:
+        value = alloc_value(ast);
+        ast->values[value].symbol = ((struct var_node*)node)->symbol;
+        ast->first[index] = value;
+        return index;
+    }
+
+    int count = parser_node_subnodes_count(node), first;
+    if (node->type == NT_LIST) {
+        first = alloc_links(ast, count + 1);
+        ast->links[first] = count;
+        first++;
+    } else {
+        first = alloc_links(ast, count);
+    }
+    ast->first[index] = first;
+    return index;
+}
+
+struct pending_node {
+    struct node *node;
+    int link;
+};
+
+/*
+ * Nodes are copied in preorder using an explicit stack, so scopes are
+ * added in index order and deep trees do not recurse.
+ */
+extern ast_index_t ast_add(ast_t ast, struct node *node)
+{
+    struct pending_node *stack;
+    int i, top = 0, capacity = 64;
+    ast_index_t root = AST_NONE;
+
+    if (node == NULL) {
+        return AST_NONE;
+    }
+
+    stack = jacc_malloc(capacity * sizeof(*stack));
+    stack[top].node = node;
+    stack[top].link = -1;
+    top++;
+    while (top > 0) {
+        struct pending_node pending = stack[--top];
+        ast_index_t index = add_node(ast, pending.node);
+        if (pending.link < 0) {
+            root = index;
+        } else {
+            ast->links[pending.link] = index;
+        }
+
+        int count = ast_subnodes_count(ast, index);
+        stack = ensure_capacity(stack, &capacity, top + count, sizeof(*stack));
+        for (i = count - 1; i >= 0; i--) {
+            struct node *subnode = parser_get_subnode(pending.node, i);
+            if (subnode == NULL) {
+                ast->links[ast->first[index] + i] = AST_NONE;
+                continue;
+            }
+            stack[top].node = subnode;
+            stack[top].link = ast->first[index] + i;
+            top++;
+        }
+    }
+    jacc_free(stack);
+    return root;
+}
+
+extern enum node_type ast_node_type(ast_t ast, ast_index_t index)
+{
+    return ast->kind[index];
+}
+
+extern struct symbol *ast_type_sym(ast_t ast, ast_index_t index)
+{
+    return ast->type_sym[index];
+}
+
+extern int ast_subnodes_count(ast_t ast, ast_index_t index)
+{
+    if (ast->kind[index] == NT_LIST) {
+        return ast->links[ast->first[index] - 1];
+    }
+    switch (ast->kind[index]) {
+    case NT_INT:
+    case NT_DOUBLE:
+    case NT_STRING:
+    case NT_IDENT:
+    case NT_VARIABLE:
+        return 0;
+    }
+    return parser_node_type_info(ast->kind[index])->op_count;
+}
+
+extern ast_index_t ast_get_subnode(ast_t ast, ast_index_t index, int subnode)
+{
+    return ast->links[ast->first[index] + subnode];
+}
+
+extern union ast_value *ast_value(ast_t ast, ast_index_t index)
+{
+    return &ast->values[ast->first[index]];
+}
+
+extern symtable_t ast_symtable(ast_t ast, ast_index_t index)
+{
+    int l = 0, r = ast->scopes_count - 1;
+    while (l <= r) {
+        int m = (l + r) / 2;
+        if (ast->scopes[m].node == index) {
+            return ast->scopes[m].symtable;
+        } else if (ast->scopes[m].node < index) {
+            l = m + 1;
+        } else {
+            r = m - 1;
+        }
+    }
+    return NULL;
+}
+
+extern int ast_memory_size(ast_t ast)
+{
+    return ast->count * (sizeof(*ast->kind) + sizeof(*ast->type_sym) + sizeof(*ast->first))
+        + ast->links_count * sizeof(*ast->links)
+        + ast->values_count * sizeof(*ast->values)
+        + ast->scopes_count * sizeof(*ast->scopes);
+}
+
+extern int ast_tree_memory_size(struct node *node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+
+    int i, size, count = parser_node_subnodes_count(node);
+    switch (node->type) {
+    case NT_INT: size = sizeof(struct int_node); break;
+    case NT_DOUBLE: size = sizeof(struct double_node); break;
+    case NT_STRING:
+    case NT_IDENT: size = sizeof(struct string_node); break;
+    case NT_VARIABLE: size = sizeof(struct var_node); break;
+    case NT_LIST:
+        size = sizeof(struct list_node) + ((struct list_node*)node)->capacity * sizeof(struct node*);
+        break;
+    default:
+        size = sizeof(struct node) + count * sizeof(struct node*);
+    }
+
+    for (i = 0; i < count; i++) {
+        size += ast_tree_memory_size(parser_get_subnode(node, i));
+    }
+    return size;
+}
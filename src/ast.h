@@ -0,0 +1,70 @@
+#ifndef JACC_AST_H
+#define JACC_AST_H
+
+#include <stdint.h>
+#include "parser.h"
+#include "symtable.h"
+
+/*
+ * Compact AST layout: nodes live in one contiguous pool and refer to each
+ * other by 32-bit indices. Per-node data is stored as separate arrays;
+ * operands of a node are a contiguous run in the links array, atom values
+ * live in a side array, and scopes are kept in a sorted side table since
+ * almost no node has one.
+ *
+ * The pipeline still builds and walks struct node trees; the pool is only
+ * filled by the stats command to compare its size with the tree's.
+ */
+
+typedef uint32_t ast_index_t;
+
+#define AST_NONE 0
+
+union ast_value {
+    int int_val;
+    double double_val;
+    const char *str_val;
+    struct symbol *symbol;
+};
+
+struct ast_scope {
+    ast_index_t node;
+    symtable_t symtable;
+};
+
+typedef struct ast {
+    int count;
+    int capacity;
+    uint8_t *kind;
+    struct symbol **type_sym;
+    uint32_t *first;
+
+    ast_index_t *links;
+    int links_count;
+    int links_capacity;
+
+    union ast_value *values;
+    int values_count;
+    int values_capacity;
+
+    struct ast_scope *scopes;
+    int scopes_count;
+    int scopes_capacity;
+} *ast_t;
+
+extern ast_t ast_create(int capacity);
+extern void ast_destroy(ast_t ast);
+
+extern ast_index_t ast_add(ast_t ast, struct node *node);
+
+extern enum node_type ast_node_type(ast_t ast, ast_index_t index);
+extern struct symbol *ast_type_sym(ast_t ast, ast_index_t index);
+extern int ast_subnodes_count(ast_t ast, ast_index_t index);
+extern ast_index_t ast_get_subnode(ast_t ast, ast_index_t index, int subnode);
+extern union ast_value *ast_value(ast_t ast, ast_index_t index);
+extern symtable_t ast_symtable(ast_t ast, ast_index_t index);
+
+extern int ast_memory_size(ast_t ast);
+extern int ast_tree_memory_size(struct node *node);
+
+#endif
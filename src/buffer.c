@@ -21,7 +21,8 @@ extern buffer_t buffer_create(int initial_size)
 extern void buffer_ensure_capacity(buffer_t buffer, int capacity)
 {
     if (capacity > buffer->size) {
-        buffer->buf = jacc_realloc(buffer->buf, capacity);
+        buffer->size = buffer->size * 2 > capacity ? buffer->size * 2 : capacity;
+        buffer->buf = jacc_realloc(buffer->buf, buffer->size);
     }
 }
 
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "cfg.h"
+
+/* arrays grow whenever count reaches a power of two */
+static void add_edge(struct cfg_edges *edges, int block)
+{
+    if ((edges->count & (edges->count - 1)) == 0) {
+        int capacity = edges->count == 0 ? 1 : edges->count * 2;
+        edges->blocks = jacc_realloc(edges->blocks, capacity * sizeof(*edges->blocks));
+    }
+    edges->blocks[edges->count++] = block;
+}
+
+/* iterative depth-first search, postorder is filled from the end */
+static void compute_rpo(cfg_t cfg)
+{
+    int *stack = jacc_malloc(cfg->blocks_count * sizeof(*stack));
+    int *next_succ = jacc_calloc(cfg->blocks_count, sizeof(*next_succ));
+    char *visited = jacc_calloc(cfg->blocks_count, 1);
+    int *postorder = jacc_malloc(cfg->blocks_count * sizeof(*postorder));
+    int i, top = 0, count = 0;
+
+    stack[top++] = 0;
+    visited[0] = 1;
+    while (top > 0) {
+        int block = stack[top - 1];
+        if (next_succ[block] < cfg->succs[block].count) {
+            int succ = cfg->succs[block].blocks[next_succ[block]++];
+            if (!visited[succ]) {
+                visited[succ] = 1;
+                stack[top++] = succ;
+            }
+        } else {
+            postorder[count++] = block;
+            top--;
+        }
+    }
+
+    cfg->rpo = jacc_malloc((count + 1) * sizeof(*cfg->rpo));
+    cfg->rpo_count = count;
+    for (i = 0; i < count; i++) {
+        cfg->rpo[i] = postorder[count - 1 - i];
+    }
+    jacc_free(postorder);
+    jacc_free(visited);
+    jacc_free(next_succ);
+    jacc_free(stack);
+}
+
+static int intersect(cfg_t cfg, int *order, int a, int b)
+{
+    while (a != b) {
+        while (order[a] > order[b]) {
+            a = cfg->idom[a];
+        }
+        while (order[b] > order[a]) {
+            b = cfg->idom[b];
+        }
+    }
+    return a;
+}
+
+/* Cooper, Harvey and Kennedy's iterative algorithm over the reverse postorder */
+static void compute_dominators(cfg_t cfg)
+{
+    int *order = jacc_malloc(cfg->blocks_count * sizeof(*order));
+    int i, j, changed = 1;
+
+    for (i = 0; i < cfg->blocks_count; i++) {
+        order[i] = -1;
+        cfg->idom[i] = -1;
+    }
+    for (i = 0; i < cfg->rpo_count; i++) {
+        order[cfg->rpo[i]] = i;
+    }
+
+    cfg->idom[0] = 0;
+    while (changed) {
+        changed = 0;
+        for (i = 1; i < cfg->rpo_count; i++) {
+            int block = cfg->rpo[i], idom = -1;
+            for (j = 0; j < cfg->preds[block].count; j++) {
+                int pred = cfg->preds[block].blocks[j];
+                if (order[pred] == -1 || cfg->idom[pred] == -1) {
+                    continue;
+                }
+                idom = idom == -1 ? pred : intersect(cfg, order, pred, idom);
+            }
+            if (cfg->idom[block] != idom) {
+                cfg->idom[block] = idom;
+                changed = 1;
+            }
+        }
+    }
+    cfg->idom[0] = -1;
+
+    for (i = 1; i < cfg->rpo_count; i++) {
+        add_edge(&cfg->children[cfg->idom[cfg->rpo[i]]], cfg->rpo[i]);
+    }
+    jacc_free(order);
+}
+
+extern cfg_t cfg_build(ir_function_t function)
+{
+    cfg_t cfg = jacc_calloc(1, sizeof(*cfg));
+    int i, j, n = function->blocks_count;
+    int *last_source;
+
+    cfg->blocks_count = n;
+    cfg->preds = jacc_calloc(n, sizeof(*cfg->preds));
+    cfg->succs = jacc_calloc(n, sizeof(*cfg->succs));
+    cfg->children = jacc_calloc(n, sizeof(*cfg->children));
+    cfg->idom = jacc_malloc(n * sizeof(*cfg->idom));
+
+    /* last_source remembers the latest block with an edge to each target */
+    last_source = jacc_malloc(n * sizeof(*last_source));
+    for (i = 0; i < n; i++) {
+        last_source[i] = -1;
+    }
+    for (i = 0; i < n; i++) {
+        struct ir_insn *last = ir_terminator(function->blocks[i]);
+        for (j = 0; last != NULL && j < last->targets_count; j++) {
+            int target = last->targets[j];
+            if (last_source[target] != i) {
+                last_source[target] = i;
+                add_edge(&cfg->succs[i], target);
+                add_edge(&cfg->preds[target], i);
+            }
+        }
+    }
+    jacc_free(last_source);
+
+    compute_rpo(cfg);
+    compute_dominators(cfg);
+    return cfg;
+}
+
+extern void cfg_destroy(cfg_t cfg)
+{
+    int i;
+    if (cfg == NULL) {
+        return;
+    }
+    for (i = 0; i < cfg->blocks_count; i++) {
+        jacc_free(cfg->preds[i].blocks);
+        jacc_free(cfg->succs[i].blocks);
+        jacc_free(cfg->children[i].blocks);
+    }
+    jacc_free(cfg->preds);
+    jacc_free(cfg->succs);
+    jacc_free(cfg->children);
+    jacc_free(cfg->rpo);
+    jacc_free(cfg->idom);
+    jacc_free(cfg);
+}
+
+extern int cfg_dominates(cfg_t cfg, int a, int b)
+{
+    while (b != -1 && b != a) {
+        b = cfg->idom[b];
+    }
+    return b == a;
+}
+
+extern int cfg_pred_index(cfg_t cfg, int block, int pred)
+{
+    int i;
+    for (i = 0; i < cfg->preds[block].count; i++) {
+        if (cfg->preds[block].blocks[i] == pred) {
+            return i;
+        }
+    }
+    return -1;
+}
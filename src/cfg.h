@@ -0,0 +1,38 @@
+#ifndef JACC_CFG_H
+#define JACC_CFG_H
+
+#include "ir.h"
+
+/*
+ * Control flow graph of an IR function with its dominator tree. Edges
+ * are deduplicated, so a switch with several cases going to one block
+ * makes a single edge. The graph is a snapshot: passes changing blocks
+ * or terminators build a new one.
+ */
+
+struct cfg_edges {
+    int *blocks;
+    int count;
+};
+
+typedef struct cfg {
+    int blocks_count;
+    struct cfg_edges *preds;
+    struct cfg_edges *succs;
+    /* reachable blocks in reverse postorder, the entry first */
+    int *rpo;
+    int rpo_count;
+    /* immediate dominators, -1 for the entry and unreachable blocks */
+    int *idom;
+    /* dominator tree children */
+    struct cfg_edges *children;
+} *cfg_t;
+
+extern cfg_t cfg_build(ir_function_t function);
+extern void cfg_destroy(cfg_t cfg);
+
+extern int cfg_dominates(cfg_t cfg, int a, int b);
+/* position of pred among the predecessors of block, -1 if it is none */
+extern int cfg_pred_index(cfg_t cfg, int block, int pred);
+
+#endif
@@ -0,0 +1,286 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "buffer.h"
+#include "parser.h"
+#include "ptrmap.h"
+#include "dump.h"
+
+#define DUMP_BUFFER_SIZE (1 << 20)
+
+static const char *node_names[] = {
+#define NODE(name, repr, cat, op_cnt, prec) #name,
+#include "nodes.def"
+#undef NODE
+};
+
+static const char *symbol_kinds[] = {
+    "variable",
+    "global_variable",
+    "field",
+    "function",
+    "scalar",
+    "alias",
+    "struct",
+    "union",
+    "enum",
+    "enum_const",
+    "array",
+    "pointer",
+    "parameter",
+};
+
+static const char *symbol_classes[] = {
+    "name",
+    "tag",
+    "label",
+};
+
+struct dumper {
+    FILE *file;
+    buffer_t out;
+    /* symbols get ids in the order they are first referenced */
+    ptrmap_t symbol_ids;
+    struct symbol **symbols;
+    int symbols_count;
+    int symbols_capacity;
+    int nodes_count;
+};
+
+static void flush(struct dumper *d)
+{
+    fwrite(buffer_data(d->out), 1, buffer_size(d->out), d->file);
+    buffer_reset(d->out);
+}
+
+static void put(struct dumper *d, const char *str)
+{
+    buffer_append_string(d->out, (char*)str, strlen(str));
+    if (buffer_size(d->out) >= DUMP_BUFFER_SIZE) {
+        flush(d);
+    }
+}
+
+static void put_int(struct dumper *d, int value)
+{
+    char buf[16];
+    sprintf(buf, "%d", value);
+    put(d, buf);
+}
+
+static void put_double(struct dumper *d, double value)
+{
+    char buf[32];
+    if (!isfinite(value)) {
+        put(d, "null");
+        return;
+    }
+    sprintf(buf, "%.17g", value);
+    put(d, buf);
+}
+
+static void put_string(struct dumper *d, const char *str)
+{
+    char buf[8];
+    if (str == NULL) {
+        put(d, "null");
+        return;
+    }
+    buffer_append(d->out, '"');
+    for (; *str != 0; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            buffer_append(d->out, '\\');
+            buffer_append(d->out, c);
+        } else if (c < 0x20) {
+            sprintf(buf, "\\u%04x", c);
+            buffer_append_string(d->out, buf, 6);
+        } else {
+            buffer_append(d->out, c);
+        }
+    }
+    buffer_append(d->out, '"');
+}
+
+static int symbol_id(struct dumper *d, struct symbol *symbol)
+{
+    int id = ptrmap_get(d->symbol_ids, symbol);
+    if (id != 0) {
+        return id;
+    }
+    if (d->symbols_count == d->symbols_capacity) {
+        d->symbols_capacity = d->symbols_capacity == 0 ? 256 : d->symbols_capacity * 2;
+        d->symbols = jacc_realloc(d->symbols, d->symbols_capacity * sizeof(*d->symbols));
+    }
+    d->symbols[d->symbols_count++] = symbol;
+    ptrmap_set(d->symbol_ids, symbol, d->symbols_count);
+    return d->symbols_count;
+}
+
+static void put_symbol_ref(struct dumper *d, struct symbol *symbol)
+{
+    if (symbol == NULL) {
+        put(d, "null");
+    } else {
+        put_int(d, symbol_id(d, symbol));
+    }
+}
+
+static void put_scope(struct dumper *d, symtable_t symtable)
+{
+    symtable_iter_t iter;
+    int first = 1;
+    put(d, "[");
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter)) {
+        put(d, first ? "{\"name\":" : ",{\"name\":");
+        first = 0;
+        put_string(d, symtable_iter_key(iter));
+        put(d, ",\"class\":\"");
+        put(d, symbol_classes[symtable_iter_key2(iter)]);
+        put(d, "\",\"symbol\":");
+        put_symbol_ref(d, symtable_iter_value(iter));
+        put(d, "}");
+    }
+    put(d, "]");
+}
+
+static void put_node(struct dumper *d, struct node *node);
+
+static void put_node(struct dumper *d, struct node *node)
+{
+    int i, count;
+    if (node == NULL) {
+        put(d, "null");
+        return;
+    }
+
+    put(d, "{\"id\":");
+    put_int(d, ++d->nodes_count);
+    put(d, ",\"kind\":\"");
+    put(d, node_names[node->type]);
+    put(d, "\",\"type\":");
+    put_symbol_ref(d, node->type_sym);
+    if (node->symtable != NULL) {
+        put(d, ",\"scope\":");
+        put_scope(d, node->symtable);
+    }
+
+    switch (node->type) {
+    case NT_INT:
+        put(d, ",\"value\":");
+        put_int(d, ((struct int_node*)node)->value);
+        put(d, "}");
+        return;
+    case NT_DOUBLE:
+        put(d, ",\"value\":");
+        put_double(d, ((struct double_node*)node)->value);
+        put(d, "}");
+        return;
+    case NT_STRING:
+    case NT_IDENT:
+        put(d, ",\"value\":");
+        put_string(d, ((struct string_node*)node)->value);
+        put(d, "}");
+        return;
+    case NT_VARIABLE:
+        put(d, ",\"symbol\":");
+        put_symbol_ref(d, ((struct var_node*)node)->symbol);
+        put(d, "}");
+        return;
+    }
+
+    count = parser_node_subnodes_count(node);
+    put(d, ",\"ops\":[");
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            put(d, ",");
+        }
+        put_node(d, parser_get_subnode(node, i));
+    }
+    put(d, "]}");
+}
+
+static void put_flags(struct dumper *d, int flags)
+{
+    static const char *names[] = { "variadic", "incomplete", "static", "extern", "unused" };
+    int i, first = 1;
+    put(d, "[");
+    for (i = 0; i < (int)(sizeof(names) / sizeof(*names)); i++) {
+        if (flags & (1 << i)) {
+            put(d, first ? "\"" : ",\"");
+            put(d, names[i]);
+            put(d, "\"");
+            first = 0;
+        }
+    }
+    put(d, "]");
+}
+
+static void put_symbol(struct dumper *d, int id)
+{
+    struct symbol *symbol = d->symbols[id - 1];
+    put(d, "{\"id\":");
+    put_int(d, id);
+    put(d, ",\"kind\":\"");
+    put(d, symbol_kinds[symbol->type]);
+    put(d, "\",\"name\":");
+    put_string(d, symbol->name);
+    put(d, ",\"size\":");
+    put_int(d, symbol->size);
+    put(d, ",\"offset\":");
+    put_int(d, symbol->offset);
+    put(d, ",\"flags\":");
+    put_flags(d, symbol->flags);
+    put(d, ",\"base\":");
+    put_symbol_ref(d, symbol->base_type);
+    if (symbol->expr != NULL) {
+        put(d, ",\"expr\":");
+        put_node(d, symbol->expr);
+    }
+    if (symbol->symtable != NULL) {
+        put(d, ",\"members\":");
+        put_scope(d, symbol->symtable);
+    }
+    if (symbol->ext != NULL) {
+        if (symbol->ext->params != NULL) {
+            put(d, ",\"params\":");
+            put_scope(d, symbol->ext->params);
+        }
+        if (symbol->ext->body != NULL) {
+            put(d, ",\"locals_size\":");
+            put_int(d, symbol->ext->locals_size);
+            put(d, ",\"body\":");
+            put_node(d, symbol->ext->body);
+        }
+    }
+    put(d, "}");
+}
+
+extern void dump_json(symtable_t symtable, FILE *file)
+{
+    struct dumper d;
+    int i;
+
+    memset(&d, 0, sizeof(d));
+    d.file = file;
+    d.out = buffer_create(DUMP_BUFFER_SIZE + 4096);
+    d.symbol_ids = ptrmap_create();
+
+    put(&d, "{\"globals\":");
+    put_scope(&d, symtable);
+    put(&d, ",\n\"symbols\":[\n");
+    /* dumping a symbol may reference new ones, which are appended */
+    for (i = 1; i <= d.symbols_count; i++) {
+        if (i > 1) {
+            put(&d, ",\n");
+        }
+        put_symbol(&d, i);
+    }
+    put(&d, "\n]}\n");
+    flush(&d);
+
+    jacc_free(d.symbols);
+    ptrmap_destroy(d.symbol_ids);
+    buffer_free(d.out);
+}
@@ -0,0 +1,16 @@
+#ifndef JACC_DUMP_H
+#define JACC_DUMP_H
+
+#include <stdio.h>
+#include "symtable.h"
+
+/*
+ * Machine-readable dump of a parsed translation unit as JSON. Symbols are
+ * listed once each with numeric ids, trees are nested with preorder node
+ * ids, and everything goes through one large buffer that is flushed in
+ * big chunks. For a compact binary form see image_write().
+ */
+
+extern void dump_json(symtable_t symtable, FILE *file);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "buffer.h"
+#include "elf.h"
+
+/* the few ELF64 records needed, spelled out to not depend on <elf.h> */
+struct elf_header {
+    unsigned char ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct elf_section {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+};
+
+struct elf_symbol {
+    uint32_t name;
+    unsigned char info;
+    unsigned char other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+};
+
+struct elf_rela {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+};
+
+#define ET_REL 1
+#define EM_X86_64 62
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHF_WRITE 1
+#define SHF_ALLOC 2
+#define SHF_EXECINSTR 4
+#define SHF_INFO_LINK 0x40
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define R_X86_64_64 1
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+
+enum {
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_RELA_TEXT,
+    SECTION_RELA_DATA,
+    SECTION_SHSTRTAB,
+    SECTION_NOTE_STACK,
+    SECTIONS_COUNT,
+};
+
+struct writer {
+    buffer_t out;
+    buffer_t strings;
+    struct elf_section sections[SECTIONS_COUNT];
+    /* symtab index of each object symbol */
+    int *indices;
+};
+
+static void align(buffer_t out, int alignment)
+{
+    while (buffer_size(out) % alignment != 0) {
+        buffer_append(out, 0);
+    }
+}
+
+static int add_string(buffer_t strings, const char *str)
+{
+    int offset = buffer_size(strings);
+    buffer_append_string(strings, (char *)str, strlen(str) + 1);
+    return offset;
+}
+
+/* appends the contents of a section and fills in where it is */
+static void write_section(struct writer *w, int index, const char *contents, int size, int alignment)
+{
+    align(w->out, alignment);
+    w->sections[index].offset = buffer_size(w->out);
+    w->sections[index].size = size;
+    w->sections[index].addralign = alignment;
+    buffer_append_string(w->out, (char *)contents, size);
+}
+
+static void set_section(struct writer *w, int index, buffer_t names, const char *name, uint32_t type, uint64_t flags)
+{
+    w->sections[index].name = add_string(names, name);
+    w->sections[index].type = type;
+    w->sections[index].flags = flags;
+}
+
+static void add_symbol(buffer_t symtab, uint32_t name, int binding, int type, int section, int value)
+{
+    struct elf_symbol symbol;
+    memset(&symbol, 0, sizeof(symbol));
+    symbol.name = name;
+    symbol.info = binding << 4 | type;
+    symbol.shndx = section;
+    symbol.value = value;
+    buffer_append_string(symtab, (char *)&symbol, sizeof(symbol));
+}
+
+/* locals come first: the null symbol, both sections and the static functions */
+static int write_symbols(struct writer *w, object_t object)
+{
+    buffer_t symtab = buffer_create(1024);
+    int i, global, count = 0, first_global = 0;
+
+    for (global = 0; global <= 1; global++) {
+        if (global) {
+            first_global = count;
+        } else {
+            add_symbol(symtab, 0, STB_LOCAL, STT_NOTYPE, 0, 0);
+            count++;
+        }
+        for (i = 0; i < object->symbols_count; i++) {
+            struct object_symbol *symbol = &object->symbols[i];
+            int section = symbol->section == OS_TEXT ? SECTION_TEXT : symbol->section == OS_DATA ? SECTION_DATA : 0;
+            if (symbol->global != global) {
+                continue;
+            }
+            w->indices[i] = count++;
+            if (symbol->name == NULL) {
+                add_symbol(symtab, 0, STB_LOCAL, STT_SECTION, section, 0);
+            } else {
+                add_symbol(symtab, add_string(w->strings, symbol->name), global ? STB_GLOBAL : STB_LOCAL,
+                    section == SECTION_TEXT ? STT_FUNC : STT_NOTYPE, section, symbol->offset);
+            }
+        }
+    }
+    write_section(w, SECTION_SYMTAB, buffer_data(symtab), buffer_size(symtab), 8);
+    buffer_free(symtab);
+    return first_global;
+}
+
+static void write_relocations(struct writer *w, object_t object, enum object_section section, int index)
+{
+    static const int types[] = { R_X86_64_PC32, R_X86_64_PLT32, R_X86_64_64 };
+    buffer_t relas = buffer_create(1024);
+    int i;
+    for (i = 0; i < object->relocs_count; i++) {
+        struct object_reloc *reloc = &object->relocs[i];
+        struct elf_rela rela;
+        if (reloc->section != section) {
+            continue;
+        }
+        rela.offset = reloc->offset;
+        rela.info = (uint64_t)w->indices[reloc->symbol] << 32 | types[reloc->type];
+        rela.addend = reloc->addend;
+        buffer_append_string(relas, (char *)&rela, sizeof(rela));
+    }
+    write_section(w, index, buffer_data(relas), buffer_size(relas), 8);
+    buffer_free(relas);
+}
+
+extern int elf_write(object_t object, FILE *file)
+{
+    static const unsigned char ident[16] = { 0x7f, 'E', 'L', 'F', 2, 1, 1 };
+    struct writer w;
+    struct elf_header header;
+    buffer_t names = buffer_create(128);
+    int first_global, ok;
+
+    memset(&w, 0, sizeof(w));
+    w.out = buffer_create(4096);
+    w.strings = buffer_create(256);
+    w.indices = jacc_malloc(object->symbols_count * sizeof(*w.indices));
+    buffer_append(w.strings, 0);
+    buffer_append(names, 0);
+
+    set_section(&w, SECTION_TEXT, names, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR);
+    set_section(&w, SECTION_DATA, names, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
+    set_section(&w, SECTION_SYMTAB, names, ".symtab", SHT_SYMTAB, 0);
+    set_section(&w, SECTION_STRTAB, names, ".strtab", SHT_STRTAB, 0);
+    set_section(&w, SECTION_RELA_TEXT, names, ".rela.text", SHT_RELA, SHF_INFO_LINK);
+    set_section(&w, SECTION_RELA_DATA, names, ".rela.data", SHT_RELA, SHF_INFO_LINK);
+    set_section(&w, SECTION_SHSTRTAB, names, ".shstrtab", SHT_STRTAB, 0);
+    set_section(&w, SECTION_NOTE_STACK, names, ".note.GNU-stack", SHT_PROGBITS, 0);
+
+    buffer_append_string(w.out, (char *)&header, sizeof(header));
+    write_section(&w, SECTION_TEXT, buffer_data(object->text), buffer_size(object->text), 16);
+    write_section(&w, SECTION_DATA, buffer_data(object->data), buffer_size(object->data), 8);
+    first_global = write_symbols(&w, object);
+    write_section(&w, SECTION_STRTAB, buffer_data(w.strings), buffer_size(w.strings), 1);
+    write_relocations(&w, object, OS_TEXT, SECTION_RELA_TEXT);
+    write_relocations(&w, object, OS_DATA, SECTION_RELA_DATA);
+    write_section(&w, SECTION_SHSTRTAB, buffer_data(names), buffer_size(names), 1);
+    write_section(&w, SECTION_NOTE_STACK, NULL, 0, 1);
+
+    w.sections[SECTION_SYMTAB].link = SECTION_STRTAB;
+    w.sections[SECTION_SYMTAB].info = first_global;
+    w.sections[SECTION_SYMTAB].entsize = sizeof(struct elf_symbol);
+    w.sections[SECTION_RELA_TEXT].link = w.sections[SECTION_RELA_DATA].link = SECTION_SYMTAB;
+    w.sections[SECTION_RELA_TEXT].info = SECTION_TEXT;
+    w.sections[SECTION_RELA_DATA].info = SECTION_DATA;
+    w.sections[SECTION_RELA_TEXT].entsize = w.sections[SECTION_RELA_DATA].entsize = sizeof(struct elf_rela);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.ident, ident, sizeof(ident));
+    header.type = ET_REL;
+    header.machine = EM_X86_64;
+    header.version = 1;
+    header.ehsize = sizeof(header);
+    header.shentsize = sizeof(struct elf_section);
+    header.shnum = SECTIONS_COUNT;
+    header.shstrndx = SECTION_SHSTRTAB;
+    align(w.out, 8);
+    header.shoff = buffer_size(w.out);
+    memcpy(buffer_data(w.out), &header, sizeof(header));
+    buffer_append_string(w.out, (char *)w.sections, sizeof(w.sections));
+
+    ok = fwrite(buffer_data(w.out), 1, buffer_size(w.out), file) == (size_t)buffer_size(w.out);
+
+    jacc_free(w.indices);
+    buffer_free(w.strings);
+    buffer_free(names);
+    buffer_free(w.out);
+    return ok;
+}
@@ -0,0 +1,10 @@
+#ifndef JACC_ELF_H
+#define JACC_ELF_H
+
+#include <stdio.h>
+#include "encoder.h"
+
+/* relocatable ELF64 object for the x86-64 System V ABI, 0 on a write error */
+extern int elf_write(object_t object, FILE *file);
+
+#endif
@@ -0,0 +1,756 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "ptrmap.h"
+#include "encoder.h"
+
+#define SHORT_JUMP_SIZE 2
+#define NEAR_JUMP_SIZE 5
+#define NEAR_JCC_SIZE 6
+
+/* one encoded text command, jumps to labels are sized by the layout */
+struct piece {
+    int start;
+    int length;
+    int offset;
+    /* rip-relative or call displacement at this position, -1 without */
+    int fixup_pos;
+    label_t fixup_label;
+    int fixup_addend;
+    int fixup_call;
+    /* -1 for jmp, the condition code of a jcc, -2 for no jump */
+    int jump;
+    int jump_short;
+    label_t jump_label;
+    /* label defined here, id 0 for none */
+    label_t defines;
+};
+
+struct encoder {
+    object_t object;
+    buffer_t code;
+    struct piece *pieces;
+    int pieces_count;
+    /* section and offset of the numbered labels */
+    int *label_sections;
+    int *label_offsets;
+    int labels_capacity;
+    /* index + 1 of the named symbols by the address of their name */
+    ptrmap_t names;
+};
+
+struct encoding {
+    unsigned char bytes[16];
+    int length;
+    int fixup_pos;
+    label_t fixup_label;
+    int fixup_addend;
+    int fixup_call;
+};
+
+/* hardware numbers of the registers in registers.def order */
+static int register_number(asm_register_t reg)
+{
+    static const int low[] = { 0, 3, 1, 2, 6, 7, 4, 5 };
+    if (reg >= AR_EAX && reg <= AR_EBP) {
+        return low[reg - AR_EAX];
+    } else if (reg >= AR_R8D && reg <= AR_R15D) {
+        return 8 + reg - AR_R8D;
+    } else if (reg >= AR_RAX && reg <= AR_RBP) {
+        return low[reg - AR_RAX];
+    } else if (reg >= AR_R8 && reg <= AR_R15) {
+        return 8 + reg - AR_R8;
+    } else if (reg >= AR_AL && reg <= AR_DL) {
+        return low[reg - AR_AL];
+    } else if (reg >= AR_AH && reg <= AR_DH) {
+        return 4 + low[reg - AR_AH];
+    }
+    return reg - AR_XMM0;
+}
+
+static int register_size(asm_register_t reg)
+{
+    if (reg >= AR_RAX && reg <= AR_R15) {
+        return 8;
+    } else if (reg >= AR_AL && reg <= AR_DH) {
+        return 1;
+    } else if (reg >= AR_XMM0 && reg <= AR_XMM15) {
+        return 16;
+    }
+    return 4;
+}
+
+static int is_register(asm_operand_t *op)
+{
+    return op->type == AOT_REGISTER;
+}
+
+static int is_xmm(asm_operand_t *op)
+{
+    return op->type == AOT_REGISTER && op->reg >= AR_XMM0 && op->reg <= AR_XMM15;
+}
+
+static int operand_size(asm_operand_t *op)
+{
+    static const int memory_sizes[] = { 1, 2, 4, 8 };
+    if (op->type == AOT_MEMORY) {
+        return memory_sizes[op->memory.size];
+    }
+    return register_size(op->reg);
+}
+
+static int fits_byte(int value)
+{
+    return value >= -128 && value <= 127;
+}
+
+static void put(struct encoding *enc, int byte)
+{
+    enc->bytes[enc->length++] = byte;
+}
+
+static void put_int(struct encoding *enc, int value, int size)
+{
+    int i;
+    for (i = 0; i < size; i++) {
+        put(enc, (value >> (8 * i)) & 0xff);
+    }
+}
+
+static void put_prefixes(struct encoding *enc, int prefix, int rex)
+{
+    if (prefix != 0) {
+        put(enc, prefix);
+    }
+    if (rex != 0) {
+        put(enc, 0x40 | rex);
+    }
+}
+
+static void put_opcode(struct encoding *enc, int opcode)
+{
+    if (opcode > 0xffff) {
+        put(enc, opcode >> 16);
+    }
+    if (opcode > 0xff) {
+        put(enc, (opcode >> 8) & 0xff);
+    }
+    put(enc, opcode & 0xff);
+}
+
+/* opcode with a register in its low bits: push, pop, mov reg, imm */
+static void encode_short(struct encoding *enc, int prefix, int w, int opcode, asm_operand_t *reg)
+{
+    int number = register_number(reg->reg);
+    put_prefixes(enc, prefix, (w ? 8 : 0) | (number >> 3));
+    put(enc, opcode + (number & 7));
+}
+
+/* an instruction with a ModRM byte, rm being a register or memory */
+static void encode_rm(struct encoding *enc, int prefix, int w, int opcode, int reg, asm_operand_t *rm)
+{
+    int rex = (w ? 8 : 0) | ((reg >> 3) << 2);
+    if (rm->type == AOT_REGISTER) {
+        int number = register_number(rm->reg);
+        put_prefixes(enc, prefix, rex | (number >> 3));
+        put_opcode(enc, opcode);
+        put(enc, 0xc0 | (reg & 7) << 3 | (number & 7));
+        return;
+    }
+
+    if (rm->memory.base.type == AOT_LABEL) {
+        put_prefixes(enc, prefix, rex);
+        put_opcode(enc, opcode);
+        put(enc, 0x05 | (reg & 7) << 3);
+        enc->fixup_pos = enc->length;
+        enc->fixup_label = rm->memory.base.label;
+        enc->fixup_addend = rm->memory.offset;
+        put_int(enc, 0, 4);
+        return;
+    }
+
+    int base = register_number(rm->memory.base.reg), offset = rm->memory.offset;
+    int has_index = rm->memory.scale != 0 && rm->memory.index.reg != AR_NONE;
+    int index = has_index ? register_number(rm->memory.index.reg) : 4;
+    int mod = offset == 0 && (base & 7) != 5 ? 0 : fits_byte(offset) ? 1 : 2;
+    int scale = rm->memory.scale == 8 ? 3 : rm->memory.scale == 4 ? 2 : rm->memory.scale == 2 ? 1 : 0;
+
+    if (register_size(rm->memory.base.reg) == 4) {
+        put(enc, 0x67);
+    }
+    put_prefixes(enc, prefix, rex | ((index >> 3) << 1) | (base >> 3));
+    put_opcode(enc, opcode);
+    if (has_index || (base & 7) == 4) {
+        put(enc, mod << 6 | (reg & 7) << 3 | 4);
+        put(enc, scale << 6 | (index & 7) << 3 | (base & 7));
+    } else {
+        put(enc, mod << 6 | (reg & 7) << 3 | (base & 7));
+    }
+    if (mod == 1) {
+        put(enc, offset & 0xff);
+    } else if (mod == 2) {
+        put_int(enc, offset, 4);
+    }
+}
+
+static int condition_code(asm_instruction_t type)
+{
+    switch (type) {
+    case ASM_JB: case ASM_SETB: return 0x2;
+    case ASM_JAE: case ASM_SETAE: return 0x3;
+    case ASM_JE: case ASM_JZ: case ASM_SETE: case ASM_SETZ: return 0x4;
+    case ASM_JNE: case ASM_JNZ: case ASM_SETNE: case ASM_SETNZ: return 0x5;
+    case ASM_JBE: case ASM_SETBE: return 0x6;
+    case ASM_JA: case ASM_SETA: return 0x7;
+    case ASM_JL: case ASM_SETL: return 0xc;
+    case ASM_JGE: case ASM_SETGE: return 0xd;
+    case ASM_JLE: case ASM_SETLE: return 0xe;
+    case ASM_JG: case ASM_SETG: return 0xf;
+    }
+    return -1;
+}
+
+/* the /digit of the group 1 arithmetic */
+static int alu_digit(asm_instruction_t type)
+{
+    switch (type) {
+    case ASM_ADD: return 0;
+    case ASM_OR: return 1;
+    case ASM_AND: return 4;
+    case ASM_SUB: return 5;
+    case ASM_XOR: return 6;
+    case ASM_CMP: return 7;
+    }
+    return -1;
+}
+
+static int unary_digit(asm_instruction_t type)
+{
+    switch (type) {
+    case ASM_NOT: return 2;
+    case ASM_NEG: return 3;
+    case ASM_MUL: return 4;
+    case ASM_IMUL: return 5;
+    case ASM_DIV: return 6;
+    case ASM_IDIV: return 7;
+    }
+    return -1;
+}
+
+static int shift_digit(asm_instruction_t type)
+{
+    switch (type) {
+    case ASM_SAL: case ASM_SHL: return 4;
+    case ASM_SHR: return 5;
+    case ASM_SAR: return 7;
+    }
+    return -1;
+}
+
+static int sse_opcode(asm_instruction_t type)
+{
+    switch (type) {
+    case ASM_ADDSD: return 0xf20f58;
+    case ASM_MULSD: return 0xf20f59;
+    case ASM_SUBSD: return 0xf20f5c;
+    case ASM_DIVSD: return 0xf20f5e;
+    case ASM_UCOMISD: return 0x660f2e;
+    case ASM_MOVAPD: return 0x660f28;
+    }
+    return -1;
+}
+
+static void encode_alu(struct encoding *enc, int digit, asm_operand_t *dst, asm_operand_t *src)
+{
+    int size = operand_size(src->type == AOT_REGISTER ? src : dst);
+    int prefix = size == 2 ? 0x66 : 0, w = size == 8;
+    if (src->type == AOT_CONSTANT) {
+        if (size == 1) {
+            encode_rm(enc, prefix, w, 0x80, digit, dst);
+            put(enc, src->value & 0xff);
+        } else if (fits_byte(src->value)) {
+            encode_rm(enc, prefix, w, 0x83, digit, dst);
+            put(enc, src->value & 0xff);
+        } else if (is_register(dst) && register_number(dst->reg) == 0) {
+            put_prefixes(enc, prefix, w ? 8 : 0);
+            put(enc, digit << 3 | 5);
+            put_int(enc, src->value, size == 2 ? 2 : 4);
+        } else {
+            encode_rm(enc, prefix, w, 0x81, digit, dst);
+            put_int(enc, src->value, size == 2 ? 2 : 4);
+        }
+    } else if (is_register(src)) {
+        encode_rm(enc, prefix, w, digit << 3 | (size == 1 ? 0 : 1), register_number(src->reg), dst);
+    } else {
+        encode_rm(enc, prefix, w, digit << 3 | (size == 1 ? 2 : 3), register_number(dst->reg), src);
+    }
+}
+
+static int encode_mov(struct encoding *enc, asm_operand_t *dst, asm_operand_t *src)
+{
+    int size = operand_size(src->type == AOT_REGISTER ? src : dst);
+    int prefix = size == 2 ? 0x66 : 0, w = size == 8;
+    if (src->type == AOT_LABEL || dst->type == AOT_LABEL) {
+        return 0;
+    } else if (src->type == AOT_CONSTANT && is_register(dst) && size != 8) {
+        encode_short(enc, prefix, 0, size == 1 ? 0xb0 : 0xb8, dst);
+        put_int(enc, src->value, size);
+    } else if (src->type == AOT_CONSTANT) {
+        encode_rm(enc, prefix, w, size == 1 ? 0xc6 : 0xc7, 0, dst);
+        put_int(enc, src->value, size == 1 ? 1 : size == 2 ? 2 : 4);
+    } else if (is_register(src)) {
+        encode_rm(enc, prefix, w, size == 1 ? 0x88 : 0x89, register_number(src->reg), dst);
+    } else {
+        encode_rm(enc, prefix, w, size == 1 ? 0x8a : 0x8b, register_number(dst->reg), src);
+    }
+    return 1;
+}
+
+static int encode_command(asm_command_t *cmd, struct encoding *enc)
+{
+    asm_operand_t *dst = &cmd->ops[0], *src = &cmd->ops[1];
+    int digit, cc = condition_code(cmd->type);
+
+    enc->length = 0;
+    enc->fixup_pos = -1;
+    enc->fixup_call = 0;
+
+    if ((digit = alu_digit(cmd->type)) != -1) {
+        encode_alu(enc, digit, dst, src);
+        return 1;
+    }
+    if ((digit = unary_digit(cmd->type)) != -1) {
+        encode_rm(enc, 0, operand_size(dst) == 8, operand_size(dst) == 1 ? 0xf6 : 0xf7, digit, dst);
+        return 1;
+    }
+    if ((digit = shift_digit(cmd->type)) != -1) {
+        int byte = operand_size(dst) == 1, w = operand_size(dst) == 8;
+        if (src->type == AOT_CONSTANT && src->value == 1) {
+            encode_rm(enc, 0, w, byte ? 0xd0 : 0xd1, digit, dst);
+        } else if (src->type == AOT_CONSTANT) {
+            encode_rm(enc, 0, w, byte ? 0xc0 : 0xc1, digit, dst);
+            put(enc, src->value & 0xff);
+        } else {
+            encode_rm(enc, 0, w, byte ? 0xd2 : 0xd3, digit, dst);
+        }
+        return 1;
+    }
+    if (cc != -1 && cmd->type >= ASM_SETZ && cmd->type <= ASM_SETBE) {
+        encode_rm(enc, 0, 0, 0x0f90 | cc, 0, dst);
+        return 1;
+    }
+    if (sse_opcode(cmd->type) != -1) {
+        int opcode = sse_opcode(cmd->type);
+        encode_rm(enc, opcode >> 16, 0, opcode & 0xffff, register_number(dst->reg), src);
+        return 1;
+    }
+
+    switch (cmd->type) {
+    case ASM_MOV:
+        return encode_mov(enc, dst, src);
+    case ASM_LEA:
+        encode_rm(enc, 0, operand_size(dst) == 8, 0x8d, register_number(dst->reg), src);
+        return 1;
+    case ASM_MOVZX:
+    case ASM_MOVSX:
+        encode_rm(enc, 0, operand_size(dst) == 8,
+            (cmd->type == ASM_MOVZX ? 0x0fb6 : 0x0fbe) | (operand_size(src) == 2), register_number(dst->reg), src);
+        return 1;
+    case ASM_MOVSXD:
+        encode_rm(enc, 0, 1, 0x63, register_number(dst->reg), src);
+        return 1;
+    case ASM_IMUL2:
+        if (src->type == AOT_CONSTANT) {
+            int small = fits_byte(src->value);
+            encode_rm(enc, 0, operand_size(dst) == 8, small ? 0x6b : 0x69, register_number(dst->reg), dst);
+            put_int(enc, src->value, small ? 1 : 4);
+        } else {
+            encode_rm(enc, 0, operand_size(dst) == 8, 0x0faf, register_number(dst->reg), src);
+        }
+        return 1;
+    case ASM_TEST:
+        if (src->type == AOT_CONSTANT) {
+            encode_rm(enc, 0, operand_size(dst) == 8, operand_size(dst) == 1 ? 0xf6 : 0xf7, 0, dst);
+            put_int(enc, src->value, operand_size(dst) == 1 ? 1 : 4);
+        } else {
+            encode_rm(enc, 0, operand_size(src) == 8, operand_size(src) == 1 ? 0x84 : 0x85, register_number(src->reg), dst);
+        }
+        return 1;
+    case ASM_INC:
+    case ASM_DEC:
+        encode_rm(enc, 0, operand_size(dst) == 8, operand_size(dst) == 1 ? 0xfe : 0xff, cmd->type == ASM_DEC, dst);
+        return 1;
+    case ASM_PUSH:
+        if (is_register(dst)) {
+            encode_short(enc, 0, 0, 0x50, dst);
+        } else if (dst->type == AOT_CONSTANT) {
+            put(enc, fits_byte(dst->value) ? 0x6a : 0x68);
+            put_int(enc, dst->value, fits_byte(dst->value) ? 1 : 4);
+        } else if (dst->type == AOT_MEMORY) {
+            encode_rm(enc, 0, 0, 0xff, 6, dst);
+        } else {
+            return 0;
+        }
+        return 1;
+    case ASM_POP:
+        if (is_register(dst)) {
+            encode_short(enc, 0, 0, 0x58, dst);
+        } else {
+            encode_rm(enc, 0, 0, 0x8f, 0, dst);
+        }
+        return 1;
+    case ASM_CALL:
+    case ASM_JMP:
+        if (dst->type == AOT_LABEL) {
+            /* only calls get here, jumps to labels are sized by the layout */
+            put(enc, 0xe8);
+            enc->fixup_pos = enc->length;
+            enc->fixup_label = dst->label;
+            enc->fixup_addend = 0;
+            enc->fixup_call = 1;
+            put_int(enc, 0, 4);
+        } else {
+            encode_rm(enc, 0, 0, 0xff, cmd->type == ASM_CALL ? 2 : 4, dst);
+        }
+        return 1;
+    case ASM_CDQ:
+        put(enc, 0x99);
+        return 1;
+    case ASM_RET:
+        put(enc, 0xc3);
+        return 1;
+    case ASM_NOP:
+        put(enc, 0x90);
+        return 1;
+    case ASM_MOVSD:
+        if (is_xmm(dst)) {
+            encode_rm(enc, 0xf2, 0, 0x0f10, register_number(dst->reg), src);
+        } else {
+            encode_rm(enc, 0xf2, 0, 0x0f11, register_number(src->reg), dst);
+        }
+        return 1;
+    case ASM_CVTSI2SD:
+        encode_rm(enc, 0xf2, operand_size(src) == 8, 0x0f2a, register_number(dst->reg), src);
+        return 1;
+    case ASM_CVTTSD2SI:
+        encode_rm(enc, 0xf2, operand_size(dst) == 8, 0x0f2c, register_number(dst->reg), src);
+        return 1;
+    }
+    return 0;
+}
+
+static void add_reloc(object_t object, enum object_section section, int offset, int symbol, enum object_reloc_type type, int addend)
+{
+    if (object->relocs_count == object->relocs_capacity) {
+        object->relocs_capacity = object->relocs_capacity == 0 ? 64 : object->relocs_capacity * 2;
+        object->relocs = jacc_realloc(object->relocs, object->relocs_capacity * sizeof(*object->relocs));
+    }
+    struct object_reloc *reloc = &object->relocs[object->relocs_count++];
+    reloc->section = section;
+    reloc->offset = offset;
+    reloc->symbol = symbol;
+    reloc->type = type;
+    reloc->addend = addend;
+}
+
+static int add_symbol(object_t object, const char *name, enum object_section section)
+{
+    if (object->symbols_count == object->symbols_capacity) {
+        object->symbols_capacity = object->symbols_capacity == 0 ? 16 : object->symbols_capacity * 2;
+        object->symbols = jacc_realloc(object->symbols, object->symbols_capacity * sizeof(*object->symbols));
+    }
+    struct object_symbol *symbol = &object->symbols[object->symbols_count];
+    symbol->name = name;
+    symbol->section = section;
+    symbol->offset = 0;
+    symbol->global = 0;
+    return object->symbols_count++;
+}
+
+/* symbol of a function name, undefined until its label is met */
+static int named_symbol(struct encoder *e, const char *name)
+{
+    int i = (int)ptrmap_get(e->names, name) - 1;
+    if (i >= 0) {
+        return i;
+    }
+    for (i = OBJECT_DATA_SYMBOL + 1; i < e->object->symbols_count; i++) {
+        if (strcmp(e->object->symbols[i].name, name) == 0) {
+            break;
+        }
+    }
+    if (i == e->object->symbols_count) {
+        add_symbol(e->object, name, OS_UNDEFINED);
+        e->object->symbols[i].global = 1;
+    }
+    ptrmap_set(e->names, name, i + 1);
+    return i;
+}
+
+static void define_label(struct encoder *e, label_t label, enum object_section section, int offset)
+{
+    if (label.name != NULL) {
+        /* adding the symbol may move the array */
+        int i = named_symbol(e, label.name);
+        struct object_symbol *symbol = &e->object->symbols[i];
+        symbol->section = section;
+        symbol->offset = offset;
+        return;
+    }
+    if (label.id >= e->labels_capacity) {
+        int i, capacity = e->labels_capacity * 2 > label.id ? e->labels_capacity * 2 : label.id + 64;
+        e->label_sections = jacc_realloc(e->label_sections, capacity * sizeof(*e->label_sections));
+        e->label_offsets = jacc_realloc(e->label_offsets, capacity * sizeof(*e->label_offsets));
+        for (i = e->labels_capacity; i < capacity; i++) {
+            e->label_sections[i] = OS_UNDEFINED;
+        }
+        e->labels_capacity = capacity;
+    }
+    e->label_sections[label.id] = section;
+    e->label_offsets[label.id] = offset;
+}
+
+/* section and offset of a label, with the symbol to relocate against */
+static enum object_section resolve_label(struct encoder *e, label_t label, int *offset, int *symbol)
+{
+    if (label.name != NULL) {
+        struct object_symbol *named;
+        *symbol = named_symbol(e, label.name);
+        named = &e->object->symbols[*symbol];
+        *offset = named->offset;
+        return named->section;
+    }
+    if (label.id >= e->labels_capacity || e->label_sections[label.id] == OS_UNDEFINED) {
+        return OS_UNDEFINED;
+    }
+    *offset = e->label_offsets[label.id];
+    *symbol = e->label_sections[label.id] == OS_TEXT ? OBJECT_TEXT_SYMBOL : OBJECT_DATA_SYMBOL;
+    return e->label_sections[label.id];
+}
+
+static void encode_data(struct encoder *e, asm_opcode_list_t *list)
+{
+    static const char zeros[64];
+    int i, length;
+    for (i = 0; i < list->count; i++) {
+        asm_command_t *cmd = &list->data[i];
+        define_label(e, cmd->ops[0].label, OS_DATA, buffer_size(e->object->data));
+        switch (cmd->type) {
+        case ASM_BYTES:
+            buffer_append_string(e->object->data, cmd->text, cmd->ops[1].value);
+            break;
+        case ASM_ZEROS:
+        case ASM_ADDRESSES:
+            length = cmd->ops[1].value * (cmd->type == ASM_ADDRESSES ? 8 : 1);
+            while (length > 0) {
+                buffer_append_string(e->object->data, (char *)zeros, length < 64 ? length : 64);
+                length -= 64;
+            }
+            break;
+        }
+    }
+}
+
+/* the jump tables point into the text, known once it is laid out */
+static void relocate_addresses(struct encoder *e, asm_opcode_list_t *list)
+{
+    int i, j, offset, symbol;
+    for (i = 0; i < list->count; i++) {
+        asm_command_t *cmd = &list->data[i];
+        if (cmd->type != ASM_ADDRESSES) {
+            continue;
+        }
+        resolve_label(e, cmd->ops[0].label, &offset, &symbol);
+        for (j = 0; j < cmd->ops[1].value; j++) {
+            int target;
+            resolve_label(e, cmd->labels[j], &target, &symbol);
+            add_reloc(e->object, OS_DATA, offset + 8 * j, OBJECT_TEXT_SYMBOL, OR_ABS64, target);
+        }
+    }
+}
+
+static int jump_size(struct piece *piece)
+{
+    if (piece->jump_short) {
+        return SHORT_JUMP_SIZE;
+    }
+    return piece->jump == -1 ? NEAR_JUMP_SIZE : NEAR_JCC_SIZE;
+}
+
+static int split_text(struct encoder *e, asm_opcode_list_t *list)
+{
+    struct encoding enc;
+    int i;
+    e->pieces = jacc_calloc(list->count + 1, sizeof(*e->pieces));
+    for (i = 0; i < list->count; i++) {
+        asm_command_t *cmd = &list->data[i];
+        struct piece *piece = &e->pieces[e->pieces_count];
+        piece->start = buffer_size(e->code);
+        piece->fixup_pos = -1;
+        piece->jump = -2;
+        if (cmd->type == ASM_TEXT || cmd->type == ASM_GLOBAL) {
+            if (cmd->type == ASM_GLOBAL) {
+                int symbol = named_symbol(e, cmd->ops[0].label.name);
+                e->object->symbols[symbol].global = 1;
+            }
+            continue;
+        } else if (cmd->type == ASM_LABEL) {
+            piece->defines = cmd->ops[0].label;
+        } else if ((cmd->type == ASM_JMP || (cmd->type >= ASM_JZ && cmd->type <= ASM_JBE)) && cmd->ops[0].type == AOT_LABEL) {
+            piece->jump = cmd->type == ASM_JMP ? -1 : condition_code(cmd->type);
+            piece->jump_short = 1;
+            piece->jump_label = cmd->ops[0].label;
+        } else if (encode_command(cmd, &enc)) {
+            buffer_append_string(e->code, (char *)enc.bytes, enc.length);
+            piece->length = enc.length;
+            if (enc.fixup_pos != -1) {
+                piece->fixup_pos = enc.fixup_pos;
+                piece->fixup_label = enc.fixup_label;
+                piece->fixup_addend = enc.fixup_addend - (enc.length - enc.fixup_pos);
+                piece->fixup_call = enc.fixup_call;
+            }
+        } else {
+            return 0;
+        }
+        e->pieces_count++;
+    }
+    return 1;
+}
+
+/* grows the short jumps not reaching their targets until every one does */
+static void layout_text(struct encoder *e)
+{
+    int i, changed = 1;
+    while (changed) {
+        int offset = 0;
+        changed = 0;
+        for (i = 0; i < e->pieces_count; i++) {
+            struct piece *piece = &e->pieces[i];
+            piece->offset = offset;
+            if (piece->defines.id != 0 || piece->defines.name != NULL) {
+                define_label(e, piece->defines, OS_TEXT, offset);
+            }
+            offset += piece->jump == -2 ? piece->length : jump_size(piece);
+        }
+        for (i = 0; i < e->pieces_count; i++) {
+            struct piece *piece = &e->pieces[i];
+            int target, symbol, distance;
+            if (piece->jump == -2 || !piece->jump_short) {
+                continue;
+            }
+            if (resolve_label(e, piece->jump_label, &target, &symbol) != OS_TEXT) {
+                piece->jump_short = 0;
+                changed = 1;
+                continue;
+            }
+            distance = target - (piece->offset + SHORT_JUMP_SIZE);
+            if (!fits_byte(distance)) {
+                piece->jump_short = 0;
+                changed = 1;
+            }
+        }
+    }
+}
+
+static void write_int(char *at, int value)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        at[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static void emit_jump(buffer_t text, struct piece *piece, int target)
+{
+    char bytes[NEAR_JCC_SIZE];
+    int length = jump_size(piece);
+    int distance = target - (piece->offset + length);
+    if (piece->jump_short) {
+        bytes[0] = piece->jump == -1 ? 0xeb : 0x70 | piece->jump;
+        bytes[1] = distance;
+    } else if (piece->jump == -1) {
+        bytes[0] = 0xe9;
+        write_int(bytes + 1, distance);
+    } else {
+        bytes[0] = 0x0f;
+        bytes[1] = 0x80 | piece->jump;
+        write_int(bytes + 2, distance);
+    }
+    buffer_append_string(text, bytes, length);
+}
+
+static void write_text(struct encoder *e)
+{
+    buffer_t text = e->object->text;
+    int i;
+    for (i = 0; i < e->pieces_count; i++) {
+        struct piece *piece = &e->pieces[i];
+        int target = 0, symbol = 0;
+        enum object_section section;
+        if (piece->jump != -2) {
+            resolve_label(e, piece->jump_label, &target, &symbol);
+            emit_jump(text, piece, target);
+            continue;
+        }
+        buffer_append_string(text, buffer_data(e->code) + piece->start, piece->length);
+        if (piece->fixup_pos == -1) {
+            continue;
+        }
+        section = resolve_label(e, piece->fixup_label, &target, &symbol);
+        int field = piece->offset + piece->fixup_pos;
+        if (section == OS_TEXT) {
+            write_int(buffer_data(text) + field, target + piece->fixup_addend - field);
+        } else if (section == OS_DATA) {
+            add_reloc(e->object, OS_TEXT, field, symbol, OR_PC32, target + piece->fixup_addend);
+        } else {
+            add_reloc(e->object, OS_TEXT, field, symbol, piece->fixup_call ? OR_PLT32 : OR_PC32, piece->fixup_addend);
+        }
+    }
+}
+
+extern object_t encoder_encode(code_t code)
+{
+    struct encoder e;
+    object_t object = jacc_calloc(1, sizeof(*object));
+    int ok;
+
+    memset(&e, 0, sizeof(e));
+    e.object = object;
+    e.code = buffer_create(4096);
+    e.names = ptrmap_create();
+    object->text = buffer_create(4096);
+    object->data = buffer_create(1024);
+    add_symbol(object, NULL, OS_TEXT);
+    add_symbol(object, NULL, OS_DATA);
+
+    encode_data(&e, &code->data_list);
+    ok = split_text(&e, &code->opcode_list);
+    if (ok) {
+        layout_text(&e);
+        write_text(&e);
+        relocate_addresses(&e, &code->data_list);
+    }
+
+    jacc_free(e.pieces);
+    jacc_free(e.label_sections);
+    jacc_free(e.label_offsets);
+    ptrmap_destroy(e.names);
+    buffer_free(e.code);
+    if (!ok) {
+        encoder_free_object(object);
+        return NULL;
+    }
+    return object;
+}
+
+extern void encoder_free_object(object_t object)
+{
+    if (object == NULL) {
+        return;
+    }
+    buffer_free(object->text);
+    buffer_free(object->data);
+    jacc_free(object->symbols);
+    jacc_free(object->relocs);
+    jacc_free(object);
+}
@@ -0,0 +1,60 @@
+#ifndef JACC_ENCODER_H
+#define JACC_ENCODER_H
+
+#include "buffer.h"
+#include "generator.h"
+
+/*
+ * Machine code of the commands generated for x86-64, with the relocations
+ * a linker or loader still has to apply. Jumps to labels take their short
+ * form whenever the target is near enough.
+ */
+
+enum object_section {
+    OS_UNDEFINED,
+    OS_TEXT,
+    OS_DATA,
+};
+
+enum object_reloc_type {
+    OR_PC32,
+    OR_PLT32,
+    OR_ABS64,
+};
+
+/* the first two symbols stand for the text and data sections and have no name */
+struct object_symbol {
+    const char *name;
+    enum object_section section;
+    int offset;
+    int global;
+};
+
+/* the field at offset gets S + A, minus its own address for the pc-relative types */
+struct object_reloc {
+    enum object_section section;
+    int offset;
+    int symbol;
+    enum object_reloc_type type;
+    int addend;
+};
+
+typedef struct object {
+    buffer_t text;
+    buffer_t data;
+    struct object_symbol *symbols;
+    int symbols_count;
+    int symbols_capacity;
+    struct object_reloc *relocs;
+    int relocs_count;
+    int relocs_capacity;
+} *object_t;
+
+#define OBJECT_TEXT_SYMBOL 0
+#define OBJECT_DATA_SYMBOL 1
+
+/* NULL when the code has a command there is no x86-64 encoding for, like the x87 ones */
+extern object_t encoder_encode(code_t code);
+extern void encoder_free_object(object_t object);
+
+#endif
@@ -0,0 +1,344 @@
+#include <limits.h>
+#include <stdlib.h>
+#include "parser.h"
+#include "folder.h"
+
+static __thread int folds;
+
+static struct node *fold_node(struct node *node);
+
+static struct node **subnode_ref(struct node *node, int index)
+{
+    if (node->type == NT_LIST) {
+        return &((struct list_node*)node)->items[index];
+    }
+    return &node->ops[index];
+}
+
+static int is_int_type(struct symbol *type)
+{
+    type = resolve_alias(type);
+    return type == &sym_int || type == &sym_char;
+}
+
+static int is_int_const(struct node *node)
+{
+    return node->type == NT_INT && is_int_type(node->type_sym);
+}
+
+static int is_int_value(struct node *node, int value)
+{
+    return is_int_const(node) && ((struct int_node*)node)->value == value;
+}
+
+static int int_value(struct node *node)
+{
+    return ((struct int_node*)node)->value;
+}
+
+static double double_value(struct node *node)
+{
+    return ((struct double_node*)node)->value;
+}
+
+static int is_same_type(struct node *n1, struct node *n2)
+{
+    return resolve_alias(n1->type_sym) == resolve_alias(n2->type_sym);
+}
+
+static int is_pure(struct node *node)
+{
+    int i;
+    if (node == NULL) {
+        return 1;
+    }
+
+    switch (node->type) {
+    case NT_CALL:
+    case NT_PREFIX_INC:
+    case NT_PREFIX_DEC:
+    case NT_POSTFIX_INC:
+    case NT_POSTFIX_DEC:
+    case NT_ASSIGN:
+    case NT_ADD_ASSIGN:
+    case NT_SUB_ASSIGN:
+    case NT_MUL_ASSIGN:
+    case NT_DIV_ASSIGN:
+    case NT_MOD_ASSIGN:
+    case NT_LSHIFT_ASSIGN:
+    case NT_RSHIFT_ASSIGN:
+    case NT_OR_ASSIGN:
+    case NT_AND_ASSIGN:
+    case NT_XOR_ASSIGN:
+        return 0;
+    }
+
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
+        if (!is_pure(parser_get_subnode(node, i))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static struct node *folded(struct node *node)
+{
+    folds++;
+    return node;
+}
+
+static struct node *int_result(struct node *node, int value)
+{
+    return folded(parser_create_int_node(value, node->type_sym));
+}
+
+extern int folder_fold_int(enum node_type type, int a, int b, int *result)
+{
+    unsigned int ua = (unsigned int)a, ub = (unsigned int)b;
+    switch (type) {
+    case NT_ADD: *result = (int)(ua + ub); return 1;
+    case NT_SUB: *result = (int)(ua - ub); return 1;
+    case NT_MUL: *result = (int)(ua * ub); return 1;
+    case NT_DIV:
+    case NT_MOD:
+        if (b == 0 || (a == INT_MIN && b == -1)) {
+            return 0;
+        }
+        *result = type == NT_DIV ? a / b : a % b;
+        return 1;
+    case NT_LSHIFT:
+    case NT_RSHIFT:
+        if (b < 0 || b >= 32) {
+            return 0;
+        }
+        *result = type == NT_LSHIFT ? (int)(ua << b) : a >> b;
+        return 1;
+    case NT_EQ: *result = a == b; return 1;
+    case NT_NE: *result = a != b; return 1;
+    case NT_LT: *result = a < b; return 1;
+    case NT_LE: *result = a <= b; return 1;
+    case NT_GT: *result = a > b; return 1;
+    case NT_GE: *result = a >= b; return 1;
+    case NT_BIT_AND: *result = a & b; return 1;
+    case NT_BIT_OR: *result = a | b; return 1;
+    case NT_BIT_XOR: *result = a ^ b; return 1;
+    case NT_AND: *result = a && b; return 1;
+    case NT_OR: *result = a || b; return 1;
+    }
+    return 0;
+}
+
+static struct node *fold_double_binary(struct node *node, double a, double b)
+{
+    switch (node->type) {
+    case NT_ADD: return folded(parser_create_double_node(a + b, node->type_sym));
+    case NT_SUB: return folded(parser_create_double_node(a - b, node->type_sym));
+    case NT_MUL: return folded(parser_create_double_node(a * b, node->type_sym));
+    case NT_DIV: return folded(parser_create_double_node(a / b, node->type_sym));
+    case NT_EQ: return int_result(node, a == b);
+    case NT_NE: return int_result(node, a != b);
+    case NT_LT: return int_result(node, a < b);
+    case NT_LE: return int_result(node, a <= b);
+    case NT_GT: return int_result(node, a > b);
+    case NT_GE: return int_result(node, a >= b);
+    }
+    return node;
+}
+
+/* operand of an identity, kept only when it already has the result type */
+static struct node *same_type_operand(struct node *node, struct node *op)
+{
+    return is_same_type(node, op) ? folded(op) : node;
+}
+
+static struct node *simplify_int_binary(struct node *node)
+{
+    struct node *x = node->ops[0], *y = node->ops[1];
+    switch (node->type) {
+    case NT_ADD:
+    case NT_BIT_OR:
+    case NT_BIT_XOR:
+        if (is_int_value(y, 0)) return same_type_operand(node, x);
+        if (is_int_value(x, 0)) return same_type_operand(node, y);
+        if (node->type == NT_BIT_OR && is_int_value(y, -1) && is_pure(x)) return int_result(node, -1);
+        break;
+    case NT_SUB:
+    case NT_LSHIFT:
+    case NT_RSHIFT:
+        if (is_int_value(y, 0)) return same_type_operand(node, x);
+        break;
+    case NT_MUL:
+    case NT_BIT_AND:
+    {
+        int unit = node->type == NT_MUL ? 1 : -1;
+        if (is_int_value(y, unit)) return same_type_operand(node, x);
+        if (is_int_value(x, unit)) return same_type_operand(node, y);
+        if ((is_int_value(y, 0) && is_pure(x)) || (is_int_value(x, 0) && is_pure(y))) return int_result(node, 0);
+        break;
+    }
+    case NT_DIV:
+        if (is_int_value(y, 1)) return same_type_operand(node, x);
+        break;
+    case NT_MOD:
+        if (is_int_value(y, 1) && is_pure(x)) return int_result(node, 0);
+        break;
+    case NT_AND:
+        if (is_int_value(x, 0)) return int_result(node, 0);
+        break;
+    case NT_OR:
+        if (is_int_const(x) && int_value(x) != 0) return int_result(node, 1);
+        break;
+    }
+    return node;
+}
+
+static struct node *fold_binary(struct node *node)
+{
+    struct node *x = node->ops[0], *y = node->ops[1];
+    int result;
+
+    if (node->type == NT_COMMA) {
+        return is_pure(x) ? folded(y) : node;
+    }
+
+    if (is_int_const(x) && is_int_const(y) && is_int_type(node->type_sym)) {
+        if (folder_fold_int(node->type, int_value(x), int_value(y), &result)) {
+            return int_result(node, result);
+        }
+        return node;
+    }
+    if (x->type == NT_DOUBLE && y->type == NT_DOUBLE) {
+        return fold_double_binary(node, double_value(x), double_value(y));
+    }
+    if (is_int_type(node->type_sym) || is_ptr_type(resolve_alias(node->type_sym))) {
+        return simplify_int_binary(node);
+    }
+    return node;
+}
+
+static struct node *fold_unary(struct node *node)
+{
+    struct node *x = node->ops[0];
+    if (is_int_const(x) && is_int_type(node->type_sym)) {
+        int a = int_value(x);
+        switch (node->type) {
+        case NT_IDENTITY: return same_type_operand(node, x);
+        case NT_NEGATION: return int_result(node, (int)(0u - (unsigned int)a));
+        case NT_COMPLEMENT: return int_result(node, ~a);
+        case NT_LOGICAL_NEGATION: return int_result(node, !a);
+        }
+    } else if (x->type == NT_DOUBLE) {
+        double a = double_value(x);
+        switch (node->type) {
+        case NT_IDENTITY: return same_type_operand(node, x);
+        case NT_NEGATION: return folded(parser_create_double_node(-a, node->type_sym));
+        case NT_LOGICAL_NEGATION: return int_result(node, !a);
+        }
+    }
+    return node;
+}
+
+static struct node *fold_cast(struct node *node)
+{
+    struct symbol *type = resolve_alias(node->type_sym);
+    struct node *x = node->ops[0];
+    if (type == &sym_double) {
+        if (is_int_const(x)) {
+            return folded(parser_create_double_node(int_value(x), node->type_sym));
+        } else if (x->type == NT_DOUBLE) {
+            return folded(parser_create_double_node(double_value(x), node->type_sym));
+        }
+    } else if (type == &sym_int || type == &sym_char) {
+        int value;
+        if (is_int_const(x)) {
+            value = int_value(x);
+        } else if (x->type == NT_DOUBLE && double_value(x) > INT_MIN - 1.0 && double_value(x) < INT_MAX + 1.0) {
+            value = (int)double_value(x);
+        } else {
+            return node;
+        }
+        return int_result(node, type == &sym_char ? (signed char)value : value);
+    }
+    return node;
+}
+
+/* frees a folded node, except for the operand kept as its result */
+static struct node *replace_node(struct node *node, struct node *result)
+{
+    int i;
+    if (result == node) {
+        return result;
+    }
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
+        struct node **subnode = subnode_ref(node, i);
+        if (*subnode == result) {
+            *subnode = NULL;
+        }
+    }
+    parser_free_node(node);
+    return result;
+}
+
+static struct node *fold_node(struct node *node)
+{
+    int i;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
+        struct node **subnode = subnode_ref(node, i);
+        *subnode = replace_node(*subnode, fold_node(*subnode));
+    }
+
+    switch (node->type) {
+    case NT_VARIABLE:
+    {
+        struct symbol *symbol = ((struct var_node*)node)->symbol;
+        if (symbol->type == ST_ENUM_CONST) {
+            return int_result(node, int_value(symbol->expr));
+        }
+        return node;
+    }
+    case NT_CAST:
+        return fold_cast(node);
+    case NT_TERNARY:
+        if (is_int_const(node->ops[0])) {
+            return same_type_operand(node, node->ops[int_value(node->ops[0]) ? 1 : 2]);
+        }
+        return node;
+    }
+
+    switch (parser_node_info(node)->cat) {
+    case NC_UNARY:
+        return fold_unary(node);
+    case NC_BINARY:
+        return fold_binary(node);
+    }
+    return node;
+}
+
+extern int folder_fold(struct node **node)
+{
+    folds = 0;
+    *node = replace_node(*node, fold_node(*node));
+    return folds;
+}
+
+extern int folder_fold_function(struct symbol *function)
+{
+    if (function->type != ST_FUNCTION || function->ext == NULL || function->ext->body == NULL) {
+        return 0;
+    }
+    return folder_fold(&function->ext->body);
+}
+
+extern int folder_process(symtable_t symtable)
+{
+    int total = 0;
+    symtable_iter_t iter = symtable_first(symtable);
+    for (; iter != NULL; iter = symtable_iter_next(iter)) {
+        total += folder_fold_function(symtable_iter_value(iter));
+    }
+    return total;
+}
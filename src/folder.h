@@ -0,0 +1,21 @@
+#ifndef JACC_FOLDER_H
+#define JACC_FOLDER_H
+
+#include "parser.h"
+#include "symtable.h"
+
+/*
+ * Constant folding over typed trees. Operator nodes with constant operands
+ * are evaluated with target semantics (32-bit wrapping int, IEEE double);
+ * anything undefined at run time (division by zero, INT_MIN / -1,
+ * out-of-range shifts) is left to the generator. Identities such as x + 0
+ * or x * 1 are simplified, and x * 0 only when x has no side effects.
+ */
+
+extern int folder_fold(struct node **node);
+extern int folder_fold_function(struct symbol *function);
+extern int folder_process(symtable_t symtable);
+/* an int operator applied to constants, 0 when the result is undefined */
+extern int folder_fold_int(enum node_type type, int a, int b, int *result);
+
+#endif
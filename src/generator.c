@@ -8,6 +8,18 @@
 #include "memory.h"
 #include "symtable.h"
 #include "parser.h"
+#include "ir.h"
+#include "lower.h"
+#include "ssa.h"
+#include "loop.h"
+#include "regalloc.h"
+#include "ptrmap.h"
+
+/* switch dispatch: a jump table needs enough cases, one per this many slots */
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_MAX_SPREAD 3
+/* below this a compare tree node just tests its cases in a row */
+#define SWITCH_LINEAR_MAX_CASES 3
 
 asm_instruction_info_t instructions[] = {
 #define COMMAND(name, repr, op_count) { ASM_##name, #repr, op_count },
@@ -30,9 +42,50 @@ asm_register_info_t registers[] = {
 #include "registers.def"
 #undef REGISTER
 
+/* how labels, data and operand sizes are spelled for an assembler */
+struct dialect {
+    const char *comment;
+    const char *label;
+    const char *symbol;
+    const char *ptr;
+    const char *bytes;
+    const char *addresses;
+    const char *zeros;
+};
+
+static const struct dialect fasm_dialect = { ";", "_@%d", "_%s", "", "db", "dd", "db %d dup(0)" };
+static const struct dialect gas_dialect = { "#", ".L%d", "%s", " ptr", ".byte", ".quad", ".zero %d" };
+
 code_t cur_code;
 int label_counter;
+int opt_level;
+target_t cur_target;
+const struct dialect *dialect;
+/* registers framing the stack and the bytes a push takes */
+asm_operand_t frame_pointer, stack_pointer;
+int word_size;
 struct symbol *cur_function;
+/* function being selected, its block labels and the frame slots of its registers */
+ir_function_t cur_ir;
+label_t *block_labels;
+int *reg_homes;
+int *reg_uses;
+/* pool index of each register, eax and edx stay free as scratch */
+int *reg_assignment;
+asm_operand_t allocatable[8];
+struct regalloc_pool pool;
+/* doubles live in xmm registers with SSE2, xmm0 staying free as scratch */
+int use_sse;
+asm_operand_t double_allocatable[8];
+struct regalloc_pool double_pool;
+/* frame slots saving the callee-saved registers in use */
+int saved_homes[8];
+/* frame slots below ebp of the parameters passed in registers */
+ptrmap_t param_slots;
+/* spilled registers loaded from parameters never written, living in their slots */
+struct symbol **reg_params;
+/* whether calls returned right away may leave the frame and jump */
+int sibling_calls;
 
 static int print_operand(asm_operand_t *op)
 {
@@ -45,13 +98,16 @@ static int print_operand(asm_operand_t *op)
     {
         int cnt = 0;
         switch (op->memory.size) {
-        case AOS_BYTE: printf("byte "); break;
-        case AOS_WORD: printf("word "); break;
-        case AOS_DWORD: printf("dword "); break;
-        case AOS_QWORD: printf("qword "); break;
+        case AOS_BYTE: printf("byte%s ", dialect->ptr); break;
+        case AOS_WORD: printf("word%s ", dialect->ptr); break;
+        case AOS_DWORD: printf("dword%s ", dialect->ptr); break;
+        case AOS_QWORD: printf("qword%s ", dialect->ptr); break;
         }
 
         printf("[");
+        if (cur_target == TARGET_X86_64_LINUX && op->memory.base.type == AOT_LABEL) {
+            printf("rip + ");
+        }
         cnt += print_operand((asm_operand_t*)&op->memory.base);
         if (op->memory.scale && !(op->memory.index.type == AOT_REGISTER && op->memory.index.reg == AR_NONE))  {
             if (cnt) printf(" + ");
@@ -87,20 +143,63 @@ static int print_operand(asm_operand_t *op)
         break;
     case AOT_LABEL:
         if (op->label.name != NULL) {
-            printf("_%s", op->label.name);
+            printf(dialect->symbol, op->label.name);
         } else {
-            printf("_@%d", op->label.id);
+            printf(dialect->label, op->label.id);
         }
         break;
     }
     return 1;
 }
 
+static void print_data(asm_command_t *command)
+{
+    int i, length = command->ops[1].value;
+    printf(dialect->label, command->ops[0].label.id);
+    printf(cur_target == TARGET_X86_64_LINUX ? ": " : " ");
+    switch (command->type) {
+    case ASM_BYTES:
+        printf("%s ", dialect->bytes);
+        for (i = 0; i < length; i++) {
+            printf(i == 0 ? "%d" : ",%d", (unsigned char)command->text[i]);
+        }
+        break;
+    case ASM_ZEROS:
+        printf(dialect->zeros, length);
+        break;
+    case ASM_ADDRESSES:
+        printf("%s ", dialect->addresses);
+        for (i = 0; i < length; i++) {
+            printf(i == 0 ? "" : ",");
+            printf(dialect->label, command->labels[i].id);
+        }
+        break;
+    }
+    printf("\n");
+}
+
 static void print_command(asm_command_t *command)
 {
-    if (command->type == ASM_TEXT) {
+    switch (command->type) {
+    case ASM_TEXT:
         printf("%s\n", command->text);
         return;
+    case ASM_LABEL:
+        print_operand(&command->ops[0]);
+        printf(":\n");
+        return;
+    case ASM_GLOBAL:
+        if (cur_target == TARGET_X86_64_LINUX) {
+            printf(".globl ");
+            print_operand(&command->ops[0]);
+            printf("\n");
+        }
+        return;
+    case ASM_BYTES:
+    case ASM_ZEROS:
+    case ASM_ADDRESSES:
+        print_data(command);
+        return;
     }
 
     asm_instruction_info_t *cmd_info = &instructions[command->type];
@@ -134,6 +233,8 @@ static void emit(asm_instruction_t cmd, ...)
 {
     asm_command_t command;
     command.type = cmd;
+    command.text = NULL;
+    command.labels = NULL;
 
     va_list args;
     va_start(args, cmd);
@@ -151,6 +252,7 @@ static void emit_text(char *format, ...)
     asm_command_t command;
     command.type = ASM_TEXT;
     command.text = jacc_malloc(256);
+    command.labels = NULL;
 
     va_list args;
     va_start(args, format);
@@ -159,19 +261,6 @@ static void emit_text(char *format, ...)
     add_opcode(&cur_code->opcode_list, command);
 }
 
-static void emit_label(label_t label)
-{
-    emit_text("_@%d:", label.id);
-}
-
-static void emit_data(char *data)
-{
-    asm_command_t command;
-    command.type = ASM_TEXT;
-    command.text = data;
-    add_opcode(&cur_code->data_list, command);
-}
-
 extern asm_operand_t constant(int value)
 {
     asm_operand_t operand;
@@ -197,6 +286,24 @@ static asm_operand_t text_label(const char *label)
     return operand;
 }
 
+static void emit_label(label_t target)
+{
+    emit(ASM_LABEL, label(target));
+}
+
+/* a data command defining label, its contents are filled in by the caller */
+static asm_command_t *emit_data(asm_instruction_t cmd, label_t target, int length)
+{
+    asm_command_t command;
+    command.type = cmd;
+    command.ops[0] = label(target);
+    command.ops[1] = constant(length);
+    command.text = NULL;
+    command.labels = NULL;
+    add_opcode(&cur_code->data_list, command);
+    return &cur_code->data_list.data[cur_code->data_list.count - 1];
+}
+
 static asm_operand_t memory(asm_operand_t base, int offset, asm_operand_t index)
 {
     assert(base.type == AOT_REGISTER || base.type == AOT_LABEL);
@@ -238,21 +345,6 @@ static asm_operand_t qword(asm_operand_t subop)
     return size_spec(AOS_QWORD, subop);
 }
 
-static void push_value(asm_operand_t op, struct symbol *type, int ret)
-{
-    if (!ret) {
-        return;
-    }
-    type = resolve_alias(type);
-    if (type == &sym_double) {
-        emit(ASM_SUB, esp, constant(8));
-        emit(ASM_FLD, qword(op));
-        emit(ASM_FSTP, qword(deref(esp)));
-    } else {
-        emit(ASM_PUSH, dword(op));
-    }
-}
-
 static label_t gen_label()
 {
     label_t label;
@@ -261,574 +353,1267 @@ static label_t gen_label()
     return label;
 }
 
-static void generate_expr(struct node *expr, int ret);
+static label_t emit_data_array(const char *data_ptr, int size)
+{
+    label_t str_label = gen_label();
+    asm_command_t *data = emit_data(ASM_BYTES, str_label, size);
+    data->text = jacc_malloc(size);
+    memcpy(data->text, data_ptr, size);
+    return str_label;
+}
 
-static asm_operand_t lvalue(struct node *expr)
+static label_t global_label(struct symbol *symbol)
 {
-    switch (expr->type) {
-    case NT_VARIABLE:
-    {
-        struct var_node *var = (struct var_node*)expr;
-        switch (var->symbol->type) {
-        case ST_PARAMETER:
-            return dword(memory(ebp, var->symbol->offset + 8, none_reg));
-        case ST_VARIABLE:
-            return dword(memory(ebp, var->symbol->offset - var->symbol->size, none_reg));
-        case ST_GLOBAL_VARIABLE:
-            if (var->symbol->label.id == 0) {
-                var->symbol->label = gen_label();
-                char *buf = jacc_malloc(30);
-                sprintf(buf, "_@%d db %d dup(0)", var->symbol->label.id, var->symbol->size);
-                emit_data(buf);
-            }
-            return dword(deref(label(var->symbol->label)));
-        default:
-            emit_text("; unhandled var symbol %d", var->symbol->type);
-        }
-        break;
+    struct symbol_ext *ext = symbol_ext(symbol);
+    if (ext->label.id == 0) {
+        ext->label = gen_label();
+        emit_data(ASM_ZEROS, ext->label, symbol->size);
     }
-    case NT_DEREFERENCE:
-        generate_expr(expr->ops[0], 1);
-        emit(ASM_POP, eax);
-        return deref(eax);
-    case NT_MEMBER:
-        emit(ASM_LEA, eax, lvalue(expr->ops[0]));
-        return memory(eax, expr->ops[1]->type_sym->offset, none_reg);
-    default:
-        emit_text("; '%s' is not lvalue", parser_node_info(expr)->repr);
+    return ext->label;
+}
+
+/* the 64-bit register holding a 32-bit one, and back */
+static asm_operand_t wide(asm_operand_t reg)
+{
+    if (reg.type == AOT_REGISTER && reg.reg >= AR_EAX && reg.reg <= AR_R15D) {
+        reg.reg += AR_RAX - AR_EAX;
     }
-    return deref(constant(0));
+    return reg;
 }
 
-static void generate_lvalue(struct node *expr)
+static asm_operand_t narrow(asm_operand_t reg)
 {
-    emit(ASM_LEA, eax, lvalue(expr));
-    emit(ASM_PUSH, eax);
+    if (reg.type == AOT_REGISTER && reg.reg >= AR_RAX && reg.reg <= AR_R15) {
+        reg.reg -= AR_RAX - AR_EAX;
+    }
+    return reg;
 }
 
-static void generate_int_cmp(asm_instruction_t cmd)
+/* a register as wide as values of the type, only x86-64 pointers take 64 bits */
+static asm_operand_t sized(asm_operand_t reg, enum ir_type type)
 {
-    emit(ASM_XOR, ecx, ecx);
-    emit(ASM_CMP, eax, ebx);
-    emit(cmd, cl);
-    emit(ASM_MOV, eax, ecx);
+    return cur_target == TARGET_X86_64_LINUX && type == IRT_PTR ? wide(reg) : narrow(reg);
 }
 
-static void generate_int_logical_op(asm_instruction_t cmd)
+static int value_size(enum ir_type type)
 {
-    label_t lbl = gen_label();
-    emit(ASM_XOR, ecx, ecx);
-    emit(ASM_TEST, eax, eax);
-    emit(cmd, label(lbl));
-    emit(ASM_TEST, ebx, ebx);
-    emit_label(lbl);
-    emit(ASM_SETNZ, cl);
-    emit(ASM_MOV, eax, ecx);
+    if (type == IRT_DOUBLE) {
+        return 8;
+    }
+    return type == IRT_PTR ? word_size : 4;
 }
 
-static void generate_unary_int_op(struct node *expr, int ret)
+/* a register as wide as the stack slots of the target */
+static asm_operand_t native(asm_operand_t reg)
 {
-    generate_expr(expr->ops[0], 1);
-    emit(ASM_POP, eax);
-    switch (expr->type) {
-    case NT_LOGICAL_NEGATION:
-        emit(ASM_XOR, ecx, ecx);
-        emit(ASM_TEST, eax, eax);
-        emit(ASM_SETZ, cl);
-        emit(ASM_MOV, eax, ecx);
-        break;
-    case NT_COMPLEMENT: emit(ASM_NOT, eax); break;
-    case NT_NEGATION: emit(ASM_NEG, eax); break;
-    case NT_IDENTITY: break;
-    case NT_PREFIX_INC:
-    case NT_PREFIX_DEC:
-        generate_lvalue(expr->ops[0]);
-        emit(ASM_POP, ebx);
-        if (expr->type == NT_PREFIX_INC)
-            emit(ASM_INC, dword(deref(ebx)));
-        else
-            emit(ASM_DEC, dword(deref(ebx)));
-        if (ret) emit(ASM_MOV, eax, dword(deref(ebx)));
-        break;
-    case NT_POSTFIX_INC:
-    case NT_POSTFIX_DEC:
-        generate_lvalue(expr->ops[0]);
-        emit(ASM_POP, ebx);
-        if (ret) emit(ASM_MOV, eax, dword(deref(ebx)));
-        if (expr->type == NT_POSTFIX_INC)
-            emit(ASM_INC, dword(deref(ebx)));
-        else
-            emit(ASM_DEC, dword(deref(ebx)));
-        break;
-    default:
-        emit_text("; unknown unary node %s", parser_node_info(expr)->repr);
+    return cur_target == TARGET_X86_64_LINUX ? wide(reg) : reg;
+}
+
+static asm_operand_t sized_memory(asm_operand_t op, int size)
+{
+    return size_spec(size == 1 ? AOS_BYTE : size == 8 ? AOS_QWORD : AOS_DWORD, op);
+}
+
+static asm_operand_t frame_slot(struct symbol *symbol, int offset)
+{
+    if (symbol->type == ST_PARAMETER && param_slots != NULL) {
+        return memory(frame_pointer, (int)ptrmap_get(param_slots, symbol) + offset, none_reg);
+    } else if (symbol->type == ST_PARAMETER) {
+        return memory(ebp, symbol->offset + 8 + offset, none_reg);
+    }
+    return memory(frame_pointer, symbol->offset - symbol->size + offset, none_reg);
+}
+
+/* allocated register or frame slot below the locals of a virtual register */
+static asm_operand_t home(int reg)
+{
+    enum ir_type type = cur_ir->reg_types[reg];
+    if (reg_assignment != NULL && reg_assignment[reg] >= 0 && type == IRT_DOUBLE) {
+        return double_allocatable[reg_assignment[reg]];
+    } else if (reg_assignment != NULL && reg_assignment[reg] >= 0) {
+        return sized(allocatable[reg_assignment[reg]], type);
+    }
+    if (reg_params != NULL && reg_params[reg] != NULL) {
+        return sized_memory(frame_slot(reg_params[reg], 0), value_size(type));
     }
-    if (ret) emit(ASM_PUSH, eax);
+    return sized_memory(memory(frame_pointer, -reg_homes[reg], none_reg), value_size(type));
 }
 
-static void generate_binary_int_op(struct node *expr, int ret)
+static int in_register(struct ir_value value)
 {
-    generate_expr(expr->ops[0], 1);
-    generate_expr(expr->ops[1], 1);
-    emit(ASM_POP, ebx);
-    emit(ASM_POP, eax);
+    return value.kind == IRV_REG && home(value.value).type == AOT_REGISTER;
+}
 
-    switch (expr->type) {
-    case NT_ADD: emit(ASM_ADD, eax, ebx); break;
-    case NT_SUB: emit(ASM_SUB, eax, ebx); break;
-    case NT_MUL: emit(ASM_IMUL, ebx); break;
-    case NT_LSHIFT:
-        emit(ASM_MOV, ecx, ebx);
-        emit(ASM_SAL, eax, cl);
-        break;
-    case NT_RSHIFT:
-        emit(ASM_MOV, ecx, ebx);
-        emit(ASM_SAR, eax, cl);
+static int is_same_register(struct ir_value value, asm_operand_t op)
+{
+    return in_register(value) && op.type == AOT_REGISTER && narrow(home(value.value)).reg == narrow(op).reg;
+}
+
+static void load_int(asm_operand_t reg, struct ir_value value);
+
+/* memory at an address value, register addresses are loaded into scratch */
+static asm_operand_t address_operand(struct ir_value address, asm_operand_t scratch)
+{
+    switch (address.kind) {
+    case IRV_LOCAL:
+        return frame_slot(address.symbol, address.value);
+    case IRV_GLOBAL:
+        if (address.symbol->type != ST_FUNCTION) {
+            return memory(label(global_label(address.symbol)), address.value, none_reg);
+        }
         break;
-    case NT_DIV:
-    case NT_MOD:
-        emit(ASM_CDQ);
-        emit(ASM_IDIV, ebx);
-        if (expr->type == NT_MOD) emit(ASM_MOV, eax, edx);
+    case IRV_REG:
+        if (in_register(address)) {
+            return deref(home(address.value));
+        }
         break;
-    case NT_EQ: generate_int_cmp(ASM_SETE); break;
-    case NT_NE: generate_int_cmp(ASM_SETNE); break;
-    case NT_LE: generate_int_cmp(ASM_SETLE); break;
-    case NT_LT: generate_int_cmp(ASM_SETL); break;
-    case NT_GE: generate_int_cmp(ASM_SETGE); break;
-    case NT_GT: generate_int_cmp(ASM_SETG); break;
-    case NT_BIT_XOR: emit(ASM_XOR, eax, ebx); break;
-    case NT_BIT_OR: emit(ASM_OR, eax, ebx); break;
-    case NT_BIT_AND: emit(ASM_AND, eax, ebx); break;
-    case NT_AND: generate_int_logical_op(ASM_JZ); break;
-    case NT_OR: generate_int_logical_op(ASM_JNZ); break;
-    default:
-        emit_text("; unknown binary node %s", parser_node_info(expr)->repr);
     }
-    if (ret) emit(ASM_PUSH, eax);
+    scratch = sized(scratch, IRT_PTR);
+    load_int(scratch, address);
+    return deref(scratch);
 }
 
-static void generate_double_cmp(asm_instruction_t cmd)
+/* x86-64 code takes addresses relative to rip */
+static void load_address(asm_operand_t reg, asm_operand_t address)
 {
-    emit(ASM_ADD, esp, constant(8));
-    emit(ASM_XOR, ecx, ecx);
-    emit(ASM_FCOMIP, st1);
-    emit(cmd, cl);
-    emit(ASM_PUSH, ecx);
-    emit(ASM_FFREEP, st0);
+    if (cur_target == TARGET_X86_64_LINUX) {
+        emit(ASM_LEA, reg, deref(address));
+    } else {
+        emit(ASM_MOV, reg, address);
+    }
 }
 
+/* the register is widened for pointers */
+static void load_int(asm_operand_t reg, struct ir_value value)
+{
+    if (value.kind != IRV_INT) {
+        reg = sized(reg, ir_value_type(cur_ir, value));
+    }
+    switch (value.kind) {
+    case IRV_REG:
+        if (!is_same_register(value, reg)) {
+            emit(ASM_MOV, reg, home(value.value));
+        }
+        return;
+    case IRV_INT:
+        emit(ASM_MOV, reg, constant(value.value));
+        return;
+    case IRV_STRING:
+        load_address(reg, label(emit_data_array(value.string, strlen(value.string) + 1)));
+        return;
+    case IRV_GLOBAL:
+        if (value.symbol->type == ST_FUNCTION) {
+            load_address(reg, text_label(value.symbol->name));
+            return;
+        }
+        /* fall through */
+    case IRV_LOCAL:
+        emit(ASM_LEA, reg, address_operand(value, reg));
+        return;
+    }
+}
 
-static void generate_unary_double_op(struct node *expr, int ret)
+/* source operand of a two-operand instruction */
+static asm_operand_t int_operand(struct ir_value value, asm_operand_t scratch)
 {
-    switch (expr->type) {
-    case NT_LOGICAL_NEGATION:
-        generate_expr(expr->ops[0], ret);
-        emit(ASM_FLD, qword(deref(esp)));
-        emit(ASM_FLDZ);
-        emit(ASM_XOR, ecx, ecx);
+    if (value.kind == IRV_REG) {
+        return home(value.value);
+    } else if (value.kind == IRV_INT) {
+        return constant(value.value);
+    }
+    scratch = sized(scratch, ir_value_type(cur_ir, value));
+    load_int(scratch, value);
+    return scratch;
+}
+
+static asm_operand_t double_operand(struct ir_value value)
+{
+    double number = value.kind == IRV_DOUBLE ? value.dvalue : value.value;
+    if (value.kind == IRV_REG) {
+        return home(value.value);
+    }
+    return qword(deref(label(emit_data_array((char *)&number, 8))));
+}
+
+static int is_direct_call(struct ir_value callee)
+{
+    return callee.kind == IRV_GLOBAL && callee.symbol->type == ST_FUNCTION;
+}
+
+/* imported functions are called through the import table on win32 and the plt on linux */
+static asm_operand_t call_target(struct ir_value callee, asm_operand_t scratch)
+{
+    if (is_direct_call(callee)) {
+        asm_operand_t name = text_label(callee.symbol->name);
+        if ((callee.symbol->flags & SF_EXTERN) == SF_EXTERN && cur_target == TARGET_I386_WIN32) {
+            name = deref(name);
+        }
+        return name;
+    }
+    scratch = sized(scratch, IRT_PTR);
+    load_int(scratch, callee);
+    return scratch;
+}
+
+static int is_compare(enum ir_opcode op)
+{
+    return op == IR_EQ || op == IR_NE || op == IR_LT || op == IR_LE || op == IR_GT || op == IR_GE;
+}
+
+/* condition codes of comparisons, doubles compare unsigned after fcomip */
+static asm_instruction_t compare_jump(struct ir_insn *insn, int negate)
+{
+    static const asm_instruction_t int_jumps[][2] = {
+        { ASM_JE, ASM_JNE }, { ASM_JNE, ASM_JE }, { ASM_JL, ASM_JGE },
+        { ASM_JLE, ASM_JG }, { ASM_JG, ASM_JLE }, { ASM_JGE, ASM_JL },
+    };
+    static const asm_instruction_t double_jumps[][2] = {
+        { ASM_JE, ASM_JNE }, { ASM_JNE, ASM_JE }, { ASM_JB, ASM_JAE },
+        { ASM_JBE, ASM_JA }, { ASM_JA, ASM_JBE }, { ASM_JAE, ASM_JB },
+    };
+    int index = insn->op - IR_EQ;
+    return insn->type == IRT_DOUBLE ? double_jumps[index][negate] : int_jumps[index][negate];
+}
+
+static asm_instruction_t compare_set(struct ir_insn *insn)
+{
+    static const asm_instruction_t int_sets[] = { ASM_SETE, ASM_SETNE, ASM_SETL, ASM_SETLE, ASM_SETG, ASM_SETGE };
+    static const asm_instruction_t double_sets[] = { ASM_SETE, ASM_SETNE, ASM_SETB, ASM_SETBE, ASM_SETA, ASM_SETAE };
+    int index = insn->op - IR_EQ;
+    return insn->type == IRT_DOUBLE ? double_sets[index] : int_sets[index];
+}
+
+/* sets the flags for a comparison of ops[0] with ops[1] */
+static void emit_compare(struct ir_insn *insn)
+{
+    if (insn->type == IRT_DOUBLE && use_sse) {
+        asm_operand_t lhs = double_operand(insn->ops[0]);
+        if (lhs.type != AOT_REGISTER) {
+            emit(ASM_MOVSD, xmm0, lhs);
+            lhs = xmm0;
+        }
+        emit(ASM_UCOMISD, lhs, double_operand(insn->ops[1]));
+    } else if (insn->type == IRT_DOUBLE) {
+        emit(ASM_FLD, double_operand(insn->ops[1]));
+        emit(ASM_FLD, double_operand(insn->ops[0]));
         emit(ASM_FCOMIP, st1);
-        emit(ASM_SETE, cl);
         emit(ASM_FFREEP, st0);
-        if (ret) {
-            emit(ASM_MOV, memory(esp, 4, none_reg), ecx);
-            emit(ASM_ADD, esp, constant(4));
+    } else {
+        asm_operand_t lhs = sized(eax, insn->type);
+        if (in_register(insn->ops[0])) {
+            lhs = home(insn->ops[0].value);
         } else {
-            emit(ASM_ADD, esp, constant(8));
+            load_int(lhs, insn->ops[0]);
         }
-        break;
-    case NT_NEGATION:
-        generate_expr(expr->ops[0], ret);
-        if (ret) {
-            emit(ASM_FLD, qword(deref(esp)));
-            emit(ASM_FCHS);
-            emit(ASM_FSTP, qword(deref(esp)));
-        } else {
-            emit(ASM_ADD, esp, constant(8));
+        emit(ASM_CMP, lhs, int_operand(insn->ops[1], edx));
+    }
+}
+
+static label_t block_label(int block)
+{
+    return block_labels[block];
+}
+
+/* jumps to then_block when cmd is satisfied, falling through when possible */
+static void emit_branch(asm_instruction_t cmd, asm_instruction_t inverse, int then_block, int else_block, int next_block)
+{
+    if (then_block == next_block) {
+        emit(inverse, label(block_label(else_block)));
+    } else {
+        emit(cmd, label(block_label(then_block)));
+        if (else_block != next_block) {
+            emit(ASM_JMP, label(block_label(else_block)));
         }
-        break;
-    case NT_IDENTITY:
-        generate_expr(expr->ops[0], ret);
-        if (!ret) {
-            emit(ASM_ADD, esp, constant(8));
+    }
+}
+
+static int is_power_of_two(int value)
+{
+    return value > 1 && (value & (value - 1)) == 0;
+}
+
+/* result of an int operation, computed in the destination register when it has one */
+static asm_operand_t result_register(struct ir_insn *insn, struct ir_value rhs)
+{
+    asm_operand_t dst = home(insn->dst);
+    if (dst.type == AOT_REGISTER && !is_same_register(rhs, dst)) {
+        return dst;
+    }
+    return sized(eax, cur_ir->reg_types[insn->dst]);
+}
+
+static void store_result(struct ir_insn *insn, asm_operand_t result)
+{
+    asm_operand_t dst = home(insn->dst);
+    if (dst.type != AOT_REGISTER || dst.reg != result.reg) {
+        emit(ASM_MOV, dst, result);
+    }
+}
+
+static void select_binary(asm_instruction_t cmd, struct ir_insn *insn, int commutative)
+{
+    struct ir_value lhs = insn->ops[0], rhs = insn->ops[1];
+    if (commutative && is_same_register(rhs, home(insn->dst)) && !is_same_register(lhs, home(insn->dst))) {
+        lhs = insn->ops[1];
+        rhs = insn->ops[0];
+    }
+    asm_operand_t result = result_register(insn, rhs);
+    load_int(result, lhs);
+    emit(cmd, result, int_operand(rhs, edx));
+    store_result(insn, result);
+}
+
+static void select_division(struct ir_insn *insn)
+{
+    asm_operand_t rhs;
+    int shift = 0, pushed = 0;
+
+    load_int(eax, insn->ops[0]);
+    if (insn->op == IR_DIV && insn->ops[1].kind == IRV_INT && is_power_of_two(insn->ops[1].value)) {
+        /* rounds toward zero by adding divisor - 1 to negative dividends */
+        while ((1 << shift) != insn->ops[1].value) {
+            shift++;
         }
+        emit(ASM_CDQ);
+        emit(ASM_AND, edx, constant(insn->ops[1].value - 1));
+        emit(ASM_ADD, eax, edx);
+        emit(ASM_SAR, eax, constant(shift));
+        store_result(insn, eax);
+        return;
+    }
+
+    /* edx is taken by the dividend, constant divisors are read from data */
+    if (insn->ops[1].kind == IRV_INT) {
+        label_t divisor = emit_data_array((char *)&insn->ops[1].value, 4);
+        rhs = dword(deref(label(divisor)));
+    } else if (insn->ops[1].kind == IRV_REG) {
+        rhs = home(insn->ops[1].value);
+    } else {
+        load_int(edx, insn->ops[1]);
+        emit(ASM_PUSH, native(edx));
+        rhs = dword(deref(stack_pointer));
+        pushed = 1;
+    }
+    emit(ASM_CDQ);
+    emit(ASM_IDIV, rhs);
+    if (pushed) {
+        emit(ASM_ADD, stack_pointer, constant(word_size));
+    }
+    store_result(insn, insn->op == IR_MOD ? edx : eax);
+}
+
+static void select_int_op(struct ir_insn *insn)
+{
+    asm_operand_t result;
+
+    if (is_compare(insn->op)) {
+        emit_compare(insn);
+        emit(compare_set(insn), al);
+        result = home(insn->dst).type == AOT_REGISTER ? home(insn->dst) : eax;
+        emit(ASM_MOVZX, result, al);
+        store_result(insn, result);
+        return;
+    }
+
+    switch (insn->op) {
+    case IR_NEG:
+    case IR_NOT:
+        result = result_register(insn, ir_none());
+        load_int(result, insn->ops[0]);
+        emit(insn->op == IR_NEG ? ASM_NEG : ASM_NOT, result);
+        store_result(insn, result);
         break;
-    case NT_PREFIX_INC:
-    case NT_PREFIX_DEC:
-        generate_lvalue(expr->ops[0]);
-        emit(ASM_POP, eax);
-        emit(ASM_FLD, qword(deref(eax)));
-        emit(ASM_FLD1);
-        if (expr->type == NT_PREFIX_INC)
-            emit(ASM_FADDP);
-        else
-            emit(ASM_FSUBP);
-        if (ret) {
-            emit(ASM_FST, qword(deref(eax)));
-            emit(ASM_SUB, esp, constant(8));
-            emit(ASM_FSTP, qword(deref(esp)));
+    case IR_ADD: select_binary(ASM_ADD, insn, 1); break;
+    case IR_SUB: select_binary(ASM_SUB, insn, 0); break;
+    case IR_AND: select_binary(ASM_AND, insn, 1); break;
+    case IR_OR: select_binary(ASM_OR, insn, 1); break;
+    case IR_XOR: select_binary(ASM_XOR, insn, 1); break;
+    case IR_MUL: select_binary(ASM_IMUL2, insn, 1); break;
+    case IR_SHL:
+    case IR_SAR:
+        if (insn->ops[1].kind == IRV_INT) {
+            result = result_register(insn, ir_none());
+            load_int(result, insn->ops[0]);
+            emit(insn->op == IR_SHL ? ASM_SAL : ASM_SAR, result, constant(insn->ops[1].value));
         } else {
-            emit(ASM_FSTP, qword(deref(eax)));
+            result = eax;
+            load_int(eax, insn->ops[0]);
+            load_int(ecx, insn->ops[1]);
+            emit(insn->op == IR_SHL ? ASM_SAL : ASM_SAR, eax, cl);
         }
+        store_result(insn, result);
         break;
-    case NT_POSTFIX_INC:
-    case NT_POSTFIX_DEC:
-        generate_lvalue(expr->ops[0]);
-        emit(ASM_POP, eax);
-        emit(ASM_FLD, qword(deref(eax)));
-        if (ret) {
-            emit(ASM_SUB, esp, constant(8));
-            emit(ASM_FST, qword(deref(esp)));
-        }
-        emit(ASM_FLD1);
-        if (expr->type == NT_POSTFIX_INC)
-            emit(ASM_FADDP);
-        else
-            emit(ASM_FSUBP);
-        emit(ASM_FSTP, qword(deref(eax)));
+    case IR_DIV:
+    case IR_MOD:
+        select_division(insn);
         break;
-    default:
-        emit_text("; unknown unary node %s", parser_node_info(expr)->repr);
     }
 }
 
-static void generate_binary_double_op(struct node *expr, int ret)
+/* memory to memory copies pass through xmm0 with SSE2 and the x87 stack without */
+static void copy_double(asm_operand_t dst, asm_operand_t src)
 {
-    generate_expr(expr->ops[0], 1);
-    emit(ASM_FLD, qword(deref(esp)));
-    generate_expr(expr->ops[1], 1);
-    emit(ASM_FLD, qword(deref(esp)));
+    if (dst.type == AOT_REGISTER && src.type == AOT_REGISTER) {
+        if (dst.reg != src.reg) {
+            emit(ASM_MOVAPD, dst, src);
+        }
+    } else if (dst.type == AOT_REGISTER || src.type == AOT_REGISTER) {
+        emit(ASM_MOVSD, dst, src);
+    } else if (use_sse) {
+        emit(ASM_MOVSD, xmm0, src);
+        emit(ASM_MOVSD, dst, xmm0);
+    } else {
+        emit(ASM_FLD, src);
+        emit(ASM_FSTP, dst);
+    }
+}
 
-    emit(ASM_ADD, esp, constant(ret ? 8 : 16));
+/* computed in the destination register unless the right operand lives there */
+static void select_double_op_sse(struct ir_insn *insn)
+{
+    struct ir_value lhs = insn->ops[0], rhs = insn->ops[1];
+    asm_operand_t dst = home(insn->dst), result = xmm0;
+    if ((insn->op == IR_ADD || insn->op == IR_MUL) && is_same_register(rhs, dst) && !is_same_register(lhs, dst)) {
+        lhs = insn->ops[1];
+        rhs = insn->ops[0];
+    }
+    if (dst.type == AOT_REGISTER && !is_same_register(rhs, dst)) {
+        result = dst;
+    }
+    copy_double(result, double_operand(lhs));
+    switch (insn->op) {
+    case IR_NEG: emit(ASM_MULSD, result, double_operand(ir_double(-1))); break;
+    case IR_ADD: emit(ASM_ADDSD, result, double_operand(rhs)); break;
+    case IR_SUB: emit(ASM_SUBSD, result, double_operand(rhs)); break;
+    case IR_MUL: emit(ASM_MULSD, result, double_operand(rhs)); break;
+    case IR_DIV: emit(ASM_DIVSD, result, double_operand(rhs)); break;
+    }
+    copy_double(dst, result);
+}
 
-    switch (expr->type) {
-    case NT_ADD: emit(ASM_FADDP); break;
-    case NT_SUB: emit(ASM_FSUBP); break;
-    case NT_MUL: emit(ASM_FMULP); break;
-    case NT_DIV: emit(ASM_FDIVP); break;
-    case NT_EQ: generate_double_cmp(ASM_SETE); return;
-    case NT_NE: generate_double_cmp(ASM_SETNE); return;
-    case NT_LE: generate_double_cmp(ASM_SETAE); return;
-    case NT_LT: generate_double_cmp(ASM_SETA); return;
-    case NT_GE: generate_double_cmp(ASM_SETBE); return;
-    case NT_GT: generate_double_cmp(ASM_SETB); return;
-    default:
-        emit_text("; unknown binary node %s", parser_node_info(expr)->repr);
+static void select_double_op(struct ir_insn *insn)
+{
+    if (is_compare(insn->op)) {
+        select_int_op(insn);
+        return;
+    }
+
+    if (use_sse) {
+        select_double_op_sse(insn);
+        return;
+    }
+
+    emit(ASM_FLD, double_operand(insn->ops[0]));
+    switch (insn->op) {
+    case IR_NEG: emit(ASM_FCHS); break;
+    case IR_ADD: emit(ASM_FADD, double_operand(insn->ops[1])); break;
+    case IR_SUB: emit(ASM_FSUB, double_operand(insn->ops[1])); break;
+    case IR_MUL: emit(ASM_FMUL, double_operand(insn->ops[1])); break;
+    case IR_DIV: emit(ASM_FDIV, double_operand(insn->ops[1])); break;
     }
+    emit(ASM_FSTP, home(insn->dst));
+}
 
-    if (ret) {
+static void select_call_result(struct ir_insn *insn)
+{
+    if (insn->type == IRT_DOUBLE && cur_target == TARGET_X86_64_LINUX) {
+        copy_double(home(insn->dst), xmm0);
+    } else if (insn->type == IRT_DOUBLE && home(insn->dst).type == AOT_REGISTER) {
+        /* cdecl returns doubles on the x87 stack */
+        emit(ASM_SUB, esp, constant(8));
         emit(ASM_FSTP, qword(deref(esp)));
+        emit(ASM_MOVSD, home(insn->dst), qword(deref(esp)));
+        emit(ASM_ADD, esp, constant(8));
+    } else if (insn->type == IRT_DOUBLE) {
+        emit(ASM_FSTP, home(insn->dst));
+    } else if (insn->dst != 0) {
+        emit(ASM_MOV, home(insn->dst), sized(eax, insn->type));
     }
-    emit(ASM_FFREEP, st0);
 }
 
-static void generate_statement(struct node *expr)
+static void leave_frame()
 {
-    switch (expr->type) {
-    case NT_IF:
-    {
-        label_t l1 = gen_label(), l2 = gen_label();
-        generate_expr(expr->ops[0], 1);
-        emit(ASM_POP, eax);
-        emit(ASM_TEST, eax, eax);
-        emit(ASM_JZ, label(l1));
-        generate_expr(expr->ops[1], 0);
-        emit(ASM_JMP, label(l2));
-        emit_label(l1);
-        generate_expr(expr->ops[2], 0);
-        emit_label(l2);
-        break;
+    int i;
+    for (i = 0; i < pool.count; i++) {
+        if (saved_homes[i] != 0) {
+            emit(ASM_MOV, native(allocatable[i]), sized_memory(memory(frame_pointer, -saved_homes[i], none_reg), word_size));
+        }
     }
-    case NT_WHILE:
-    {
-        label_t l1 = gen_label(), l2 = gen_label();
-        emit_label(l1);
-        generate_expr(expr->ops[0], 1);
-        emit(ASM_POP, eax);
-        emit(ASM_TEST, eax, eax);
-        emit(ASM_JZ, label(l2));
-        generate_expr(expr->ops[1], 0);
-        emit(ASM_JMP, label(l1));
-        emit_label(l2);
-        break;
+    emit(ASM_MOV, stack_pointer, frame_pointer);
+    emit(ASM_POP, frame_pointer);
+}
+
+static int argument_size(struct ir_value value)
+{
+    return ir_value_type(cur_ir, value) == IRT_DOUBLE ? 8 : 4;
+}
+
+/*
+ * cdecl: every argument is pushed right to left and the caller pops them.
+ * A sibling call moves them over the arguments of the function, leaves its
+ * frame and jumps, so that the callee returns straight to our caller.
+ */
+static void select_call(struct ir_insn *insn, int sibling)
+{
+    int i, size = 0;
+    for (i = insn->args_count - 1; i >= 0; i--) {
+        struct ir_value arg = insn->args[i];
+        if (ir_value_type(cur_ir, arg) == IRT_DOUBLE) {
+            emit(ASM_SUB, esp, constant(8));
+            copy_double(qword(deref(esp)), double_operand(arg));
+        } else {
+            emit(ASM_PUSH, int_operand(arg, eax));
+        }
+        size += argument_size(arg);
     }
-    case NT_DO_WHILE:
-    {
-        label_t l1 = gen_label();
-        emit_label(l1);
-        generate_expr(expr->ops[0], 0);
-        generate_expr(expr->ops[1], 1);
-        emit(ASM_POP, eax);
-        emit(ASM_TEST, eax, eax);
-        emit(ASM_JNZ, label(l1));
-        break;
+
+    if (sibling) {
+        for (i = 0; i < size; i += 4) {
+            emit(ASM_MOV, eax, dword(memory(esp, i, none_reg)));
+            emit(ASM_MOV, dword(memory(ebp, 8 + i, none_reg)), eax);
+        }
+        leave_frame();
+        emit(ASM_JMP, call_target(insn->ops[0], eax));
+        return;
     }
-    case NT_FOR:
-    {
-        label_t l1 = gen_label(), l2 = gen_label();
-        generate_expr(expr->ops[0], 0);
-        emit_label(l1);
-        generate_expr(expr->ops[1], 1);
-        emit(ASM_POP, eax);
-        emit(ASM_TEST, eax, eax);
-        emit(ASM_JZ, label(l2));
-        generate_expr(expr->ops[3], 0);
-        generate_expr(expr->ops[2], 0);
-        emit(ASM_JMP, label(l1));
-        emit_label(l2);
-        break;
+    emit(ASM_CALL, call_target(insn->ops[0], eax));
+    if (size != 0) {
+        emit(ASM_ADD, esp, constant(size));
     }
-    case NT_RETURN:
-    {
-        if (is_compatible_types(expr->type_sym, &sym_int)) {
-            generate_expr(expr->ops[0], 1);
-            emit(ASM_POP, eax);
-        } else if (expr->type_sym == &sym_double) {
-            generate_expr(expr->ops[0], 1);
-            emit(ASM_FLD, qword(deref(esp)));
-            emit(ASM_ADD, esp, constant(8));
-        }
-        emit(ASM_JMP, label(cur_function->return_label));
-        break;
+    select_call_result(insn);
+}
+
+/* the frame grows down by one naturally aligned slot of this size */
+static int frame_alloc(int frame_size, int size)
+{
+    return (frame_size + 2 * size - 1) / size * size;
+}
+
+#define SYSV_INT_REGISTERS 6
+#define SYSV_DOUBLE_REGISTERS 8
+
+static const asm_register_t sysv_int_registers[] = { AR_EDI, AR_ESI, AR_EDX, AR_ECX, AR_R8D, AR_R9D };
+
+/*
+ * System V: the first six int and eight double arguments go in registers,
+ * the rest is pushed right to left keeping rsp 16-byte aligned. None of
+ * the argument registers is allocatable, so they are loaded in any order.
+ */
+static void select_call_sysv(struct ir_insn *insn, int sibling)
+{
+    int *slots = jacc_malloc((insn->args_count + 1) * sizeof(*slots));
+    int i, ints = 0, doubles = 0, pushed = 0;
+    asm_operand_t callee;
+
+    for (i = 0; i < insn->args_count; i++) {
+        if (ir_value_type(cur_ir, insn->args[i]) == IRT_DOUBLE) {
+            slots[i] = doubles < SYSV_DOUBLE_REGISTERS ? doubles++ : -1;
+        } else {
+            slots[i] = ints < SYSV_INT_REGISTERS ? ints++ : -1;
+        }
+        pushed += slots[i] == -1;
     }
-    default:
-        emit_text("; unknown statement %s", parser_node_info(expr)->repr);
+
+    if (pushed % 2 != 0) {
+        emit(ASM_SUB, rsp, constant(8));
+    }
+    for (i = insn->args_count - 1; i >= 0; i--) {
+        struct ir_value arg = insn->args[i];
+        if (slots[i] != -1) {
+            continue;
+        }
+        if (ir_value_type(cur_ir, arg) == IRT_DOUBLE) {
+            emit(ASM_SUB, rsp, constant(8));
+            copy_double(qword(deref(rsp)), double_operand(arg));
+        } else if (arg.kind == IRV_INT) {
+            emit(ASM_PUSH, constant(arg.value));
+        } else {
+            load_int(eax, arg);
+            emit(ASM_PUSH, rax);
+        }
+    }
+    for (i = 0; i < insn->args_count; i++) {
+        struct ir_value arg = insn->args[i];
+        if (slots[i] == -1) {
+            continue;
+        } else if (ir_value_type(cur_ir, arg) == IRT_DOUBLE) {
+            asm_operand_t xmm = xmm0;
+            xmm.reg += slots[i];
+            copy_double(xmm, double_operand(arg));
+        } else {
+            asm_operand_t reg = eax;
+            reg.reg = sysv_int_registers[slots[i]];
+            load_int(reg, arg);
+        }
+    }
+
+    /* al tells variadic functions how many vector registers hold arguments */
+    callee = call_target(insn->ops[0], r11d);
+    if (!is_direct_call(insn->ops[0]) || (insn->ops[0].symbol->flags & SF_VARIADIC) == SF_VARIADIC) {
+        emit(ASM_MOV, eax, constant(doubles));
+    }
+    if (sibling) {
+        leave_frame();
+        emit(ASM_JMP, callee);
+        jacc_free(slots);
+        return;
+    }
+    emit(ASM_CALL, callee);
+    if (pushed != 0) {
+        emit(ASM_ADD, rsp, constant(8 * (pushed + pushed % 2)));
     }
+    select_call_result(insn);
+    jacc_free(slots);
 }
 
-static label_t emit_data_array(const char *data_ptr, int size)
+static void select_load(struct ir_insn *insn)
 {
-    label_t str_label = gen_label();
-    char *buf = jacc_malloc(15 + 4 * size);
-    char *ptr = buf;
+    asm_operand_t source = address_operand(insn->ops[0], eax), result;
+    if (reg_params != NULL && reg_params[insn->dst] != NULL) {
+        return;
+    }
+    if (insn->type == IRT_DOUBLE) {
+        copy_double(home(insn->dst), qword(source));
+        return;
+    }
+    result = home(insn->dst).type == AOT_REGISTER ? home(insn->dst) : sized(eax, insn->type);
+    if (insn->size == 1) {
+        emit(ASM_MOVSX, result, size_spec(AOS_BYTE, source));
+    } else {
+        emit(ASM_MOV, result, sized_memory(source, insn->size));
+    }
+    store_result(insn, result);
+}
 
-    ptr += sprintf(ptr, "_@%d db ", str_label.id);
-    int i = 0;
-    for (; i < size; i++) {
-        ptr += sprintf(ptr, i == 0 ? "%d" : ",%d", data_ptr[i] < 0 ? 256 + data_ptr[i] : data_ptr[i]);
+/* the low byte of a value, through dl unless it is in a register having one */
+static asm_operand_t byte_operand(struct ir_value value)
+{
+    if (is_same_register(value, ebx)) {
+        return bl;
+    } else if (is_same_register(value, ecx)) {
+        return cl;
     }
+    load_int(edx, value);
+    return dl;
+}
 
-    emit_data(buf);
-    return str_label;
+static void select_store(struct ir_insn *insn)
+{
+    asm_operand_t place = address_operand(insn->ops[0], eax);
+    struct ir_value value = insn->ops[1];
+    if (insn->type == IRT_DOUBLE) {
+        copy_double(qword(place), double_operand(value));
+    } else if (value.kind == IRV_INT) {
+        if (insn->size == 1) {
+            emit(ASM_MOV, size_spec(AOS_BYTE, place), constant((signed char)value.value));
+        } else {
+            emit(ASM_MOV, sized_memory(place, insn->size), constant(value.value));
+        }
+    } else if (insn->size == 1) {
+        emit(ASM_MOV, size_spec(AOS_BYTE, place), byte_operand(value));
+    } else if (in_register(value)) {
+        emit(ASM_MOV, sized_memory(place, insn->size), home(value.value));
+    } else {
+        asm_operand_t scratch = sized(edx, ir_value_type(cur_ir, value));
+        load_int(scratch, value);
+        emit(ASM_MOV, sized_memory(place, insn->size), scratch);
+    }
 }
 
-static void generate_expr(struct node *expr, int ret)
+static void select_mov(struct ir_insn *insn)
 {
-    if (expr == NULL) {
-        return;
+    asm_operand_t dst = home(insn->dst);
+    if (insn->type == IRT_DOUBLE) {
+        copy_double(dst, double_operand(insn->ops[0]));
+    } else if (insn->ops[0].kind == IRV_INT || in_register(insn->ops[0])) {
+        if (!is_same_register(insn->ops[0], dst)) {
+            emit(ASM_MOV, dst, int_operand(insn->ops[0], eax));
+        }
+    } else if (dst.type == AOT_REGISTER) {
+        load_int(dst, insn->ops[0]);
+    } else {
+        asm_operand_t scratch = sized(eax, insn->type);
+        load_int(scratch, insn->ops[0]);
+        emit(ASM_MOV, dst, scratch);
     }
+}
 
-    switch (expr->type) {
-    case NT_NOP:
-        return;
-    case NT_LIST:
-    {
-        struct list_node *list = (struct list_node*)expr;
-        int i = 0;
-        for (; i < list->size; i++) {
-            generate_expr(list->items[i], 0);
+/* cvtsi2sd, cvttsd2si and movsxd cover the conversions with SSE2 */
+static void select_convert_sse(struct ir_insn *insn)
+{
+    asm_operand_t result;
+    if (insn->op != IR_I2D) {
+        result = result_register(insn, ir_none());
+    }
+    switch (insn->op) {
+    case IR_D2I:
+        emit(ASM_CVTTSD2SI, result, double_operand(insn->ops[0]));
+        break;
+    case IR_I2D:
+        result = home(insn->dst).type == AOT_REGISTER ? home(insn->dst) : xmm0;
+        if (insn->ops[0].kind == IRV_REG) {
+            emit(ASM_CVTSI2SD, result, home(insn->ops[0].value));
+        } else {
+            load_int(eax, insn->ops[0]);
+            emit(ASM_CVTSI2SD, result, eax);
         }
+        copy_double(home(insn->dst), result);
         return;
+    case IR_I2P:
+        if (insn->ops[0].kind == IRV_INT) {
+            emit(ASM_MOV, result, constant(insn->ops[0].value));
+        } else {
+            emit(ASM_MOVSXD, result, int_operand(insn->ops[0], eax));
+        }
+        break;
+    case IR_P2I:
+        if (in_register(insn->ops[0])) {
+            emit(ASM_MOV, result, narrow(home(insn->ops[0].value)));
+        } else if (insn->ops[0].kind == IRV_REG) {
+            emit(ASM_MOV, result, dword(home(insn->ops[0].value)));
+        } else {
+            load_int(result, insn->ops[0]);
+        }
+        break;
     }
-    case NT_CALL:
-    {
-        struct list_node *list = (struct list_node*)expr->ops[1];
-        int i = list->size - 1, size = 0;
-        for (; i >= 0; i--) {
-            generate_expr(list->items[i], 1);
-            size += list->items[i]->type_sym->size;
+    store_result(insn, result);
+}
+
+/* x87 loads and stores integers only from memory */
+static void select_convert(struct ir_insn *insn)
+{
+    asm_operand_t dst = home(insn->dst);
+    if (insn->op == IR_I2P || insn->op == IR_P2I) {
+        if (cur_target == TARGET_X86_64_LINUX) {
+            select_convert_sse(insn);
+        } else {
+            select_mov(insn);
         }
-        asm_operand_t target = text_label(expr->ops[0]->type_sym->name);
-        if ((expr->ops[0]->type_sym->flags & SF_EXTERN) == SF_EXTERN) {
-            target = deref(target);
+    } else if (use_sse) {
+        select_convert_sse(insn);
+    } else if (insn->op == IR_D2I) {
+        emit(ASM_FLD, double_operand(insn->ops[0]));
+        if (dst.type == AOT_REGISTER) {
+            emit(ASM_SUB, esp, constant(4));
+            emit(ASM_FISTTP, dword(deref(esp)));
+            emit(ASM_POP, dst);
+        } else {
+            emit(ASM_FISTTP, dst);
         }
-        emit(ASM_CALL, target); // @todo function pointers
-        emit(ASM_ADD, esp, constant(size));
+    } else if (insn->ops[0].kind == IRV_REG && !in_register(insn->ops[0])) {
+        emit(ASM_FILD, home(insn->ops[0].value));
+        emit(ASM_FSTP, dst);
+    } else {
+        emit(ASM_PUSH, int_operand(insn->ops[0], eax));
+        emit(ASM_FILD, dword(deref(esp)));
+        emit(ASM_ADD, esp, constant(4));
+        emit(ASM_FSTP, dst);
+    }
+}
 
-        if (is_compatible_types(expr->type_sym, &sym_int) || expr->type_sym->type == ST_POINTER) {
-            if (ret) emit(ASM_PUSH, eax);
-        } else if (expr->type_sym == &sym_double) {
-            if (ret) {
-                emit(ASM_SUB, esp, constant(8));
-                emit(ASM_FSTP, qword(deref(esp)));
-            } else {
-                emit(ASM_FFREEP, st0);
+struct switch_case {
+    int value;
+    label_t label;
+};
+
+static int compare_cases(const void *a, const void *b)
+{
+    const struct switch_case *c1 = a, *c2 = b;
+    if (c1->value != c2->value) {
+        return c1->value < c2->value ? -1 : 1;
+    }
+    return c1->label.id - c2->label.id;
+}
+
+static int is_dense(struct switch_case *cases, int count)
+{
+    long long spread = (long long)cases[count - 1].value - cases[0].value + 1;
+    return spread <= (long long)count * SWITCH_TABLE_MAX_SPREAD;
+}
+/* a run of sorted cases dispatched through one table, or a single case */
+struct case_cluster {
+    struct switch_case *cases;
+    int count;
+};
+
+/* greedily takes the longest dense run starting at each case */
+static int cluster_cases(struct switch_case *cases, int count, struct case_cluster *clusters)
+{
+    int i = 0, j, clusters_count = 0;
+    while (i < count) {
+        int last = i;
+        for (j = i + SWITCH_TABLE_MIN_CASES - 1; j < count; j++) {
+            if ((long long)cases[j].value - cases[i].value + 1 > (long long)(count - i) * SWITCH_TABLE_MAX_SPREAD) {
+                break;
+            }
+            if (is_dense(cases + i, j - i + 1)) {
+                last = j;
             }
         }
-        return;
+        clusters[clusters_count].cases = cases + i;
+        clusters[clusters_count].count = last - i + 1;
+        clusters_count++;
+        i = last + 1;
     }
-    case NT_STRING:
-    {
-        char *str = ((struct string_node*)expr)->value;
-        label_t str_label = emit_data_array(str, strlen(str) + 1);
-        if (ret) emit(ASM_PUSH, label(str_label));
-        return;
+    return clusters_count;
+}
+
+/* value in eax, the table lives in the data section */
+static void emit_jump_table(struct case_cluster *cluster, label_t default_label, int checked)
+{
+    struct switch_case *cases = cluster->cases;
+    label_t table = gen_label();
+    int min = cases[0].value, range = cases[cluster->count - 1].value - min;
+    asm_command_t *data = emit_data(ASM_ADDRESSES, table, range + 1);
+    int i, j = 0;
+
+    data->labels = jacc_malloc((range + 1) * sizeof(*data->labels));
+    for (i = 0; i <= range; i++) {
+        data->labels[i] = default_label;
+        if (cases[j].value - min == i) {
+            data->labels[i] = cases[j++].label;
+        }
     }
-    case NT_DOUBLE:
-    {
-        double value = ((struct double_node*)expr)->value;
-        label_t data_label = emit_data_array((char *)&value, 8);
-        push_value(deref(label(data_label)), expr->type_sym, ret);
+
+    if (min != 0) {
+        emit(ASM_SUB, eax, constant(min));
+    }
+    if (!checked) {
+        emit(ASM_CMP, eax, constant(range));
+        emit(ASM_JA, label(default_label));
+    }
+    /* the 32-bit operations above cleared the upper half of rax */
+    if (cur_target == TARGET_X86_64_LINUX) {
+        asm_operand_t entry = memory(rdx, 0, rax);
+        entry.memory.scale = 8;
+        emit(ASM_LEA, rdx, deref(label(table)));
+        emit(ASM_JMP, qword(entry));
+    } else {
+        asm_operand_t entry = memory(label(table), 0, eax);
+        entry.memory.scale = 4;
+        emit(ASM_JMP, dword(entry));
+    }
+}
+
+/* balanced compare tree over the clusters, few single cases are tested in a row */
+static void emit_case_tree(struct case_cluster *clusters, int count, label_t default_label)
+{
+    int i, singles = 1;
+    for (i = 0; i < count; i++) {
+        singles = singles && clusters[i].count == 1;
+    }
+
+    if (count == 1 && !singles) {
+        emit_jump_table(clusters, default_label, 0);
         return;
     }
-    case NT_MEMBER:
-        emit(ASM_LEA, eax, lvalue(expr));
-        push_value(deref(eax), expr->type_sym, ret);
+    if (singles && count <= SWITCH_LINEAR_MAX_CASES) {
+        for (i = 0; i < count; i++) {
+            emit(ASM_CMP, eax, constant(clusters[i].cases[0].value));
+            emit(ASM_JE, label(clusters[i].cases[0].label));
+        }
+        emit(ASM_JMP, label(default_label));
         return;
-    case NT_TERNARY:
-    {
-        label_t l1 = gen_label(), l2 = gen_label();
-        generate_expr(expr->ops[0], 1);
-        emit(ASM_POP, eax);
-        emit(ASM_TEST, eax, eax);
-        emit(ASM_JZ, label(l1));
-        generate_expr(expr->ops[1], ret);
-        emit(ASM_JMP, label(l2));
-        emit_label(l1);
-        generate_expr(expr->ops[2], ret);
-        emit_label(l2);
+    }
+
+    int mid = count / 2;
+    struct case_cluster *cluster = &clusters[mid];
+    label_t lower = gen_label();
+    if (cluster->count == 1) {
+        emit(ASM_CMP, eax, constant(cluster->cases[0].value));
+        emit(ASM_JE, label(cluster->cases[0].label));
+        emit(ASM_JL, label(lower));
+    } else {
+        label_t upper = gen_label();
+        emit(ASM_CMP, eax, constant(cluster->cases[0].value));
+        emit(ASM_JL, label(lower));
+        emit(ASM_CMP, eax, constant(cluster->cases[cluster->count - 1].value));
+        emit(ASM_JG, label(upper));
+        emit_jump_table(cluster, default_label, 1);
+        emit_label(upper);
+    }
+    emit_case_tree(clusters + mid + 1, count - mid - 1, default_label);
+    emit_label(lower);
+    emit_case_tree(clusters, mid, default_label);
+}
+
+static void select_switch(struct ir_insn *insn)
+{
+    struct switch_case *cases = jacc_malloc((insn->args_count + 1) * sizeof(*cases));
+    struct case_cluster *clusters = jacc_malloc((insn->args_count + 1) * sizeof(*clusters));
+    int i, count = 0;
+
+    for (i = 0; i < insn->args_count; i++) {
+        cases[i].value = insn->args[i].value;
+        cases[i].label = block_label(insn->targets[i + 1]);
+    }
+
+    /* a repeated value keeps its first case */
+    qsort(cases, insn->args_count, sizeof(*cases), compare_cases);
+    for (i = 0; i < insn->args_count; i++) {
+        if (count == 0 || cases[count - 1].value != cases[i].value) {
+            cases[count++] = cases[i];
+        }
+    }
+
+    load_int(eax, insn->ops[0]);
+    if (count == 0) {
+        emit(ASM_JMP, label(block_label(insn->targets[0])));
+    } else {
+        count = cluster_cases(cases, count, clusters);
+        emit_case_tree(clusters, count, block_label(insn->targets[0]));
+    }
+    jacc_free(clusters);
+    jacc_free(cases);
+}
+
+static void select_return(struct ir_insn *insn, int last)
+{
+    if (insn->type == IRT_DOUBLE && cur_target == TARGET_X86_64_LINUX) {
+        copy_double(xmm0, double_operand(insn->ops[0]));
+    } else if (insn->type == IRT_DOUBLE && in_register(insn->ops[0])) {
+        emit(ASM_SUB, esp, constant(8));
+        emit(ASM_MOVSD, qword(deref(esp)), home(insn->ops[0].value));
+        emit(ASM_FLD, qword(deref(esp)));
+        emit(ASM_ADD, esp, constant(8));
+    } else if (insn->type == IRT_DOUBLE) {
+        emit(ASM_FLD, double_operand(insn->ops[0]));
+    } else if (insn->type != IRT_VOID) {
+        load_int(eax, insn->ops[0]);
+    }
+    if (!last) {
+        emit(ASM_JMP, label(cur_function->ext->return_label));
+    }
+}
+
+/* a comparison feeding only the branch right after it sets the flags for a jcc */
+static int is_fused_compare(struct ir_block *block, int index)
+{
+    struct ir_insn *insn = &block->insns[index];
+    struct ir_insn *next = index + 1 < block->count ? &block->insns[index + 1] : NULL;
+    return is_compare(insn->op)
+        && next != NULL && next->op == IR_BR
+        && next->ops[0].kind == IRV_REG && next->ops[0].value == insn->dst
+        && reg_uses[insn->dst] == 1;
+}
+
+static void select_branch(struct ir_block *block, int index, int next_block)
+{
+    struct ir_insn *insn = &block->insns[index];
+    if (index > 0 && is_fused_compare(block, index - 1)) {
+        struct ir_insn *compare = &block->insns[index - 1];
+        emit_compare(compare);
+        emit_branch(compare_jump(compare, 0), compare_jump(compare, 1), insn->targets[0], insn->targets[1], next_block);
         return;
     }
-    case NT_ASSIGN:
-    {
-        struct symbol *s0 = resolve_alias(expr->ops[0]->type_sym);
-        if (s0 == &sym_double) {
-            generate_expr(expr->ops[1], 1);
-            emit(ASM_FLD, qword(deref(esp)));
-            generate_lvalue(expr->ops[0]);
-            emit(ASM_POP, eax);
-            if (ret) {
-                emit(ASM_FST, qword(deref(esp)));
-            } else {
-                emit(ASM_ADD, esp, constant(8));
-            }
-            emit(ASM_FSTP, qword(deref(eax)));
+    if (in_register(insn->ops[0])) {
+        emit(ASM_TEST, home(insn->ops[0].value), home(insn->ops[0].value));
+    } else {
+        asm_operand_t scratch = sized(eax, ir_value_type(cur_ir, insn->ops[0]));
+        load_int(scratch, insn->ops[0]);
+        emit(ASM_TEST, scratch, scratch);
+    }
+    emit_branch(ASM_JNZ, ASM_JZ, insn->targets[0], insn->targets[1], next_block);
+}
+
+static int sysv_stack_arguments(struct ir_insn *insn)
+{
+    int i, ints = 0, doubles = 0;
+    for (i = 0; i < insn->args_count; i++) {
+        if (ir_value_type(cur_ir, insn->args[i]) == IRT_DOUBLE) {
+            doubles++;
+        } else {
+            ints++;
+        }
+    }
+    return (ints > SYSV_INT_REGISTERS ? ints - SYSV_INT_REGISTERS : 0)
+        + (doubles > SYSV_DOUBLE_REGISTERS ? doubles - SYSV_DOUBLE_REGISTERS : 0);
+}
+
+/* a tail call to a function of the unit needing no more stack for its arguments than ours came with */
+static int is_sibling_call(struct ir_block *block, int index)
+{
+    struct ir_insn *insn = &block->insns[index];
+    struct ir_value callee = insn->ops[0];
+    symtable_iter_t iter;
+    int i, size = 0;
+
+    if (!sibling_calls || !ir_is_tail_call(block, index) || !is_direct_call(callee)
+        || (callee.symbol->flags & SF_EXTERN) == SF_EXTERN) {
+        return 0;
+    }
+    if (cur_target == TARGET_X86_64_LINUX) {
+        return sysv_stack_arguments(insn) == 0;
+    }
+    for (iter = symtable_first(cur_function->ext->params); iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *param = symtable_iter_value(iter);
+        size += resolve_alias(param->base_type) == &sym_double ? 8 : 4;
+    }
+    for (i = 0; i < insn->args_count; i++) {
+        size -= argument_size(insn->args[i]);
+    }
+    return size >= 0;
+}
+
+static void select_insn(struct ir_block *block, int index, int next_block)
+{
+    struct ir_insn *insn = &block->insns[index];
+    switch (insn->op) {
+    case IR_MOV:
+        select_mov(insn);
+        break;
+    case IR_I2D:
+    case IR_D2I:
+    case IR_I2P:
+    case IR_P2I:
+        select_convert(insn);
+        break;
+    case IR_LOAD:
+        select_load(insn);
+        break;
+    case IR_STORE:
+        select_store(insn);
+        break;
+    case IR_CALL:
+        if (cur_target == TARGET_X86_64_LINUX) {
+            select_call_sysv(insn, is_sibling_call(block, index));
         } else {
-            generate_lvalue(expr->ops[0]);
-            generate_expr(expr->ops[1], 1);
-            emit(ASM_POP, ebx);
-            emit(ASM_POP, eax);
-            emit(ASM_MOV, deref(eax), ebx);
-            if (ret) emit(ASM_PUSH, ebx);
+            select_call(insn, is_sibling_call(block, index));
         }
+        break;
+    case IR_JMP:
+        if (insn->targets[0] != next_block) {
+            emit(ASM_JMP, label(block_label(insn->targets[0])));
+        }
+        break;
+    case IR_BR:
+        select_branch(block, index, next_block);
+        break;
+    case IR_SWITCH:
+        select_switch(insn);
+        break;
+    case IR_RET:
+        if (index == 0 || !is_sibling_call(block, index - 1)) {
+            select_return(insn, next_block == cur_ir->blocks_count);
+        }
+        break;
+    default:
+        if (is_fused_compare(block, index)) {
+            break;
+        }
+        if (insn->type == IRT_DOUBLE) {
+            select_double_op(insn);
+        } else {
+            select_int_op(insn);
+        }
+    }
+}
+
+static void count_uses(struct ir_value value)
+{
+    if (value.kind == IRV_REG) {
+        reg_uses[value.value]++;
+    }
+}
+
+static void note_parameter_use(ptrmap_t written, struct ir_insn *insn, struct ir_value value)
+{
+    if (value.kind != IRV_LOCAL || value.symbol->type != ST_PARAMETER) {
         return;
     }
-    case NT_CAST:
-    {
-        struct symbol *ret_type = resolve_alias(expr->type_sym), *s0 = resolve_alias(expr->ops[0]->type_sym);
-        generate_expr(expr->ops[0], ret);
-        if (ret) {
-            if ((is_compatible_types(s0, &sym_int) || is_ptr_type(s0)) && ret_type == &sym_double) {
-                emit(ASM_FILD, dword(deref(esp)));
-                emit(ASM_SUB, esp, constant(4));
-                emit(ASM_FSTP, qword(deref(esp)));
-            } else if (s0 == &sym_double && (is_compatible_types(ret_type, &sym_int) || is_ptr_type(ret_type))) {
-                emit(ASM_FLD, qword(deref(esp)));
-                emit(ASM_FISTTP, dword(memory(esp, 4, none_reg)));
-                emit(ASM_ADD, esp, constant(4));
+    if (insn->op == IR_LOAD && insn->size == value_size(insn->type) && value.value == 0 && insn->ops[0].kind == IRV_LOCAL) {
+        if (reg_assignment[insn->dst] < 0) {
+            reg_params[insn->dst] = value.symbol;
+        }
+    } else {
+        ptrmap_set(written, value.symbol, 1);
+    }
+}
+
+/* a spilled register only loaded from a parameter nothing writes can stay in its slot */
+static void find_parameter_homes()
+{
+    ptrmap_t written = ptrmap_create();
+    int i, j, k;
+    reg_params = jacc_calloc(cur_ir->regs_count + 1, sizeof(*reg_params));
+    for (i = 0; i < cur_ir->blocks_count; i++) {
+        struct ir_block *block = cur_ir->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            struct ir_insn *insn = &block->insns[j];
+            note_parameter_use(written, insn, insn->ops[0]);
+            note_parameter_use(written, insn, insn->ops[1]);
+            for (k = 0; k < insn->args_count; k++) {
+                note_parameter_use(written, insn, insn->args[k]);
             }
         }
-        return;
     }
-    case NT_REFERENCE:
-        emit(ASM_LEA, eax, lvalue(expr->ops[0]));
-        if (ret) emit(ASM_PUSH, eax);
-        return;
-    case NT_DEREFERENCE:
-        generate_expr(expr->ops[0], 1);
-        emit(ASM_POP, eax);
-        push_value(dword(deref(eax)), expr->type_sym, ret);
-        return;
-    case NT_VARIABLE:
-        push_value(lvalue(expr), expr->type_sym, ret);
-        return;
-    case NT_INT:
-        if (ret) emit(ASM_PUSH, constant(((struct int_node*)expr)->value));
-        return;
-    case NT_ADD:
-    {
-        struct symbol *s1 = resolve_alias(expr->ops[0]->type_sym);
-        if (is_ptr_type(s1)) {
-            generate_expr(expr->ops[0], 1);
-            generate_expr(expr->ops[1], 1);
-            emit(ASM_POP, eax);
-            emit(ASM_MOV, ebx, constant(s1->base_type->size));
-            emit(ASM_IMUL, ebx);
-            emit(ASM_POP, ebx);
-            emit(ASM_ADD, eax, ebx);
-            if (ret) emit(ASM_PUSH, eax);
-            return;
+    for (i = 1; i <= cur_ir->regs_count; i++) {
+        if (reg_params[i] != NULL && ptrmap_get(written, reg_params[i]) != 0) {
+            reg_params[i] = NULL;
         }
-        break;
     }
+    ptrmap_destroy(written);
+}
+
+/*
+ * System V parameters arriving in registers get slots below the locals
+ * and are stored there on entry, the others stay above the return address.
+ */
+static int assign_parameter_slots(struct symbol *func, int size)
+{
+    int ints = 0, doubles = 0, stack = 16;
+    symtable_iter_t iter = symtable_first(func->ext->params);
+    for (; iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *param = symtable_iter_value(iter);
+        int in_register = resolve_alias(param->base_type) == &sym_double
+            ? doubles++ < SYSV_DOUBLE_REGISTERS : ints++ < SYSV_INT_REGISTERS;
+        if (in_register) {
+            size = frame_alloc(size, 8);
+            ptrmap_set(param_slots, param, (uintptr_t)-size);
+        } else {
+            ptrmap_set(param_slots, param, stack);
+            stack += 8;
+        }
     }
+    return size;
+}
 
-    enum node_category cat = parser_node_info(expr)->cat;
-    switch (cat) {
-    case NC_UNARY:
-    {
-        struct symbol *s0 = resolve_alias(expr->ops[0]->type_sym);
-        if (s0 == &sym_double) {
-            generate_unary_double_op(expr, ret);
-            return;
-        } else if (is_compatible_types(s0, &sym_int) || s0->type == ST_POINTER) {
-            generate_unary_int_op(expr, ret);
-            return;
+static void store_parameters(struct symbol *func)
+{
+    int ints = 0, doubles = 0;
+    symtable_iter_t iter = symtable_first(func->ext->params);
+    for (; iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *param = symtable_iter_value(iter);
+        struct symbol *type = resolve_alias(param->base_type);
+        if (type == &sym_double && doubles < SYSV_DOUBLE_REGISTERS) {
+            asm_operand_t xmm = xmm0;
+            xmm.reg += doubles++;
+            emit(ASM_MOVSD, qword(frame_slot(param, 0)), xmm);
+        } else if (type != &sym_double && ints < SYSV_INT_REGISTERS) {
+            asm_operand_t reg = eax;
+            reg.reg = sysv_int_registers[ints++];
+            reg = sized(reg, is_ptr_type(type) ? IRT_PTR : IRT_INT);
+            emit(ASM_MOV, sized_memory(frame_slot(param, 0), is_ptr_type(type) ? 8 : 4), reg);
         }
-        return;
     }
-    case NC_BINARY:
-    {
-        struct symbol *s0 = resolve_alias(expr->ops[0]->type_sym);
-        if (s0 == &sym_double) {
-            generate_binary_double_op(expr, ret);
-            return;
-        } else if (is_compatible_types(s0, &sym_int) || s0->type == ST_POINTER) {
-            generate_binary_int_op(expr, ret);
-            return;
+}
+
+/* registers left without a physical one and the callee-saved ones in use get frame slots below the locals */
+static int assign_homes(int locals_size)
+{
+    int i, j, k, size = locals_size;
+    reg_homes = jacc_calloc(cur_ir->regs_count + 1, sizeof(*reg_homes));
+    reg_uses = jacc_calloc(cur_ir->regs_count + 1, sizeof(*reg_uses));
+    for (i = 0; i < pool.count; i++) {
+        saved_homes[i] = 0;
+    }
+    for (i = 1; i <= cur_ir->regs_count; i++) {
+        int index = reg_assignment != NULL ? reg_assignment[i] : -1;
+        if (index >= 0) {
+            if (cur_ir->reg_types[i] != IRT_DOUBLE && (pool.call_clobbers & (1u << index)) == 0 && saved_homes[index] == 0) {
+                size = frame_alloc(size, word_size);
+                saved_homes[index] = size;
+            }
+            continue;
+        }
+        if (reg_params == NULL || reg_params[i] == NULL) {
+            size = frame_alloc(size, value_size(cur_ir->reg_types[i]));
+            reg_homes[i] = size;
         }
     }
-    case NC_STATEMENT:
-        generate_statement(expr);
-        return;
+    for (i = 0; i < cur_ir->blocks_count; i++) {
+        struct ir_block *block = cur_ir->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            count_uses(block->insns[j].ops[0]);
+            count_uses(block->insns[j].ops[1]);
+            for (k = 0; k < block->insns[j].args_count; k++) {
+                count_uses(block->insns[j].args[k]);
+            }
+        }
     }
-    emit_text("; unknown node %s", parser_node_info(expr)->repr);
+    return size;
 }
 
 static void generate_function(struct symbol *func)
 {
-    if ((func->flags & SF_EXTERN) == SF_EXTERN) {
+    int i, j, frame_size;
+    if ((func->flags & SF_EXTERN) == SF_EXTERN || (func->flags & SF_UNUSED) == SF_UNUSED) {
         return;
     }
 
     cur_function = func;
-    func->return_label = gen_label();
+    struct symbol_ext *ext = symbol_ext(func);
+    ext->return_label = gen_label();
     int is_main = strcmp(func->name, "main") == 0;
 
-    emit_text("; start %s", func->name);
-
-    emit_text("_%s:", func->name);
+    cur_ir = lower_function(func);
+    if (cur_ir == NULL) {
+        return;
+    }
+    if (opt_level > 0) {
+        ssa_construct(cur_ir);
+        loop_optimize(cur_ir);
+    }
+    ssa_destruct(cur_ir);
+    /* the callee must not see the frame it replaces */
+    sibling_calls = opt_level > 0 && !is_main && !ir_frame_escapes(cur_ir);
+    frame_size = cur_ir->locals_size;
+    if (cur_target == TARGET_X86_64_LINUX) {
+        param_slots = ptrmap_create();
+        frame_size = assign_parameter_slots(func, frame_size);
+    }
+    if (opt_level > 0) {
+        reg_assignment = regalloc_linear_scan(cur_ir, &pool, use_sse ? &double_pool : NULL);
+        find_parameter_homes();
+    }
+    frame_size = assign_homes(frame_size);
+    if (cur_target == TARGET_X86_64_LINUX) {
+        frame_size = (frame_size + 15) & ~15;
+    }
+    block_labels = jacc_malloc(cur_ir->blocks_count * sizeof(*block_labels));
+    for (i = 0; i < cur_ir->blocks_count; i++) {
+        block_labels[i] = gen_label();
+    }
 
+    emit_text("%s start %s", dialect->comment, func->name);
     if (is_main) {
+        emit(ASM_GLOBAL, text_label(func->name));
+    }
+    emit(ASM_LABEL, text_label(func->name));
+
+    if (is_main && cur_target == TARGET_I386_WIN32) {
         emit(ASM_MOV, dword(deref(text_label("@main_esp"))), esp);
     }
-    emit(ASM_PUSH, ebp);
-    emit(ASM_MOV, ebp, esp);
-    if (func->locals_size != 0) {
-        emit(ASM_SUB, esp, constant(func->locals_size));
+    emit(ASM_PUSH, frame_pointer);
+    emit(ASM_MOV, frame_pointer, stack_pointer);
+    if (frame_size != 0) {
+        emit(ASM_SUB, stack_pointer, constant(frame_size));
+    }
+    for (i = 0; i < pool.count; i++) {
+        if (saved_homes[i] != 0) {
+            emit(ASM_MOV, sized_memory(memory(frame_pointer, -saved_homes[i], none_reg), word_size), native(allocatable[i]));
+        }
+    }
+    if (cur_target == TARGET_X86_64_LINUX) {
+        store_parameters(func);
     }
 
-    generate_expr(func->expr, 0);
-
-    if (func->locals_size != 0) {
-        emit(ASM_ADD, esp, constant(func->locals_size));
+    for (i = 0; i < cur_ir->blocks_count; i++) {
+        struct ir_block *block = cur_ir->blocks[i];
+        emit_label(block_labels[i]);
+        for (j = 0; j < block->count; j++) {
+            select_insn(block, j, i + 1);
+        }
     }
 
-    emit_label(func->return_label);
-    emit(ASM_MOV, esp, ebp);
-    emit(ASM_POP, ebp);
+    emit_label(ext->return_label);
+    /* like ExitProcess(0) on win32, main exits with 0 unless it returns a value */
+    if (is_main && cur_target == TARGET_X86_64_LINUX && parser_is_void_symbol(resolve_alias(func->base_type))) {
+        emit(ASM_MOV, eax, constant(0));
+    }
+    leave_frame();
 
-    if (is_main) {
+    if (is_main && cur_target == TARGET_I386_WIN32) {
         label_t l1 = gen_label();
         emit(ASM_CMP, esp, dword(deref(text_label("@main_esp"))));
         emit(ASM_JE, label(l1));
@@ -843,17 +1628,86 @@ static void generate_function(struct symbol *func)
         emit(ASM_RET);
     }
 
-    emit_text("; end %s\n", func->name);
+    emit_text("%s end %s\n", dialect->comment, func->name);
+
+    jacc_free(block_labels);
+    jacc_free(reg_assignment);
+    jacc_free(reg_params);
+    reg_assignment = NULL;
+    reg_params = NULL;
+    if (param_slots != NULL) {
+        ptrmap_destroy(param_slots);
+        param_slots = NULL;
+    }
+    jacc_free(reg_uses);
+    jacc_free(reg_homes);
+    ir_function_destroy(cur_ir);
+    cur_ir = NULL;
 }
 
 extern void generator_init()
 {
     label_counter = 0;
+    opt_level = 1;
+    use_sse = 0;
+    generator_target_set(TARGET_I386_WIN32);
 }
 
-extern void generator_destroy()
+extern void generator_sse_set(int enabled)
 {
+    use_sse = enabled || cur_target == TARGET_X86_64_LINUX;
+}
 
+extern void generator_target_set(target_t target)
+{
+    int i;
+    /* no xmm register survives a call, x86-64 passes arguments in xmm0-xmm7 */
+    int first_xmm = target == TARGET_X86_64_LINUX ? 8 : 1;
+    int last_xmm = target == TARGET_X86_64_LINUX ? 15 : 7;
+    double_pool.count = last_xmm - first_xmm + 1;
+    double_pool.call_clobbers = (1u << double_pool.count) - 1;
+    double_pool.shift_clobbers = 0;
+    for (i = 0; i < double_pool.count; i++) {
+        double_allocatable[i] = xmm0;
+        double_allocatable[i].reg += first_xmm + i;
+    }
+    cur_target = target;
+    if (target == TARGET_X86_64_LINUX) {
+        /* the argument registers stay out of the pool, r11 is the call scratch */
+        static const struct regalloc_pool sysv_pool = { 6, 1 << 5, 0 };
+        dialect = &gas_dialect;
+        frame_pointer = rbp;
+        stack_pointer = rsp;
+        word_size = 8;
+        allocatable[0] = ebx;
+        allocatable[1] = r12d;
+        allocatable[2] = r13d;
+        allocatable[3] = r14d;
+        allocatable[4] = r15d;
+        allocatable[5] = r10d;
+        pool = sysv_pool;
+        use_sse = 1;
+    } else {
+        static const struct regalloc_pool cdecl_pool = { 4, 1 << 0, 1 << 0 };
+        dialect = &fasm_dialect;
+        frame_pointer = ebp;
+        stack_pointer = esp;
+        word_size = 4;
+        allocatable[0] = ecx;
+        allocatable[1] = ebx;
+        allocatable[2] = esi;
+        allocatable[3] = edi;
+        pool = cdecl_pool;
+    }
+}
+
+extern void generator_opt_level_set(int level)
+{
+    opt_level = level;
+}
+
+extern void generator_destroy()
+{
 }
 
 extern code_t generator_process(symtable_t symtable)
@@ -873,9 +1727,27 @@ extern code_t generator_process(symtable_t symtable)
     return code;
 }
 
+static void print_gas_code(code_t code)
+{
+    int i;
+    printf("\t.intel_syntax noprefix\n\t.text\n");
+    for (i = 0; i < code->opcode_list.count; i++) {
+        print_command(&code->opcode_list.data[i]);
+    }
+    printf("\t.data\n");
+    for (i = 0; i < code->data_list.count; i++) {
+        print_command(&code->data_list.data[i]);
+    }
+    printf("\t.section .note.GNU-stack,\"\",@progbits\n");
+}
+
 extern void generator_print_code(code_t code)
 {
     int i;
+    if (cur_target == TARGET_X86_64_LINUX) {
+        print_gas_code(code);
+        return;
+    }
     printf("format PE console\nentry _main\n");
     printf("include '%%fasm%%/include/win32a.inc'\n\n");
     printf("section '.text' code executable\n");
@@ -899,6 +1771,11 @@ extern void generator_print_code(code_t code)
 
 static void free_opcode_list_data(asm_opcode_list_t *list)
 {
+    int i;
+    for (i = 0; i < list->count; i++) {
+        jacc_free(list->data[i].text);
+        jacc_free(list->data[i].labels);
+    }
     jacc_free(list->data);
 }
 
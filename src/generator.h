@@ -56,10 +56,15 @@ typedef struct {
     int value;
 } asm_operand_t;
 
+/*
+ * LABEL and GLOBAL take a label, the data commands a label and a constant
+ * length: BYTES of text, ZEROS or ADDRESSES of labels.
+ */
 typedef struct {
     asm_instruction_t type;
     asm_operand_t ops[2];
     char *text;
+    label_t *labels;
 } asm_command_t;
 
 typedef struct {
@@ -73,8 +78,20 @@ typedef struct code {
     asm_opcode_list_t data_list;
 } *code_t;
 
+/* i386 PE assembled by FASM, or x86-64 System V ELF assembled by GNU as */
+typedef enum {
+    TARGET_I386_WIN32,
+    TARGET_X86_64_LINUX,
+} target_t;
+
 extern void generator_init();
 extern void generator_destroy();
+/* the parser has to be told the pointer size of the target too */
+extern void generator_target_set(target_t target);
+/* doubles in xmm registers instead of the x87 stack, x86-64 always has them */
+extern void generator_sse_set(int enabled);
+/* SSA construction needs level 1 */
+extern void generator_opt_level_set(int level);
 
 extern code_t generator_process(symtable_t symtable);
 extern void generator_print_code(code_t code);
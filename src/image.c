@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "memory.h"
+#include "buffer.h"
+#include "image.h"
+#include "ptrmap.h"
+
+struct image_data {
+    const char *base;
+    size_t size;
+};
+
+struct writer {
+    buffer_t out;
+    ptrmap_t written;
+    int symbols_count;
+    int nodes_count;
+};
+
+/* zero-filled and aligned room for a record */
+static image_ref_t reserve(struct writer *w, int size)
+{
+    static char zeros[256];
+    image_ref_t ref;
+    while (buffer_size(w->out) % 4 != 0) {
+        buffer_append(w->out, 0);
+    }
+    ref = buffer_size(w->out);
+    while (size > 0) {
+        int chunk = size < (int)sizeof(zeros) ? size : (int)sizeof(zeros);
+        buffer_append_string(w->out, zeros, chunk);
+        size -= chunk;
+    }
+    return ref;
+}
+
+static void *record(struct writer *w, image_ref_t ref)
+{
+    return buffer_data(w->out) + ref;
+}
+
+static image_ref_t write_node(struct writer *w, struct node *node);
+
+static image_ref_t write_string(struct writer *w, const char *str)
+{
+    image_ref_t ref;
+    int len;
+    if (str == NULL) {
+        return 0;
+    }
+    if ((ref = ptrmap_get(w->written, str)) != 0) {
+        return ref;
+    }
+    len = strlen(str) + 1;
+    ref = reserve(w, len);
+    memcpy(record(w, ref), str, len);
+    ptrmap_set(w->written, str, ref);
+    return ref;
+}
+
+static image_ref_t write_symbol(struct writer *w, struct symbol *symbol);
+
+static image_ref_t write_table(struct writer *w, symtable_t symtable)
+{
+    image_ref_t ref, key, symbol;
+    symtable_iter_t iter;
+    int i, count = 0;
+    if (symtable == NULL) {
+        return 0;
+    }
+    if ((ref = ptrmap_get(w->written, symtable)) != 0) {
+        return ref;
+    }
+
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter)) {
+        count++;
+    }
+    ref = reserve(w, sizeof(struct image_table) + count * sizeof(struct image_entry));
+    ((struct image_table*)record(w, ref))->count = count;
+    ptrmap_set(w->written, symtable, ref);
+
+    i = 0;
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter), i++) {
+        key = write_string(w, symtable_iter_key(iter));
+        symbol = write_symbol(w, symtable_iter_value(iter));
+        struct image_entry *entry = &((struct image_table*)record(w, ref))->entries[i];
+        entry->key = key;
+        entry->key2 = symtable_iter_key2(iter);
+        entry->symbol = symbol;
+    }
+    return ref;
+}
+
+static enum image_builtin builtin_id(struct symbol *symbol)
+{
+    if (symbol == &sym_void) return IB_VOID;
+    if (symbol == &sym_int) return IB_INT;
+    if (symbol == &sym_double) return IB_DOUBLE;
+    if (symbol == &sym_char) return IB_CHAR;
+    if (symbol == &sym_char_ptr) return IB_CHAR_PTR;
+    if (symbol == &sym_printf) return IB_PRINTF;
+    return IB_NONE;
+}
+
+static image_ref_t write_symbol(struct writer *w, struct symbol *symbol)
+{
+    struct image_symbol result;
+    image_ref_t ref;
+    if (symbol == NULL) {
+        return 0;
+    }
+    if ((ref = ptrmap_get(w->written, symbol)) != 0) {
+        return ref;
+    }
+
+    /* registered before the fields, types may refer back to themselves */
+    ref = reserve(w, sizeof(result));
+    ptrmap_set(w->written, symbol, ref);
+    w->symbols_count++;
+
+    memset(&result, 0, sizeof(result));
+    result.builtin = builtin_id(symbol);
+    result.type = symbol->type;
+    result.flags = symbol->flags;
+    result.size = symbol->size;
+    result.offset = symbol->offset;
+    result.name = write_string(w, symbol->name);
+    result.base_type = write_symbol(w, symbol->base_type);
+    result.expr = write_node(w, symbol->expr);
+    result.symtable = write_table(w, symbol->symtable);
+    if (symbol->ext != NULL) {
+        result.params = write_table(w, symbol->ext->params);
+        result.body = write_node(w, symbol->ext->body);
+        result.locals_size = symbol->ext->locals_size;
+    }
+    memcpy(record(w, ref), &result, sizeof(result));
+    return ref;
+}
+
+static image_ref_t write_node(struct writer *w, struct node *node)
+{
+    image_ref_t ref, type_sym, symtable, value;
+    int i, count;
+    if (node == NULL) {
+        return 0;
+    }
+
+    w->nodes_count++;
+    type_sym = write_symbol(w, node->type_sym);
+    symtable = write_table(w, node->symtable);
+
+    switch (node->type) {
+    case NT_INT:
+        count = 1;
+        break;
+    case NT_DOUBLE:
+        count = 2;
+        break;
+    case NT_STRING:
+    case NT_IDENT:
+    case NT_VARIABLE:
+        count = 1;
+        break;
+    default:
+        count = parser_node_subnodes_count(node);
+    }
+
+    ref = reserve(w, sizeof(struct image_node) + count * sizeof(uint32_t));
+    struct image_node *result = record(w, ref);
+    result->type = node->type;
+    result->count = count;
+    result->type_sym = type_sym;
+    result->symtable = symtable;
+
+    switch (node->type) {
+    case NT_INT:
+        memcpy(result->data, &((struct int_node*)node)->value, sizeof(int));
+        return ref;
+    case NT_DOUBLE:
+        memcpy(result->data, &((struct double_node*)node)->value, sizeof(double));
+        return ref;
+    case NT_STRING:
+    case NT_IDENT:
+        value = write_string(w, ((struct string_node*)node)->value);
+        ((struct image_node*)record(w, ref))->data[0] = value;
+        return ref;
+    case NT_VARIABLE:
+        value = write_symbol(w, ((struct var_node*)node)->symbol);
+        ((struct image_node*)record(w, ref))->data[0] = value;
+        return ref;
+    }
+
+    for (i = 0; i < count; i++) {
+        value = write_node(w, parser_get_subnode(node, i));
+        ((struct image_node*)record(w, ref))->data[i] = value;
+    }
+    return ref;
+}
+
+extern int image_write(symtable_t symtable, FILE *file)
+{
+    struct writer w;
+    struct image_header header;
+    image_ref_t globals;
+    int ok;
+
+    memset(&w, 0, sizeof(w));
+    w.out = buffer_create(4096);
+    w.written = ptrmap_create();
+    reserve(&w, sizeof(header));
+    globals = write_table(&w, symtable);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.pointer_size = parser_pointer_size_get();
+    header.size = buffer_size(w.out);
+    header.globals = globals;
+    header.symbols_count = w.symbols_count;
+    header.nodes_count = w.nodes_count;
+    header.names_count = parser_names_count();
+    memcpy(record(&w, 0), &header, sizeof(header));
+
+    ok = fwrite(buffer_data(w.out), 1, buffer_size(w.out), file) == (size_t)buffer_size(w.out);
+
+    ptrmap_destroy(w.written);
+    buffer_free(w.out);
+    return ok;
+}
+
+/* loaded symbols and tables by ref */
+struct loader {
+    image_t image;
+    ptrmap_t loaded;
+};
+
+static struct node *load_node(struct loader *l, image_ref_t ref);
+static struct symbol *load_symbol(struct loader *l, image_ref_t ref);
+
+static symtable_t load_table(struct loader *l, image_ref_t ref)
+{
+    const struct image_table *table = image_table(l->image, ref);
+    symtable_t result;
+    uint32_t i;
+    if (table == NULL) {
+        return NULL;
+    }
+    if ((result = (symtable_t)ptrmap_get(l->loaded, (void*)(uintptr_t)ref)) != NULL) {
+        return result;
+    }
+
+    result = symtable_create(table->count < 16 ? 16 : table->count);
+    ptrmap_set(l->loaded, (void*)(uintptr_t)ref, (uintptr_t)result);
+    for (i = 0; i < table->count; i++) {
+        symtable_set(result, image_string(l->image, table->entries[i].key),
+            table->entries[i].key2, load_symbol(l, table->entries[i].symbol));
+    }
+    return result;
+}
+
+static struct symbol *load_symbol(struct loader *l, image_ref_t ref)
+{
+    const struct image_symbol *source = image_symbol(l->image, ref);
+    struct symbol *symbol;
+    if (source == NULL) {
+        return NULL;
+    }
+    if ((symbol = (struct symbol*)ptrmap_get(l->loaded, (void*)(uintptr_t)ref)) != NULL) {
+        return symbol;
+    }
+
+    switch (source->builtin) {
+    case IB_VOID: return &sym_void;
+    case IB_INT: return &sym_int;
+    case IB_DOUBLE: return &sym_double;
+    case IB_CHAR: return &sym_char;
+    case IB_CHAR_PTR: return &sym_char_ptr;
+    case IB_PRINTF: return &sym_printf;
+    }
+
+    symbol = jacc_calloc(1, sizeof(*symbol));
+    __sync_fetch_and_add(&symbol_stats.symbols, 1);
+    ptrmap_set(l->loaded, (void*)(uintptr_t)ref, (uintptr_t)symbol);
+    symbol->type = source->type;
+    symbol->flags = source->flags;
+    symbol->size = source->size;
+    symbol->offset = source->offset;
+    symbol->name = image_string(l->image, source->name);
+    symbol->base_type = load_symbol(l, source->base_type);
+    symbol->expr = load_node(l, source->expr);
+    symbol->symtable = load_table(l, source->symtable);
+    if (symbol->type == ST_FUNCTION || source->params != 0 || source->body != 0) {
+        struct symbol_ext *ext = symbol_ext(symbol);
+        ext->params = load_table(l, source->params);
+        if (ext->params == NULL) {
+            ext->params = symtable_create(16);
+        }
+        ext->body = load_node(l, source->body);
+        ext->locals_size = source->locals_size;
+    }
+    return symbol;
+}
+
+static struct node *load_node(struct loader *l, image_ref_t ref)
+{
+    const struct image_node *source = image_node(l->image, ref);
+    struct node *node;
+    const char *str;
+    uint32_t i;
+    if (source == NULL) {
+        return NULL;
+    }
+
+    switch (source->type) {
+    case NT_INT:
+        node = parser_create_int_node(image_node_int(source), NULL);
+        break;
+    case NT_DOUBLE:
+        node = parser_create_double_node(image_node_double(source), NULL);
+        break;
+    case NT_STRING:
+    case NT_IDENT:
+        node = parser_create_node(source->type, 0);
+        /* trees own their strings */
+        str = image_string(l->image, source->data[0]);
+        ((struct string_node*)node)->value = strcpy(jacc_malloc(strlen(str) + 1), str);
+        break;
+    case NT_VARIABLE:
+        node = parser_create_node(source->type, 0);
+        ((struct var_node*)node)->symbol = load_symbol(l, source->data[0]);
+        break;
+    default:
+        node = parser_create_node(source->type, source->count);
+        for (i = 0; i < source->count; i++) {
+            struct node *subnode = load_node(l, source->data[i]);
+            if (node->type == NT_LIST) {
+                ((struct list_node*)node)->items[i] = subnode;
+            } else {
+                node->ops[i] = subnode;
+            }
+        }
+    }
+    node->type_sym = load_symbol(l, source->type_sym);
+    node->symtable = load_table(l, source->symtable);
+    return node;
+}
+
+extern symtable_t image_load(image_t image)
+{
+    struct loader l;
+    symtable_t result;
+
+    memset(&l, 0, sizeof(l));
+    l.image = image;
+    l.loaded = ptrmap_create();
+    result = load_table(&l, image_header(image)->globals);
+    ptrmap_destroy(l.loaded);
+    return result;
+}
+
+extern image_t image_open(const char *path)
+{
+    struct stat st;
+    const struct image_header *header;
+    void *base;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*header)) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = base;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0
+        || header->version != IMAGE_VERSION || header->size != (uint32_t)st.st_size
+        || header->pointer_size != (uint32_t)parser_pointer_size_get()) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    image_t image = jacc_malloc(sizeof(*image));
+    image->base = base;
+    image->size = st.st_size;
+    return image;
+}
+
+extern void image_close(image_t image)
+{
+    if (image == NULL) {
+        return;
+    }
+    munmap((void*)image->base, image->size);
+    jacc_free(image);
+}
+
+/* NULL for none and for refs running past the end of the image */
+static const void *at(image_t image, image_ref_t ref, size_t size)
+{
+    if (ref == 0 || ref % 4 != 0 || ref + size > image->size) {
+        return NULL;
+    }
+    return image->base + ref;
+}
+
+extern const struct image_header *image_header(image_t image)
+{
+    return (const struct image_header*)image->base;
+}
+
+extern const struct image_table *image_table(image_t image, image_ref_t ref)
+{
+    const struct image_table *table = at(image, ref, sizeof(*table));
+    if (table == NULL || at(image, ref, sizeof(*table) + table->count * sizeof(table->entries[0])) == NULL) {
+        return NULL;
+    }
+    return table;
+}
+
+extern const struct image_symbol *image_symbol(image_t image, image_ref_t ref)
+{
+    return at(image, ref, sizeof(struct image_symbol));
+}
+
+extern const struct image_node *image_node(image_t image, image_ref_t ref)
+{
+    const struct image_node *node = at(image, ref, sizeof(*node));
+    if (node == NULL || at(image, ref, sizeof(*node) + node->count * sizeof(node->data[0])) == NULL) {
+        return NULL;
+    }
+    return node;
+}
+
+extern const char *image_string(image_t image, image_ref_t ref)
+{
+    if (ref == 0 || ref >= image->size || memchr(image->base + ref, 0, image->size - ref) == NULL) {
+        return NULL;
+    }
+    return image->base + ref;
+}
+
+extern int image_node_int(const struct image_node *node)
+{
+    int value;
+    memcpy(&value, node->data, sizeof(value));
+    return value;
+}
+
+extern double image_node_double(const struct image_node *node)
+{
+    double value;
+    memcpy(&value, node->data, sizeof(value));
+    return value;
+}
@@ -0,0 +1,105 @@
+#ifndef JACC_IMAGE_H
+#define JACC_IMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "parser.h"
+#include "symtable.h"
+
+/*
+ * Binary image of a parsed translation unit: symbol tables, symbols and
+ * typed trees. Every reference is a byte offset from the start of the
+ * image, 0 meaning none, so a mapped file is used in place without any
+ * pointer fix-up. Records are 4-byte aligned and shared symbols, tables
+ * and strings are written once. Type sizes and field offsets depend on the
+ * pointer size, so an image is only opened with the one it was built with.
+ */
+
+#define IMAGE_MAGIC "JACCIMG"
+#define IMAGE_VERSION 3
+
+typedef uint32_t image_ref_t;
+
+struct image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint32_t size;
+    image_ref_t globals;
+    uint32_t symbols_count;
+    uint32_t nodes_count;
+    uint32_t names_count;
+};
+
+struct image_entry {
+    image_ref_t key;
+    uint32_t key2;
+    image_ref_t symbol;
+};
+
+struct image_table {
+    uint32_t count;
+    struct image_entry entries[];
+};
+
+/* builtin symbols are tagged, loading maps them back to the parser's own */
+enum image_builtin {
+    IB_NONE,
+    IB_VOID,
+    IB_INT,
+    IB_DOUBLE,
+    IB_CHAR,
+    IB_CHAR_PTR,
+    IB_PRINTF,
+};
+
+struct image_symbol {
+    uint32_t builtin;
+    uint32_t type;
+    uint32_t flags;
+    int32_t size;
+    int32_t offset;
+    image_ref_t name;
+    image_ref_t base_type;
+    image_ref_t expr;
+    image_ref_t symtable;
+    image_ref_t params;
+    image_ref_t body;
+    int32_t locals_size;
+};
+
+/*
+ * Atoms keep their value in data: an int, a double in two words, a string
+ * or a symbol ref. Other nodes keep refs to their count operands.
+ */
+struct image_node {
+    uint32_t type;
+    uint32_t count;
+    image_ref_t type_sym;
+    image_ref_t symtable;
+    uint32_t data[];
+};
+
+typedef struct image_data *image_t;
+
+extern int image_write(symtable_t symtable, FILE *file);
+
+extern image_t image_open(const char *path);
+/*
+ * Rebuilds the global symbol table of an image as live symbols, e.g. to
+ * start parsing after a prologue. Names point into the mapped image, so
+ * it must stay open while they are used.
+ */
+extern symtable_t image_load(image_t image);
+extern void image_close(image_t image);
+
+extern const struct image_header *image_header(image_t image);
+extern const struct image_table *image_table(image_t image, image_ref_t ref);
+extern const struct image_symbol *image_symbol(image_t image, image_ref_t ref);
+extern const struct image_node *image_node(image_t image, image_ref_t ref);
+extern const char *image_string(image_t image, image_ref_t ref);
+
+extern int image_node_int(const struct image_node *node);
+extern double image_node_double(const struct image_node *node);
+
+#endif
@@ -0,0 +1,427 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "symtable.h"
+#include "ir.h"
+
+static const char *opcode_names[] = {
+#define IR_OP(name, repr) repr,
+#include "ir.def"
+#undef IR_OP
+};
+
+extern ir_function_t ir_function_create(struct symbol *symbol)
+{
+    ir_function_t function = jacc_calloc(1, sizeof(*function));
+    function->symbol = symbol;
+    function->locals_size = symbol->ext != NULL ? symbol->ext->locals_size : 0;
+    return function;
+}
+
+static void free_block(struct ir_block *block)
+{
+    int i;
+    for (i = 0; i < block->count; i++) {
+        jacc_free(block->insns[i].args);
+        jacc_free(block->insns[i].targets);
+    }
+    jacc_free(block->insns);
+    jacc_free(block);
+}
+
+extern void ir_function_destroy(ir_function_t function)
+{
+    int i;
+    if (function == NULL) {
+        return;
+    }
+    for (i = 0; i < function->blocks_count; i++) {
+        free_block(function->blocks[i]);
+    }
+    for (i = 0; i < function->locals_count; i++) {
+        jacc_free(function->locals[i]);
+    }
+    jacc_free(function->locals);
+    jacc_free(function->blocks);
+    jacc_free(function->reg_types);
+    jacc_free(function);
+}
+
+extern int ir_block_create(ir_function_t function)
+{
+    if (function->blocks_count == function->blocks_capacity) {
+        function->blocks_capacity = function->blocks_capacity == 0 ? 16 : function->blocks_capacity * 2;
+        function->blocks = jacc_realloc(function->blocks, function->blocks_capacity * sizeof(*function->blocks));
+    }
+    struct ir_block *block = jacc_calloc(1, sizeof(*block));
+    block->id = function->blocks_count;
+    function->blocks[function->blocks_count++] = block;
+    return block->id;
+}
+
+extern int ir_reg_create(ir_function_t function, enum ir_type type)
+{
+    if (function->regs_count + 1 >= function->regs_capacity) {
+        function->regs_capacity = function->regs_capacity == 0 ? 64 : function->regs_capacity * 2;
+        function->reg_types = jacc_realloc(function->reg_types, function->regs_capacity * sizeof(*function->reg_types));
+    }
+    function->regs_count++;
+    function->reg_types[function->regs_count] = type;
+    return function->regs_count;
+}
+
+extern struct symbol *ir_local_create(ir_function_t function, struct symbol *symbol)
+{
+    struct symbol *local = jacc_malloc(sizeof(*local));
+    *local = *symbol;
+    local->type = ST_VARIABLE;
+    local->offset = -function->locals_size;
+    function->locals_size += local->size;
+    function->locals = jacc_realloc(function->locals, (function->locals_count + 1) * sizeof(*function->locals));
+    function->locals[function->locals_count++] = local;
+    return local;
+}
+
+extern struct ir_insn *ir_insn_add(ir_function_t function, int block_id, enum ir_opcode op, enum ir_type type)
+{
+    struct ir_block *block = function->blocks[block_id];
+    if (block->count == block->capacity) {
+        block->capacity = block->capacity == 0 ? 8 : block->capacity * 2;
+        block->insns = jacc_realloc(block->insns, block->capacity * sizeof(*block->insns));
+    }
+    struct ir_insn *insn = &block->insns[block->count++];
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->type = type;
+    return insn;
+}
+
+extern void ir_insn_set_targets(struct ir_insn *insn, int count, ...)
+{
+    va_list args;
+    int i;
+    insn->targets = jacc_realloc(insn->targets, count * sizeof(*insn->targets));
+    insn->targets_count = count;
+    va_start(args, count);
+    for (i = 0; i < count; i++) {
+        insn->targets[i] = va_arg(args, int);
+    }
+    va_end(args);
+}
+
+extern void ir_insn_add_arg(struct ir_insn *insn, struct ir_value arg)
+{
+    insn->args = jacc_realloc(insn->args, (insn->args_count + 1) * sizeof(*insn->args));
+    insn->args[insn->args_count++] = arg;
+}
+
+extern struct ir_value ir_none()
+{
+    struct ir_value value;
+    memset(&value, 0, sizeof(value));
+    return value;
+}
+
+extern struct ir_value ir_reg(int reg)
+{
+    struct ir_value value = ir_none();
+    value.kind = IRV_REG;
+    value.value = reg;
+    return value;
+}
+
+extern struct ir_value ir_int(int number)
+{
+    struct ir_value value = ir_none();
+    value.kind = IRV_INT;
+    value.value = number;
+    return value;
+}
+
+extern struct ir_value ir_double(double number)
+{
+    struct ir_value value = ir_none();
+    value.kind = IRV_DOUBLE;
+    value.dvalue = number;
+    return value;
+}
+
+extern struct ir_value ir_string(const char *string)
+{
+    struct ir_value value = ir_none();
+    value.kind = IRV_STRING;
+    value.string = string;
+    return value;
+}
+
+extern struct ir_value ir_local(struct symbol *symbol, int offset)
+{
+    struct ir_value value = ir_none();
+    value.kind = IRV_LOCAL;
+    value.symbol = symbol;
+    value.value = offset;
+    return value;
+}
+
+extern struct ir_value ir_global(struct symbol *symbol, int offset)
+{
+    struct ir_value value = ir_none();
+    value.kind = IRV_GLOBAL;
+    value.symbol = symbol;
+    value.value = offset;
+    return value;
+}
+
+extern enum ir_type ir_value_type(ir_function_t function, struct ir_value value)
+{
+    switch (value.kind) {
+    case IRV_NONE:
+        return IRT_VOID;
+    case IRV_REG:
+        return function->reg_types[value.value];
+    case IRV_DOUBLE:
+        return IRT_DOUBLE;
+    case IRV_STRING:
+    case IRV_LOCAL:
+    case IRV_GLOBAL:
+        return IRT_PTR;
+    }
+    return IRT_INT;
+}
+
+extern int ir_is_terminator(enum ir_opcode op)
+{
+    return op == IR_JMP || op == IR_BR || op == IR_SWITCH || op == IR_RET;
+}
+
+extern struct ir_insn *ir_terminator(struct ir_block *block)
+{
+    if (block->count == 0 || !ir_is_terminator(block->insns[block->count - 1].op)) {
+        return NULL;
+    }
+    return &block->insns[block->count - 1];
+}
+
+extern int ir_is_tail_call(struct ir_block *block, int index)
+{
+    struct ir_insn *call = &block->insns[index], *ret;
+    if (call->op != IR_CALL || index + 1 >= block->count) {
+        return 0;
+    }
+    ret = &block->insns[index + 1];
+    if (ret->op != IR_RET || ret->type != call->type) {
+        return 0;
+    }
+    if (call->dst == 0) {
+        return ret->ops[0].kind == IRV_NONE;
+    }
+    return ret->ops[0].kind == IRV_REG && ret->ops[0].value == call->dst;
+}
+
+extern int ir_frame_escapes(ir_function_t function)
+{
+    int i, j, k;
+    for (i = 0; i < function->blocks_count; i++) {
+        struct ir_block *block = function->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            struct ir_insn *insn = &block->insns[j];
+            int memory = insn->op == IR_LOAD || insn->op == IR_STORE;
+            if ((!memory && insn->ops[0].kind == IRV_LOCAL) || insn->ops[1].kind == IRV_LOCAL) {
+                return 1;
+            }
+            for (k = 0; k < insn->args_count; k++) {
+                if (insn->args[k].kind == IRV_LOCAL) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+extern const char *ir_opcode_name(enum ir_opcode op)
+{
+    return opcode_names[op];
+}
+
+/* drops the inputs coming from removed blocks */
+static void remove_phi_inputs(struct ir_insn *phi, int *renumber)
+{
+    int i, count = 0;
+    for (i = 0; i < phi->args_count; i++) {
+        if (renumber[phi->targets[i]] != -1) {
+            phi->args[count] = phi->args[i];
+            phi->targets[count] = renumber[phi->targets[i]];
+            count++;
+        }
+    }
+    phi->args_count = phi->targets_count = count;
+}
+
+extern void ir_remove_unreachable(ir_function_t function)
+{
+    int *renumber = jacc_malloc(function->blocks_count * sizeof(*renumber));
+    int *worklist = jacc_malloc(function->blocks_count * sizeof(*worklist));
+    int i, j, count = 0, top = 0;
+
+    for (i = 0; i < function->blocks_count; i++) {
+        renumber[i] = -1;
+    }
+    renumber[0] = 0;
+    worklist[top++] = 0;
+    while (top > 0) {
+        struct ir_insn *last = ir_terminator(function->blocks[worklist[--top]]);
+        for (j = 0; last != NULL && j < last->targets_count; j++) {
+            if (renumber[last->targets[j]] == -1) {
+                renumber[last->targets[j]] = 0;
+                worklist[top++] = last->targets[j];
+            }
+        }
+    }
+
+    for (i = 0; i < function->blocks_count; i++) {
+        if (renumber[i] == -1) {
+            free_block(function->blocks[i]);
+            continue;
+        }
+        renumber[i] = count;
+        function->blocks[count] = function->blocks[i];
+        function->blocks[count]->id = count;
+        count++;
+    }
+    function->blocks_count = count;
+
+    for (i = 0; i < count; i++) {
+        struct ir_block *block = function->blocks[i];
+        struct ir_insn *last = ir_terminator(block);
+        for (j = 0; last != NULL && j < last->targets_count; j++) {
+            last->targets[j] = renumber[last->targets[j]];
+        }
+        for (j = 0; j < block->count && block->insns[j].op == IR_PHI; j++) {
+            remove_phi_inputs(&block->insns[j], renumber);
+        }
+    }
+    jacc_free(worklist);
+    jacc_free(renumber);
+}
+
+static void print_value(struct ir_value value, FILE *file)
+{
+    const char *ptr;
+    switch (value.kind) {
+    case IRV_NONE:
+        fprintf(file, "_");
+        return;
+    case IRV_REG:
+        fprintf(file, "r%d", value.value);
+        return;
+    case IRV_INT:
+        fprintf(file, "%d", value.value);
+        return;
+    case IRV_DOUBLE:
+        fprintf(file, "%g", value.dvalue);
+        return;
+    case IRV_STRING:
+        fputc('"', file);
+        for (ptr = value.string; *ptr != 0; ptr++) {
+            if (*ptr == '"' || *ptr == '\\') {
+                fprintf(file, "\\%c", *ptr);
+            } else if ((unsigned char)*ptr < 0x20) {
+                fprintf(file, "\\x%02x", (unsigned char)*ptr);
+            } else {
+                fputc(*ptr, file);
+            }
+        }
+        fputc('"', file);
+        return;
+    case IRV_LOCAL:
+    case IRV_GLOBAL:
+        fprintf(file, "%s%s", value.kind == IRV_LOCAL ? "&" : "@", value.symbol->name);
+        if (value.value != 0) {
+            fprintf(file, "%+d", value.value);
+        }
+        return;
+    }
+}
+
+static void print_insn(struct ir_insn *insn, FILE *file)
+{
+    int i;
+    fprintf(file, "    ");
+    if (insn->dst != 0) {
+        fprintf(file, "r%d = ", insn->dst);
+    }
+    fprintf(file, "%s", opcode_names[insn->op]);
+    if (insn->op == IR_LOAD || insn->op == IR_STORE) {
+        fprintf(file, "%d", insn->size);
+    } else if (insn->type == IRT_DOUBLE) {
+        fprintf(file, ".d");
+    }
+
+    switch (insn->op) {
+    case IR_LOAD:
+        fprintf(file, " [");
+        print_value(insn->ops[0], file);
+        fprintf(file, "]");
+        break;
+    case IR_STORE:
+        fprintf(file, " [");
+        print_value(insn->ops[0], file);
+        fprintf(file, "], ");
+        print_value(insn->ops[1], file);
+        break;
+    case IR_CALL:
+        fprintf(file, " ");
+        print_value(insn->ops[0], file);
+        fprintf(file, "(");
+        for (i = 0; i < insn->args_count; i++) {
+            fprintf(file, i == 0 ? "" : ", ");
+            print_value(insn->args[i], file);
+        }
+        fprintf(file, ")");
+        break;
+    case IR_PHI:
+        for (i = 0; i < insn->args_count; i++) {
+            fprintf(file, i == 0 ? " [b%d: " : ", [b%d: ", insn->targets[i]);
+            print_value(insn->args[i], file);
+            fprintf(file, "]");
+        }
+        break;
+    case IR_JMP:
+        fprintf(file, " b%d", insn->targets[0]);
+        break;
+    case IR_BR:
+        fprintf(file, " ");
+        print_value(insn->ops[0], file);
+        fprintf(file, ", b%d, b%d", insn->targets[0], insn->targets[1]);
+        break;
+    case IR_SWITCH:
+        fprintf(file, " ");
+        print_value(insn->ops[0], file);
+        fprintf(file, ", b%d", insn->targets[0]);
+        for (i = 0; i < insn->args_count; i++) {
+            fprintf(file, ", %d: b%d", insn->args[i].value, insn->targets[i + 1]);
+        }
+        break;
+    default:
+        for (i = 0; i < 2 && insn->ops[i].kind != IRV_NONE; i++) {
+            fprintf(file, i == 0 ? " " : ", ");
+            print_value(insn->ops[i], file);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+extern void ir_print_function(ir_function_t function, FILE *file)
+{
+    int i, j;
+    fprintf(file, "function %s\n", function->symbol->name);
+    for (i = 0; i < function->blocks_count; i++) {
+        struct ir_block *block = function->blocks[i];
+        fprintf(file, "b%d:\n", block->id);
+        for (j = 0; j < block->count; j++) {
+            print_insn(&block->insns[j], file);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef JACC_IR_H
+#define JACC_IR_H
+
+#include <stdio.h>
+#include "symtable.h"
+
+/*
+ * Three-address code between typed trees and instruction selection. A
+ * function is a list of basic blocks, block 0 being the entry, and every
+ * block ends with exactly one jmp, br, switch or ret. Values are kept in
+ * virtual registers numbered from 1 and typed int, pointer or double;
+ * pointers are as wide as the target makes them, ints stay 32-bit. Variables
+ * stay in memory and are reached through loads and stores until SSA
+ * construction promotes them, leaving phis at the start of blocks.
+ */
+
+enum ir_opcode {
+#define IR_OP(name, repr) IR_##name,
+#include "ir.def"
+#undef IR_OP
+};
+
+enum ir_type {
+    IRT_VOID,
+    IRT_INT,
+    IRT_PTR,
+    IRT_DOUBLE,
+};
+
+enum ir_value_kind {
+    IRV_NONE,
+    IRV_REG,
+    IRV_INT,
+    IRV_DOUBLE,
+    IRV_STRING,
+    /* addresses of a variable plus a byte offset */
+    IRV_LOCAL,
+    IRV_GLOBAL,
+};
+
+struct ir_value {
+    enum ir_value_kind kind;
+    /* register number, integer or address offset */
+    int value;
+    double dvalue;
+    const char *string;
+    struct symbol *symbol;
+};
+
+/*
+ * Operations take their operands in ops and their result in dst. The type
+ * is the one of the operands, so comparisons of doubles are double typed
+ * but produce an int register. Loads and stores move size bytes through
+ * the address in ops[0], a store taking its value from ops[1].
+ */
+struct ir_insn {
+    enum ir_opcode op;
+    enum ir_type type;
+    int size;
+    int dst;
+    struct ir_value ops[2];
+    /* call arguments, phi inputs or switch case values */
+    struct ir_value *args;
+    int args_count;
+    /*
+     * successors: br goes to the first one when ops[0] is not zero, switch to the first when no case matches;
+     * for phis the predecessor each input comes from
+     */
+    int *targets;
+    int targets_count;
+};
+
+struct ir_block {
+    int id;
+    struct ir_insn *insns;
+    int count;
+    int capacity;
+};
+
+typedef struct ir_function {
+    struct symbol *symbol;
+    struct ir_block **blocks;
+    int blocks_count;
+    int blocks_capacity;
+    /* indexed by register number, entry 0 is unused */
+    enum ir_type *reg_types;
+    int regs_count;
+    int regs_capacity;
+    /* frame bytes of the variables, the ones of inlined calls included */
+    int locals_size;
+    struct symbol **locals;
+    int locals_count;
+} *ir_function_t;
+
+extern ir_function_t ir_function_create(struct symbol *symbol);
+extern void ir_function_destroy(ir_function_t function);
+
+extern int ir_block_create(ir_function_t function);
+extern int ir_reg_create(ir_function_t function, enum ir_type type);
+/* a copy of a variable placed below the others in the frame, owned by the function */
+extern struct symbol *ir_local_create(ir_function_t function, struct symbol *symbol);
+/* appends an empty instruction, valid until the next one is added to the block */
+extern struct ir_insn *ir_insn_add(ir_function_t function, int block, enum ir_opcode op, enum ir_type type);
+extern void ir_insn_set_targets(struct ir_insn *insn, int count, ...);
+extern void ir_insn_add_arg(struct ir_insn *insn, struct ir_value arg);
+
+extern struct ir_value ir_none();
+extern struct ir_value ir_reg(int reg);
+extern struct ir_value ir_int(int value);
+extern struct ir_value ir_double(double value);
+extern struct ir_value ir_string(const char *string);
+extern struct ir_value ir_local(struct symbol *symbol, int offset);
+extern struct ir_value ir_global(struct symbol *symbol, int offset);
+
+extern enum ir_type ir_value_type(ir_function_t function, struct ir_value value);
+extern int ir_is_terminator(enum ir_opcode op);
+extern struct ir_insn *ir_terminator(struct ir_block *block);
+/* a call at index whose result, if any, the function returns right away */
+extern int ir_is_tail_call(struct ir_block *block, int index);
+/* whether the address of a variable is used other than to load or store it */
+extern int ir_frame_escapes(ir_function_t function);
+extern const char *ir_opcode_name(enum ir_opcode op);
+
+/* drops blocks not reachable from the entry and renumbers the rest */
+extern void ir_remove_unreachable(ir_function_t function);
+
+extern void ir_print_function(ir_function_t function, FILE *file);
+
+#endif
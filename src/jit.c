@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "memory.h"
+#include "jit.h"
+
+#if JIT_HOST_SUPPORTED
+
+/* jmp [rip + 0] followed by the address */
+#define STUB_SIZE 16
+
+struct jit {
+    char *base;
+    size_t size;
+    int (*main)();
+};
+
+static size_t round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static int reloc_fits(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/* where every symbol lives, with stubs for the undefined ones */
+static int resolve_symbols(object_t object, char *text, char *stubs, char *data, char **addresses, char **calls)
+{
+    int i, stubs_count = 0;
+    for (i = 0; i < object->symbols_count; i++) {
+        struct object_symbol *symbol = &object->symbols[i];
+        char *stub;
+        switch (symbol->section) {
+        case OS_TEXT:
+            addresses[i] = calls[i] = text + symbol->offset;
+            break;
+        case OS_DATA:
+            addresses[i] = calls[i] = data + symbol->offset;
+            break;
+        default:
+            addresses[i] = dlsym(RTLD_DEFAULT, symbol->name);
+            if (addresses[i] == NULL) {
+                fprintf(stderr, "undefined symbol %s\n", symbol->name);
+                return 0;
+            }
+            stub = stubs + STUB_SIZE * stubs_count++;
+            stub[0] = 0xFF;
+            stub[1] = 0x25;
+            memset(stub + 2, 0, 4);
+            memcpy(stub + 6, &addresses[i], sizeof(addresses[i]));
+            calls[i] = stub;
+        }
+    }
+    return 1;
+}
+
+static int apply_relocs(object_t object, char *text, char *data, char **addresses, char **calls)
+{
+    int i;
+    for (i = 0; i < object->relocs_count; i++) {
+        struct object_reloc *reloc = &object->relocs[i];
+        char *field = (reloc->section == OS_TEXT ? text : data) + reloc->offset;
+        char *target = reloc->type == OR_PLT32 ? calls[reloc->symbol] : addresses[reloc->symbol];
+        int64_t value;
+        int32_t value32;
+        switch (reloc->type) {
+        case OR_ABS64:
+            value = (int64_t)(intptr_t)target + reloc->addend;
+            memcpy(field, &value, sizeof(value));
+            break;
+        default:
+            value = target + reloc->addend - field;
+            if (!reloc_fits(value)) {
+                fprintf(stderr, "%s is out of reach\n", object->symbols[reloc->symbol].name);
+                return 0;
+            }
+            value32 = value;
+            memcpy(field, &value32, sizeof(value32));
+        }
+    }
+    return 1;
+}
+
+extern jit_t jit_load(object_t object)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t stubs_offset = round_up(buffer_size(object->text), STUB_SIZE);
+    size_t data_offset, size;
+    char **addresses, **calls;
+    int i, undefined = 0, main_symbol = -1, ok;
+    jit_t jit;
+
+    for (i = 0; i < object->symbols_count; i++) {
+        if (object->symbols[i].section == OS_UNDEFINED) {
+            undefined++;
+        } else if (object->symbols[i].name != NULL && strcmp(object->symbols[i].name, "main") == 0) {
+            main_symbol = i;
+        }
+    }
+    if (main_symbol < 0 || object->symbols[main_symbol].section != OS_TEXT) {
+        fprintf(stderr, "no main function\n");
+        return NULL;
+    }
+
+    data_offset = round_up(stubs_offset + undefined * STUB_SIZE, page);
+    size = round_up(data_offset + buffer_size(object->data) + 1, page);
+    jit = jacc_malloc(sizeof(*jit));
+    jit->size = size;
+    jit->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->base == MAP_FAILED) {
+        jacc_free(jit);
+        fprintf(stderr, "cannot map code\n");
+        return NULL;
+    }
+    memcpy(jit->base, buffer_data(object->text), buffer_size(object->text));
+    memcpy(jit->base + data_offset, buffer_data(object->data), buffer_size(object->data));
+
+    addresses = jacc_malloc(object->symbols_count * sizeof(*addresses));
+    calls = jacc_malloc(object->symbols_count * sizeof(*calls));
+    ok = resolve_symbols(object, jit->base, jit->base + stubs_offset, jit->base + data_offset, addresses, calls)
+        && apply_relocs(object, jit->base, jit->base + data_offset, addresses, calls)
+        && mprotect(jit->base, data_offset, PROT_READ | PROT_EXEC) == 0;
+    jit->main = (int (*)())(intptr_t)(jit->base + object->symbols[main_symbol].offset);
+    jacc_free(addresses);
+    jacc_free(calls);
+
+    if (!ok) {
+        jit_free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+/* the program shares stdio with the compiler, so its output is flushed in order */
+extern int jit_call_main(jit_t jit)
+{
+    int result = jit->main();
+    fflush(stdout);
+    return result;
+}
+
+extern void jit_free(jit_t jit)
+{
+    if (jit == NULL) {
+        return;
+    }
+    munmap(jit->base, jit->size);
+    jacc_free(jit);
+}
+
+#else
+
+extern jit_t jit_load(object_t object)
+{
+    (void)object;
+    fprintf(stderr, "run: host is not x86-64 Linux\n");
+    return NULL;
+}
+
+extern int jit_call_main(jit_t jit)
+{
+    (void)jit;
+    return EXIT_FAILURE;
+}
+
+extern void jit_free(jit_t jit)
+{
+    (void)jit;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef JACC_JIT_H
+#define JACC_JIT_H
+
+#include "encoder.h"
+
+/*
+ * Loads an encoded x86-64 object into executable memory of this process.
+ * Symbols the object leaves undefined are looked up among the ones already
+ * loaded, libc included, and calls to them go through jump stubs placed
+ * right after the text, as the libraries may be mapped too far for a rel32.
+ * The code follows the x86-64 System V ABI, so it only runs on such a host.
+ */
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_HOST_SUPPORTED 1
+#else
+#define JIT_HOST_SUPPORTED 0
+#endif
+
+typedef struct jit *jit_t;
+
+/* NULL after printing the reason when the object cannot be loaded */
+extern jit_t jit_load(object_t object);
+extern int jit_call_main(jit_t jit);
+extern void jit_free(jit_t jit);
+
+#endif
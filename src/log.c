@@ -5,8 +5,11 @@
 #include "memory.h"
 #include "log.h"
 
+#define LOG_LINE_SIZE 512
+
 char *unit_name = NULL;
-int unit_line = -1, unit_column = -1;
+__thread int unit_line = -1, unit_column = -1;
+__thread buffer_t capture = NULL;
 
 extern void log_close()
 {
@@ -29,17 +32,43 @@ extern void log_set_pos(int line, int column)
     unit_column = column;
 }
 
+extern buffer_t log_capture(buffer_t buffer)
+{
+    buffer_t previous = capture;
+    capture = buffer;
+    return previous;
+}
+
+extern void log_write(FILE *stream, const char *text, int len)
+{
+    if (capture != NULL) {
+        buffer_append_string(capture, (char*)text, len);
+    } else {
+        fwrite(text, 1, len, stream);
+    }
+}
+
 static void log_print_ex(FILE *stream, const char *prefix, const char *msg)
 {
+    char line[LOG_LINE_SIZE];
+    int len = 0;
     if (unit_name != NULL) {
-        fprintf(stream, "%s:", unit_name);
+        len += snprintf(line, sizeof(line), "%s:", unit_name);
 
-        if (unit_line != -1) {
-            fprintf(stream, "%d:%d:", unit_line, unit_column);
+        if (unit_line != -1 && len < (int)sizeof(line)) {
+            len += snprintf(line + len, sizeof(line) - len, "%d:%d:", unit_line, unit_column);
+        }
+        if (len < (int)sizeof(line)) {
+            len += snprintf(line + len, sizeof(line) - len, " ");
         }
-        fprintf(stream, " ");
     }
-    fprintf(stream, "%s%s\n", prefix, msg);
+    if (len < (int)sizeof(line)) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%s\n", prefix, msg);
+    }
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    log_write(stream, line, len);
 }
 
 extern void log_print(const char *msg)
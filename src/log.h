@@ -1,11 +1,18 @@
 #ifndef JACC_LOG_H
 #define JACC_LOG_H
 
+#include <stdio.h>
+#include "buffer.h"
+
 extern void log_close();
 
 extern void log_set_unit(const char *name);
 extern void log_set_pos(int line, int column);
 
+/* redirects messages of the calling thread into buffer, NULL restores streams */
+extern buffer_t log_capture(buffer_t buffer);
+extern void log_write(FILE *stream, const char *text, int len);
+
 extern void log_print(const char *msg);
 extern void log_error(const char *msg);
 extern void log_warning(const char *msg);
@@ -0,0 +1,857 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "ptrmap.h"
+#include "cfg.h"
+#include "loop.h"
+
+struct loop {
+    int header;
+    /* -1 when the loop is entered other than by a jump from a single block */
+    int preheader;
+    /* member blocks, the header first */
+    int *blocks;
+    int count;
+    char *in_loop;
+};
+
+struct loops {
+    ir_function_t function;
+    cfg_t cfg;
+    struct loop *loops;
+    int count;
+    /* definitions of each register in the function */
+    int *defs;
+    /* variables whose address is used other than by loads and stores */
+    ptrmap_t escaped;
+};
+
+static struct loop *loop_of(struct loops *l, int header)
+{
+    struct loop *loop;
+    int i;
+    for (i = 0; i < l->count; i++) {
+        if (l->loops[i].header == header) {
+            return &l->loops[i];
+        }
+    }
+    l->loops = jacc_realloc(l->loops, (l->count + 1) * sizeof(*l->loops));
+    loop = &l->loops[l->count++];
+    loop->header = header;
+    loop->preheader = -1;
+    loop->blocks = jacc_malloc(l->function->blocks_count * sizeof(*loop->blocks));
+    loop->blocks[0] = header;
+    loop->count = 1;
+    loop->in_loop = jacc_calloc(l->function->blocks_count, 1);
+    loop->in_loop[header] = 1;
+    return loop;
+}
+
+/* the blocks reaching the latch without going through the header */
+static void add_body(struct loops *l, struct loop *loop, int latch)
+{
+    int *stack = jacc_malloc(l->function->blocks_count * sizeof(*stack));
+    int i, top = 0;
+    if (!loop->in_loop[latch]) {
+        loop->in_loop[latch] = 1;
+        loop->blocks[loop->count++] = latch;
+        stack[top++] = latch;
+    }
+    while (top > 0) {
+        struct cfg_edges *preds = &l->cfg->preds[stack[--top]];
+        for (i = 0; i < preds->count; i++) {
+            int pred = preds->blocks[i];
+            if (!loop->in_loop[pred] && (pred == 0 || l->cfg->idom[pred] != -1)) {
+                loop->in_loop[pred] = 1;
+                loop->blocks[loop->count++] = pred;
+                stack[top++] = pred;
+            }
+        }
+    }
+    jacc_free(stack);
+}
+
+static void find_preheader(struct loops *l, struct loop *loop)
+{
+    struct cfg_edges *preds = &l->cfg->preds[loop->header];
+    int i, outside = -1;
+    for (i = 0; i < preds->count; i++) {
+        if (loop->in_loop[preds->blocks[i]]) {
+            continue;
+        }
+        if (outside != -1) {
+            return;
+        }
+        outside = preds->blocks[i];
+    }
+    if (outside != -1 && ir_terminator(l->function->blocks[outside])->op == IR_JMP) {
+        loop->preheader = outside;
+    }
+}
+
+static int compare_loops(const void *a, const void *b)
+{
+    return ((const struct loop *)a)->count - ((const struct loop *)b)->count;
+}
+
+/*
+ * Back edges go to a block dominating their source, which comes earlier in
+ * reverse postorder. Inner loops come first, being smaller than the ones
+ * around them.
+ */
+static void find_loops(struct loops *l)
+{
+    int *order = jacc_malloc(l->function->blocks_count * sizeof(*order));
+    int i, j;
+    for (i = 0; i < l->cfg->rpo_count; i++) {
+        order[l->cfg->rpo[i]] = i;
+    }
+    for (i = 0; i < l->cfg->rpo_count; i++) {
+        int block = l->cfg->rpo[i];
+        struct cfg_edges *succs = &l->cfg->succs[block];
+        for (j = 0; j < succs->count; j++) {
+            int succ = succs->blocks[j];
+            if (order[succ] <= i && cfg_dominates(l->cfg, succ, block)) {
+                add_body(l, loop_of(l, succ), block);
+            }
+        }
+    }
+    jacc_free(order);
+    for (i = 0; i < l->count; i++) {
+        find_preheader(l, &l->loops[i]);
+    }
+    qsort(l->loops, l->count, sizeof(*l->loops), compare_loops);
+}
+
+static void note_escape(struct loops *l, struct ir_value value)
+{
+    if (value.kind == IRV_LOCAL) {
+        ptrmap_set(l->escaped, value.symbol, 1);
+    }
+}
+
+static void scan_function(struct loops *l)
+{
+    ir_function_t f = l->function;
+    int i, j, k;
+    l->defs = jacc_calloc(f->regs_count + 1, sizeof(*l->defs));
+    l->escaped = ptrmap_create();
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            struct ir_insn *insn = &block->insns[j];
+            l->defs[insn->dst]++;
+            if (insn->op != IR_LOAD && insn->op != IR_STORE) {
+                note_escape(l, insn->ops[0]);
+            }
+            note_escape(l, insn->ops[1]);
+            for (k = 0; k < insn->args_count; k++) {
+                note_escape(l, insn->args[k]);
+            }
+        }
+    }
+}
+
+static int is_direct(struct ir_value address)
+{
+    return address.kind == IRV_LOCAL || address.kind == IRV_GLOBAL;
+}
+
+/* variables that no pointer can reach */
+static int is_private(struct loops *l, struct ir_value address)
+{
+    return address.kind == IRV_LOCAL && ptrmap_get(l->escaped, address.symbol) == 0;
+}
+
+static int may_alias(struct loops *l, struct ir_value a, int a_size, struct ir_value b, int b_size)
+{
+    if (is_direct(a) && is_direct(b)) {
+        return a.kind == b.kind && a.symbol == b.symbol && a.value < b.value + b_size && b.value < a.value + a_size;
+    }
+    return !is_private(l, a) && !is_private(l, b);
+}
+
+struct store {
+    struct ir_value address;
+    int size;
+};
+
+struct hoist {
+    struct loops *l;
+    struct loop *loop;
+    /* definitions of each register inside the loop */
+    int *loop_defs;
+    struct store *stores;
+    int stores_count;
+    int has_call;
+    int *exits;
+    int exits_count;
+};
+
+static int is_invariant(struct hoist *h, struct ir_value value)
+{
+    return value.kind != IRV_REG || h->loop_defs[value.value] == 0;
+}
+
+static int is_pure(struct ir_insn *insn)
+{
+    switch (insn->op) {
+    case IR_DIV:
+    case IR_MOD:
+        /* dividing by zero or INT_MIN by -1 traps, whether the loop would have divided or not */
+        return insn->type == IRT_DOUBLE
+            || (insn->ops[1].kind == IRV_INT && insn->ops[1].value != 0 && insn->ops[1].value != -1);
+    case IR_LOAD:
+    case IR_STORE:
+    case IR_CALL:
+    case IR_PHI:
+        return 0;
+    }
+    return !ir_is_terminator(insn->op);
+}
+
+static int is_safe_load(struct hoist *h, int block, struct ir_insn *insn)
+{
+    int i;
+    if (!is_direct(insn->ops[0])) {
+        /* the loop reads through the pointer before leaving, so reading it once first cannot fault */
+        if (h->exits_count == 0) {
+            return 0;
+        }
+        for (i = 0; i < h->exits_count; i++) {
+            if (!cfg_dominates(h->l->cfg, block, h->exits[i])) {
+                return 0;
+            }
+        }
+    }
+    if (h->has_call && !is_private(h->l, insn->ops[0])) {
+        return 0;
+    }
+    for (i = 0; i < h->stores_count; i++) {
+        if (may_alias(h->l, insn->ops[0], insn->size, h->stores[i].address, h->stores[i].size)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int can_hoist(struct hoist *h, int block, struct ir_insn *insn)
+{
+    if (insn->dst == 0 || h->l->defs[insn->dst] != 1 || !is_invariant(h, insn->ops[0]) || !is_invariant(h, insn->ops[1])) {
+        return 0;
+    }
+    if (insn->op == IR_LOAD) {
+        return is_safe_load(h, block, insn);
+    }
+    return is_pure(insn);
+}
+
+static void insert_before_terminator(ir_function_t function, int block_id, struct ir_insn *insn)
+{
+    struct ir_block *block = function->blocks[block_id];
+    ir_insn_add(function, block_id, insn->op, insn->type);
+    block->insns[block->count - 1] = block->insns[block->count - 2];
+    block->insns[block->count - 2] = *insn;
+}
+
+static void summarize(struct hoist *h)
+{
+    ir_function_t f = h->l->function;
+    int i, j, k;
+    h->loop_defs = jacc_calloc(f->regs_count + 1, sizeof(*h->loop_defs));
+    h->stores = NULL;
+    h->stores_count = h->has_call = h->exits_count = 0;
+    h->exits = jacc_malloc(h->loop->count * sizeof(*h->exits));
+    for (i = 0; i < h->loop->count; i++) {
+        int id = h->loop->blocks[i];
+        struct ir_block *block = f->blocks[id];
+        struct cfg_edges *succs = &h->l->cfg->succs[id];
+        for (j = 0; j < block->count; j++) {
+            struct ir_insn *insn = &block->insns[j];
+            h->loop_defs[insn->dst]++;
+            if (insn->op == IR_STORE) {
+                h->stores = jacc_realloc(h->stores, (h->stores_count + 1) * sizeof(*h->stores));
+                h->stores[h->stores_count].address = insn->ops[0];
+                h->stores[h->stores_count++].size = insn->size;
+            }
+            h->has_call |= insn->op == IR_CALL;
+        }
+        for (k = 0; k < succs->count; k++) {
+            if (!h->loop->in_loop[succs->blocks[k]]) {
+                h->exits[h->exits_count++] = id;
+                break;
+            }
+        }
+    }
+}
+
+static void hoist_invariants(struct loops *l, struct loop *loop)
+{
+    ir_function_t f = l->function;
+    struct hoist h;
+    int i, j, changed = 1;
+
+    h.l = l;
+    h.loop = loop;
+    summarize(&h);
+    while (changed) {
+        changed = 0;
+        for (i = 0; i < loop->count; i++) {
+            struct ir_block *block = f->blocks[loop->blocks[i]];
+            for (j = 0; j < block->count; ) {
+                struct ir_insn insn = block->insns[j];
+                if (!can_hoist(&h, loop->blocks[i], &insn)) {
+                    j++;
+                    continue;
+                }
+                memmove(&block->insns[j], &block->insns[j + 1], (block->count - j - 1) * sizeof(*block->insns));
+                block->count--;
+                insert_before_terminator(f, loop->preheader, &insn);
+                h.loop_defs[insn.dst] = 0;
+                changed = 1;
+            }
+        }
+    }
+    jacc_free(h.loop_defs);
+    jacc_free(h.stores);
+    jacc_free(h.exits);
+}
+
+/* an address base + index * scale, the index being an int register */
+struct address {
+    int dst;
+    struct ir_value base;
+    int index;
+    int scale;
+    /* the scaled index is widened to pointer size before the add */
+    int widen;
+};
+
+struct insertion {
+    int block;
+    /* the instruction it goes after, -1 for the start of the block */
+    int after;
+    struct ir_insn insn;
+};
+
+struct reduce {
+    struct loops *l;
+    int regs_count;
+    /* block and position of the single definition of each register, -1 for none */
+    int *def_block;
+    int *def_index;
+    struct address *addresses;
+    int addresses_count;
+    /* whether an index steps by constants from a phi: 1 yes, 2 no */
+    char *induction;
+    /* pointers to base + register * scale of the family being reduced */
+    int *twins;
+    char *member;
+    int *members;
+    int members_count;
+    struct insertion *insertions;
+    int insertions_count;
+    int *replaced;
+};
+
+static struct ir_insn *def_of(struct reduce *r, int reg)
+{
+    if (reg > r->regs_count || r->def_index[reg] == -1) {
+        return NULL;
+    }
+    return &r->l->function->blocks[r->def_block[reg]]->insns[r->def_index[reg]];
+}
+
+static int is_step(struct ir_insn *insn)
+{
+    return (insn->op == IR_ADD || insn->op == IR_SUB) && insn->type == IRT_INT
+        && insn->ops[0].kind == IRV_REG && insn->ops[1].kind == IRV_INT;
+}
+
+static int step_of(struct ir_insn *insn)
+{
+    return insn->op == IR_ADD ? insn->ops[1].value : -insn->ops[1].value;
+}
+
+static int is_induction(struct reduce *r, int reg)
+{
+    struct ir_insn *insn = def_of(r, reg);
+    if (r->induction[reg] == 0) {
+        r->induction[reg] = 2;
+        while (insn != NULL && is_step(insn)) {
+            insn = def_of(r, insn->ops[0].value);
+        }
+        if (insn != NULL && insn->op == IR_PHI && insn->type == IRT_INT) {
+            r->induction[reg] = 1;
+        }
+    }
+    return r->induction[reg] == 1;
+}
+
+static int match_address(struct reduce *r, struct ir_insn *insn, struct address *address)
+{
+    struct ir_insn *def;
+    int index;
+    if (insn->op != IR_ADD || insn->type != IRT_PTR || insn->dst == 0 || insn->ops[1].kind != IRV_REG) {
+        return 0;
+    }
+    if (!is_direct(insn->ops[0]) && (insn->ops[0].kind != IRV_REG || def_of(r, insn->ops[0].value) == NULL)) {
+        return 0;
+    }
+    address->dst = insn->dst;
+    address->base = insn->ops[0];
+    address->widen = 0;
+    index = insn->ops[1].value;
+    def = def_of(r, index);
+    if (def != NULL && def->op == IR_I2P && def->ops[0].kind == IRV_REG) {
+        address->widen = 1;
+        index = def->ops[0].value;
+        def = def_of(r, index);
+    }
+    address->index = index;
+    address->scale = 1;
+    if (def != NULL && def->op == IR_MUL && def->type == IRT_INT && def->ops[0].kind == IRV_REG
+        && def->ops[1].kind == IRV_INT && def->ops[1].value > 0) {
+        address->index = def->ops[0].value;
+        address->scale = def->ops[1].value;
+    } else if (r->l->function->reg_types[index] != IRT_INT) {
+        return 0;
+    }
+    return def_of(r, address->index) != NULL;
+}
+
+static int same_value(struct ir_value a, struct ir_value b)
+{
+    return a.kind == b.kind && a.value == b.value && a.symbol == b.symbol;
+}
+
+static int same_family(struct address *a, struct address *b)
+{
+    return same_value(a->base, b->base) && a->scale == b->scale && a->widen == b->widen;
+}
+
+static void scan_addresses(struct reduce *r)
+{
+    ir_function_t f = r->l->function;
+    int i, j;
+    r->def_block = jacc_malloc((r->regs_count + 1) * sizeof(*r->def_block));
+    r->def_index = jacc_malloc((r->regs_count + 1) * sizeof(*r->def_index));
+    memset(r->def_index, -1, (r->regs_count + 1) * sizeof(*r->def_index));
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            int dst = block->insns[j].dst;
+            if (dst != 0 && r->l->defs[dst] == 1) {
+                r->def_block[dst] = i;
+                r->def_index[dst] = j;
+            }
+        }
+    }
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            struct address address;
+            if (match_address(r, &block->insns[j], &address)) {
+                r->addresses = jacc_realloc(r->addresses, (r->addresses_count + 1) * sizeof(*r->addresses));
+                r->addresses[r->addresses_count++] = address;
+            }
+        }
+    }
+}
+
+static int in_any_loop(struct loops *l, int block)
+{
+    int i;
+    for (i = 0; i < l->count; i++) {
+        if (l->loops[i].in_loop[block]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* whether the base can be computed at the end of the block */
+static int base_available(struct reduce *r, struct address *family, int block)
+{
+    return family->base.kind != IRV_REG || cfg_dominates(r->l->cfg, r->def_block[family->base.value], block);
+}
+
+static int is_seed(struct reduce *r, struct address *family, struct ir_value value)
+{
+    return value.kind == IRV_REG && def_of(r, value.value) != NULL
+        && r->l->function->reg_types[value.value] == IRT_INT
+        && base_available(r, family, r->def_block[value.value]);
+}
+
+/* the members stepping from phis together with the indexes of the family, 0 if one of them starts where the base is not known */
+static int collect_members(struct reduce *r, struct address *family)
+{
+    int i, k, has_phi = 0;
+    r->members_count = 0;
+    for (i = 0; i < r->addresses_count; i++) {
+        int index = r->addresses[i].index;
+        if (same_family(&r->addresses[i], family) && is_induction(r, index) && !r->member[index]) {
+            r->member[index] = 1;
+            r->members[r->members_count++] = index;
+        }
+    }
+    for (i = 0; i < r->members_count; i++) {
+        int reg = r->members[i];
+        struct ir_insn *insn = def_of(r, reg);
+        struct ir_value *inputs = insn->op == IR_PHI ? insn->args : insn->ops;
+        int count = insn->op == IR_PHI ? insn->args_count : 1;
+        has_phi |= insn->op == IR_PHI;
+        for (k = 0; k < count; k++) {
+            struct ir_value input = inputs[k];
+            if (input.kind == IRV_REG && is_induction(r, input.value)) {
+                if (!r->member[input.value]) {
+                    r->member[input.value] = 1;
+                    r->members[r->members_count++] = input.value;
+                }
+            } else if (input.kind == IRV_INT ? !base_available(r, family, insn->targets[k]) : !is_seed(r, family, input)) {
+                return 0;
+            }
+        }
+    }
+    return has_phi;
+}
+
+static struct ir_insn *insert(struct reduce *r, int block, int after, enum ir_opcode op, enum ir_type type)
+{
+    struct insertion *insertion;
+    r->insertions = jacc_realloc(r->insertions, (r->insertions_count + 1) * sizeof(*r->insertions));
+    insertion = &r->insertions[r->insertions_count++];
+    insertion->block = block;
+    insertion->after = after;
+    memset(&insertion->insn, 0, sizeof(insertion->insn));
+    insertion->insn.op = op;
+    insertion->insn.type = type;
+    return &insertion->insn;
+}
+
+static int insert_op(struct reduce *r, int block, enum ir_opcode op, enum ir_type type, struct ir_value a, struct ir_value b)
+{
+    struct ir_insn *insn = insert(r, block, r->l->function->blocks[block]->count - 2, op, type);
+    insn->dst = ir_reg_create(r->l->function, op == IR_I2P ? IRT_PTR : type);
+    insn->ops[0] = a;
+    insn->ops[1] = b;
+    return insn->dst;
+}
+
+/* base + value * scale at the end of the block */
+static struct ir_value scaled(struct reduce *r, struct address *family, struct ir_value value, int block)
+{
+    struct ir_value base = family->base;
+    if (value.kind == IRV_INT) {
+        if (is_direct(base) || value.value == 0) {
+            base.value += is_direct(base) ? value.value * family->scale : 0;
+            return base;
+        }
+        return ir_reg(insert_op(r, block, IR_ADD, IRT_PTR, base, ir_int(value.value * family->scale)));
+    }
+    if (family->scale != 1) {
+        value = ir_reg(insert_op(r, block, IR_MUL, IRT_INT, value, ir_int(family->scale)));
+    }
+    if (family->widen) {
+        value = ir_reg(insert_op(r, block, IR_I2P, IRT_INT, value, ir_none()));
+    }
+    return ir_reg(insert_op(r, block, IR_ADD, IRT_PTR, base, value));
+}
+
+/* registers defined outside the loop get their pointer once, where they are defined */
+static struct ir_value twin_of(struct reduce *r, struct address *family, struct ir_value value, int block)
+{
+    if (value.kind == IRV_REG) {
+        if (r->twins[value.value] == 0) {
+            r->twins[value.value] = scaled(r, family, value, r->def_block[value.value]).value;
+        }
+        return ir_reg(r->twins[value.value]);
+    }
+    return scaled(r, family, value, block);
+}
+
+static void add_twins(struct reduce *r, struct address *family)
+{
+    ir_function_t f = r->l->function;
+    int i, k;
+    for (i = 0; i < r->members_count; i++) {
+        r->twins[r->members[i]] = ir_reg_create(f, IRT_PTR);
+    }
+    for (i = 0; i < r->members_count; i++) {
+        int reg = r->members[i];
+        struct ir_insn *def = def_of(r, reg);
+        struct ir_insn *insn;
+        if (def->op == IR_PHI) {
+            struct ir_value *args = jacc_malloc(def->args_count * sizeof(*args));
+            for (k = 0; k < def->args_count; k++) {
+                args[k] = twin_of(r, family, def->args[k], def->targets[k]);
+            }
+            insn = insert(r, r->def_block[reg], -1, IR_PHI, IRT_PTR);
+            insn->args = args;
+            insn->args_count = def->args_count;
+            insn->targets = jacc_malloc(def->targets_count * sizeof(*insn->targets));
+            memcpy(insn->targets, def->targets, def->targets_count * sizeof(*insn->targets));
+            insn->targets_count = def->targets_count;
+        } else {
+            insn = insert(r, r->def_block[reg], r->def_index[reg], IR_ADD, IRT_PTR);
+            insn->ops[0] = ir_reg(r->twins[def->ops[0].value]);
+            insn->ops[1] = ir_int(step_of(def) * family->scale);
+        }
+        insn->dst = r->twins[reg];
+    }
+}
+
+/* tests of members inside loops compare pointers instead, leaving the index dead when nothing else reads it */
+static void replace_tests(struct reduce *r, struct address *family)
+{
+    static const enum ir_opcode mirrored[] = { IR_EQ, IR_NE, IR_GT, IR_GE, IR_LT, IR_LE };
+    struct loops *l = r->l;
+    int i, j, k;
+    for (i = 0; i < l->count; i++) {
+        struct loop *loop = &l->loops[i];
+        for (j = 0; j < loop->count; j++) {
+            struct ir_block *block = l->function->blocks[loop->blocks[j]];
+            for (k = 0; k < block->count; k++) {
+                struct ir_insn *insn = &block->insns[k];
+                struct ir_value a = insn->ops[0], b = insn->ops[1], bound;
+                enum ir_opcode op = insn->op;
+                if (op < IR_EQ || op > IR_GE || insn->type != IRT_INT) {
+                    continue;
+                }
+                if (a.kind != IRV_REG || !r->member[a.value]) {
+                    if (b.kind != IRV_REG || !r->member[b.value]) {
+                        continue;
+                    }
+                    a = insn->ops[1];
+                    b = insn->ops[0];
+                    op = mirrored[op - IR_EQ];
+                }
+                if (b.kind == IRV_REG && r->member[b.value]) {
+                    bound = ir_reg(r->twins[b.value]);
+                } else if (b.kind == IRV_INT && (is_direct(family->base)
+                    || (loop->preheader != -1 && base_available(r, family, loop->preheader)))) {
+                    bound = scaled(r, family, b, loop->preheader);
+                } else if (is_seed(r, family, b) && !loop->in_loop[r->def_block[b.value]]) {
+                    bound = twin_of(r, family, b, -1);
+                } else {
+                    continue;
+                }
+                insn->op = op;
+                insn->type = IRT_PTR;
+                insn->ops[0] = ir_reg(r->twins[a.value]);
+                insn->ops[1] = bound;
+            }
+        }
+    }
+}
+
+static int compare_insertions(const void *a, const void *b)
+{
+    const struct insertion *x = a, *y = b;
+    if (x->block != y->block) {
+        return x->block - y->block;
+    }
+    if (x->after != y->after) {
+        return x->after - y->after;
+    }
+    return x->insn.size - y->insn.size;
+}
+
+static void apply_insertions(struct reduce *r)
+{
+    ir_function_t f = r->l->function;
+    int i = 0, j, k;
+    /* qsort is not stable, size holds the order of insertion until the instructions are placed */
+    for (k = 0; k < r->insertions_count; k++) {
+        r->insertions[k].insn.size = k;
+    }
+    qsort(r->insertions, r->insertions_count, sizeof(*r->insertions), compare_insertions);
+    while (i < r->insertions_count) {
+        int id = r->insertions[i].block, count = 0, end = i;
+        struct ir_block *block = f->blocks[id];
+        struct ir_insn *insns;
+        while (end < r->insertions_count && r->insertions[end].block == id) {
+            end++;
+        }
+        insns = jacc_malloc((block->count + end - i) * sizeof(*insns));
+        for (j = -1; j < block->count; j++) {
+            if (j >= 0) {
+                insns[count++] = block->insns[j];
+            }
+            while (i < end && r->insertions[i].after == j) {
+                insns[count] = r->insertions[i++].insn;
+                insns[count++].size = 0;
+            }
+        }
+        jacc_free(block->insns);
+        block->insns = insns;
+        block->count = block->capacity = count;
+    }
+}
+
+static void replace_addresses(struct reduce *r)
+{
+    ir_function_t f = r->l->function;
+    int i, j, k;
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            struct ir_insn *insn = &block->insns[j];
+            for (k = 0; k < 2 + insn->args_count; k++) {
+                struct ir_value *value = k < 2 ? &insn->ops[k] : &insn->args[k - 2];
+                if (value->kind == IRV_REG && value->value <= r->regs_count && r->replaced[value->value] != 0) {
+                    *value = ir_reg(r->replaced[value->value]);
+                }
+            }
+        }
+    }
+}
+
+static int reduce_strength(struct loops *l)
+{
+    ir_function_t f = l->function;
+    struct reduce r;
+    int i, j, size;
+
+    memset(&r, 0, sizeof(r));
+    r.l = l;
+    r.regs_count = f->regs_count;
+    size = r.regs_count + 1;
+    r.induction = jacc_calloc(size, 1);
+    r.twins = jacc_calloc(size, sizeof(*r.twins));
+    r.member = jacc_calloc(size, 1);
+    r.members = jacc_malloc(size * sizeof(*r.members));
+    r.replaced = jacc_calloc(size, sizeof(*r.replaced));
+    scan_addresses(&r);
+    for (i = 0; i < r.addresses_count; i++) {
+        struct address *family = &r.addresses[i];
+        if (r.replaced[family->dst] != 0 || !is_induction(&r, family->index)
+            || !in_any_loop(l, r.def_block[family->dst])) {
+            continue;
+        }
+        if (collect_members(&r, family)) {
+            add_twins(&r, family);
+            for (j = 0; j < r.addresses_count; j++) {
+                if (same_family(&r.addresses[j], family) && r.member[r.addresses[j].index]) {
+                    r.replaced[r.addresses[j].dst] = r.twins[r.addresses[j].index];
+                }
+            }
+            replace_tests(&r, family);
+        }
+        memset(r.twins, 0, size * sizeof(*r.twins));
+        memset(r.member, 0, size);
+    }
+    apply_insertions(&r);
+    replace_addresses(&r);
+    jacc_free(r.def_block);
+    jacc_free(r.def_index);
+    jacc_free(r.addresses);
+    jacc_free(r.induction);
+    jacc_free(r.twins);
+    jacc_free(r.member);
+    jacc_free(r.members);
+    jacc_free(r.insertions);
+    jacc_free(r.replaced);
+    return r.insertions_count != 0;
+}
+
+static int has_effect(struct ir_insn *insn)
+{
+    return insn->dst == 0 || insn->op == IR_CALL;
+}
+
+static void mark_live(struct ir_insn *insn, char *live, int *stack, int *top)
+{
+    int k;
+    for (k = 0; k < 2 + insn->args_count; k++) {
+        struct ir_value value = k < 2 ? insn->ops[k] : insn->args[k - 2];
+        if (value.kind == IRV_REG && !live[value.value]) {
+            live[value.value] = 1;
+            stack[(*top)++] = value.value;
+        }
+    }
+}
+
+/* drops computations no store, call or terminator depends on, the counters left behind by strength reduction among them */
+static void remove_dead(ir_function_t f)
+{
+    int size = f->regs_count + 1;
+    char *live = jacc_calloc(size, 1);
+    int *stack = jacc_malloc(size * sizeof(*stack));
+    int *first = jacc_calloc(size + 1, sizeof(*first));
+    struct ir_insn **defs;
+    int i, j, k, top = 0, count = 0;
+
+    for (i = 0; i < f->blocks_count; i++) {
+        for (j = 0; j < f->blocks[i]->count; j++) {
+            first[f->blocks[i]->insns[j].dst + 1]++;
+            count++;
+        }
+    }
+    for (i = 0; i < size; i++) {
+        first[i + 1] += first[i];
+    }
+    defs = jacc_malloc(count * sizeof(*defs));
+    for (i = 0; i < f->blocks_count; i++) {
+        for (j = 0; j < f->blocks[i]->count; j++) {
+            struct ir_insn *insn = &f->blocks[i]->insns[j];
+            defs[first[insn->dst]++] = insn;
+            if (has_effect(insn)) {
+                mark_live(insn, live, stack, &top);
+            }
+        }
+    }
+    /* first now holds where the definitions of the next register start */
+    while (top > 0) {
+        int reg = stack[--top];
+        for (k = reg == 0 ? 0 : first[reg - 1]; k < first[reg]; k++) {
+            mark_live(defs[k], live, stack, &top);
+        }
+    }
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = k = 0; j < block->count; j++) {
+            if (has_effect(&block->insns[j]) || live[block->insns[j].dst]) {
+                block->insns[k++] = block->insns[j];
+            } else {
+                jacc_free(block->insns[j].args);
+                jacc_free(block->insns[j].targets);
+            }
+        }
+        block->count = k;
+    }
+    jacc_free(live);
+    jacc_free(stack);
+    jacc_free(first);
+    jacc_free(defs);
+}
+
+extern void loop_optimize(ir_function_t function)
+{
+    struct loops l;
+    int i;
+
+    memset(&l, 0, sizeof(l));
+    l.function = function;
+    l.cfg = cfg_build(function);
+    find_loops(&l);
+    if (l.count != 0) {
+        scan_function(&l);
+        for (i = 0; i < l.count; i++) {
+            if (l.loops[i].preheader != -1) {
+                hoist_invariants(&l, &l.loops[i]);
+            }
+        }
+        if (reduce_strength(&l)) {
+            remove_dead(function);
+        }
+        jacc_free(l.defs);
+        ptrmap_destroy(l.escaped);
+    }
+    for (i = 0; i < l.count; i++) {
+        jacc_free(l.loops[i].blocks);
+        jacc_free(l.loops[i].in_loop);
+    }
+    jacc_free(l.loops);
+    cfg_destroy(l.cfg);
+}
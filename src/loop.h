@@ -0,0 +1,25 @@
+#ifndef JACC_LOOP_H
+#define JACC_LOOP_H
+
+#include "ir.h"
+
+/*
+ * Loop optimizations on SSA form. Loops are the natural loops of the back
+ * edges of the control flow graph: the ones of while, for and do loops,
+ * and of tail calls turned into jumps. A loop is only changed when the
+ * block entering it ends with a jump to its header, as lowering always
+ * leaves it, so that this block can serve as the preheader.
+ *
+ * Computations and loads giving the same value on every iteration move to
+ * the preheader. Loads move only when no store or call in the loop may
+ * write what they read and when they cannot fault: they read a variable,
+ * or every way out of the loop goes through them.
+ *
+ * Addresses base + i * size of an index stepping by constants from a phi
+ * become pointers stepping by size * step alongside it, and tests of the
+ * index inside loops compare those pointers, so that the index goes away
+ * when nothing else reads it.
+ */
+extern void loop_optimize(ir_function_t function);
+
+#endif
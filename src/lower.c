@@ -0,0 +1,1386 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "parser.h"
+#include "folder.h"
+#include "ptrmap.h"
+#include "lower.h"
+
+static ir_function_t fn;
+static int cur_block;
+/* targets of break and continue, -1 when there is none */
+static int break_block, continue_block;
+/* case and default nodes to their block ids plus one */
+static ptrmap_t case_blocks;
+/* expression nodes to their labels plus one */
+static ptrmap_t labels;
+
+/* calls clobber the scratch registers, so anything live across one needs a saved one */
+#define CALL_NEED 16
+
+/* body sizes in nodes: any call to a small function, a function's total growth, static ones called once */
+#define INLINE_SIZE 40
+#define INLINE_GROWTH 400
+#define INLINE_SINGLE_SIZE 2000
+#define INLINE_DEPTH 8
+
+/* body sizes in nodes: loops unrolled by the factor, loops unrolled completely counting every copy */
+#define UNROLL_FACTOR 4
+#define UNROLL_SIZE 40
+#define UNROLL_FULL_SIZE 160
+
+/* a call being expanded in place, returns jump to join leaving the value in result */
+struct inline_frame {
+    struct symbol *function;
+    /* variables of the callee to their copies in the frame of fn */
+    ptrmap_t locals;
+    int result;
+    int join;
+    /* returned by fn right away, so that the returns of the callee are returns of fn */
+    int tail;
+    struct inline_frame *outer;
+};
+
+static struct inline_frame *inlined;
+static int inline_budget;
+/* functions to their body sizes plus one, NULL while inlining is off */
+static ptrmap_t body_sizes;
+static ptrmap_t single_calls;
+
+static int opt_level = 1;
+/* copies of the body of a counted loop, 1 while loops are not unrolled */
+static int unroll_factor = 1;
+/* the counter of a fully unrolled loop reads as its value in the copy being lowered */
+static struct symbol *unrolled_var;
+static int unrolled_value;
+/* variables whose address is taken in the functions lowered so far */
+static ptrmap_t addressed;
+static ptrmap_t addressed_scanned;
+/* whether calls of fn to itself in tail position become jumps to head, -1 until one does */
+static int self_tail_calls;
+static int tail_head;
+/* call statements ending a void function */
+static ptrmap_t tail_stmts;
+/* the call being returned, when fn returns it right away */
+static struct node *tail_expr;
+
+static struct ir_value lower_expr(struct node *expr);
+static void lower_cond(struct node *expr, int true_block, int false_block);
+static void lower_stmt(struct node *stmt);
+
+static int combine_labels(int left, int right)
+{
+    int need = left >> 1 == right >> 1 ? (left >> 1) + 1 : (left > right ? left : right) >> 1;
+    return need << 1 | ((left | right) & 1);
+}
+
+/*
+ * Sethi-Ullman label of an expression: the registers needed to evaluate it
+ * without spilling, shifted left once, with the low bit set if it has side
+ * effects.
+ */
+static int label_of(struct node *expr)
+{
+    uintptr_t memo;
+    int result = 0;
+
+    if (expr == NULL) {
+        return 0;
+    }
+    memo = ptrmap_get(labels, expr);
+    if (memo != 0) {
+        return memo - 1;
+    }
+    switch (expr->type) {
+    case NT_INT:
+    case NT_DOUBLE:
+    case NT_STRING:
+    case NT_NOP:
+        break;
+    case NT_VARIABLE:
+        result = 1 << 1;
+        break;
+    case NT_CALL:
+        result = CALL_NEED << 1 | 1;
+        break;
+    case NT_MEMBER:
+    case NT_CAST:
+        result = combine_labels(label_of(expr->ops[0]), 0);
+        break;
+    case NT_PREFIX_INC:
+    case NT_PREFIX_DEC:
+    case NT_POSTFIX_INC:
+    case NT_POSTFIX_DEC:
+        result = combine_labels(label_of(expr->ops[0]), 0) | 1;
+        break;
+    case NT_TERNARY:
+        result = combine_labels(label_of(expr->ops[0]), combine_labels(label_of(expr->ops[1]), label_of(expr->ops[2])));
+        break;
+    case NT_ASSIGN:
+        result = combine_labels(label_of(expr->ops[0]), label_of(expr->ops[1])) | 1;
+        break;
+    default:
+        switch (parser_node_info(expr)->cat) {
+        case NC_UNARY:
+            result = combine_labels(label_of(expr->ops[0]), 0);
+            break;
+        case NC_BINARY:
+            result = combine_labels(label_of(expr->ops[0]), label_of(expr->ops[1]));
+            break;
+        default:
+            result = CALL_NEED << 1 | 1;
+        }
+    }
+    ptrmap_set(labels, expr, result + 1);
+    return result;
+}
+
+/* operands free of side effects may go in any order, the hungrier one first frees its registers sooner */
+static int right_first(struct node *expr)
+{
+    int left = label_of(expr->ops[0]), right = label_of(expr->ops[1]);
+    return ((left | right) & 1) == 0 && right > left;
+}
+
+static void lower_operands(struct node *expr, struct ir_value *a, struct ir_value *b)
+{
+    if (right_first(expr)) {
+        *b = lower_expr(expr->ops[1]);
+        *a = lower_expr(expr->ops[0]);
+    } else {
+        *a = lower_expr(expr->ops[0]);
+        *b = lower_expr(expr->ops[1]);
+    }
+}
+
+static enum ir_type type_of(struct symbol *type)
+{
+    type = resolve_alias(type);
+    if (type == &sym_double) {
+        return IRT_DOUBLE;
+    } else if (parser_is_void_symbol(type)) {
+        return IRT_VOID;
+    } else if (is_ptr_type(type)) {
+        return IRT_PTR;
+    }
+    return IRT_INT;
+}
+
+static int size_of(struct symbol *type)
+{
+    type = resolve_alias(type);
+    if (type == &sym_char) {
+        return 1;
+    } else if (type == &sym_double) {
+        return 8;
+    } else if (is_ptr_type(type)) {
+        return parser_pointer_size_get();
+    }
+    return 4;
+}
+
+static struct ir_insn *add(enum ir_opcode op, enum ir_type type)
+{
+    return ir_insn_add(fn, cur_block, op, type);
+}
+
+static void start_block(int block)
+{
+    cur_block = block;
+}
+
+static void jump(int target)
+{
+    ir_insn_set_targets(add(IR_JMP, IRT_VOID), 1, target);
+}
+
+static void branch(struct ir_value value, int true_block, int false_block)
+{
+    if (value.kind == IRV_INT) {
+        jump(value.value != 0 ? true_block : false_block);
+        return;
+    }
+    struct ir_insn *insn = add(IR_BR, IRT_INT);
+    insn->ops[0] = value;
+    ir_insn_set_targets(insn, 2, true_block, false_block);
+}
+
+static struct ir_value emit_op(enum ir_opcode op, enum ir_type type, enum ir_type result, struct ir_value a, struct ir_value b)
+{
+    int dst = ir_reg_create(fn, result);
+    struct ir_insn *insn = add(op, type);
+    insn->dst = dst;
+    insn->ops[0] = a;
+    insn->ops[1] = b;
+    return ir_reg(dst);
+}
+
+static void emit_mov(int dst, struct ir_value value)
+{
+    struct ir_insn *insn = add(IR_MOV, fn->reg_types[dst]);
+    insn->dst = dst;
+    insn->ops[0] = value;
+}
+
+static struct ir_value load(struct symbol *type, struct ir_value address)
+{
+    struct symbol *resolved = resolve_alias(type);
+    if (resolved->type == ST_ARRAY) {
+        return address;
+    }
+    int dst = ir_reg_create(fn, type_of(resolved));
+    struct ir_insn *insn = add(IR_LOAD, type_of(resolved));
+    insn->size = size_of(resolved);
+    insn->dst = dst;
+    insn->ops[0] = address;
+    return ir_reg(dst);
+}
+
+static struct ir_value to_pointer(struct ir_value value);
+
+static void store(struct symbol *type, struct ir_value address, struct ir_value value)
+{
+    if (type_of(type) == IRT_PTR) {
+        value = to_pointer(value);
+    }
+    struct ir_insn *insn = add(IR_STORE, type_of(type));
+    insn->size = size_of(type);
+    insn->ops[0] = address;
+    insn->ops[1] = value;
+}
+
+static struct ir_value offset_address(struct ir_value address, int offset)
+{
+    if (offset == 0) {
+        return address;
+    }
+    if (address.kind == IRV_LOCAL || address.kind == IRV_GLOBAL || address.kind == IRV_INT) {
+        address.value += offset;
+        return address;
+    }
+    return emit_op(IR_ADD, IRT_PTR, IRT_PTR, address, ir_int(offset));
+}
+
+static struct ir_value scale(struct ir_value index, int size)
+{
+    if (index.kind == IRV_INT) {
+        return ir_int(index.value * size);
+    } else if (size == 1) {
+        return index;
+    }
+    return emit_op(IR_MUL, IRT_INT, IRT_INT, index, ir_int(size));
+}
+
+/* ints become pointers by sign extension where pointers are wider */
+static struct ir_value to_pointer(struct ir_value value)
+{
+    if (value.kind != IRV_REG || fn->reg_types[value.value] != IRT_INT || parser_pointer_size_get() == sym_int.size) {
+        return value;
+    }
+    return emit_op(IR_I2P, IRT_INT, IRT_PTR, value, ir_none());
+}
+
+static struct ir_value to_int(struct ir_value value)
+{
+    if (ir_value_type(fn, value) != IRT_PTR || parser_pointer_size_get() == sym_int.size) {
+        return value;
+    }
+    return emit_op(IR_P2I, IRT_PTR, IRT_INT, value, ir_none());
+}
+
+static struct ir_value truncate_char(struct ir_value value)
+{
+    if (value.kind == IRV_INT) {
+        return ir_int((signed char)value.value);
+    }
+    value = emit_op(IR_SHL, IRT_INT, IRT_INT, value, ir_int(24));
+    return emit_op(IR_SAR, IRT_INT, IRT_INT, value, ir_int(24));
+}
+
+static struct ir_value convert(struct ir_value value, struct symbol *from, struct symbol *to)
+{
+    enum ir_type from_type = type_of(from), to_type = type_of(to);
+    if (from_type == IRT_INT && to_type == IRT_DOUBLE) {
+        if (value.kind == IRV_INT) {
+            return ir_double(value.value);
+        }
+        return emit_op(IR_I2D, IRT_INT, IRT_DOUBLE, value, ir_none());
+    } else if (from_type == IRT_DOUBLE && to_type == IRT_INT) {
+        value = emit_op(IR_D2I, IRT_DOUBLE, IRT_INT, value, ir_none());
+    } else if (from_type == IRT_PTR && to_type == IRT_INT) {
+        value = to_int(value);
+    } else if (from_type == IRT_INT && to_type == IRT_PTR) {
+        return to_pointer(value);
+    }
+    if (resolve_alias(to) == &sym_char && resolve_alias(from) != &sym_char) {
+        value = truncate_char(value);
+    }
+    return value;
+}
+
+/* the copy in the frame of fn of a variable of an inlined callee */
+static struct symbol *local_symbol(struct symbol *symbol)
+{
+    struct symbol *local;
+    if (inlined == NULL) {
+        return symbol;
+    }
+    local = (struct symbol *)ptrmap_get(inlined->locals, symbol);
+    if (local == NULL) {
+        local = ir_local_create(fn, symbol);
+        ptrmap_set(inlined->locals, symbol, (uintptr_t)local);
+    }
+    return local;
+}
+
+static struct ir_value lower_address(struct node *expr)
+{
+    switch (expr->type) {
+    case NT_VARIABLE:
+    {
+        struct symbol *symbol = ((struct var_node*)expr)->symbol;
+        if (symbol->type == ST_GLOBAL_VARIABLE || symbol->type == ST_FUNCTION) {
+            return ir_global(symbol, 0);
+        }
+        return ir_local(local_symbol(symbol), 0);
+    }
+    case NT_DEREFERENCE:
+        return lower_expr(expr->ops[0]);
+    case NT_MEMBER:
+        return offset_address(lower_address(expr->ops[0]), expr->ops[1]->type_sym->offset);
+    }
+    return ir_int(0);
+}
+
+static struct ir_value lower_bool(struct node *expr)
+{
+    int result = ir_reg_create(fn, IRT_INT);
+    int true_block = ir_block_create(fn), false_block = ir_block_create(fn), join = ir_block_create(fn);
+    lower_cond(expr, true_block, false_block);
+    start_block(true_block);
+    emit_mov(result, ir_int(1));
+    jump(join);
+    start_block(false_block);
+    emit_mov(result, ir_int(0));
+    jump(join);
+    start_block(join);
+    return ir_reg(result);
+}
+
+static struct ir_value lower_ternary(struct node *expr)
+{
+    enum ir_type type = type_of(expr->type_sym);
+    int result = type == IRT_VOID ? 0 : ir_reg_create(fn, type);
+    int true_block = ir_block_create(fn), false_block = ir_block_create(fn), join = ir_block_create(fn);
+    struct ir_value value;
+
+    lower_cond(expr->ops[0], true_block, false_block);
+    start_block(true_block);
+    value = lower_expr(expr->ops[1]);
+    if (result != 0) {
+        emit_mov(result, value);
+    }
+    jump(join);
+    start_block(false_block);
+    value = lower_expr(expr->ops[2]);
+    if (result != 0) {
+        emit_mov(result, value);
+    }
+    jump(join);
+    start_block(join);
+    return result != 0 ? ir_reg(result) : ir_none();
+}
+
+/* the function a call expands to in place, NULL to really call it */
+static struct symbol *inline_callee(struct node *expr)
+{
+    struct symbol *function;
+    struct inline_frame *frame;
+    int size, depth = 0;
+
+    if (body_sizes == NULL || expr->ops[0]->type != NT_VARIABLE) {
+        return NULL;
+    }
+    function = ((struct var_node*)expr->ops[0])->symbol;
+    if (ptrmap_get(single_calls, function) != 0) {
+        return function;
+    }
+    size = (int)ptrmap_get(body_sizes, function) - 1;
+    if (size < 0 || size > INLINE_SIZE || size > inline_budget || function == fn->symbol) {
+        return NULL;
+    }
+    for (frame = inlined; frame != NULL; frame = frame->outer, depth++) {
+        if (frame->function == function || depth == INLINE_DEPTH) {
+            return NULL;
+        }
+    }
+    inline_budget -= size;
+    return function;
+}
+
+/* the parameters become locals of the caller holding the arguments */
+static struct ir_value lower_inlined(struct symbol *function, struct ir_value *args, int tail)
+{
+    struct inline_frame frame;
+    enum ir_type type = type_of(function->base_type);
+    int i, saved_break = break_block, saved_continue = continue_block;
+    struct symbol *saved_unrolled = unrolled_var;
+    symtable_iter_t iter = symtable_first(function->ext->params);
+
+    frame.function = function;
+    frame.locals = ptrmap_create();
+    frame.result = type == IRT_VOID ? 0 : ir_reg_create(fn, type);
+    frame.join = ir_block_create(fn);
+    frame.tail = tail && resolve_alias(function->base_type) == resolve_alias(fn->symbol->base_type);
+    frame.outer = inlined;
+    for (i = 0; iter != NULL; iter = symtable_iter_next(iter), i++) {
+        struct symbol *param = symtable_iter_value(iter);
+        struct symbol *local = ir_local_create(fn, param);
+        ptrmap_set(frame.locals, param, (uintptr_t)local);
+        store(param->base_type, ir_local(local, 0), args[i]);
+    }
+
+    inlined = &frame;
+    break_block = continue_block = -1;
+    unrolled_var = NULL;
+    lower_stmt(function->ext->body);
+    jump(frame.join);
+    start_block(frame.join);
+    inlined = frame.outer;
+    break_block = saved_break;
+    continue_block = saved_continue;
+    unrolled_var = saved_unrolled;
+
+    ptrmap_destroy(frame.locals);
+    return frame.result != 0 ? ir_reg(frame.result) : ir_none();
+}
+
+static struct ir_value lower_call(struct node *expr)
+{
+    struct list_node *list = (struct list_node*)expr->ops[1];
+    struct ir_value *args = jacc_malloc((list->size + 1) * sizeof(*args));
+    enum ir_type type = type_of(expr->type_sym);
+    struct symbol *function = inline_callee(expr);
+    int i, tail = expr == tail_expr;
+
+    for (i = list->size - 1; i >= 0; i--) {
+        args[i] = lower_expr(list->items[i]);
+    }
+    if (function != NULL) {
+        struct ir_value result = lower_inlined(function, args, tail);
+        jacc_free(args);
+        return result;
+    }
+    struct ir_value callee = lower_expr(expr->ops[0]);
+    int dst = type == IRT_VOID ? 0 : ir_reg_create(fn, type);
+    struct ir_insn *insn = add(IR_CALL, type);
+    insn->dst = dst;
+    insn->ops[0] = callee;
+    insn->args = args;
+    insn->args_count = list->size;
+    return dst != 0 ? ir_reg(dst) : ir_none();
+}
+
+/* calls made before the definition refer to a declaration of the same name */
+static int is_self_call(struct node *expr)
+{
+    struct symbol *callee;
+    if (!self_tail_calls || expr == NULL || expr->type != NT_CALL || expr->ops[0]->type != NT_VARIABLE) {
+        return 0;
+    }
+    callee = ((struct var_node*)expr->ops[0])->symbol;
+    return callee == fn->symbol || (callee->type == ST_FUNCTION && strcmp(callee->name, fn->symbol->name) == 0);
+}
+
+/* the arguments replace the parameters and the body starts over */
+static void lower_self_tail_call(struct node *expr)
+{
+    struct list_node *list = (struct list_node*)expr->ops[1];
+    struct ir_value *args = jacc_malloc((list->size + 1) * sizeof(*args));
+    symtable_iter_t iter = symtable_first(fn->symbol->ext->params);
+    int i;
+
+    for (i = list->size - 1; i >= 0; i--) {
+        args[i] = lower_expr(list->items[i]);
+    }
+    for (i = 0; iter != NULL; iter = symtable_iter_next(iter), i++) {
+        struct symbol *param = symtable_iter_value(iter);
+        store(param->base_type, ir_local(param, 0), args[i]);
+    }
+    if (tail_head == -1) {
+        tail_head = ir_block_create(fn);
+    }
+    jump(tail_head);
+    start_block(ir_block_create(fn));
+    jacc_free(args);
+}
+
+static struct ir_value lower_inc(struct node *expr)
+{
+    struct symbol *type = expr->ops[0]->type_sym;
+    enum ir_type ir_type = type_of(type);
+    struct ir_value address = lower_address(expr->ops[0]);
+    struct ir_value old = load(type, address), new;
+    enum ir_opcode op = expr->type == NT_PREFIX_INC || expr->type == NT_POSTFIX_INC ? IR_ADD : IR_SUB;
+
+    if (ir_type == IRT_DOUBLE) {
+        new = emit_op(op, ir_type, ir_type, old, ir_double(1));
+    } else {
+        new = emit_op(op, ir_type, ir_type, old, ir_int(ir_type == IRT_PTR ? resolve_alias(type)->base_type->size : 1));
+    }
+    if (size_of(type) == 1) {
+        new = truncate_char(new);
+    }
+    store(type, address, new);
+    return expr->type == NT_PREFIX_INC || expr->type == NT_PREFIX_DEC ? new : old;
+}
+
+static enum ir_opcode binary_opcode(enum node_type type)
+{
+    switch (type) {
+    case NT_ADD: return IR_ADD;
+    case NT_SUB: return IR_SUB;
+    case NT_MUL: return IR_MUL;
+    case NT_DIV: return IR_DIV;
+    case NT_MOD: return IR_MOD;
+    case NT_BIT_AND: return IR_AND;
+    case NT_BIT_OR: return IR_OR;
+    case NT_BIT_XOR: return IR_XOR;
+    case NT_LSHIFT: return IR_SHL;
+    case NT_RSHIFT: return IR_SAR;
+    case NT_EQ: return IR_EQ;
+    case NT_NE: return IR_NE;
+    case NT_LT: return IR_LT;
+    case NT_LE: return IR_LE;
+    case NT_GT: return IR_GT;
+    case NT_GE: return IR_GE;
+    }
+    return IR_MOV;
+}
+
+/* the operation with its operands exchanged, IR_MOV when there is none */
+static enum ir_opcode swapped_opcode(enum ir_opcode op)
+{
+    switch (op) {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+    case IR_EQ:
+    case IR_NE:
+        return op;
+    case IR_LT: return IR_GT;
+    case IR_LE: return IR_GE;
+    case IR_GT: return IR_LT;
+    case IR_GE: return IR_LE;
+    }
+    return IR_MOV;
+}
+
+static struct ir_value lower_binary(struct node *expr)
+{
+    struct symbol *t0 = resolve_alias(expr->ops[0]->type_sym), *t1 = resolve_alias(expr->ops[1]->type_sym);
+    struct ir_value a, b;
+
+    switch (expr->type) {
+    case NT_COMMA:
+        lower_expr(expr->ops[0]);
+        return lower_expr(expr->ops[1]);
+    case NT_AND:
+    case NT_OR:
+        return lower_bool(expr);
+    case NT_ASSIGN:
+        if (right_first(expr)) {
+            b = lower_expr(expr->ops[1]);
+            a = lower_address(expr->ops[0]);
+        } else {
+            a = lower_address(expr->ops[0]);
+            b = lower_expr(expr->ops[1]);
+        }
+        store(expr->ops[0]->type_sym, a, b);
+        return b;
+    case NT_ADD:
+    case NT_SUB:
+        if (is_ptr_type(t0) && is_ptr_type(t1)) {
+            lower_operands(expr, &a, &b);
+            a = to_int(emit_op(IR_SUB, IRT_PTR, IRT_PTR, a, b));
+            if (t0->base_type->size > 1) {
+                a = emit_op(IR_DIV, IRT_INT, IRT_INT, a, ir_int(t0->base_type->size));
+            }
+            return a;
+        } else if (is_ptr_type(t0)) {
+            lower_operands(expr, &a, &b);
+            b = scale(b, t0->base_type->size);
+            if (b.kind == IRV_INT) {
+                return offset_address(a, expr->type == NT_ADD ? b.value : -b.value);
+            }
+            return emit_op(binary_opcode(expr->type), IRT_PTR, IRT_PTR, a, to_pointer(b));
+        }
+        break;
+    }
+
+    enum ir_opcode op = binary_opcode(expr->type);
+    if (op == IR_MOV) {
+        return ir_none();
+    }
+    lower_operands(expr, &a, &b);
+    if (a.kind == IRV_INT && b.kind != IRV_INT && swapped_opcode(op) != IR_MOV) {
+        struct ir_value constant = a;
+        a = b;
+        b = constant;
+        op = swapped_opcode(op);
+    }
+    /* constants the tree did not have, like the counter of a fully unrolled loop */
+    if (opt_level > 0 && type_of(t0) == IRT_INT && b.kind == IRV_INT) {
+        int value;
+        if (a.kind == IRV_INT && folder_fold_int(expr->type, a.value, b.value, &value)) {
+            return ir_int(value);
+        } else if ((op == IR_MUL && b.value == 1) || ((op == IR_ADD || op == IR_SUB) && b.value == 0)) {
+            return a;
+        } else if (op == IR_MUL && b.value == 0) {
+            return b;
+        }
+    }
+    return emit_op(op, type_of(t0), type_of(expr->type_sym), a, b);
+}
+
+static struct ir_value lower_expr(struct node *expr)
+{
+    if (expr == NULL) {
+        return ir_none();
+    }
+
+    switch (expr->type) {
+    case NT_NOP:
+        return ir_none();
+    case NT_INT:
+        return ir_int(((struct int_node*)expr)->value);
+    case NT_DOUBLE:
+        return ir_double(((struct double_node*)expr)->value);
+    case NT_STRING:
+        return ir_string(((struct string_node*)expr)->value);
+    case NT_VARIABLE:
+    {
+        struct symbol *symbol = ((struct var_node*)expr)->symbol;
+        if (symbol->type == ST_ENUM_CONST) {
+            return ir_int(((struct int_node*)symbol->expr)->value);
+        } else if (symbol == unrolled_var) {
+            return ir_int(unrolled_value);
+        } else if (symbol->type == ST_FUNCTION) {
+            return ir_global(symbol, 0);
+        }
+        return load(expr->type_sym, lower_address(expr));
+    }
+    case NT_REFERENCE:
+        return lower_address(expr->ops[0]);
+    case NT_DEREFERENCE:
+    case NT_MEMBER:
+        return load(expr->type_sym, lower_address(expr));
+    case NT_CALL:
+        return lower_call(expr);
+    case NT_TERNARY:
+        return lower_ternary(expr);
+    case NT_CAST:
+        return convert(lower_expr(expr->ops[0]), expr->ops[0]->type_sym, expr->type_sym);
+    case NT_IDENTITY:
+        return lower_expr(expr->ops[0]);
+    case NT_NEGATION:
+    case NT_COMPLEMENT:
+    {
+        enum ir_type type = type_of(expr->ops[0]->type_sym);
+        return emit_op(expr->type == NT_NEGATION ? IR_NEG : IR_NOT, type, type, lower_expr(expr->ops[0]), ir_none());
+    }
+    case NT_LOGICAL_NEGATION:
+        return lower_bool(expr);
+    case NT_PREFIX_INC:
+    case NT_PREFIX_DEC:
+    case NT_POSTFIX_INC:
+    case NT_POSTFIX_DEC:
+        return lower_inc(expr);
+    }
+
+    if (parser_node_info(expr)->cat == NC_BINARY) {
+        return lower_binary(expr);
+    } else if (parser_node_info(expr)->cat == NC_STATEMENT) {
+        lower_stmt(expr);
+    }
+    return ir_none();
+}
+
+static void lower_cond(struct node *expr, int true_block, int false_block)
+{
+    switch (expr->type) {
+    case NT_AND:
+    case NT_OR:
+    {
+        int next = ir_block_create(fn);
+        if (expr->type == NT_AND) {
+            lower_cond(expr->ops[0], next, false_block);
+        } else {
+            lower_cond(expr->ops[0], true_block, next);
+        }
+        start_block(next);
+        lower_cond(expr->ops[1], true_block, false_block);
+        return;
+    }
+    case NT_LOGICAL_NEGATION:
+        lower_cond(expr->ops[0], false_block, true_block);
+        return;
+    }
+
+    struct ir_value value = lower_expr(expr);
+    if (ir_value_type(fn, value) == IRT_DOUBLE) {
+        value = emit_op(IR_NE, IRT_DOUBLE, IRT_INT, value, ir_double(0));
+    }
+    branch(value, true_block, false_block);
+}
+
+struct case_list {
+    int *values;
+    int *blocks;
+    int count;
+    int capacity;
+    int default_block;
+};
+
+/* labels of a switch body, nested switches own their cases */
+static void collect_cases(struct node *node, struct case_list *cases)
+{
+    int i;
+    if (node == NULL || node->type == NT_SWITCH || parser_node_info(node)->cat != NC_STATEMENT) {
+        return;
+    }
+
+    if (node->type == NT_CASE) {
+        int block = ir_block_create(fn);
+        ptrmap_set(case_blocks, node, block + 1);
+        folder_fold(&node->ops[0]);
+        if (node->ops[0]->type == NT_INT) {
+            if (cases->count == cases->capacity) {
+                cases->capacity = cases->capacity == 0 ? 16 : cases->capacity * 2;
+                cases->values = jacc_realloc(cases->values, cases->capacity * sizeof(*cases->values));
+                cases->blocks = jacc_realloc(cases->blocks, cases->capacity * sizeof(*cases->blocks));
+            }
+            cases->values[cases->count] = ((struct int_node*)node->ops[0])->value;
+            cases->blocks[cases->count] = block;
+            cases->count++;
+        }
+    } else if (node->type == NT_DEFAULT) {
+        cases->default_block = ir_block_create(fn);
+        ptrmap_set(case_blocks, node, cases->default_block + 1);
+    }
+
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
+        collect_cases(parser_get_subnode(node, i), cases);
+    }
+}
+
+static void lower_switch(struct node *stmt)
+{
+    struct case_list cases;
+    int i, exit = ir_block_create(fn), saved_break = break_block;
+
+    memset(&cases, 0, sizeof(cases));
+    cases.default_block = -1;
+    collect_cases(stmt->ops[1], &cases);
+
+    struct ir_value value = lower_expr(stmt->ops[0]);
+    struct ir_insn *insn = add(IR_SWITCH, IRT_INT);
+    insn->ops[0] = value;
+    insn->targets = jacc_malloc((cases.count + 1) * sizeof(*insn->targets));
+    insn->targets_count = cases.count + 1;
+    insn->targets[0] = cases.default_block != -1 ? cases.default_block : exit;
+    for (i = 0; i < cases.count; i++) {
+        ir_insn_add_arg(insn, ir_int(cases.values[i]));
+        insn->targets[i + 1] = cases.blocks[i];
+    }
+
+    start_block(ir_block_create(fn));
+    break_block = exit;
+    lower_stmt(stmt->ops[1]);
+    break_block = saved_break;
+    jump(exit);
+    start_block(exit);
+
+    jacc_free(cases.values);
+    jacc_free(cases.blocks);
+}
+
+static void lower_loop_body(struct node *body, int exit, int next)
+{
+    int saved_break = break_block, saved_continue = continue_block;
+    break_block = exit;
+    continue_block = next;
+    lower_stmt(body);
+    break_block = saved_break;
+    continue_block = saved_continue;
+}
+
+static void find_addressed(struct node *node)
+{
+    int i;
+    if (node == NULL) {
+        return;
+    }
+    if (node->type == NT_REFERENCE && node->ops[0]->type == NT_VARIABLE) {
+        ptrmap_set(addressed, ((struct var_node*)node->ops[0])->symbol, 1);
+    }
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
+        find_addressed(parser_get_subnode(node, i));
+    }
+}
+
+/* int variables of the function being lowered that nothing but their name reaches */
+static struct symbol *counted_var(struct node *node)
+{
+    struct symbol *function = inlined != NULL ? inlined->function : fn->symbol, *symbol;
+    if (node->type != NT_VARIABLE) {
+        return NULL;
+    }
+    if (ptrmap_get(addressed_scanned, function) == 0) {
+        ptrmap_set(addressed_scanned, function, 1);
+        find_addressed(function->ext->body);
+    }
+    symbol = ((struct var_node*)node)->symbol;
+    if ((symbol->type != ST_VARIABLE && symbol->type != ST_PARAMETER)
+        || resolve_alias(node->type_sym) != &sym_int || ptrmap_get(addressed, symbol) != 0) {
+        return NULL;
+    }
+    return symbol;
+}
+
+/* nodes of a loop body, over limit when copying it would break labels or cases or it assigns the counter or the bound */
+static int unroll_size(struct node *node, struct symbol *counter, struct symbol *bound, int limit)
+{
+    int i, size = 1;
+    if (node == NULL) {
+        return 0;
+    }
+    switch (node->type) {
+    case NT_WHILE:
+    case NT_DO_WHILE:
+    case NT_FOR:
+    case NT_SWITCH:
+    case NT_CASE:
+    case NT_DEFAULT:
+    case NT_LABEL:
+    case NT_GOTO:
+        return limit + 1;
+    case NT_ASSIGN:
+    case NT_ADD_ASSIGN:
+    case NT_SUB_ASSIGN:
+    case NT_MUL_ASSIGN:
+    case NT_DIV_ASSIGN:
+    case NT_MOD_ASSIGN:
+    case NT_LSHIFT_ASSIGN:
+    case NT_RSHIFT_ASSIGN:
+    case NT_OR_ASSIGN:
+    case NT_AND_ASSIGN:
+    case NT_XOR_ASSIGN:
+    case NT_PREFIX_INC:
+    case NT_PREFIX_DEC:
+    case NT_POSTFIX_INC:
+    case NT_POSTFIX_DEC:
+        if (node->ops[0]->type == NT_VARIABLE) {
+            struct symbol *symbol = ((struct var_node*)node->ops[0])->symbol;
+            if (symbol == counter || symbol == bound) {
+                return limit + 1;
+            }
+        }
+        break;
+    case NT_CALL:
+        /* every copy may expand the callee in place */
+        if (body_sizes != NULL && node->ops[0]->type == NT_VARIABLE) {
+            size += (int)ptrmap_get(body_sizes, ((struct var_node*)node->ops[0])->symbol);
+        }
+        break;
+    }
+    for (i = 0; i < parser_node_subnodes_count(node) && size <= limit; i++) {
+        size += unroll_size(parser_get_subnode(node, i), counter, bound, limit - size);
+    }
+    return size;
+}
+
+/* the constant a counter steps by, 0 for other steps; i += c arrives as i = i + c */
+static int counter_step(struct node *step, struct symbol *counter)
+{
+    struct node *value;
+    int sign = 1;
+    switch (step->type) {
+    case NT_PREFIX_DEC:
+    case NT_POSTFIX_DEC:
+        sign = -1;
+        /* fall through */
+    case NT_PREFIX_INC:
+    case NT_POSTFIX_INC:
+        return counted_var(step->ops[0]) == counter ? sign : 0;
+    case NT_ASSIGN:
+        value = step->ops[1];
+        if (counted_var(step->ops[0]) != counter || (value->type != NT_ADD && value->type != NT_SUB)
+            || counted_var(value->ops[0]) != counter || value->ops[1]->type != NT_INT) {
+            return 0;
+        }
+        sign = value->type == NT_ADD ? 1 : -1;
+        if (((struct int_node*)value->ops[1])->value > 0 && ((struct int_node*)value->ops[1])->value <= 0xffff) {
+            return sign * ((struct int_node*)value->ops[1])->value;
+        }
+    }
+    return 0;
+}
+
+/* for (...; i < n; i += step) and the like, with n constant or a variable the body leaves alone */
+struct counted_loop {
+    struct node *counter;
+    struct node *bound;
+    int step;
+    int size;
+};
+
+static int find_counted_loop(struct node *stmt, struct counted_loop *loop)
+{
+    struct node *cond = stmt->ops[1];
+    struct symbol *counter, *bound = NULL;
+    int up;
+    if (cond->type != NT_LT && cond->type != NT_LE && cond->type != NT_GT && cond->type != NT_GE) {
+        return 0;
+    }
+    counter = counted_var(cond->ops[0]);
+    if (counter == NULL || (cond->ops[1]->type != NT_INT
+        && ((bound = counted_var(cond->ops[1])) == NULL || bound == counter))) {
+        return 0;
+    }
+    up = cond->type == NT_LT || cond->type == NT_LE;
+    loop->counter = cond->ops[0];
+    loop->bound = cond->ops[1];
+    loop->step = counter_step(stmt->ops[2], counter);
+    loop->size = unroll_size(stmt->ops[3], counter, bound, UNROLL_FULL_SIZE);
+    return loop->step != 0 && (loop->step > 0) == up && loop->size <= UNROLL_FULL_SIZE;
+}
+
+static int compare_ints(enum node_type type, long long a, long long b)
+{
+    switch (type) {
+    case NT_LT: return a < b;
+    case NT_LE: return a <= b;
+    case NT_GT: return a > b;
+    }
+    return a >= b;
+}
+
+/* iterations of a loop from a constant start to a constant bound, -1 when there are more than max */
+static int trip_count(struct node *stmt, struct counted_loop *loop, int *start, int max)
+{
+    struct node *init = stmt->ops[0];
+    long long value;
+    int trips = 0;
+    if (loop->bound->type != NT_INT || init->type != NT_ASSIGN || init->ops[1]->type != NT_INT
+        || init->ops[0]->type != NT_VARIABLE
+        || ((struct var_node*)init->ops[0])->symbol != ((struct var_node*)loop->counter)->symbol) {
+        return -1;
+    }
+    *start = ((struct int_node*)init->ops[1])->value;
+    for (value = *start; compare_ints(stmt->ops[1]->type, value, ((struct int_node*)loop->bound)->value); value += loop->step) {
+        if (++trips > max) {
+            return -1;
+        }
+    }
+    return trips;
+}
+
+/* a copy of the body for every iteration, the counter kept in memory for breaks and the code after */
+static void lower_full_unroll(struct node *stmt, struct counted_loop *loop, int start, int trips)
+{
+    struct symbol *saved_var = unrolled_var, *type = loop->counter->type_sym;
+    int saved_value = unrolled_value, exit = ir_block_create(fn), i;
+    lower_stmt(stmt->ops[0]);
+    for (i = 0; i < trips; i++) {
+        int next = ir_block_create(fn);
+        unrolled_var = ((struct var_node*)loop->counter)->symbol;
+        unrolled_value = start + i * loop->step;
+        lower_loop_body(stmt->ops[3], exit, next);
+        unrolled_var = saved_var;
+        unrolled_value = saved_value;
+        jump(next);
+        start_block(next);
+        store(type, lower_address(loop->counter), ir_int(start + (i + 1) * loop->step));
+    }
+    jump(exit);
+    start_block(exit);
+}
+
+/*
+ * The main loop runs the body unroll_factor times per test, while the
+ * counter is far enough from the bound; the original loop does the rest.
+ * A bound so close to the end of int that the limit would wrap skips the
+ * main loop.
+ */
+static void lower_unrolled_loop(struct node *stmt, struct counted_loop *loop)
+{
+    int main_test = ir_block_create(fn), main_body = ir_block_create(fn), rest_test = ir_block_create(fn);
+    int rest_body = ir_block_create(fn), rest_step = ir_block_create(fn), exit = ir_block_create(fn);
+    int delta = (unroll_factor - 1) * loop->step, i;
+    enum ir_opcode op = binary_opcode(stmt->ops[1]->type);
+    struct ir_value bound, limit;
+
+    lower_stmt(stmt->ops[0]);
+    bound = lower_expr(loop->bound);
+    if (bound.kind == IRV_INT) {
+        long long value = (long long)bound.value - delta;
+        limit = ir_int((int)value);
+        jump(value == (int)value ? main_test : rest_test);
+    } else {
+        limit = emit_op(IR_SUB, IRT_INT, IRT_INT, bound, ir_int(delta));
+        branch(emit_op(delta > 0 ? IR_LT : IR_GT, IRT_INT, IRT_INT, limit, bound), main_test, rest_test);
+    }
+    start_block(main_test);
+    branch(emit_op(op, IRT_INT, IRT_INT, lower_expr(loop->counter), limit), main_body, rest_test);
+    start_block(main_body);
+    for (i = 0; i < unroll_factor; i++) {
+        int step = ir_block_create(fn);
+        lower_loop_body(stmt->ops[3], exit, step);
+        jump(step);
+        start_block(step);
+        lower_stmt(stmt->ops[2]);
+    }
+    jump(main_test);
+
+    start_block(rest_test);
+    lower_cond(stmt->ops[1], rest_body, exit);
+    start_block(rest_body);
+    lower_loop_body(stmt->ops[3], exit, rest_step);
+    jump(rest_step);
+    start_block(rest_step);
+    lower_stmt(stmt->ops[2]);
+    jump(rest_test);
+    start_block(exit);
+}
+
+static int lower_counted_loop(struct node *stmt)
+{
+    struct counted_loop loop;
+    int start, trips;
+    if (unroll_factor < 2 || !find_counted_loop(stmt, &loop)) {
+        return 0;
+    }
+    trips = trip_count(stmt, &loop, &start, UNROLL_FULL_SIZE / (loop.size > 0 ? loop.size : 1));
+    if (trips != -1) {
+        lower_full_unroll(stmt, &loop, start, trips);
+    } else if (loop.size <= UNROLL_SIZE) {
+        lower_unrolled_loop(stmt, &loop);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static void lower_stmt(struct node *stmt)
+{
+    if (stmt == NULL) {
+        return;
+    }
+
+    switch (stmt->type) {
+    case NT_NOP:
+        return;
+    case NT_LIST:
+    {
+        struct list_node *list = (struct list_node*)stmt;
+        int i;
+        for (i = 0; i < list->size; i++) {
+            lower_stmt(list->items[i]);
+        }
+        return;
+    }
+    case NT_IF:
+    {
+        int then_block = ir_block_create(fn), else_block = ir_block_create(fn), join = ir_block_create(fn);
+        lower_cond(stmt->ops[0], then_block, else_block);
+        start_block(then_block);
+        lower_stmt(stmt->ops[1]);
+        jump(join);
+        start_block(else_block);
+        lower_stmt(stmt->ops[2]);
+        jump(join);
+        start_block(join);
+        return;
+    }
+    case NT_WHILE:
+    {
+        int cond = ir_block_create(fn), body = ir_block_create(fn), exit = ir_block_create(fn);
+        jump(cond);
+        start_block(cond);
+        lower_cond(stmt->ops[0], body, exit);
+        start_block(body);
+        lower_loop_body(stmt->ops[1], exit, cond);
+        jump(cond);
+        start_block(exit);
+        return;
+    }
+    case NT_DO_WHILE:
+    {
+        int body = ir_block_create(fn), cond = ir_block_create(fn), exit = ir_block_create(fn);
+        jump(body);
+        start_block(body);
+        lower_loop_body(stmt->ops[0], exit, cond);
+        jump(cond);
+        start_block(cond);
+        lower_cond(stmt->ops[1], body, exit);
+        start_block(exit);
+        return;
+    }
+    case NT_FOR:
+    {
+        if (lower_counted_loop(stmt)) {
+            return;
+        }
+        int cond = ir_block_create(fn), body = ir_block_create(fn), step = ir_block_create(fn), exit = ir_block_create(fn);
+        lower_stmt(stmt->ops[0]);
+        jump(cond);
+        start_block(cond);
+        if (stmt->ops[1]->type == NT_NOP) {
+            jump(body);
+        } else {
+            lower_cond(stmt->ops[1], body, exit);
+        }
+        start_block(body);
+        lower_loop_body(stmt->ops[3], exit, step);
+        jump(step);
+        start_block(step);
+        lower_stmt(stmt->ops[2]);
+        jump(cond);
+        start_block(exit);
+        return;
+    }
+    case NT_SWITCH:
+        lower_switch(stmt);
+        return;
+    case NT_CASE:
+    case NT_DEFAULT:
+    {
+        int block = (int)ptrmap_get(case_blocks, stmt) - 1;
+        if (block != -1) {
+            jump(block);
+            start_block(block);
+        }
+        lower_stmt(stmt->type == NT_CASE ? stmt->ops[1] : stmt->ops[0]);
+        return;
+    }
+    case NT_BREAK:
+    case NT_CONTINUE:
+    {
+        int target = stmt->type == NT_BREAK ? break_block : continue_block;
+        if (target != -1) {
+            jump(target);
+            start_block(ir_block_create(fn));
+        }
+        return;
+    }
+    case NT_RETURN:
+    {
+        int tail = inlined == NULL || inlined->tail;
+        if (tail && is_self_call(stmt->ops[0])) {
+            lower_self_tail_call(stmt->ops[0]);
+            return;
+        }
+        struct symbol *type = (inlined != NULL ? inlined->function : fn->symbol)->base_type;
+        struct ir_value value = ir_none();
+        if (stmt->ops[0] != NULL && stmt->ops[0]->type != NT_NOP) {
+            tail_expr = tail ? stmt->ops[0] : NULL;
+            value = lower_expr(stmt->ops[0]);
+            tail_expr = NULL;
+            if (type_of(type) != IRT_VOID) {
+                value = convert(value, stmt->ops[0]->type_sym, type);
+            }
+        }
+        if (inlined != NULL && !inlined->tail) {
+            if (inlined->result != 0 && value.kind != IRV_NONE) {
+                emit_mov(inlined->result, value);
+            }
+            jump(inlined->join);
+        } else {
+            struct ir_insn *insn = add(IR_RET, type_of(type));
+            insn->ops[0] = type_of(type) != IRT_VOID ? value : ir_none();
+        }
+        start_block(ir_block_create(fn));
+        return;
+    }
+    case NT_LABEL:
+        lower_stmt(stmt->ops[1]);
+        return;
+    case NT_GOTO:
+        return;
+    }
+    if (inlined == NULL && ptrmap_get(tail_stmts, stmt) != 0 && is_self_call(stmt)) {
+        lower_self_tail_call(stmt);
+        return;
+    }
+    lower_expr(stmt);
+}
+
+/* the statements a void function may end with, the last one of a list or either branch of an if */
+static void find_tail_stmts(struct node *stmt)
+{
+    while (stmt != NULL) {
+        switch (stmt->type) {
+        case NT_LIST:
+        {
+            struct list_node *list = (struct list_node*)stmt;
+            stmt = list->size > 0 ? list->items[list->size - 1] : NULL;
+            break;
+        }
+        case NT_IF:
+            find_tail_stmts(stmt->ops[1]);
+            stmt = stmt->ops[2];
+            break;
+        case NT_CALL:
+            ptrmap_set(tail_stmts, stmt, 1);
+            return;
+        default:
+            return;
+        }
+    }
+}
+
+/* the entry only jumps to head, which gets the code the entry had */
+static void split_entry()
+{
+    struct ir_block *entry = fn->blocks[0], *head = fn->blocks[tail_head];
+    struct ir_insn *insns = head->insns;
+    int capacity = head->capacity;
+    head->insns = entry->insns;
+    head->count = entry->count;
+    head->capacity = entry->capacity;
+    entry->insns = insns;
+    entry->count = 0;
+    entry->capacity = capacity;
+    start_block(0);
+    jump(tail_head);
+}
+
+static void lower_body(struct symbol *function)
+{
+    fn = ir_function_create(function);
+    case_blocks = ptrmap_create();
+    labels = ptrmap_create();
+    tail_stmts = ptrmap_create();
+    addressed = ptrmap_create();
+    addressed_scanned = ptrmap_create();
+    break_block = continue_block = -1;
+    unrolled_var = NULL;
+    inline_budget = INLINE_GROWTH;
+    tail_head = -1;
+    if (parser_is_void_symbol(resolve_alias(function->base_type))) {
+        find_tail_stmts(function->ext->body);
+    }
+    start_block(ir_block_create(fn));
+    lower_stmt(function->ext->body);
+    add(IR_RET, type_of(function->base_type));
+    ptrmap_destroy(case_blocks);
+    ptrmap_destroy(labels);
+    ptrmap_destroy(tail_stmts);
+    ptrmap_destroy(addressed);
+    ptrmap_destroy(addressed_scanned);
+}
+
+extern ir_function_t lower_function(struct symbol *function)
+{
+    ir_function_t result;
+    if (function->type != ST_FUNCTION || function->ext == NULL || function->ext->body == NULL) {
+        return NULL;
+    }
+
+    self_tail_calls = opt_level > 0;
+    lower_body(function);
+    /* a pointer into the frame could see the variables of the next call, so that one gets a frame of its own */
+    if (tail_head != -1 && ir_frame_escapes(fn)) {
+        ir_function_destroy(fn);
+        self_tail_calls = 0;
+        lower_body(function);
+    }
+    if (tail_head != -1) {
+        split_entry();
+    }
+
+    ir_remove_unreachable(fn);
+    result = fn;
+    fn = NULL;
+    return result;
+}
+
+static void count_ref(ptrmap_t map, struct symbol *function)
+{
+    ptrmap_set(map, function, ptrmap_get(map, function) + 1);
+}
+
+/* nodes of a tree, counting the references to functions and the direct calls among them */
+static int count_nodes(struct node *node, ptrmap_t calls, ptrmap_t refs)
+{
+    int i, count = 1;
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->type == NT_VARIABLE && ((struct var_node*)node)->symbol->type == ST_FUNCTION) {
+        count_ref(refs, ((struct var_node*)node)->symbol);
+    } else if (node->type == NT_CALL && node->ops[0]->type == NT_VARIABLE) {
+        count_ref(calls, ((struct var_node*)node->ops[0])->symbol);
+    }
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
+        count += count_nodes(parser_get_subnode(node, i), calls, refs);
+    }
+    return count;
+}
+
+static int can_inline(struct symbol *function)
+{
+    return function->type == ST_FUNCTION && function->ext != NULL && function->ext->body != NULL
+        && (function->flags & (SF_EXTERN | SF_VARIADIC | SF_UNUSED)) == 0;
+}
+
+extern void lower_inline_prepare(symtable_t symtable)
+{
+    ptrmap_t calls = ptrmap_create(), refs = ptrmap_create();
+    symtable_iter_t iter;
+
+    lower_destroy();
+    body_sizes = ptrmap_create();
+    single_calls = ptrmap_create();
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *function = symtable_iter_value(iter);
+        if (can_inline(function)) {
+            ptrmap_set(body_sizes, function, count_nodes(function->ext->body, calls, refs) + 1);
+        }
+    }
+    /* whatever their size these are expanded at their only call and not generated on their own */
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *function = symtable_iter_value(iter);
+        if (can_inline(function) && (function->flags & SF_STATIC) == SF_STATIC
+            && ptrmap_get(refs, function) == 1 && ptrmap_get(calls, function) == 1
+            && ptrmap_get(body_sizes, function) - 1 <= INLINE_SINGLE_SIZE) {
+            ptrmap_set(single_calls, function, 1);
+            function->flags |= SF_UNUSED;
+        }
+    }
+    ptrmap_destroy(calls);
+    ptrmap_destroy(refs);
+}
+
+extern void lower_opt_level_set(int level)
+{
+    opt_level = level;
+    unroll_factor = level >= 2 ? UNROLL_FACTOR : 1;
+}
+
+extern void lower_unroll_set(int factor)
+{
+    unroll_factor = factor;
+}
+
+extern void lower_destroy()
+{
+    if (body_sizes != NULL) {
+        ptrmap_destroy(body_sizes);
+        ptrmap_destroy(single_calls);
+        body_sizes = single_calls = NULL;
+    }
+}
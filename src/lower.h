@@ -0,0 +1,35 @@
+#ifndef JACC_LOWER_H
+#define JACC_LOWER_H
+
+#include "ir.h"
+#include "symtable.h"
+
+/*
+ * Lowers the typed body of a function to three-address code. Conditions
+ * become branches with && and || short-circuited, loops and switches get
+ * their own blocks, and every local variable access becomes a load or a
+ * store. Returns NULL for functions without a body. Above -O0 a function
+ * calling itself in tail position jumps back to its start instead, unless
+ * the address of one of its variables is taken.
+ *
+ * From -O2 counted for loops are unrolled: an int counter stepping by a
+ * constant towards a constant or a variable bound, neither of which the
+ * body assigns or anything points to. Small constant trip counts get a copy
+ * of the body per iteration, other loops test the bound once per unroll
+ * factor copies and finish the iterations left in the original loop.
+ */
+
+extern ir_function_t lower_function(struct symbol *function);
+extern void lower_opt_level_set(int level);
+/* copies of the body of an unrolled loop, below 2 turns unrolling off; set after the optimization level */
+extern void lower_unroll_set(int factor);
+
+/*
+ * Lets lower_function expand calls in place: calls to small functions
+ * within a growth budget, and the only call to a static function, which is
+ * then marked unused so that it is not generated on its own.
+ */
+extern void lower_inline_prepare(symtable_t symtable);
+extern void lower_destroy();
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <stdint.h>
 #include "memory.h"
 #include "lexer.h"
 #include "parser.h"
@@ -9,11 +11,38 @@
 #include "symtable.h"
 #include "generator.h"
 #include "optimizer.h"
-
-int show_indents[255];
+#include "ast.h"
+#include "stack.h"
+#include "folder.h"
+#include "image.h"
+#include "dump.h"
+#include "ir.h"
+#include "lower.h"
+#include "ssa.h"
+#include "loop.h"
+#include "encoder.h"
+#include "elf.h"
+#include "jit.h"
+#include "vm.h"
+
+struct options {
+    int opt_level;
+    int jobs;
+    int lazy;
+    const char *prologue;
+    target_t target;
+    int sse;
+    int time;
+    /* -1 leaves it to the optimization level */
+    int unroll;
+} options = { 1, 1, 0, NULL, TARGET_I386_WIN32, 0, 0, -1 };
+
+int *show_indents = NULL;
+int show_indents_capacity = 0;
 
 void print_node(struct node *node, int level, int root);
 void print_symtable(symtable_t symtable, int level);
+void inspect_node(image_t image, image_ref_t ref, int level);
 
 char *simple_commands[] = {
     "lex",
@@ -21,11 +50,71 @@ char *simple_commands[] = {
     "parse_stmt",
     "parse",
     "compile",
+    "object",
+    "run",
+    "vm",
+    "stats",
+    "serialize",
+    "inspect",
+    "json",
+    "ir",
 };
 
 void print_usage()
 {
-    printf("USAGE: jacc lex filename\n");
+    printf("USAGE: jacc command [options] [filename]\n");
+    printf("  -O<level>  optimization level, -O0 disables constant folding and SSA promotion, -O2 unrolls loops\n");
+    printf("  -unroll=<factor>  copies of the body of unrolled loops, 1 disables unrolling\n");
+    printf("  -j<jobs>   parse function bodies on this many threads\n");
+    printf("  -lazy      only parse functions reachable from main and non-static ones\n");
+    printf("  -P<image>  start from the declarations of a serialized prologue\n");
+    printf("  -msse2     keep doubles in xmm registers on i386, x86-64 always does\n");
+    printf("  object     write a relocatable ELF object instead of assembly, x86-64 only\n");
+    printf("  run        compile into memory and call main right away, x86-64 Linux hosts only\n");
+    printf("  vm         compile to bytecode and interpret it, library calls need x86-64 System V\n");
+    printf("  -time      print how many microseconds run and vm spent compiling and running\n");
+    printf("  --target=<i386-win32|x86_64-linux>  platform to compile for, FASM for Windows by default\n");
+}
+
+int parse_option(const char *arg)
+{
+    if (arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '9' && arg[3] == 0) {
+        options.opt_level = arg[2] - '0';
+        return 1;
+    }
+    if (arg[1] == 'j' && atoi(arg + 2) > 0) {
+        options.jobs = atoi(arg + 2);
+        return 1;
+    }
+    if (arg[1] == 'P' && arg[2] != 0) {
+        options.prologue = arg + 2;
+        return 1;
+    }
+    if (strncmp(arg, "-unroll=", 8) == 0 && atoi(arg + 8) > 0) {
+        options.unroll = atoi(arg + 8);
+        return 1;
+    }
+    if (strcmp(arg, "-lazy") == 0) {
+        options.lazy = 1;
+        return 1;
+    }
+    if (strcmp(arg, "-time") == 0) {
+        options.time = 1;
+        return 1;
+    }
+    if (strcmp(arg, "-msse2") == 0) {
+        options.sse = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--target=i386-win32") == 0) {
+        options.target = TARGET_I386_WIN32;
+        return 1;
+    }
+    if (strcmp(arg, "--target=x86_64-linux") == 0) {
+        options.target = TARGET_X86_64_LINUX;
+        return 1;
+    }
+    return 0;
 }
 
 const char *basename(const char *path)
@@ -70,6 +159,20 @@ int cmd_lex(FILE *file, const char *filename)
     return EXIT_SUCCESS;
 }
 
+void reserve_indents(int level)
+{
+    if (level < show_indents_capacity) {
+        return;
+    }
+    int old_capacity = show_indents_capacity;
+    show_indents_capacity = show_indents_capacity == 0 ? 256 : show_indents_capacity * 2;
+    if (show_indents_capacity <= level) {
+        show_indents_capacity = level + 1;
+    }
+    show_indents = jacc_realloc(show_indents, show_indents_capacity * sizeof(*show_indents));
+    memset(show_indents + old_capacity, 0, (show_indents_capacity - old_capacity) * sizeof(*show_indents));
+}
+
 void print_indent(int level)
 {
     int i;
@@ -92,18 +195,10 @@ void print_node_indent(int level, int root)
     }
 }
 
-void print_branch(struct node *node, int level, int last)
-{
-    print_indent(level + 1);
-    printf("\n");
-    if (last) {
-        show_indents[level + 1] = 0;
-    }
-    print_node(node, level + 1, 0);
-}
 
 void print_symbol(struct symbol *symbol, int level, int depth)
 {
+    reserve_indents(level + 2);
     switch (symbol->type) {
     case ST_SCALAR_TYPE:
         printf("%s", symbol->name);
@@ -135,9 +230,9 @@ void print_symbol(struct symbol *symbol, int level, int depth)
             printf("variadic ");
         }
         printf("function ");
-        if (symtable_size(symbol->symtable) > 0) {
+        if (symtable_size(symbol->ext->params) > 0) {
             printf("taking (\n");
-            symtable_iter_t iter = symtable_first(symbol->symtable);
+            symtable_iter_t iter = symtable_first(symbol->ext->params);
             for (; iter != NULL; iter = symtable_iter_next(iter)) {
                 print_indent(level + 1);
                 print_symbol(symtable_iter_value(iter), level + 1, 0);
@@ -155,10 +250,10 @@ void print_symbol(struct symbol *symbol, int level, int depth)
             print_symbol(symbol->base_type, level, 0);
             printf(">");
         }
-        if (symbol->expr != NULL && level == 0) {
+        if (symbol->ext->body != NULL && level == 0) {
             printf(" defined as {\n");
             show_indents[level + 1] = 0;
-            print_node(symbol->expr, level + 1, 1);
+            print_node(symbol->ext->body, level + 1, 1);
             print_indent(level);
             printf("}");
         }
@@ -229,6 +324,7 @@ void print_symtable(symtable_t symtable, int level)
     }
 
     symtable_iter_t iter = symtable_first(symtable);
+    reserve_indents(level + 2);
     show_indents[level] = 0;
     for (; iter != NULL; iter = symtable_iter_next(iter)) {
         print_indent(level);
@@ -244,19 +340,30 @@ void print_symtable(symtable_t symtable, int level)
     }
 }
 
-void print_node(struct node *node, int level, int root)
+struct print_branch {
+    struct node *node;
+    int level;
+    int last;
+};
+
+/* prints a node without its operands and returns their count */
+int print_node_head(struct node *node, int level, int root)
 {
     if (node == NULL) {
-        return;
+        return 0;
     }
 
-    struct node_info *info = parser_node_info(node);
-    int i, print_type = 1;
+    reserve_indents(level + 2);
+
+    enum node_type type = node->type;
+    struct symbol *type_sym = node->type_sym;
+    symtable_t symtable = node->symtable;
+    int print_type = 1;
     show_indents[level + 1] = 1;
 
     print_node_indent(level, root);
     printf("(");
-    switch (node->type) {
+    switch (type) {
     case NT_INT:
         printf("%d", ((struct int_node*)node)->value);
         print_type = 0;
@@ -281,26 +388,26 @@ void print_node(struct node *node, int level, int root)
         break;
     case NT_CAST:
         printf("cast to <");
-        print_symbol(((struct cast_node*)node)->base.type_sym, level + 1, 0);
+        print_symbol(type_sym, level + 1, 0);
         printf(">");
         print_type = 0;
         break;
     default:
-        printf("%s", info->repr);
-        if (node->type_sym != NULL && (parser_flags_get() & PF_RESOLVE_NAMES) == PF_RESOLVE_NAMES) {
+        printf("%s", parser_node_type_info(type)->repr);
+        if (type_sym != NULL && (parser_flags_get() & PF_RESOLVE_NAMES) == PF_RESOLVE_NAMES) {
             print_type = 1;
         }
         break;
     }
     printf(")");
-    if (node->type_sym != NULL && print_type) {
+    if (type_sym != NULL && print_type) {
         printf(" -> <");
         int old_indent = show_indents[level + 1];
         show_indents[level + 1] = 0;
-        if (node->type_sym->type == ST_VARIABLE || node->type_sym->type == ST_GLOBAL_VARIABLE || node->type_sym->type == ST_PARAMETER) {
-            print_symbol(node->type_sym->base_type, level + 1, 1);
+        if (type_sym->type == ST_VARIABLE || type_sym->type == ST_GLOBAL_VARIABLE || type_sym->type == ST_PARAMETER) {
+            print_symbol(type_sym->base_type, level + 1, 1);
         } else {
-            print_symbol(node->type_sym, level + 1, 1);
+            print_symbol(type_sym, level + 1, 1);
         }
         show_indents[level + 1] = old_indent;
         printf(">");
@@ -308,33 +415,171 @@ void print_node(struct node *node, int level, int root)
     printf("\n");
 
     int op_count = parser_node_subnodes_count(node);
-    if (node->symtable != NULL && symtable_size(node->symtable) > 0) {
+    if (symtable != NULL && symtable_size(symtable) > 0) {
         print_indent(level);
         printf("[\n");
-        print_symtable(node->symtable, level + 1);
+        print_symtable(symtable, level + 1);
         print_indent(level);
         printf("]");
         if (op_count == 0) {
             printf("\n");
         }
     }
+    return op_count;
+}
+
+/* preorder walk with an explicit stack, so deep trees don't exhaust the C stack */
+void print_node(struct node *node, int level, int root)
+{
+    struct print_branch *stack = NULL;
+    int i, top = 0, capacity = 0, op_count = print_node_head(node, level, root);
+
+    for (;;) {
+        if (top + op_count > capacity) {
+            capacity = (top + op_count) * 2;
+            stack = jacc_realloc(stack, capacity * sizeof(*stack));
+        }
+        for (i = op_count - 1; i >= 0; i--) {
+            stack[top].node = parser_get_subnode(node, i);
+            stack[top].level = level + 1;
+            stack[top].last = i == op_count - 1;
+            top++;
+        }
+        if (top == 0) {
+            break;
+        }
 
-    for (i = 0; i < op_count; i++) {
-        print_branch(parser_get_subnode(node, i), level, i == op_count - 1);
+        struct print_branch branch = stack[--top];
+        node = branch.node;
+        level = branch.level;
+        reserve_indents(level + 1);
+        print_indent(level);
+        printf("\n");
+        if (branch.last) {
+            show_indents[level] = 0;
+        }
+        op_count = print_node_head(node, level, 0);
     }
+    jacc_free(stack);
+}
+
+void print_stats(symtable_t symtable)
+{
+    int tree_size = 0;
+    ast_t ast = ast_create(0);
+
+    symtable_iter_t iter = symtable_first(symtable);
+    for (; iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *symbol = symtable_iter_value(iter);
+        if (symbol->type == ST_FUNCTION && symbol->ext->body != NULL) {
+            if (options.opt_level > 0) {
+                printf("folds in %s: %d\n", symbol->name, folder_fold_function(symbol));
+            }
+            tree_size += ast_tree_memory_size(symbol->ext->body);
+            ast_add(ast, symbol->ext->body);
+        }
+    }
+
+    printf("symbols: %d x %d bytes\n", symbol_stats.symbols, (int)sizeof(struct symbol));
+    printf("symbol exts: %d x %d bytes\n", symbol_stats.exts, (int)sizeof(struct symbol_ext));
+    printf("ast nodes: %d\n", ast->count - 1);
+    printf("ast tree: %d bytes\n", tree_size);
+    printf("ast pool: %d bytes\n", ast_memory_size(ast));
+    ast_destroy(ast);
+}
+
+void print_ir(symtable_t symtable)
+{
+    symtable_iter_t iter = symtable_first(symtable);
+    for (; iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *symbol = symtable_iter_value(iter);
+        if (symbol->type == ST_FUNCTION && (symbol->flags & SF_UNUSED) != SF_UNUSED) {
+            ir_function_t function = lower_function(symbol);
+            if (function != NULL) {
+                if (options.opt_level > 0) {
+                    ssa_construct(function);
+                    loop_optimize(function);
+                }
+                ir_print_function(function, stdout);
+                ir_function_destroy(function);
+            }
+        }
+    }
+}
+
+long long clock_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/* the passes over the whole unit that code generation builds on */
+void optimize_unit(symtable_t symtable)
+{
+    lower_opt_level_set(options.opt_level);
+    if (options.unroll != -1) {
+        lower_unroll_set(options.unroll);
+    }
+    if (options.opt_level > 0) {
+        folder_process(symtable);
+        lower_inline_prepare(symtable);
+    }
+}
+
+/* machine code of the whole unit, code keeps the commands it came from */
+object_t encode_program(symtable_t symtable, code_t *code)
+{
+    object_t object;
+    optimize_unit(symtable);
+    generator_opt_level_set(options.opt_level);
+    *code = generator_process(symtable);
+    optimizer_optimize(*code);
+    object = encoder_encode(*code);
+    if (object == NULL) {
+        fprintf(stderr, "cannot encode the generated code\n");
+    }
+    return object;
 }
 
 int cmd_parse_expr(FILE *file, const char *filename, const char *cmd)
 {
     log_set_unit(basename(filename));
 
+    /* run executes the code right here */
+    if (strcmp(cmd, "run") == 0) {
+        options.target = TARGET_X86_64_LINUX;
+    }
+
     lexer_init(file);
     parser_init();
+    parser_jobs_set(options.jobs);
+    parser_lazy_set(options.lazy);
+    parser_pointer_size_set(options.target == TARGET_X86_64_LINUX ? 8 : 4);
+    /* bytecode works on pointers of the host */
+    if (strcmp(cmd, "vm") == 0) {
+        parser_pointer_size_set(sizeof(void *));
+    }
     generator_init();
+    generator_target_set(options.target);
+    generator_sse_set(options.sse);
 
     struct node* node = NULL;
     symtable_t symtable = NULL;
     code_t code = NULL;
+    image_t prologue = NULL;
+    int status = EXIT_SUCCESS;
+
+    if (options.prologue != NULL) {
+        prologue = image_open(options.prologue);
+        if (prologue == NULL) {
+            fprintf(stderr, "Cannot read image %s, or it was built for another pointer size\n", basename(options.prologue));
+            parser_destroy();
+            lexer_destroy();
+            return EXIT_FAILURE;
+        }
+        parser_prologue_set(image_load(prologue), image_header(prologue)->names_count);
+    }
 
     if (strcmp(cmd, "parse_expr") == 0) {
         parser_flags_set(0);
@@ -351,12 +596,90 @@ int cmd_parse_expr(FILE *file, const char *filename, const char *cmd)
     } else if (strcmp(cmd, "compile") == 0) {
         symtable = parser_parse();
         if (symtable != NULL) {
+            optimize_unit(symtable);
+            generator_opt_level_set(options.opt_level);
             code = generator_process(symtable);
             optimizer_optimize(code);
             generator_print_code(code);
         } else {
             print_symtable(symtable, 0);
         }
+    } else if (strcmp(cmd, "object") == 0) {
+        if (options.target != TARGET_X86_64_LINUX) {
+            fprintf(stderr, "object files need --target=x86_64-linux\n");
+            status = EXIT_FAILURE;
+        } else if ((symtable = parser_parse()) != NULL) {
+            object_t object = encode_program(symtable, &code);
+            if (object == NULL || !elf_write(object, stdout)) {
+                status = EXIT_FAILURE;
+            }
+            encoder_free_object(object);
+        } else {
+            status = EXIT_FAILURE;
+        }
+    } else if (strcmp(cmd, "run") == 0) {
+        long long started_at = clock_us();
+        jit_t jit = NULL;
+        if (!JIT_HOST_SUPPORTED) {
+            fprintf(stderr, "run: host is not x86-64 Linux\n");
+        } else if ((symtable = parser_parse()) != NULL) {
+            object_t object = encode_program(symtable, &code);
+            if (object != NULL) {
+                jit = jit_load(object);
+            }
+            encoder_free_object(object);
+        }
+        if (jit != NULL) {
+            long long loaded_at = clock_us();
+            status = jit_call_main(jit);
+            if (options.time) {
+                fprintf(stderr, "compile and load %lld us, run %lld us\n",
+                    loaded_at - started_at, clock_us() - loaded_at);
+            }
+            jit_free(jit);
+        } else {
+            status = EXIT_FAILURE;
+        }
+    } else if (strcmp(cmd, "vm") == 0) {
+        long long started_at = clock_us();
+        vm_program_t program = NULL;
+        if ((symtable = parser_parse()) != NULL) {
+            optimize_unit(symtable);
+            program = vm_compile(symtable, options.opt_level);
+        }
+        if (program != NULL) {
+            long long compiled_at = clock_us();
+            status = vm_run(program);
+            if (options.time) {
+                fprintf(stderr, "compile %lld us, run %lld us\n", compiled_at - started_at, clock_us() - compiled_at);
+            }
+            vm_free(program);
+        } else {
+            status = EXIT_FAILURE;
+        }
+    } else if (strcmp(cmd, "serialize") == 0) {
+        parser_flags_set(PF_RESOLVE_NAMES);
+        symtable = parser_parse();
+        if (symtable != NULL) {
+            image_write(symtable, stdout);
+        }
+    } else if (strcmp(cmd, "json") == 0) {
+        parser_flags_set(PF_RESOLVE_NAMES);
+        symtable = parser_parse();
+        if (symtable != NULL) {
+            dump_json(symtable, stdout);
+        }
+    } else if (strcmp(cmd, "ir") == 0) {
+        symtable = parser_parse();
+        if (symtable != NULL) {
+            optimize_unit(symtable);
+            print_ir(symtable);
+        }
+    } else if (strcmp(cmd, "stats") == 0) {
+        symtable = parser_parse();
+        if (symtable != NULL) {
+            print_stats(symtable);
+        }
     }
 
     parser_free_node(node);
@@ -364,10 +687,174 @@ int cmd_parse_expr(FILE *file, const char *filename, const char *cmd)
     generator_free_code(code);
 
     generator_destroy();
+    lower_destroy();
     parser_destroy();
     lexer_destroy();
+    image_close(prologue);
 
     log_close();
+    return status;
+}
+
+void inspect_type(image_t image, image_ref_t ref)
+{
+    const struct image_symbol *symbol = image_symbol(image, ref);
+    if (symbol == NULL) {
+        printf("?");
+        return;
+    }
+    switch (symbol->type) {
+    case ST_VARIABLE:
+    case ST_GLOBAL_VARIABLE:
+    case ST_FIELD:
+    case ST_PARAMETER:
+        inspect_type(image, symbol->base_type);
+        break;
+    case ST_POINTER:
+        printf("pointer to ");
+        inspect_type(image, symbol->base_type);
+        break;
+    case ST_ARRAY:
+        printf("array of ");
+        inspect_type(image, symbol->base_type);
+        break;
+    case ST_FUNCTION:
+        printf("function returning ");
+        inspect_type(image, symbol->base_type);
+        break;
+    case ST_STRUCT:
+        printf("struct %s", image_string(image, symbol->name));
+        break;
+    case ST_UNION:
+        printf("union %s", image_string(image, symbol->name));
+        break;
+    case ST_ENUM:
+        printf("enum %s", image_string(image, symbol->name));
+        break;
+    default:
+        printf("%s", image_string(image, symbol->name));
+    }
+}
+
+void inspect_table(image_t image, image_ref_t ref, int level);
+
+void inspect_node(image_t image, image_ref_t ref, int level)
+{
+    const struct image_node *node = image_node(image, ref);
+    uint32_t i;
+    if (node == NULL) {
+        return;
+    }
+
+    printf("%*s(", level * 2, "");
+    switch (node->type) {
+    case NT_INT:
+        printf("%d", image_node_int(node));
+        break;
+    case NT_DOUBLE:
+        printf("%f", image_node_double(node));
+        break;
+    case NT_STRING:
+        printf("\"%s\"", image_string(image, node->data[0]));
+        break;
+    case NT_IDENT:
+        printf("ident %s", image_string(image, node->data[0]));
+        break;
+    case NT_VARIABLE:
+    {
+        const struct image_symbol *symbol = image_symbol(image, node->data[0]);
+        printf("var %s", symbol != NULL ? image_string(image, symbol->name) : "?");
+        break;
+    }
+    default:
+        printf("%s", parser_node_type_info(node->type)->repr);
+    }
+    printf(")");
+    if (node->type_sym != 0) {
+        printf(" -> ");
+        inspect_type(image, node->type_sym);
+    }
+    printf("\n");
+
+    inspect_table(image, node->symtable, level + 1);
+    switch (node->type) {
+    case NT_INT:
+    case NT_DOUBLE:
+    case NT_STRING:
+    case NT_IDENT:
+    case NT_VARIABLE:
+        return;
+    }
+    for (i = 0; i < node->count; i++) {
+        inspect_node(image, node->data[i], level + 1);
+    }
+}
+
+void inspect_table(image_t image, image_ref_t ref, int level)
+{
+    const struct image_table *table = image_table(image, ref);
+    uint32_t i;
+    if (table == NULL) {
+        return;
+    }
+    for (i = 0; i < table->count; i++) {
+        const struct image_symbol *symbol = image_symbol(image, table->entries[i].symbol);
+        printf("%*s%s%s: ", level * 2, "", table->entries[i].key2 == SC_TAG ? "tag " : "",
+            image_string(image, table->entries[i].key));
+        if (symbol == NULL) {
+            printf("?\n");
+            continue;
+        }
+        switch (symbol->type) {
+        case ST_FUNCTION:
+            inspect_type(image, table->entries[i].symbol);
+            if (symbol->body != 0) {
+                printf(", locals %d", symbol->locals_size);
+            }
+            printf("\n");
+            inspect_table(image, symbol->params, level + 1);
+            inspect_node(image, symbol->body, level + 1);
+            break;
+        case ST_STRUCT:
+        case ST_UNION:
+        case ST_ENUM:
+            inspect_type(image, table->entries[i].symbol);
+            printf(", %d bytes\n", symbol->size);
+            inspect_table(image, symbol->symtable, level + 1);
+            break;
+        case ST_FIELD:
+        case ST_VARIABLE:
+            inspect_type(image, symbol->base_type);
+            printf(" at %d\n", symbol->offset);
+            inspect_node(image, symbol->expr, level + 1);
+            break;
+        case ST_TYPE_ALIAS:
+            printf("alias for ");
+            inspect_type(image, symbol->base_type);
+            printf("\n");
+            break;
+        default:
+            inspect_type(image, table->entries[i].symbol);
+            printf("\n");
+            inspect_node(image, symbol->expr, level + 1);
+        }
+    }
+}
+
+int cmd_inspect(const char *filename)
+{
+    parser_pointer_size_set(options.target == TARGET_X86_64_LINUX ? 8 : 4);
+    image_t image = image_open(filename);
+    if (image == NULL) {
+        fprintf(stderr, "Cannot read image %s\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    const struct image_header *header = image_header(image);
+    printf("image: %u bytes, %u symbols, %u nodes\n", header->size, header->symbols_count, header->nodes_count);
+    inspect_table(image, header->globals, 0);
+
+    image_close(image);
     return EXIT_SUCCESS;
 }
 
@@ -382,11 +869,11 @@ int is_cmd(const char *str)
     return 0;
 }
 
-int main(int argc, char** argv)
+int run_command(int argc, char** argv)
 {
     FILE *file;
     char *filename;
-    int status;
+    int i, status;
 
     if (argc < 2) {
         print_usage();
@@ -394,8 +881,30 @@ int main(int argc, char** argv)
     }
 
     if (is_cmd(argv[1])) {
-        if (argc == 3) {
-            filename = argv[2];
+        filename = NULL;
+        for (i = 2; i < argc; i++) {
+            if (argv[i][0] == '-' && argv[i][1] != 0) {
+                if (!parse_option(argv[i])) {
+                    print_usage();
+                    return EXIT_FAILURE;
+                }
+            } else if (filename == NULL) {
+                filename = argv[i];
+            } else {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (strcmp(argv[1], "inspect") == 0) {
+            if (filename == NULL) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+            return cmd_inspect(filename);
+        }
+
+        if (filename != NULL) {
             file = fopen(filename, "r");
             if (file == NULL) {
                 fprintf(stderr, "Cannot open file");
@@ -412,7 +921,7 @@ int main(int argc, char** argv)
             status = cmd_parse_expr(file, filename, argv[1]);
         }
 
-        if (argc == 3) {
+        if (file != stdin) {
             fclose(file);
         }
         return status;
@@ -420,3 +929,26 @@ int main(int argc, char** argv)
     print_usage();
     return EXIT_SUCCESS;
 }
+
+struct main_args {
+    int argc;
+    char **argv;
+};
+
+void *run_command_thunk(void *arg)
+{
+    struct main_args *args = arg;
+    return (void*)(intptr_t)run_command(args->argc, args->argv);
+}
+
+int main(int argc, char** argv)
+{
+    /* nesting in the source is bounded by the stack of the thread parsing it */
+    struct main_args args = { argc, argv };
+    struct stack_thread thread;
+    if (!stack_thread_start(&thread, run_command_thunk, &args)) {
+        fprintf(stderr, "Cannot reserve a stack for the compiler\n");
+        return EXIT_FAILURE;
+    }
+    return (int)(intptr_t)stack_thread_join(&thread);
+}
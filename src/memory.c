@@ -2,7 +2,7 @@
 #include <stdio.h>
 #include "memory.h"
 
-inline void *jacc_check_malloc_result(void *ptr)
+static inline void *jacc_check_malloc_result(void *ptr)
 {
     if (ptr == NULL) {
         fprintf(stderr, "Memory allocation failed");
@@ -30,6 +30,16 @@ int is_eq(void *operand1, void *operand2)
     return 0;
 }
 
+/*
+ * The generator keeps values in allocated registers, only eax and edx are
+ * scratch and known dead after the idioms folding a register away.
+ */
+int is_scratch(asm_operand_t *op)
+{
+    return op->type == AOT_REGISTER
+        && (op->reg == AR_EAX || op->reg == AR_EDX || op->reg == AR_RAX || op->reg == AR_RDX);
+}
+
 int push_pop_opt_possible(asm_command_t *a, asm_command_t *b)
 {
     return a->type == ASM_PUSH
@@ -112,7 +122,8 @@ int opt_lea_lea(asm_command_t *cmd)
     if ( cmd[0].type == ASM_LEA
       && cmd[1].type == ASM_LEA
       && cmd[0].ops[0].reg == cmd[1].ops[0].reg
-      && is_eq(&cmd[1].ops[1].memory.base, &cmd[1].ops[1].memory.base)
+      && is_eq(&cmd[1].ops[1].memory.base, &cmd[0].ops[0])
+      && cmd[1].ops[1].memory.index.reg == AR_NONE
       ) {
         cmd[0].ops[1].memory.offset += cmd[1].ops[1].memory.offset;
         return 1;
@@ -131,7 +142,7 @@ int opt_lea_mov(asm_command_t *cmd)
 {
     if ( cmd[0].type == ASM_LEA
       && cmd[1].type == ASM_MOV
-      && cmd[0].ops[0].type == AOT_REGISTER
+      && is_scratch(&cmd[0].ops[0])
       && cmd[1].ops[0].type == AOT_REGISTER
       && is_eq(&cmd[0].ops[0], &cmd[1].ops[1])
       ) {
@@ -157,7 +168,7 @@ int opt_lea_deref(asm_command_t *cmd)
         || cmd[1].type == ASM_INC
         || cmd[1].type == ASM_DEC
          )
-      && cmd[0].ops[0].type == AOT_REGISTER
+      && is_scratch(&cmd[0].ops[0])
       && cmd[0].ops[1].type == AOT_MEMORY
       && cmd[1].ops[0].type == AOT_MEMORY
       && is_eq(&cmd[1].ops[0].memory.base, &cmd[0].ops[0])
@@ -182,7 +193,7 @@ int opt_lea_mov_ref(asm_command_t *cmd)
 {
     if ( cmd[0].type == ASM_LEA
       && cmd[1].type == ASM_MOV
-      && cmd[0].ops[0].type == AOT_REGISTER
+      && is_scratch(&cmd[0].ops[0])
       && cmd[0].ops[1].type == AOT_MEMORY
       && cmd[1].ops[0].type == AOT_MEMORY
       && cmd[1].ops[1].type != AOT_MEMORY
@@ -252,7 +263,7 @@ int opt_mov(asm_command_t *cmd)
      * mov c, a
      */
     if (cmd[1].type == ASM_MOV
-      && cmd[0].ops[0].type != AOT_MEMORY
+      && is_scratch(&cmd[0].ops[0])
       && is_eq(&cmd[0].ops[0], &cmd[1].ops[1])
       && ( cmd[0].ops[1].type != AOT_MEMORY
         || cmd[1].ops[0].type != AOT_MEMORY
@@ -269,7 +280,7 @@ int opt_mov(asm_command_t *cmd)
      * test reg2, reg2
      */
     if (cmd[1].type == ASM_TEST
-      && cmd[0].ops[0].type == AOT_REGISTER
+      && is_scratch(&cmd[0].ops[0])
       && cmd[0].ops[1].type == AOT_REGISTER
       && is_eq(&cmd[0].ops[0], &cmd[1].ops[1])
       && is_eq(&cmd[1].ops[0], &cmd[1].ops[1])
@@ -286,7 +297,7 @@ int opt_mov(asm_command_t *cmd)
      * imul eax, imm
      */
     if (cmd[1].type == ASM_IMUL
-      && cmd[0].ops[0].type == AOT_REGISTER
+      && is_scratch(&cmd[0].ops[0])
       && cmd[0].ops[1].type == AOT_CONSTANT
       && is_eq(&cmd[0].ops[0], &cmd[1].ops[0])
       ) {
@@ -299,7 +310,7 @@ int opt_mov(asm_command_t *cmd)
 
 int is_power_of_2(int v)
 {
-    return (v & (v - 1)) == 0;
+    return v > 0 && (v & (v - 1)) == 0;
 }
 
 int int_log2(int v)
@@ -331,37 +342,11 @@ int opt_imul2(asm_command_t *cmd)
     return -1;
 }
 
-/*
- * mov reg, 2**p
- * cdq
- * idiv reg
- * =>
- * sar eax, p
- */
-
-int opt_idiv(asm_command_t *cmd)
-{
-    if ( cmd[0].type == ASM_MOV
-      && cmd[1].type == ASM_CDQ
-      && cmd[2].type == ASM_IDIV
-      && cmd[0].ops[0].type == AOT_REGISTER
-      && cmd[0].ops[1].type == AOT_CONSTANT
-      && is_power_of_2(cmd[0].ops[1].value)
-      && is_eq(&cmd[0].ops[0], &cmd[2].ops[0])
-      ) {
-        cmd[0].type = ASM_SAR;
-        cmd[0].ops[0].reg = AR_EAX;
-        cmd[0].ops[1].value = int_log2(cmd[0].ops[1].value);
-        return 1;
-    }
-    return -1;
-}
-
 /*
  * fstp reg/mem
  * fld reg/mem
  * =>
- * nothing
+ * fst reg/mem
  */
 
 int opt_fstp_fld(asm_command_t *cmd)
@@ -370,7 +355,8 @@ int opt_fstp_fld(asm_command_t *cmd)
       && cmd[1].type == ASM_FLD
       && is_eq(&cmd[0].ops[0], &cmd[1].ops[0])
       ) {
-        return 0;
+        cmd[0].type = ASM_FST;
+        return 1;
     }
     return -1;
 }
@@ -441,7 +427,6 @@ struct optimization_pass passes[] = {
     { opt_add_sub, 2 },
     { opt_mov, 2 },
     { opt_imul2, 1 },
-    { opt_idiv, 3 },
     { opt_fstp_fld, 2 },
     { opt_cond_jmp, 3 },
 };
@@ -462,7 +447,7 @@ void optimizer_optimize(code_t code)
         int i = 0, pos = 0, count = list->count;
         changed = 0;
         for (; i < count; i++) {
-            if (list->data[i].type == ASM_TEXT) {
+            if (list->data[i].type == ASM_TEXT || list->data[i].type == ASM_LABEL || list->data[i].type == ASM_GLOBAL) {
                 list->data[pos] = list->data[i];
                 pos++;
                 continue;
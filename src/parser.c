@@ -5,6 +5,8 @@
 #include "parser.h"
 #include "log.h"
 #include "pull.h"
+#include "pool.h"
+#include "folder.h"
 
 #define ALLOC_NODE(enum_type, var_name) \
     ALLOC_NODE_EX(enum_type, var_name, node_##enum_type)
@@ -21,23 +23,90 @@
 
 #define HAS_FLAG(expr, flag) (((expr) & (flag)) == (flag))
 
-#define SYMTABLE_MAX_DEPTH 255
+#define PREC_ASSIGN 2
+
+#define SYMTABLE_INITIAL_DEPTH 64
 #define SYMTABLE_DEFAULT_SIZE 16
+#define GENERATED_NAME_SIZE 32
+
+/*
+ * A function body parsed out of line, or a run of top-level declarations
+ * between two such bodies. Units keep the source order, so their generated
+ * names and messages can be committed exactly as a serial parse would.
+ */
+struct recorded_token {
+    struct token token;
+    char *diagnostics;
+};
+
+struct generated_name {
+    char *buf;
+    const char *prefix;
+};
+
+/* case values seen in the innermost switch */
+struct case_values {
+    int *values;
+    int count;
+    int capacity;
+};
+
+struct parse_unit {
+    int index;
+    struct symbol *function;
+    int visible_globals;
+
+    struct recorded_token *tokens;
+    int tokens_count;
+    int tokens_capacity;
+    int replay_pos;
+
+    struct generated_name *names;
+    int names_count;
+    int names_capacity;
+
+    /* functions referenced by the unit, for lazy parsing */
+    struct symbol **uses;
+    int uses_count;
+    int uses_capacity;
+
+    buffer_t log;
+    struct node *body;
+    int locals_size;
+    int parsed;
+    int failed;
+};
 
-symtable_t symtables[SYMTABLE_MAX_DEPTH];
-int current_symtable;
+__thread symtable_t *symtables;
+__thread int *outer_symtables; /* nearest non-empty symtable below each level */
+__thread int symtables_capacity;
+__thread int current_symtable;
+__thread int visible_globals = -1;
 int name_uid = 0;
-int parser_flags = 0;
+__thread int parser_flags = 0;
+int parser_jobs = 1;
+int parser_lazy = 0;
+int parser_pointer_size = 4;
+symtable_t prologue_symtable = NULL;
 struct symbol sym_null, sym_void, sym_int, sym_double, sym_char, sym_char_ptr, sym_printf;
 
-pull_t parser_pull;
-int function_locals_size;
+__thread pull_t parser_pull;
+__thread struct case_values *switch_cases;
+__thread int function_locals_size;
 
-struct token token;
-struct token token_next;
+__thread struct token token;
+__thread struct token token_next;
+
+__thread struct parse_unit *replay_unit;
+__thread struct parse_unit *name_unit;
+struct parse_unit **parse_units;
+int parse_units_count;
+int parse_units_capacity;
+symtable_t frozen_symtables[2];
+int frozen_flags;
 
 struct node_info nodes_info[] = {
-#define NODE(name, repr, cat, op_cnt) {repr, cat, op_cnt},
+#define NODE(name, repr, cat, op_cnt, prec) {repr, cat, op_cnt, prec},
 #include "nodes.def"
 #undef NODE
 };
@@ -49,8 +118,8 @@ enum declaration_type {
     DT_PARAMETER,
 };
 
-enum declaration_type cur_decl_type;
-struct list_node *initializers_list;
+__thread enum declaration_type cur_decl_type;
+__thread struct list_node *initializers_list;
 
 static void init_node(struct node *node, int size, enum node_type type)
 {
@@ -59,10 +128,30 @@ static void init_node(struct node *node, int size, enum node_type type)
     node->type = type;
 }
 
+static void replay_token(struct parse_unit *unit, struct token *dst)
+{
+    if (unit->replay_pos < unit->tokens_count) {
+        struct recorded_token *record = &unit->tokens[unit->replay_pos++];
+        *dst = record->token;
+        if (record->diagnostics != NULL) {
+            log_write(stderr, record->diagnostics, strlen(record->diagnostics));
+        }
+        return;
+    }
+    /* past the recorded range only the end of stream can be seen */
+    *dst = unit->tokens[unit->tokens_count - 1].token;
+    dst->type = TOK_EOS;
+    dst->text = NULL;
+}
+
 static int next_token()
 {
     lexer_token_free_data(&token);
     token = token_next;
+    if (replay_unit != NULL) {
+        replay_token(replay_unit, &token_next);
+        return token.type != TOK_ERROR;
+    }
     lexer_next_token(&token_next);
     while (token_next.type == TOK_COMMENT) {
         lexer_token_free_data(&token_next);
@@ -125,11 +214,37 @@ static inline int calc_types()
 
 static char* generate_name(const char *prefix)
 {
-    char *buf = jacc_malloc(16);
-    sprintf(buf, "%s%d", prefix, ++name_uid);
+    char *buf = jacc_malloc(GENERATED_NAME_SIZE);
+    if (name_unit == NULL) {
+        sprintf(buf, "%s%d", prefix, ++name_uid);
+        return buf;
+    }
+
+    /* numbered in source order once all units are parsed */
+    struct parse_unit *unit = name_unit;
+    if (unit->names_count == unit->names_capacity) {
+        unit->names_capacity = unit->names_capacity == 0 ? 4 : unit->names_capacity * 2;
+        unit->names = jacc_realloc(unit->names, unit->names_capacity * sizeof(*unit->names));
+    }
+    unit->names[unit->names_count].buf = buf;
+    unit->names[unit->names_count].prefix = prefix;
+    sprintf(buf, "%s.%d.%d", prefix, unit->index, unit->names_count++);
     return buf;
 }
 
+static void note_function_use(struct symbol *function)
+{
+    struct parse_unit *unit = name_unit;
+    if (!parser_lazy || unit == NULL) {
+        return;
+    }
+    if (unit->uses_count == unit->uses_capacity) {
+        unit->uses_capacity = unit->uses_capacity == 0 ? 4 : unit->uses_capacity * 2;
+        unit->uses = jacc_realloc(unit->uses, unit->uses_capacity * sizeof(*unit->uses));
+    }
+    unit->uses[unit->uses_count++] = function;
+}
+
 static symtable_t get_current_symtable()
 {
     return symtables[current_symtable];
@@ -138,7 +253,19 @@ static symtable_t get_current_symtable()
 static symtable_t push_symtable_ex(symtable_t symtable)
 {
     current_symtable++;
+    if (current_symtable == symtables_capacity) {
+        symtables_capacity *= 2;
+        symtables = jacc_realloc(symtables, symtables_capacity * sizeof(*symtables));
+        outer_symtables = jacc_realloc(outer_symtables, symtables_capacity * sizeof(*outer_symtables));
+    }
     symtables[current_symtable] = symtable;
+
+    /* only the innermost symtable gets new symbols, so empty outer ones can be skipped for good */
+    int outer = current_symtable - 1;
+    if (symtable_size(symtables[outer]) == 0) {
+        outer = outer_symtables[outer];
+    }
+    outer_symtables[current_symtable] = outer;
     return symtables[current_symtable];
 }
 
@@ -162,8 +289,10 @@ static void put_symbol(const char *name, struct symbol *symbol, enum symbol_clas
 static struct symbol *get_symbol(const char *name, enum symbol_class symclass)
 {
     int i = current_symtable;
-    for (; i >= 0; i--) {
-        struct symbol *result = symtable_get(symtables[i], name, symclass);
+    for (; i >= 0; i = outer_symtables[i]) {
+        struct symbol *result = i == 1 && visible_globals >= 0
+            ? symtable_get_visible(symtables[i], name, symclass, visible_globals)
+            : symtable_get(symtables[i], name, symclass);
         if (result != NULL) {
             return result;
         }
@@ -220,6 +349,18 @@ extern int is_ptr_type(struct symbol *symbol)
     return 0;
 }
 
+/*
+ * Tags are completed in place, so a deferred body, which sees the globals
+ * as they were at its position, also ignores completions made after it.
+ */
+static int is_complete(struct symbol *symbol)
+{
+    if (HAS_FLAG(symbol->flags, SF_INCOMPLETE)) {
+        return 0;
+    }
+    return visible_globals < 0 || symbol->ext == NULL || symbol->ext->completed < visible_globals;
+}
+
 static int is_struct_type(struct symbol *symbol)
 {
     if (symbol == NULL) {
@@ -253,6 +394,7 @@ static int is_lvalue(struct node *node)
 {
     switch (node->type) {
     case NT_VARIABLE:
+        return ((struct var_node*)node)->symbol->type != ST_ENUM_CONST;
     case NT_DEREFERENCE:
     case NT_SUBSCRIPT:
     case NT_MEMBER:
@@ -284,6 +426,7 @@ static struct symbol *alloc_symbol(enum symbol_type type)
     struct symbol *symbol = jacc_malloc(sizeof(*symbol));
     memset(symbol, 0, sizeof(*symbol));
     symbol->type = type;
+    __sync_fetch_and_add(&symbol_stats.symbols, 1);
     return symbol;
 }
 
@@ -332,6 +475,9 @@ int is_compatible_types(struct symbol *s1, struct symbol *s2)
 
     s1 = resolve_alias(s1);
     s2 = resolve_alias(s2);
+    if (s1 == s2) {
+        return 1;
+    }
 
     enum symbol_type t1 = get_generic_type(s1), t2 = get_generic_type(s2);
 
@@ -346,7 +492,7 @@ int is_compatible_types(struct symbol *s1, struct symbol *s2)
     if (t1 == ST_FUNCTION && t2 == ST_FUNCTION) {
         return is_compatible_types(s1->base_type, s2->base_type)
                 && s1->flags == s2->flags
-                && is_compatible_symtable(s1->symtable, s2->symtable);
+                && is_compatible_symtable(s1->ext->params, s2->ext->params);
     }
 
     if ((t1 == ST_STRUCT || t1 == ST_UNION) && t1 == t2) {
@@ -528,6 +674,8 @@ static int set_inc_expr_type(struct node *node)
 }
 
 static struct node *parse_expr(int level);
+static struct node *parse_stmt();
+static struct node *parse_unary_expr();
 static struct node *parse_assign_expr();
 static struct node *parse_cast_expr();
 static int is_parse_type_specifier();
@@ -595,10 +743,22 @@ static struct node *parse_primary_expr()
             EXPECT(TOK_IDENT)
             ALLOC_NODE_EX(NT_VARIABLE, var_node, var_node)
             var_node->symbol = get_symbol(token.value.str_val, SC_NAME);
+            if (var_node->symbol == NULL) {
+                parser_error("undeclared identifier");
+                return NULL;
+            }
+            if (var_node->symbol->type == ST_ENUM_CONST) {
+                var_node->base.type_sym = &sym_int;
+                next_token();
+                return (struct node*)var_node;
+            }
             if (!is_var_symbol(var_node->symbol) && var_node->symbol->type != ST_FUNCTION) {
                 parser_error("expected variable type");
                 return NULL;
             }
+            if (var_node->symbol->type == ST_FUNCTION) {
+                note_function_use(var_node->symbol);
+            }
             var_node->base.type_sym = var_node->symbol;
             next_token();
             struct symbol *symbol = resolve_alias(var_node->symbol);
@@ -662,6 +822,10 @@ static int process_member_node(struct node *node)
         parser_error("expected struct or union");
         return 0;
     }
+    if (!is_complete(obj)) {
+        parser_error("member of incomplete type");
+        return 0;
+    }
 
     const char *field_name = ((struct string_node*)node->ops[1])->value;
     struct symbol *field = symtable_get(obj->symtable, field_name, SC_NAME);
@@ -720,7 +884,7 @@ static struct node *parse_postfix_expr()
             if (calc_types()) {
                 cnode->base.type_sym = func->base_type;
 
-                int param_count = symtable_size(func->symtable);
+                int param_count = symtable_size(func->ext->params);
                 if (list_node->size < param_count) {
                     parser_error("too few arguments to function");
                     return NULL;
@@ -730,7 +894,7 @@ static struct node *parse_postfix_expr()
                 }
 
                 int i = 0, offset = 0;
-                symtable_iter_t iter = symtable_first(func->symtable);
+                symtable_iter_t iter = symtable_first(func->ext->params);
                 for (; iter != NULL; iter = symtable_iter_next(iter), i++) {
                     struct symbol *param = symtable_iter_value(iter);
                     struct symbol *type = param->base_type;
@@ -934,7 +1098,7 @@ static struct node *parse_cast_expr()
 static struct node *parse_cond_expr()
 {
     struct node *node;
-    PARSE(node, expr, 1)
+    PARSE(node, expr, nodes_info[NT_OR].prec)
     while (1) {
         if (!accept(TOK_QUESTION)) {
             return node;
@@ -943,7 +1107,7 @@ static struct node *parse_cond_expr()
         new_node->ops[0] = node;
         PARSE(new_node->ops[1], expr, 0)
         CONSUME(TOK_COLON)
-        PARSE(new_node->ops[2], expr, 1)
+        PARSE(new_node->ops[2], expr, nodes_info[NT_OR].prec)
         node = (struct node*)new_node;
 
         if (calc_types()) {
@@ -1003,42 +1167,6 @@ static enum node_type get_node_type()
 }
 
 #define CHECK(token_type) { if (token.type == token_type) return 1; }
-static int accept_expr_token(int level)
-{
-    switch (level) {
-    case 0: CHECK(TOK_COMMA); break;
-    case 1: CHECK(TOK_OR_OP); break;
-    case 2: CHECK(TOK_AND_OP); break;
-    case 3: CHECK(TOK_BIT_OR_OP); break;
-    case 4: CHECK(TOK_BIT_XOR_OP); break;
-    case 5: CHECK(TOK_AMP); break;
-    case 6:
-        CHECK(TOK_EQUAL_OP)
-        CHECK(TOK_NOT_EQUAL_OP)
-        break;
-    case 7:
-        CHECK(TOK_LT_OP)
-        CHECK(TOK_LE_OP)
-        CHECK(TOK_GT_OP)
-        CHECK(TOK_GE_OP)
-        break;
-    case 8:
-        CHECK(TOK_LSHIFT_OP)
-        CHECK(TOK_RSHIFT_OP)
-        break;
-    case 9:
-        CHECK(TOK_ADD_OP)
-        CHECK(TOK_SUB_OP)
-        break;
-    case 10:
-        CHECK(TOK_STAR)
-        CHECK(TOK_DIV_OP)
-        CHECK(TOK_MOD_OP)
-        break;
-    }
-    return 0;
-}
-
 static int accept_assign_expr_token()
 {
     CHECK(TOK_ASSIGN)
@@ -1112,40 +1240,30 @@ static struct node *parse_assign_expr()
     return (struct node*)new_node;
 }
 
-static struct node *parse_expr_subnode(int level)
-{
-    switch (level) {
-    case 0: /* comma */
-        return parse_assign_expr();
-    case 1: /* or */
-    case 2: /* and */
-    case 3: /* bit or */
-    case 4: /* bit xor */
-    case 5: /* bit and */
-    case 6: /* equality */
-    case 7: /* relational */
-    case 8: /* shift */
-    case 9: /* additive */
-        return parse_expr(level + 1);
-    case 10: /* multiplicative */
-        return parse_cast_expr();
-    }
-    return NULL;
-}
-
-static struct node *parse_expr(int level)
+/*
+ * Precedence climbing over the binding powers in nodes.def: parses binary
+ * operators binding at least as tight as min_prec. Assignment and ternary
+ * operators are right-associative and handled by parse_assign_expr, so
+ * below PREC_ASSIGN operands are whole assignment expressions.
+ */
+static struct node *parse_expr(int min_prec)
 {
     struct node *node;
-    PARSE(node, expr_subnode, level)
+    if (min_prec <= PREC_ASSIGN) {
+        PARSE(node, assign_expr)
+    } else {
+        PARSE(node, cast_expr)
+    }
 
     while (1) {
-        if (!accept_expr_token(level)) {
+        int prec = nodes_info[get_node_type()].prec;
+        if (prec < min_prec || prec == 0 || prec == PREC_ASSIGN) {
             return node;
         }
         ALLOC_NODE_EX(get_node_type(), new_node, binary_node)
         next_token();
         new_node->ops[0] = node;
-        PARSE(new_node->ops[1], expr_subnode, level)
+        PARSE(new_node->ops[1], expr, prec + 1)
         node = (struct node*)new_node;
 
         if (calc_types()) {
@@ -1163,6 +1281,32 @@ static struct node *parse_const_expr()
     return parse_cond_expr();
 }
 
+static int check_case_value(struct node **node)
+{
+    int i, value;
+    folder_fold(node);
+    if ((*node)->type != NT_INT) {
+        parser_error("case label is not an integer constant expression");
+        return 0;
+    }
+    if (switch_cases == NULL) {
+        return 1;
+    }
+    value = ((struct int_node*)*node)->value;
+    for (i = 0; i < switch_cases->count; i++) {
+        if (switch_cases->values[i] == value) {
+            parser_error("duplicate case value");
+            return 0;
+        }
+    }
+    if (switch_cases->count == switch_cases->capacity) {
+        switch_cases->capacity = switch_cases->capacity == 0 ? 16 : switch_cases->capacity * 2;
+        switch_cases->values = jacc_realloc(switch_cases->values, switch_cases->capacity * sizeof(*switch_cases->values));
+    }
+    switch_cases->values[switch_cases->count++] = value;
+    return 1;
+}
+
 static struct node *parse_opt_expr_with(enum token_type type)
 {
     struct node *node;
@@ -1259,7 +1403,13 @@ static struct node *parse_stmt()
         PARSE(switch_node->ops[0], expr, 0)
         CONSUME(TOK_RPAREN)
         switch_node->symtable = push_symtable();
-        PARSE(switch_node->ops[1], stmt)
+        struct case_values cases, *outer_cases = switch_cases;
+        memset(&cases, 0, sizeof(cases));
+        switch_cases = &cases;
+        switch_node->ops[1] = parse_stmt();
+        switch_cases = outer_cases;
+        jacc_free(cases.values);
+        PARSE_CHECK(switch_node->ops[1])
         pop_symtable();
         return (struct node*)switch_node;
     }
@@ -1315,6 +1465,9 @@ static struct node *parse_stmt()
         ALLOC_NODE(NT_CASE, case_node)
         CONSUME(TOK_CASE)
         PARSE(case_node->ops[0], const_expr)
+        if (calc_types() && !check_case_value(&case_node->ops[0])) {
+            return NULL;
+        }
         CONSUME(TOK_COLON)
         PARSE(case_node->ops[1], stmt)
         return (struct node*)case_node;
@@ -1377,7 +1530,7 @@ static struct symbol *parse_function_declarator(struct symbol *base_type)
     func->base_type = base_type;
 
     push_symtable();
-    func->symtable = get_current_symtable();
+    symbol_ext(func)->params = get_current_symtable();
 
     CONSUME(TOK_LPAREN)
     if (token.type != TOK_RPAREN) {
@@ -1418,7 +1571,7 @@ static struct symbol *parse_declarator_base(const char **name)
     while (token.type == TOK_STAR) {
         struct symbol *pointer = alloc_symbol(ST_POINTER);
         pointer->base_type = outer_symbol;
-        pointer->size = sym_int.size;
+        pointer->size = parser_pointer_size;
         outer_symbol = pointer;
         next_token();
     }
@@ -1460,7 +1613,10 @@ static struct symbol *parse_structured_specifier_start(enum symbol_type symbol_t
         token.value.str_val = NULL;
         next_token();
 
-        struct symbol *struct_tag = get_symbol(symbol->name, SC_TAG);
+        /* a tag followed by a body declares a new type in the current scope */
+        struct symbol *struct_tag = token.type == TOK_LBRACE
+            ? symtable_get(get_current_symtable(), symbol->name, SC_TAG)
+            : get_symbol(symbol->name, SC_TAG);
         if (struct_tag != NULL) {
             jacc_free((char*)symbol->name);
             jacc_free(symbol);
@@ -1489,6 +1645,8 @@ static struct symbol *parse_struct_or_union_specifier()
         } while (!accept(TOK_RBRACE));
         pop_symtable();
         symbol->flags &= ~SF_INCOMPLETE;
+        /* tags completed inside a deferred body are local to it */
+        symbol_ext(symbol)->completed = visible_globals >= 0 ? 0 : symtable_version(symtables[1]);
 
         symtable_iter_t iter = symtable_first(symbol->symtable);
         for (; iter != NULL; iter = symtable_iter_next(iter)) {
@@ -1632,6 +1790,223 @@ static struct symbol *parse_specifier_qualifier_list()
     return parse_type_specifier();
 }
 
+static struct parse_unit *add_parse_unit(struct symbol *function)
+{
+    struct parse_unit *unit = jacc_calloc(1, sizeof(*unit));
+    unit->index = parse_units_count;
+    unit->function = function;
+    unit->log = buffer_create(64);
+    if (parse_units_count == parse_units_capacity) {
+        parse_units_capacity = parse_units_capacity == 0 ? 16 : parse_units_capacity * 2;
+        parse_units = jacc_realloc(parse_units, parse_units_capacity * sizeof(*parse_units));
+    }
+    parse_units[parse_units_count++] = unit;
+    return unit;
+}
+
+static void free_parse_unit(struct parse_unit *unit)
+{
+    int i;
+    for (i = unit->replay_pos; i < unit->tokens_count; i++) {
+        lexer_token_free_data(&unit->tokens[i].token);
+    }
+    for (i = 0; i < unit->tokens_count; i++) {
+        jacc_free(unit->tokens[i].diagnostics);
+    }
+    jacc_free(unit->tokens);
+    jacc_free(unit->names);
+    jacc_free(unit->uses);
+    buffer_free(unit->log);
+    jacc_free(unit);
+}
+
+static void begin_segment()
+{
+    name_unit = add_parse_unit(NULL);
+    log_capture(name_unit->log);
+}
+
+static void record_token(struct parse_unit *unit, struct token *src, char *diagnostics)
+{
+    if (unit->tokens_count == unit->tokens_capacity) {
+        unit->tokens_capacity = unit->tokens_capacity == 0 ? 64 : unit->tokens_capacity * 2;
+        unit->tokens = jacc_realloc(unit->tokens, unit->tokens_capacity * sizeof(*unit->tokens));
+    }
+    unit->tokens[unit->tokens_count].token = *src;
+    unit->tokens[unit->tokens_count].diagnostics = diagnostics;
+    unit->tokens_count++;
+    /* the data now belongs to the record */
+    src->text = NULL;
+    src->value.str_val = NULL;
+}
+
+static char *next_token_diagnostics(buffer_t diagnostics)
+{
+    buffer_reset(diagnostics);
+    log_capture(diagnostics);
+    next_token();
+    log_capture(name_unit->log);
+    if (buffer_size(diagnostics) == 0) {
+        return NULL;
+    }
+    char *text = jacc_malloc(buffer_size(diagnostics) + 1);
+    memcpy(text, buffer_data(diagnostics), buffer_size(diagnostics));
+    text[buffer_size(diagnostics)] = 0;
+    return text;
+}
+
+/*
+ * Records the tokens of a function body up to the matching brace. Lexer
+ * messages stay attached to their tokens and are replayed when the body
+ * is parsed, including those of the two tokens a serial parse would look
+ * ahead past the closing brace.
+ */
+static void defer_function_body(struct symbol *function)
+{
+    struct parse_unit *unit = add_parse_unit(function);
+    buffer_t diagnostics = buffer_create(64);
+    char *token_diagnostics = NULL, *next_diagnostics = NULL;
+    int depth = 0;
+
+    unit->visible_globals = symtable_version(symtables[1]);
+    for (;;) {
+        enum token_type type = token.type;
+        record_token(unit, &token, token_diagnostics);
+        if (type == TOK_LBRACE) {
+            depth++;
+        } else if (type == TOK_RBRACE) {
+            depth--;
+        }
+        if (depth == 0 || type == TOK_EOS || type == TOK_ERROR) {
+            break;
+        }
+        token_diagnostics = next_diagnostics;
+        next_diagnostics = next_token_diagnostics(diagnostics);
+    }
+
+    if (token.type != TOK_EOS && token.type != TOK_ERROR) {
+        struct token lookahead;
+        token_diagnostics = next_diagnostics;
+        next_diagnostics = next_token_diagnostics(diagnostics);
+        /* only positions of the look-ahead tokens, the data stays with them */
+        lookahead = token;
+        lookahead.type = TOK_EOS;
+        lookahead.text = NULL;
+        record_token(unit, &lookahead, token_diagnostics);
+        lookahead = token_next;
+        lookahead.type = TOK_EOS;
+        lookahead.text = NULL;
+        record_token(unit, &lookahead, next_diagnostics);
+    } else {
+        jacc_free(next_diagnostics);
+    }
+    buffer_free(diagnostics);
+    begin_segment();
+}
+
+static void init_scopes()
+{
+    current_symtable = 0;
+    symtables_capacity = SYMTABLE_INITIAL_DEPTH;
+    symtables = jacc_malloc(symtables_capacity * sizeof(*symtables));
+    outer_symtables = jacc_malloc(symtables_capacity * sizeof(*outer_symtables));
+    outer_symtables[0] = -1;
+}
+
+/* the pool may run a body on the thread that is parsing the top level */
+struct parser_thread_state {
+    symtable_t *symtables;
+    int *outer_symtables;
+    int symtables_capacity;
+    int current_symtable;
+    int parser_flags;
+    pull_t parser_pull;
+    int function_locals_size;
+    struct token token;
+    struct token token_next;
+    enum declaration_type cur_decl_type;
+    struct list_node *initializers_list;
+    struct parse_unit *name_unit;
+    buffer_t log;
+};
+
+static void save_thread_state(struct parser_thread_state *state)
+{
+    state->symtables = symtables;
+    state->outer_symtables = outer_symtables;
+    state->symtables_capacity = symtables_capacity;
+    state->current_symtable = current_symtable;
+    state->parser_flags = parser_flags;
+    state->parser_pull = parser_pull;
+    state->function_locals_size = function_locals_size;
+    state->token = token;
+    state->token_next = token_next;
+    state->cur_decl_type = cur_decl_type;
+    state->initializers_list = initializers_list;
+    state->name_unit = name_unit;
+    state->log = log_capture(NULL);
+}
+
+static void restore_thread_state(struct parser_thread_state *state)
+{
+    symtables = state->symtables;
+    outer_symtables = state->outer_symtables;
+    symtables_capacity = state->symtables_capacity;
+    current_symtable = state->current_symtable;
+    parser_flags = state->parser_flags;
+    parser_pull = state->parser_pull;
+    function_locals_size = state->function_locals_size;
+    token = state->token;
+    token_next = state->token_next;
+    cur_decl_type = state->cur_decl_type;
+    initializers_list = state->initializers_list;
+    name_unit = state->name_unit;
+    log_capture(state->log);
+}
+
+static void parse_body_unit(void *ctx, int index)
+{
+    struct parse_unit *unit = ((struct parse_unit**)ctx)[index];
+    struct parser_thread_state saved;
+
+    save_thread_state(&saved);
+
+    parser_pull = pull_create();
+    init_scopes();
+    symtables[0] = frozen_symtables[0];
+    push_symtable_ex(frozen_symtables[1]);
+    parser_flags = frozen_flags;
+    visible_globals = unit->visible_globals;
+    replay_unit = unit;
+    name_unit = unit;
+    log_capture(unit->log);
+
+    memset(&token, 0, sizeof(token));
+    memset(&token_next, 0, sizeof(token_next));
+    token.type = TOK_ERROR;
+    token_next.type = TOK_ERROR;
+    next_token();
+    next_token();
+
+    function_locals_size = 0;
+    cur_decl_type = DT_LOCAL;
+    push_symtable_ex(unit->function->ext->params);
+    unit->body = parse_stmt();
+    pop_symtable();
+    unit->locals_size = function_locals_size;
+    unit->parsed = 1;
+    unit->failed = unit->body == NULL;
+
+    lexer_token_free_data(&token);
+    lexer_token_free_data(&token_next);
+    replay_unit = NULL;
+    visible_globals = -1;
+    pull_destroy(parser_pull);
+    jacc_free(symtables);
+    jacc_free(outer_symtables);
+    restore_thread_state(&saved);
+}
+
 static struct node *parse_initializer()
 {
     return parse_assign_expr();
@@ -1679,7 +2054,7 @@ static struct symbol *parse_declaration()
         }
         symbol->name = symbol_name;
 
-        if (!is_typedef && HAS_FLAG(symbol->base_type->flags, SF_INCOMPLETE)) {
+        if (!is_typedef && !is_complete(symbol->base_type)) {
             parser_error("variable, field or function has incomplete type");
             return NULL;
         }
@@ -1696,14 +2071,17 @@ static struct symbol *parse_declaration()
 
         if (symbol->type == ST_FUNCTION) {
             put_symbol(symbol->name, symbol, SC_NAME);
-            if (token.type == TOK_LBRACE) {
+            if (token.type == TOK_LBRACE && parse_units != NULL && replay_unit == NULL) {
+                defer_function_body(symbol);
+                return &sym_null;
+            } else if (token.type == TOK_LBRACE) {
                 function_locals_size = 0;
                 cur_decl_type = DT_LOCAL;
-                push_symtable_ex(symbol->symtable);
-                PARSE(symbol->expr, stmt);
+                push_symtable_ex(symbol->ext->params);
+                PARSE(symbol->ext->body, stmt);
                 pop_symtable();
                 cur_decl_type = DT_GLOBAL;
-                symbol->locals_size = function_locals_size;
+                symbol->ext->locals_size = function_locals_size;
             }
         } else {
             if (accept(TOK_ASSIGN)) {
@@ -1737,7 +2115,7 @@ static struct symbol *parse_declaration()
             put_symbol(symbol->name, symbol, SC_NAME);
         }
 
-        if (symbol->type == ST_FUNCTION && symbol->expr != NULL) {
+        if (symbol->type == ST_FUNCTION && symbol->ext->body != NULL) {
             return &sym_null;
         }
     } while (accept(TOK_COMMA));
@@ -1757,8 +2135,8 @@ static void init_type(const char *name, struct symbol *symbol, int size)
 extern void parser_init()
 {
     parser_pull = pull_create();
-    current_symtable = 0;
     parser_flags = PF_RESOLVE_NAMES | PF_ADD_INITIALIZERS;
+    init_scopes();
     symtables[0] = symtable_create(SYMTABLE_DEFAULT_SIZE);
     initializers_list = NULL;
 
@@ -1771,17 +2149,17 @@ extern void parser_init()
 
     sym_char_ptr.type = ST_POINTER;
     sym_char_ptr.base_type = &sym_char;
-    sym_char_ptr.size = sym_int.size;
+    sym_char_ptr.size = parser_pointer_size;
 
     sym_printf.type = ST_FUNCTION;
     sym_printf.flags = SF_EXTERN | SF_VARIADIC;
     sym_printf.base_type = &sym_void;
-    sym_printf.symtable = symtable_create(SYMTABLE_DEFAULT_SIZE);
+    symbol_ext(&sym_printf)->params = symtable_create(SYMTABLE_DEFAULT_SIZE);
 
     struct symbol *param = alloc_symbol(ST_VARIABLE);
     param->name = "message";
     param->base_type = &sym_char_ptr;
-    symtable_set(sym_printf.symtable, param->name, SC_NAME, param);
+    symtable_set(sym_printf.ext->params, param->name, SC_NAME, param);
 
     token.type = TOK_ERROR;
     token_next.type = TOK_ERROR;
@@ -1792,6 +2170,8 @@ extern void parser_init()
 extern void parser_destroy()
 {
     symtable_destroy(symtables[0], 0);
+    jacc_free(symtables);
+    jacc_free(outer_symtables);
     pull_destroy(parser_pull);
     lexer_token_free_data(&token);
 }
@@ -1817,10 +2197,155 @@ extern struct node *parser_parse_statement()
     return safe_parsing(parse_stmt());
 }
 
+static int is_reachability_root(struct parse_unit *unit)
+{
+    int i;
+    if (!HAS_FLAG(unit->function->flags, SF_STATIC) || strcmp(unit->function->name, "main") == 0) {
+        return 1;
+    }
+    /* bodies with lexer errors are parsed to report them */
+    for (i = 0; i < unit->tokens_count; i++) {
+        if (unit->tokens[i].diagnostics != NULL || unit->tokens[i].token.type == TOK_ERROR) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void mark_uses(symtable_t definitions, struct parse_unit *unit)
+{
+    int i;
+    for (i = 0; i < unit->uses_count; i++) {
+        struct symbol *function = symtable_get(definitions, unit->uses[i]->name, SC_NAME);
+        if (function != NULL) {
+            function->flags &= ~SF_UNUSED;
+        }
+    }
+}
+
+/*
+ * Parses only the bodies reachable from main and from non-static functions,
+ * a wave of newly referenced functions at a time. The rest keep SF_UNUSED
+ * and are left out by the generator.
+ */
+static void parse_reachable_bodies()
+{
+    symtable_t definitions = symtable_create(SYMTABLE_DEFAULT_SIZE);
+    struct parse_unit **bodies = jacc_malloc(parse_units_count * sizeof(*bodies));
+    int i, bodies_count;
+
+    for (i = 0; i < parse_units_count; i++) {
+        struct parse_unit *unit = parse_units[i];
+        if (unit->function != NULL) {
+            symtable_set(definitions, unit->function->name, SC_NAME, unit->function);
+            if (!is_reachability_root(unit)) {
+                unit->function->flags |= SF_UNUSED;
+            }
+        }
+    }
+    for (i = 0; i < parse_units_count; i++) {
+        if (parse_units[i]->function == NULL) {
+            mark_uses(definitions, parse_units[i]);
+        }
+    }
+
+    do {
+        bodies_count = 0;
+        for (i = 0; i < parse_units_count; i++) {
+            struct parse_unit *unit = parse_units[i];
+            if (unit->function != NULL && !unit->parsed && !HAS_FLAG(unit->function->flags, SF_UNUSED)) {
+                bodies[bodies_count++] = unit;
+            }
+        }
+        pool_run(parser_jobs, bodies_count, parse_body_unit, bodies);
+        for (i = 0; i < bodies_count; i++) {
+            mark_uses(definitions, bodies[i]);
+        }
+    } while (bodies_count > 0);
+
+    jacc_free(bodies);
+    symtable_destroy(definitions, 1);
+}
+
+static symtable_t parse_in_units()
+{
+    symtable_t result;
+    struct parse_unit **bodies;
+    int i, bodies_count = 0;
+
+    begin_segment();
+    while (!accept(TOK_EOS)) {
+        cur_decl_type = DT_GLOBAL;
+        if (parse_declaration() == NULL) {
+            name_unit->failed = 1;
+            break;
+        }
+    }
+    if (!name_unit->failed && token.type != TOK_EOS) {
+        unexpected_token(lexer_token_type_name(TOK_EOS));
+        name_unit->failed = 1;
+    }
+    log_capture(NULL);
+    name_unit = NULL;
+
+    frozen_symtables[0] = symtables[0];
+    frozen_symtables[1] = symtables[1];
+    frozen_flags = parser_flags;
+    if (parser_lazy) {
+        parse_reachable_bodies();
+    } else {
+        bodies = jacc_malloc(parse_units_count * sizeof(*bodies));
+        for (i = 0; i < parse_units_count; i++) {
+            if (parse_units[i]->function != NULL) {
+                bodies[bodies_count++] = parse_units[i];
+            }
+        }
+        pool_run(parser_jobs, bodies_count, parse_body_unit, bodies);
+        jacc_free(bodies);
+    }
+
+    /* commit in source order, stopping where a serial parse would have */
+    result = symtables[1];
+    for (i = 0; i < parse_units_count; i++) {
+        struct parse_unit *unit = parse_units[i];
+        int j;
+        for (j = 0; j < unit->names_count; j++) {
+            sprintf(unit->names[j].buf, "%s%d", unit->names[j].prefix, ++name_uid);
+        }
+        log_write(stderr, buffer_data(unit->log), buffer_size(unit->log));
+        if (unit->failed) {
+            result = NULL;
+            break;
+        }
+        if (unit->parsed) {
+            unit->function->ext->body = unit->body;
+            unit->function->ext->locals_size = unit->locals_size;
+        }
+    }
+
+    for (i = 0; i < parse_units_count; i++) {
+        free_parse_unit(parse_units[i]);
+    }
+    jacc_free(parse_units);
+    parse_units = NULL;
+    parse_units_count = 0;
+    parse_units_capacity = 0;
+
+    pull_clear(parser_pull);
+    return result;
+}
+
 extern symtable_t parser_parse()
 {
     current_symtable = 0;
-    push_symtable();
+    if (prologue_symtable != NULL) {
+        push_symtable_ex(prologue_symtable);
+    } else {
+        push_symtable();
+    }
+    if (parser_jobs > 1 || (parser_lazy && calc_types())) {
+        return parse_in_units();
+    }
     while (!accept(TOK_EOS)) {
         cur_decl_type = DT_GLOBAL;
         if (parse_declaration() == NULL) {
@@ -1840,7 +2365,7 @@ extern void parser_free_node(struct node *node)
         return;
     }
 
-    for (i = 0; i < parser_node_info(node)->op_count; i++) {
+    for (i = 0; i < parser_node_subnodes_count(node); i++) {
         parser_free_node(parser_get_subnode(node, i));
     }
 
@@ -1857,11 +2382,32 @@ extern void parser_free_node(struct node *node)
     jacc_free(node);
 }
 
+extern struct node *parser_create_int_node(int value, struct symbol *type_sym)
+{
+    ALLOC_NODE_EX(NT_INT, node, int_node)
+    node->value = value;
+    node->base.type_sym = type_sym;
+    return (struct node*)node;
+}
+
+extern struct node *parser_create_double_node(double value, struct symbol *type_sym)
+{
+    ALLOC_NODE_EX(NT_DOUBLE, node, double_node)
+    node->value = value;
+    node->base.type_sym = type_sym;
+    return (struct node*)node;
+}
+
 extern struct node_info *parser_node_info(struct node *node)
 {
     return &nodes_info[node->type];
 }
 
+extern struct node_info *parser_node_type_info(enum node_type type)
+{
+    return &nodes_info[type];
+}
+
 extern int parser_node_subnodes_count(struct node *node)
 {
     if (node->type == NT_LIST) {
@@ -1878,11 +2424,75 @@ extern struct node *parser_get_subnode(struct node *node, int index)
     return node->ops[index];
 }
 
+extern struct node *parser_create_node(enum node_type type, int subnodes_count)
+{
+    switch (type) {
+    case NT_INT:
+        return parser_create_int_node(0, NULL);
+    case NT_DOUBLE:
+        return parser_create_double_node(0, NULL);
+    case NT_STRING:
+    case NT_IDENT:
+    {
+        ALLOC_NODE_EX(type, node, string_node)
+        return (struct node*)node;
+    }
+    case NT_VARIABLE:
+    {
+        ALLOC_NODE_EX(type, node, var_node)
+        return (struct node*)node;
+    }
+    case NT_LIST:
+    {
+        struct list_node *node = alloc_list_node();
+        list_node_ensure_capacity(node, subnodes_count);
+        node->size = subnodes_count;
+        return (struct node*)node;
+    }
+    }
+
+    struct node *node = jacc_malloc(sizeof(struct node) + subnodes_count * sizeof(struct node*));
+    init_node(node, sizeof(struct node) + subnodes_count * sizeof(struct node*), type);
+    return node;
+}
+
 extern int parser_is_void_symbol(struct symbol *symbol)
 {
     return symbol == &sym_void;
 }
 
+extern void parser_jobs_set(int jobs)
+{
+    parser_jobs = jobs;
+}
+
+extern void parser_lazy_set(int lazy)
+{
+    parser_lazy = lazy;
+}
+
+extern void parser_pointer_size_set(int size)
+{
+    parser_pointer_size = size;
+    sym_char_ptr.size = size;
+}
+
+extern int parser_pointer_size_get()
+{
+    return parser_pointer_size;
+}
+
+extern void parser_prologue_set(symtable_t globals, int names_count)
+{
+    prologue_symtable = globals;
+    name_uid = names_count;
+}
+
+extern int parser_names_count()
+{
+    return name_uid;
+}
+
 extern void parser_flags_set(int new_flags)
 {
     parser_flags = new_flags;
@@ -13,7 +13,7 @@
     };
 
 enum node_type {
-#define NODE(name, str, cat, op_cnt) NT_##name,
+#define NODE(name, str, cat, op_cnt, prec) NT_##name,
 #include "nodes.def"
 #undef NODE
 };
@@ -32,6 +32,7 @@ struct node_info {
     const char *repr;
     enum node_category cat;
     int op_count;
+    int prec;
 };
 
 struct node {
@@ -73,7 +74,7 @@ struct cast_node {
     struct node *ops[1];
 };
 
-#define NODE(name, str, cat, op_cnt) \
+#define NODE(name, str, cat, op_cnt, prec) \
 struct node_NT_##name { \
     enum node_type type; \
     symtable_t symtable; \
@@ -94,12 +95,28 @@ extern struct node *parser_parse_statement();
 extern symtable_t parser_parse();
 
 extern void parser_free_node(struct node *node);
+extern struct node *parser_create_int_node(int value, struct symbol *type_sym);
+extern struct node *parser_create_double_node(double value, struct symbol *type_sym);
+/* a zeroed node with room for subnodes_count operands or list items */
+extern struct node *parser_create_node(enum node_type type, int subnodes_count);
 extern struct node_info *parser_node_info(struct node *node);
+extern struct node_info *parser_node_type_info(enum node_type type);
 extern int parser_node_subnodes_count(struct node *node);
 extern struct node *parser_get_subnode(struct node *node, int index);
 
 extern int parser_is_void_symbol(struct symbol *symbol);
 
+/* parse function bodies on this many threads, output is the same as with 1 */
+extern void parser_jobs_set(int jobs);
+/* skip bodies not reachable from main or non-static functions, see SF_UNUSED */
+extern void parser_lazy_set(int lazy);
+/* pointers are 4 bytes unless the target needs more, set before parsing */
+extern void parser_pointer_size_set(int size);
+extern int parser_pointer_size_get();
+/* start the global scope from a snapshot, e.g. a prologue loaded by image_load() */
+extern void parser_prologue_set(symtable_t globals, int names_count);
+extern int parser_names_count();
+
 extern void parser_flags_set(int new_flags);
 extern int parser_flags_get();
 
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include "memory.h"
+#include "pool.h"
+#include "stack.h"
+
+struct pool_data {
+    int count;
+    int next;
+    pool_func_t func;
+    void *ctx;
+};
+
+static void run_items(struct pool_data *pool)
+{
+    for (;;) {
+        int index = __sync_fetch_and_add(&pool->next, 1);
+        if (index >= pool->count) {
+            break;
+        }
+        pool->func(pool->ctx, index);
+    }
+}
+
+static void *pool_worker(void *arg)
+{
+    run_items(arg);
+    return NULL;
+}
+
+extern void pool_run(int jobs, int count, pool_func_t func, void *ctx)
+{
+    struct pool_data pool = { count, 0, func, ctx };
+    struct stack_thread *threads;
+    int i, started = 0;
+
+    if (jobs > count) {
+        jobs = count;
+    }
+    if (jobs <= 1) {
+        for (i = 0; i < count; i++) {
+            func(ctx, i);
+        }
+        return;
+    }
+
+    threads = jacc_malloc((jobs - 1) * sizeof(*threads));
+    for (i = 0; i < jobs - 1; i++) {
+        if (stack_thread_start(&threads[started], pool_worker, &pool)) {
+            started++;
+        }
+    }
+
+    /* the calling thread takes items too, so none are left if a thread fails to start */
+    run_items(&pool);
+    for (i = 0; i < started; i++) {
+        stack_thread_join(&threads[i]);
+    }
+    jacc_free(threads);
+}
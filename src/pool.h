@@ -0,0 +1,14 @@
+#ifndef JACC_POOL_H
+#define JACC_POOL_H
+
+/*
+ * Fixed-size thread pool for independent work items. pool_run() calls
+ * func(ctx, i) once for every i in [0, count) on up to jobs threads and
+ * returns when all items are done. Items are claimed in increasing order.
+ */
+
+typedef void (*pool_func_t)(void *ctx, int index);
+
+extern void pool_run(int jobs, int count, pool_func_t func, void *ctx);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include "memory.h"
+#include "ptrmap.h"
+
+struct ptrmap_data {
+    const void **keys;
+    uintptr_t *values;
+    int count;
+    int capacity;
+};
+
+static int hash(const void *key, int capacity)
+{
+    return (int)((((uintptr_t)key >> 3) * 2654435761u) & (capacity - 1));
+}
+
+extern ptrmap_t ptrmap_create()
+{
+    return jacc_calloc(1, sizeof(struct ptrmap_data));
+}
+
+extern void ptrmap_destroy(ptrmap_t map)
+{
+    if (map == NULL) {
+        return;
+    }
+    jacc_free(map->keys);
+    jacc_free(map->values);
+    jacc_free(map);
+}
+
+extern uintptr_t ptrmap_get(ptrmap_t map, const void *key)
+{
+    int i;
+    if (map->capacity == 0) {
+        return 0;
+    }
+    for (i = hash(key, map->capacity); map->keys[i] != NULL; i = (i + 1) & (map->capacity - 1)) {
+        if (map->keys[i] == key) {
+            return map->values[i];
+        }
+    }
+    return 0;
+}
+
+static void grow(ptrmap_t map)
+{
+    struct ptrmap_data old = *map;
+    int i;
+    map->capacity = old.capacity == 0 ? 256 : old.capacity * 2;
+    map->keys = jacc_calloc(map->capacity, sizeof(*map->keys));
+    map->values = jacc_malloc(map->capacity * sizeof(*map->values));
+    map->count = 0;
+    for (i = 0; i < old.capacity; i++) {
+        if (old.keys[i] != NULL) {
+            ptrmap_set(map, old.keys[i], old.values[i]);
+        }
+    }
+    jacc_free(old.keys);
+    jacc_free(old.values);
+}
+
+extern void ptrmap_set(ptrmap_t map, const void *key, uintptr_t value)
+{
+    int i;
+    if ((map->count + 1) * 2 > map->capacity) {
+        grow(map);
+    }
+    for (i = hash(key, map->capacity); map->keys[i] != NULL; i = (i + 1) & (map->capacity - 1)) {
+        if (map->keys[i] == key) {
+            map->values[i] = value;
+            return;
+        }
+    }
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+}
+
+extern int ptrmap_size(ptrmap_t map)
+{
+    return map->count;
+}
@@ -0,0 +1,16 @@
+#ifndef JACC_PTRMAP_H
+#define JACC_PTRMAP_H
+
+#include <stdint.h>
+
+/* open addressing map from non-NULL addresses to values, 0 meaning absent */
+typedef struct ptrmap_data *ptrmap_t;
+
+extern ptrmap_t ptrmap_create();
+extern void ptrmap_destroy(ptrmap_t map);
+
+extern uintptr_t ptrmap_get(ptrmap_t map, const void *key);
+extern void ptrmap_set(ptrmap_t map, const void *key, uintptr_t value);
+extern int ptrmap_size(ptrmap_t map);
+
+#endif
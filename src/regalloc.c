@@ -0,0 +1,307 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "cfg.h"
+#include "regalloc.h"
+
+struct interval {
+    int reg;
+    int start;
+    int end;
+    unsigned forbidden;
+};
+
+struct positions {
+    int *data;
+    int count;
+    int capacity;
+};
+
+struct liveness {
+    ir_function_t function;
+    cfg_t cfg;
+    struct interval *intervals;
+    int *block_start;
+    int *block_end;
+    /* upward exposed uses: blocks the registers are live into, chained per register */
+    int *seed_head;
+    int *seed_next;
+    int *seed_block;
+    int seeds_count;
+    int seeds_capacity;
+    /* blocks defining each register, chained the same way */
+    int *def_head;
+    int *def_next;
+    int *def_block;
+    int defs_count;
+    int defs_capacity;
+    struct positions calls;
+    struct positions shifts;
+};
+
+static void add_position(struct positions *positions, int pos)
+{
+    if (positions->count == positions->capacity) {
+        positions->capacity = positions->capacity == 0 ? 16 : positions->capacity * 2;
+        positions->data = jacc_realloc(positions->data, positions->capacity * sizeof(*positions->data));
+    }
+    positions->data[positions->count++] = pos;
+}
+
+static void extend(struct interval *interval, int pos)
+{
+    if (pos < interval->start) {
+        interval->start = pos;
+    }
+    if (pos > interval->end) {
+        interval->end = pos;
+    }
+}
+
+static void add_link(int **next, int **blocks, int *count, int *capacity, int *head, int block)
+{
+    if (*count == *capacity) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        *next = jacc_realloc(*next, *capacity * sizeof(**next));
+        *blocks = jacc_realloc(*blocks, *capacity * sizeof(**blocks));
+    }
+    (*next)[*count] = *head;
+    (*blocks)[*count] = block;
+    *head = (*count)++;
+}
+
+static void use(struct liveness *l, struct ir_value value, int block, int pos, int *defined_in)
+{
+    if (value.kind != IRV_REG) {
+        return;
+    }
+    extend(&l->intervals[value.value], pos);
+    if (defined_in[value.value] != block) {
+        add_link(&l->seed_next, &l->seed_block, &l->seeds_count, &l->seeds_capacity, &l->seed_head[value.value], block);
+    }
+}
+
+/* numbers the instructions and collects local uses and definitions */
+static void scan_blocks(struct liveness *l)
+{
+    ir_function_t f = l->function;
+    int *defined_in = jacc_malloc((f->regs_count + 1) * sizeof(*defined_in));
+    int i, j, k, pos = 0;
+
+    for (i = 0; i <= f->regs_count; i++) {
+        defined_in[i] = -1;
+    }
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        l->block_start[i] = pos;
+        for (j = 0; j < block->count; j++, pos++) {
+            struct ir_insn *insn = &block->insns[j];
+            use(l, insn->ops[0], i, pos, defined_in);
+            use(l, insn->ops[1], i, pos, defined_in);
+            for (k = 0; k < insn->args_count; k++) {
+                use(l, insn->args[k], i, pos, defined_in);
+            }
+            if (insn->dst != 0) {
+                extend(&l->intervals[insn->dst], pos);
+                if (defined_in[insn->dst] != i) {
+                    defined_in[insn->dst] = i;
+                    add_link(&l->def_next, &l->def_block, &l->defs_count, &l->defs_capacity, &l->def_head[insn->dst], i);
+                }
+            }
+            if (insn->op == IR_CALL) {
+                add_position(&l->calls, pos);
+            } else if ((insn->op == IR_SHL || insn->op == IR_SAR) && insn->ops[1].kind != IRV_INT) {
+                add_position(&l->shifts, pos);
+            }
+        }
+        l->block_end[i] = pos - 1;
+    }
+    jacc_free(defined_in);
+}
+
+/* walks back from the uses of each register until its definitions */
+static void propagate_liveness(struct liveness *l)
+{
+    ir_function_t f = l->function;
+    int *live_in = jacc_malloc(f->blocks_count * sizeof(*live_in));
+    int *defines = jacc_malloc(f->blocks_count * sizeof(*defines));
+    int *worklist = jacc_malloc(f->blocks_count * sizeof(*worklist));
+    int i, reg, link;
+
+    for (i = 0; i < f->blocks_count; i++) {
+        live_in[i] = defines[i] = 0;
+    }
+    for (reg = 1; reg <= f->regs_count; reg++) {
+        int top = 0;
+        for (link = l->def_head[reg]; link != -1; link = l->def_next[link]) {
+            defines[l->def_block[link]] = reg;
+        }
+        for (link = l->seed_head[reg]; link != -1; link = l->seed_next[link]) {
+            if (live_in[l->seed_block[link]] != reg) {
+                live_in[l->seed_block[link]] = reg;
+                worklist[top++] = l->seed_block[link];
+            }
+        }
+        while (top > 0) {
+            int block = worklist[--top];
+            struct cfg_edges *preds = &l->cfg->preds[block];
+            extend(&l->intervals[reg], l->block_start[block]);
+            for (i = 0; i < preds->count; i++) {
+                int pred = preds->blocks[i];
+                extend(&l->intervals[reg], l->block_end[pred]);
+                if (defines[pred] != reg && live_in[pred] != reg) {
+                    live_in[pred] = reg;
+                    worklist[top++] = pred;
+                }
+            }
+        }
+    }
+    jacc_free(worklist);
+    jacc_free(defines);
+    jacc_free(live_in);
+}
+
+/* whether some position lies strictly inside the interval */
+static int crosses(struct positions *positions, struct interval *interval)
+{
+    int low = 0, high = positions->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (positions->data[mid] <= interval->start) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < positions->count && positions->data[low] < interval->end;
+}
+
+static int compare_starts(const void *a, const void *b)
+{
+    const struct interval *i1 = *(struct interval * const *)a, *i2 = *(struct interval * const *)b;
+    if (i1->start != i2->start) {
+        return i1->start < i2->start ? -1 : 1;
+    }
+    return i1->reg - i2->reg;
+}
+
+static void scan(struct interval **sorted, int count, struct regalloc_pool *pool, int *assignment)
+{
+    struct interval **active = jacc_malloc((pool->count + 1) * sizeof(*active));
+    int i, j, active_count = 0;
+    unsigned used = 0;
+
+    for (i = 0; i < count; i++) {
+        struct interval *current = sorted[i];
+        int chosen = -1;
+
+        /* intervals ending here give their register up */
+        for (j = 0; j < active_count; j++) {
+            if (active[j]->end <= current->start) {
+                used &= ~(1u << assignment[active[j]->reg]);
+                active[j--] = active[--active_count];
+            }
+        }
+
+        for (j = 0; j < pool->count && chosen == -1; j++) {
+            if (!((used | current->forbidden) & (1u << j))) {
+                chosen = j;
+            }
+        }
+        if (chosen == -1) {
+            /* spill the allowed interval living longest */
+            int victim = -1;
+            for (j = 0; j < active_count; j++) {
+                if (!(current->forbidden & (1u << assignment[active[j]->reg]))
+                    && active[j]->end > current->end
+                    && (victim == -1 || active[j]->end > active[victim]->end)) {
+                    victim = j;
+                }
+            }
+            if (victim == -1) {
+                continue;
+            }
+            chosen = assignment[active[victim]->reg];
+            assignment[active[victim]->reg] = -1;
+            active[victim] = active[--active_count];
+        }
+
+        assignment[current->reg] = chosen;
+        used |= 1u << chosen;
+        active[active_count++] = current;
+    }
+    jacc_free(active);
+}
+
+/* the intervals of one register class, int and pointer or double, against their pool */
+static void allocate_class(struct liveness *l, int doubles, struct regalloc_pool *pool, int *assignment)
+{
+    ir_function_t function = l->function;
+    struct interval **sorted = jacc_malloc((function->regs_count + 1) * sizeof(*sorted));
+    int i, count = 0;
+
+    for (i = 1; i <= function->regs_count; i++) {
+        struct interval *interval = &l->intervals[i];
+        if ((function->reg_types[i] == IRT_DOUBLE) != doubles || interval->end == -1) {
+            continue;
+        }
+        if (crosses(&l->calls, interval)) {
+            interval->forbidden |= pool->call_clobbers;
+        }
+        if (crosses(&l->shifts, interval)) {
+            interval->forbidden |= pool->shift_clobbers;
+        }
+        sorted[count++] = interval;
+    }
+    qsort(sorted, count, sizeof(*sorted), compare_starts);
+    scan(sorted, count, pool, assignment);
+    jacc_free(sorted);
+}
+
+extern int *regalloc_linear_scan(ir_function_t function, struct regalloc_pool *pool, struct regalloc_pool *double_pool)
+{
+    struct liveness l;
+    int n = function->regs_count;
+    int *assignment = jacc_malloc((n + 1) * sizeof(*assignment));
+    int i;
+
+    memset(&l, 0, sizeof(l));
+    l.function = function;
+    l.cfg = cfg_build(function);
+    l.intervals = jacc_malloc((n + 1) * sizeof(*l.intervals));
+    l.block_start = jacc_malloc(function->blocks_count * sizeof(*l.block_start));
+    l.block_end = jacc_malloc(function->blocks_count * sizeof(*l.block_end));
+    l.seed_head = jacc_malloc((n + 1) * sizeof(*l.seed_head));
+    l.def_head = jacc_malloc((n + 1) * sizeof(*l.def_head));
+    for (i = 0; i <= n; i++) {
+        l.intervals[i].reg = i;
+        l.intervals[i].start = INT_MAX;
+        l.intervals[i].end = -1;
+        l.intervals[i].forbidden = 0;
+        l.seed_head[i] = l.def_head[i] = -1;
+        assignment[i] = -1;
+    }
+
+    scan_blocks(&l);
+    propagate_liveness(&l);
+
+    allocate_class(&l, 0, pool, assignment);
+    if (double_pool != NULL) {
+        allocate_class(&l, 1, double_pool, assignment);
+    }
+
+    jacc_free(l.calls.data);
+    jacc_free(l.shifts.data);
+    jacc_free(l.seed_head);
+    jacc_free(l.seed_next);
+    jacc_free(l.seed_block);
+    jacc_free(l.def_head);
+    jacc_free(l.def_next);
+    jacc_free(l.def_block);
+    jacc_free(l.block_start);
+    jacc_free(l.block_end);
+    jacc_free(l.intervals);
+    cfg_destroy(l.cfg);
+    return assignment;
+}
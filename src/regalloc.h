@@ -0,0 +1,30 @@
+#ifndef JACC_REGALLOC_H
+#define JACC_REGALLOC_H
+
+#include "ir.h"
+
+/*
+ * Linear scan allocation of the virtual registers of a function
+ * out of SSA form, blocks being laid out in their order. Live intervals
+ * are the hull of every position a register is live at, so an interval ending
+ * where another starts may share its register: the instruction reads
+ * its operands before writing its result.
+ *
+ * Pool registers in call_clobbers are not given to intervals live across
+ * a call, the ones in shift_clobbers to intervals live across a shift by
+ * a register amount.
+ */
+
+struct regalloc_pool {
+    int count;
+    unsigned call_clobbers;
+    unsigned shift_clobbers;
+};
+
+/*
+ * Pool index of each register, -1 for spilled ones; index 0 is unused.
+ * Doubles take their index in double_pool, they are all spilled without one.
+ */
+extern int *regalloc_linear_scan(ir_function_t function, struct regalloc_pool *pool, struct regalloc_pool *double_pool);
+
+#endif
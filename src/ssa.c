@@ -0,0 +1,655 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "parser.h"
+#include "ptrmap.h"
+#include "cfg.h"
+#include "ssa.h"
+
+struct variable {
+    struct symbol *symbol;
+    enum ir_type type;
+    int size;
+    int escaped;
+    int has_loads;
+    /* blocks storing to the variable, each listed once */
+    int *def_blocks;
+    int defs_count;
+    int last_def_block;
+    /* reaching definitions during renaming, the value on entry below them */
+    struct ir_value *defs;
+    int defs_top;
+    int defs_capacity;
+    struct ir_value entry_value;
+};
+
+struct phi_list {
+    struct ir_insn *insns;
+    /* variable of each phi */
+    int *vars;
+    int count;
+    int capacity;
+};
+
+struct ssa {
+    ir_function_t function;
+    cfg_t cfg;
+    ptrmap_t var_ids;
+    struct variable *vars;
+    int vars_count;
+    int vars_capacity;
+    struct phi_list *phis;
+    /* parameter loads put at the start of the entry block */
+    struct ir_insn *entry_loads;
+    int entry_loads_count;
+    /* registers of removed loads and phis to the values replacing them */
+    struct ir_value *replace;
+};
+
+static struct variable *find_variable(struct ssa *s, struct symbol *symbol)
+{
+    int id = ptrmap_get(s->var_ids, symbol);
+    if (id != 0) {
+        return &s->vars[id - 1];
+    }
+    if (s->vars_count == s->vars_capacity) {
+        s->vars_capacity = s->vars_capacity == 0 ? 16 : s->vars_capacity * 2;
+        s->vars = jacc_realloc(s->vars, s->vars_capacity * sizeof(*s->vars));
+    }
+    struct variable *var = &s->vars[s->vars_count++];
+    memset(var, 0, sizeof(*var));
+    var->symbol = symbol;
+    var->size = resolve_alias(symbol)->size;
+    var->type = IRT_VOID;
+    var->escaped = var->size != 4 && var->size != 8;
+    var->last_def_block = -1;
+    ptrmap_set(s->var_ids, symbol, s->vars_count);
+    return var;
+}
+
+static int var_index(struct ssa *s, struct variable *var)
+{
+    return var - s->vars;
+}
+
+/* the promoted variable accessed by a load or store, NULL for other memory */
+static struct variable *accessed_variable(struct ssa *s, struct ir_insn *insn)
+{
+    struct variable *var;
+    if (insn->ops[0].kind != IRV_LOCAL) {
+        return NULL;
+    }
+    var = &s->vars[ptrmap_get(s->var_ids, insn->ops[0].symbol) - 1];
+    return var->escaped ? NULL : var;
+}
+
+static void escape(struct ssa *s, struct ir_value value)
+{
+    if (value.kind == IRV_LOCAL) {
+        find_variable(s, value.symbol)->escaped = 1;
+    }
+}
+
+static void note_access(struct ssa *s, struct ir_insn *insn, int block)
+{
+    struct variable *var = find_variable(s, insn->ops[0].symbol);
+    if (var->type == IRT_VOID) {
+        var->type = insn->type;
+    }
+    if (insn->ops[0].value != 0 || insn->size != var->size || insn->type != var->type) {
+        var->escaped = 1;
+    } else if (insn->op == IR_LOAD) {
+        var->has_loads = 1;
+    } else if (var->last_def_block != block) {
+        var->last_def_block = block;
+        var->def_blocks = jacc_realloc(var->def_blocks, (var->defs_count + 1) * sizeof(*var->def_blocks));
+        var->def_blocks[var->defs_count++] = block;
+    }
+}
+
+/* finds the variables to promote, any use of an address other than a load or store escapes it */
+static void collect_variables(struct ssa *s)
+{
+    ir_function_t f = s->function;
+    int i, j, k;
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            struct ir_insn *insn = &block->insns[j];
+            if ((insn->op == IR_LOAD || insn->op == IR_STORE) && insn->ops[0].kind == IRV_LOCAL) {
+                note_access(s, insn, i);
+            } else {
+                escape(s, insn->ops[0]);
+            }
+            escape(s, insn->ops[1]);
+            for (k = 0; k < insn->args_count; k++) {
+                escape(s, insn->args[k]);
+            }
+        }
+    }
+}
+
+static struct cfg_edges *dominance_frontiers(cfg_t cfg)
+{
+    struct cfg_edges *frontiers = jacc_calloc(cfg->blocks_count, sizeof(*frontiers));
+    int *last_added = jacc_malloc(cfg->blocks_count * sizeof(*last_added));
+    int i, j;
+
+    for (i = 0; i < cfg->blocks_count; i++) {
+        last_added[i] = -1;
+    }
+    for (i = 0; i < cfg->rpo_count; i++) {
+        int block = cfg->rpo[i];
+        if (cfg->preds[block].count < 2) {
+            continue;
+        }
+        for (j = 0; j < cfg->preds[block].count; j++) {
+            int runner = cfg->preds[block].blocks[j];
+            if (runner != 0 && cfg->idom[runner] == -1) {
+                continue;
+            }
+            while (runner != cfg->idom[block] && last_added[runner] != block) {
+                struct cfg_edges *frontier = &frontiers[runner];
+                last_added[runner] = block;
+                frontier->blocks = jacc_realloc(frontier->blocks, (frontier->count + 1) * sizeof(*frontier->blocks));
+                frontier->blocks[frontier->count++] = block;
+                runner = cfg->idom[runner];
+            }
+        }
+    }
+    jacc_free(last_added);
+    return frontiers;
+}
+
+static struct ir_value undefined_value(enum ir_type type)
+{
+    return type == IRT_DOUBLE ? ir_double(0) : ir_int(0);
+}
+
+static void add_phi(struct ssa *s, int block, int var_id)
+{
+    struct phi_list *list = &s->phis[block];
+    struct variable *var = &s->vars[var_id];
+    struct cfg_edges *preds = &s->cfg->preds[block];
+    int i;
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        list->insns = jacc_realloc(list->insns, list->capacity * sizeof(*list->insns));
+        list->vars = jacc_realloc(list->vars, list->capacity * sizeof(*list->vars));
+    }
+    struct ir_insn *phi = &list->insns[list->count];
+    list->vars[list->count++] = var_id;
+    memset(phi, 0, sizeof(*phi));
+    phi->op = IR_PHI;
+    phi->type = var->type;
+    phi->dst = ir_reg_create(s->function, var->type);
+    phi->args_count = phi->targets_count = preds->count;
+    phi->args = jacc_malloc(preds->count * sizeof(*phi->args));
+    phi->targets = jacc_malloc(preds->count * sizeof(*phi->targets));
+    for (i = 0; i < preds->count; i++) {
+        phi->args[i] = undefined_value(var->type);
+        phi->targets[i] = preds->blocks[i];
+    }
+}
+
+/* phis go on the iterated dominance frontier of the blocks storing to each variable */
+static void place_phis(struct ssa *s)
+{
+    struct cfg_edges *frontiers = dominance_frontiers(s->cfg);
+    int n = s->function->blocks_count;
+    int *has_phi = jacc_malloc(n * sizeof(*has_phi));
+    int *queued = jacc_malloc(n * sizeof(*queued));
+    int *worklist = jacc_malloc(n * sizeof(*worklist));
+    int i, j, v;
+
+    for (i = 0; i < n; i++) {
+        has_phi[i] = queued[i] = -1;
+    }
+    for (v = 0; v < s->vars_count; v++) {
+        struct variable *var = &s->vars[v];
+        int top = 0;
+        if (var->escaped) {
+            continue;
+        }
+        for (i = 0; i < var->defs_count; i++) {
+            worklist[top++] = var->def_blocks[i];
+            queued[var->def_blocks[i]] = v;
+        }
+        while (top > 0) {
+            struct cfg_edges *frontier = &frontiers[worklist[--top]];
+            for (j = 0; j < frontier->count; j++) {
+                int block = frontier->blocks[j];
+                if (has_phi[block] == v) {
+                    continue;
+                }
+                has_phi[block] = v;
+                add_phi(s, block, v);
+                if (queued[block] != v) {
+                    queued[block] = v;
+                    worklist[top++] = block;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        jacc_free(frontiers[i].blocks);
+    }
+    jacc_free(frontiers);
+    jacc_free(worklist);
+    jacc_free(queued);
+    jacc_free(has_phi);
+}
+
+/* promoted parameters start from their value in memory */
+static void load_parameters(struct ssa *s)
+{
+    int v;
+    for (v = 0; v < s->vars_count; v++) {
+        struct variable *var = &s->vars[v];
+        var->entry_value = undefined_value(var->type);
+        if (var->escaped || !var->has_loads || var->symbol->type != ST_PARAMETER) {
+            continue;
+        }
+        s->entry_loads = jacc_realloc(s->entry_loads, (s->entry_loads_count + 1) * sizeof(*s->entry_loads));
+        struct ir_insn *load = &s->entry_loads[s->entry_loads_count++];
+        memset(load, 0, sizeof(*load));
+        load->op = IR_LOAD;
+        load->type = var->type;
+        load->size = var->size;
+        load->dst = ir_reg_create(s->function, var->type);
+        load->ops[0] = ir_local(var->symbol, 0);
+        var->entry_value = ir_reg(load->dst);
+    }
+}
+
+static void push_def(struct variable *var, struct ir_value value)
+{
+    if (var->defs_top == var->defs_capacity) {
+        var->defs_capacity = var->defs_capacity == 0 ? 8 : var->defs_capacity * 2;
+        var->defs = jacc_realloc(var->defs, var->defs_capacity * sizeof(*var->defs));
+    }
+    var->defs[var->defs_top++] = value;
+}
+
+static struct ir_value current_def(struct variable *var)
+{
+    return var->defs_top == 0 ? var->entry_value : var->defs[var->defs_top - 1];
+}
+
+struct rename_state {
+    /* variables defined in the blocks being visited, -1 marking a block start */
+    int *log;
+    int log_count;
+    int log_capacity;
+};
+
+static void log_def(struct rename_state *state, int var_id)
+{
+    if (state->log_count == state->log_capacity) {
+        state->log_capacity = state->log_capacity == 0 ? 64 : state->log_capacity * 2;
+        state->log = jacc_realloc(state->log, state->log_capacity * sizeof(*state->log));
+    }
+    state->log[state->log_count++] = var_id;
+}
+
+/* drops promoted loads and stores, and fills the phi inputs of the successors */
+static void rename_block(struct ssa *s, struct rename_state *state, int block_id)
+{
+    struct ir_block *block = s->function->blocks[block_id];
+    struct phi_list *phis = &s->phis[block_id];
+    struct cfg_edges *succs = &s->cfg->succs[block_id];
+    int i, j, count = 0;
+
+    log_def(state, -1);
+    for (i = 0; i < phis->count; i++) {
+        push_def(&s->vars[phis->vars[i]], ir_reg(phis->insns[i].dst));
+        log_def(state, phis->vars[i]);
+    }
+
+    for (i = 0; i < block->count; i++) {
+        struct ir_insn *insn = &block->insns[i];
+        struct variable *var = NULL;
+        if (insn->op == IR_LOAD || insn->op == IR_STORE) {
+            var = accessed_variable(s, insn);
+        }
+        if (var == NULL) {
+            block->insns[count++] = *insn;
+        } else if (insn->op == IR_LOAD) {
+            s->replace[insn->dst] = current_def(var);
+        } else {
+            push_def(var, insn->ops[1]);
+            log_def(state, var_index(s, var));
+        }
+    }
+    block->count = count;
+
+    for (i = 0; i < succs->count; i++) {
+        struct phi_list *succ_phis = &s->phis[succs->blocks[i]];
+        int index = cfg_pred_index(s->cfg, succs->blocks[i], block_id);
+        for (j = 0; j < succ_phis->count; j++) {
+            succ_phis->insns[j].args[index] = current_def(&s->vars[succ_phis->vars[j]]);
+        }
+    }
+}
+
+static void unwind_block(struct ssa *s, struct rename_state *state)
+{
+    while (state->log[--state->log_count] != -1) {
+        s->vars[state->log[state->log_count]].defs_top--;
+    }
+}
+
+/* preorder walk of the dominator tree, negative entries leave a block */
+static void rename_variables(struct ssa *s)
+{
+    struct rename_state state;
+    int *stack = jacc_malloc(2 * s->function->blocks_count * sizeof(*stack));
+    int i, top = 0;
+
+    memset(&state, 0, sizeof(state));
+    stack[top++] = 0;
+    while (top > 0) {
+        int entry = stack[--top];
+        if (entry < 0) {
+            unwind_block(s, &state);
+            continue;
+        }
+        rename_block(s, &state, entry);
+        stack[top++] = -1;
+        for (i = s->cfg->children[entry].count - 1; i >= 0; i--) {
+            stack[top++] = s->cfg->children[entry].blocks[i];
+        }
+    }
+    jacc_free(state.log);
+    jacc_free(stack);
+}
+
+static struct ir_value resolve(struct ssa *s, struct ir_value value)
+{
+    while (value.kind == IRV_REG && s->replace[value.value].kind != IRV_NONE) {
+        value = s->replace[value.value];
+    }
+    return value;
+}
+
+static int same_value(struct ir_value a, struct ir_value b)
+{
+    return a.kind == b.kind && a.value == b.value && a.symbol == b.symbol
+        && a.string == b.string && (a.kind != IRV_DOUBLE || a.dvalue == b.dvalue);
+}
+
+static void resolve_insn(struct ssa *s, struct ir_insn *insn)
+{
+    int i;
+    insn->ops[0] = resolve(s, insn->ops[0]);
+    insn->ops[1] = resolve(s, insn->ops[1]);
+    for (i = 0; i < insn->args_count; i++) {
+        insn->args[i] = resolve(s, insn->args[i]);
+    }
+}
+
+static void remove_phi(struct phi_list *list, int index)
+{
+    jacc_free(list->insns[index].args);
+    jacc_free(list->insns[index].targets);
+    list->count--;
+    list->insns[index] = list->insns[list->count];
+    list->vars[index] = list->vars[list->count];
+}
+
+/* a phi merging one value besides itself is replaced by that value */
+static void remove_trivial_phis(struct ssa *s)
+{
+    int i, j, k, changed = 1;
+    while (changed) {
+        changed = 0;
+        for (i = 0; i < s->function->blocks_count; i++) {
+            struct phi_list *list = &s->phis[i];
+            for (j = 0; j < list->count; j++) {
+                struct ir_insn *phi = &list->insns[j];
+                struct ir_value self = ir_reg(phi->dst), unique = ir_none();
+                int distinct = 0;
+                resolve_insn(s, phi);
+                for (k = 0; k < phi->args_count && distinct < 2; k++) {
+                    if (same_value(phi->args[k], self) || (distinct == 1 && same_value(phi->args[k], unique))) {
+                        continue;
+                    }
+                    unique = phi->args[k];
+                    distinct++;
+                }
+                if (distinct < 2) {
+                    s->replace[phi->dst] = distinct == 0 ? undefined_value(phi->type) : unique;
+                    remove_phi(list, j--);
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static void count_use(int *uses, struct ir_value value, int delta)
+{
+    if (value.kind == IRV_REG) {
+        uses[value.value] += delta;
+    }
+}
+
+/* phis whose result is only used by dead phis go away */
+static void remove_dead_phis(struct ssa *s)
+{
+    ir_function_t f = s->function;
+    int *uses = jacc_calloc(f->regs_count + 1, sizeof(*uses));
+    int i, j, k, changed = 1;
+
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            resolve_insn(s, &block->insns[j]);
+            count_use(uses, block->insns[j].ops[0], 1);
+            count_use(uses, block->insns[j].ops[1], 1);
+            for (k = 0; k < block->insns[j].args_count; k++) {
+                count_use(uses, block->insns[j].args[k], 1);
+            }
+        }
+        for (j = 0; j < s->phis[i].count; j++) {
+            struct ir_insn *phi = &s->phis[i].insns[j];
+            for (k = 0; k < phi->args_count; k++) {
+                if (!same_value(phi->args[k], ir_reg(phi->dst))) {
+                    count_use(uses, phi->args[k], 1);
+                }
+            }
+        }
+    }
+
+    while (changed) {
+        changed = 0;
+        for (i = 0; i < f->blocks_count; i++) {
+            struct phi_list *list = &s->phis[i];
+            for (j = 0; j < list->count; j++) {
+                struct ir_insn *phi = &list->insns[j];
+                if (uses[phi->dst] != 0) {
+                    continue;
+                }
+                for (k = 0; k < phi->args_count; k++) {
+                    if (!same_value(phi->args[k], ir_reg(phi->dst))) {
+                        count_use(uses, phi->args[k], -1);
+                    }
+                }
+                remove_phi(list, j--);
+                changed = 1;
+            }
+        }
+    }
+    jacc_free(uses);
+}
+
+/* puts phis and parameter loads in front of the remaining instructions */
+static void rebuild_blocks(struct ssa *s)
+{
+    ir_function_t f = s->function;
+    int i, j;
+    for (i = 0; i < f->blocks_count; i++) {
+        struct ir_block *block = f->blocks[i];
+        struct phi_list *phis = &s->phis[i];
+        int extra = phis->count + (i == 0 ? s->entry_loads_count : 0);
+        if (extra != 0) {
+            if (block->count + extra > block->capacity) {
+                block->capacity = block->count + extra;
+                block->insns = jacc_realloc(block->insns, block->capacity * sizeof(*block->insns));
+            }
+            memmove(block->insns + extra, block->insns, block->count * sizeof(*block->insns));
+            memcpy(block->insns, phis->insns, phis->count * sizeof(*block->insns));
+            if (i == 0) {
+                memcpy(block->insns + phis->count, s->entry_loads, s->entry_loads_count * sizeof(*block->insns));
+            }
+            block->count += extra;
+        }
+        for (j = 0; j < block->count; j++) {
+            resolve_insn(s, &block->insns[j]);
+        }
+        jacc_free(phis->insns);
+        jacc_free(phis->vars);
+    }
+}
+
+extern void ssa_construct(ir_function_t function)
+{
+    struct ssa s;
+    int i, promoted = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.function = function;
+    s.var_ids = ptrmap_create();
+    collect_variables(&s);
+    for (i = 0; i < s.vars_count; i++) {
+        promoted += !s.vars[i].escaped;
+    }
+
+    if (promoted != 0) {
+        s.cfg = cfg_build(function);
+        s.phis = jacc_calloc(function->blocks_count, sizeof(*s.phis));
+        place_phis(&s);
+        load_parameters(&s);
+        s.replace = jacc_calloc(function->regs_count + 1, sizeof(*s.replace));
+        rename_variables(&s);
+        remove_trivial_phis(&s);
+        remove_dead_phis(&s);
+        rebuild_blocks(&s);
+        jacc_free(s.replace);
+        jacc_free(s.entry_loads);
+        jacc_free(s.phis);
+        cfg_destroy(s.cfg);
+    }
+
+    for (i = 0; i < s.vars_count; i++) {
+        jacc_free(s.vars[i].def_blocks);
+        jacc_free(s.vars[i].defs);
+    }
+    jacc_free(s.vars);
+    ptrmap_destroy(s.var_ids);
+}
+
+/* appends a copy to a block, keeping its terminator last */
+static void insert_copy(ir_function_t function, int block_id, int dst, enum ir_type type, struct ir_value value)
+{
+    struct ir_block *block = function->blocks[block_id];
+    struct ir_insn *insn = ir_insn_add(function, block_id, IR_MOV, type);
+    struct ir_insn terminator;
+    insn->dst = dst;
+    insn->ops[0] = value;
+    if (block->count > 1 && ir_is_terminator(block->insns[block->count - 2].op)) {
+        terminator = block->insns[block->count - 2];
+        block->insns[block->count - 2] = block->insns[block->count - 1];
+        block->insns[block->count - 1] = terminator;
+    }
+}
+
+static int split_edge(ir_function_t function, int pred, int block)
+{
+    int i, edge = ir_block_create(function);
+    struct ir_insn *last = ir_terminator(function->blocks[pred]);
+    for (i = 0; i < last->targets_count; i++) {
+        if (last->targets[i] == block) {
+            last->targets[i] = edge;
+        }
+    }
+    ir_insn_set_targets(ir_insn_add(function, edge, IR_JMP, IRT_VOID), 1, block);
+    return edge;
+}
+
+struct phi_copy {
+    int dst;
+    enum ir_type type;
+    struct ir_value value;
+};
+
+/* parallel copies of one edge, through temporaries when a phi reads another one's result */
+static void emit_phi_copies(ir_function_t function, int pred, struct phi_copy *copies, int count)
+{
+    int i, j, conflict = 0;
+    for (i = 0; i < count && !conflict; i++) {
+        for (j = 0; j < count; j++) {
+            if (i != j && copies[i].value.kind == IRV_REG && copies[i].value.value == copies[j].dst) {
+                conflict = 1;
+            }
+        }
+    }
+    if (conflict) {
+        for (i = 0; i < count; i++) {
+            int temp = ir_reg_create(function, copies[i].type);
+            insert_copy(function, pred, temp, copies[i].type, copies[i].value);
+            copies[i].value = ir_reg(temp);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (copies[i].value.kind != IRV_REG || copies[i].value.value != copies[i].dst) {
+            insert_copy(function, pred, copies[i].dst, copies[i].type, copies[i].value);
+        }
+    }
+}
+
+extern void ssa_destruct(ir_function_t function)
+{
+    int i, j, k, blocks_count = function->blocks_count;
+    cfg_t cfg = NULL;
+
+    for (i = 0; i < blocks_count; i++) {
+        struct ir_block *block = function->blocks[i];
+        int phis_count = 0;
+        while (phis_count < block->count && block->insns[phis_count].op == IR_PHI) {
+            phis_count++;
+        }
+        if (phis_count == 0) {
+            continue;
+        }
+        if (cfg == NULL) {
+            cfg = cfg_build(function);
+        }
+
+        struct phi_copy *copies = jacc_malloc(phis_count * sizeof(*copies));
+        int preds_count = block->insns[0].targets_count;
+        for (j = 0; j < preds_count; j++) {
+            int pred = block->insns[0].targets[j];
+            if (pred < blocks_count && cfg->succs[pred].count > 1) {
+                pred = split_edge(function, pred, i);
+            }
+            for (k = 0; k < phis_count; k++) {
+                copies[k].dst = block->insns[k].dst;
+                copies[k].type = block->insns[k].type;
+                copies[k].value = block->insns[k].args[j];
+            }
+            emit_phi_copies(function, pred, copies, phis_count);
+        }
+        jacc_free(copies);
+
+        for (j = 0; j < phis_count; j++) {
+            jacc_free(block->insns[j].args);
+            jacc_free(block->insns[j].targets);
+        }
+        block->count -= phis_count;
+        memmove(block->insns, block->insns + phis_count, block->count * sizeof(*block->insns));
+    }
+    cfg_destroy(cfg);
+}
@@ -0,0 +1,20 @@
+#ifndef JACC_SSA_H
+#define JACC_SSA_H
+
+#include "ir.h"
+
+/*
+ * Promotes scalar locals and parameters whose address is never taken to
+ * virtual registers in SSA form, placing phis on the iterated dominance
+ * frontiers of their stores. A variable qualifies when every access is a
+ * whole int, pointer or double load or store of it.
+ */
+extern void ssa_construct(ir_function_t function);
+
+/*
+ * Replaces phis with copies at the end of their predecessors, splitting
+ * critical edges first. Registers may have several definitions after it.
+ */
+extern void ssa_destruct(ir_function_t function);
+
+#endif
@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stack.h"
+
+/* address space only, pages are committed on first use */
+#define STACK_RESERVE (sizeof(void*) >= 8 ? (size_t)16 << 30 : (size_t)512 << 20)
+/* smallest reservation tried when address space is limited */
+#define STACK_MINIMUM ((size_t)64 << 20)
+
+extern int stack_thread_start(struct stack_thread *thread, stack_func_t func, void *arg)
+{
+    pthread_attr_t attr;
+    size_t page = sysconf(_SC_PAGESIZE);
+    int result;
+
+    for (thread->size = STACK_RESERVE; ; thread->size /= 2) {
+        thread->memory = mmap(NULL, thread->size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (thread->memory != MAP_FAILED) {
+            break;
+        }
+        if (thread->size / 2 < STACK_MINIMUM) {
+            return 0;
+        }
+    }
+    /* the stack grows down, so overflowing it hits the guard page */
+    mprotect(thread->memory, page, PROT_NONE);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, thread->memory, thread->size);
+    result = pthread_create(&thread->id, &attr, func, arg) == 0;
+    pthread_attr_destroy(&attr);
+    if (!result) {
+        munmap(thread->memory, thread->size);
+    }
+    return result;
+}
+
+extern void *stack_thread_join(struct stack_thread *thread)
+{
+    void *result = NULL;
+    pthread_join(thread->id, &result);
+    munmap(thread->memory, thread->size);
+    return result;
+}
@@ -0,0 +1,28 @@
+#ifndef JACC_STACK_H
+#define JACC_STACK_H
+
+/*
+ * Threads with a large stack for deeply recursive passes. The parser,
+ * folder, lowering and serializers follow the nesting of the source, so
+ * instead of guarding each of them, every thread that runs them starts on
+ * a stack reserved up front. Pages are only committed as the stack grows,
+ * so nesting depth is bounded by memory rather than by the default stack
+ * size. If address space is limited, the reservation is halved down to a
+ * minimum before starting the thread fails.
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+typedef void *(*stack_func_t)(void *arg);
+
+struct stack_thread {
+    pthread_t id;
+    void *memory;
+    size_t size;
+};
+
+extern int stack_thread_start(struct stack_thread *thread, stack_func_t func, void *arg);
+extern void *stack_thread_join(struct stack_thread *thread);
+
+#endif
@@ -8,9 +8,11 @@
 
 struct symtable_node {
     int hash;
+    int index;
     symtable_key_t key;
     symtable_key2_t key2;
     symtable_value_t value;
+    struct symtable_node *older;
     struct symtable_node *next;
 };
 
@@ -22,11 +24,23 @@ struct symtable_list_node {
 struct symtable_data {
     int capacity;
     int size;
+    int version;
     struct symtable_node **buckets;
     struct symtable_list_node *list_head;
     struct symtable_list_node *list_tail;
 };
 
+struct symbol_stats symbol_stats;
+
+extern struct symbol_ext *symbol_ext(struct symbol *symbol)
+{
+    if (symbol->ext == NULL) {
+        symbol->ext = jacc_calloc(1, sizeof(*symbol->ext));
+        __sync_fetch_and_add(&symbol_stats.exts, 1);
+    }
+    return symbol->ext;
+}
+
 static int compute_hash(const char *key)
 {
     int hash = 17;
@@ -44,6 +58,7 @@ extern symtable_t symtable_create(int capacity)
     symtable->list_head = NULL;
     symtable->list_tail = NULL;
     symtable->size = 0;
+    symtable->version = 0;
     symtable->buckets = jacc_malloc(capacity * sizeof(*symtable->buckets));
     memset(symtable->buckets, 0, capacity * sizeof(*symtable->buckets));
     return symtable;
@@ -51,7 +66,11 @@ extern symtable_t symtable_create(int capacity)
 
 static void free_symtable_node(struct symtable_node *node)
 {
-    jacc_free(node);
+    while (node != NULL) {
+        struct symtable_node *older = node->older;
+        jacc_free(node);
+        node = older;
+    }
 }
 
 extern void symtable_destroy(symtable_t symtable, int free_nodes)
@@ -89,6 +108,11 @@ extern int symtable_size(symtable_t symtable)
     return symtable->size;
 }
 
+extern int symtable_version(symtable_t symtable)
+{
+    return symtable->version;
+}
+
 static struct symtable_node *find_node(symtable_t symtable, symtable_key_t key, symtable_key2_t key2)
 {
     int key_hash = compute_hash(key);
@@ -112,19 +136,49 @@ extern symtable_value_t symtable_get(symtable_t symtable, symtable_key_t key, sy
     return NULL;
 }
 
+extern symtable_value_t symtable_get_visible(symtable_t symtable, symtable_key_t key, symtable_key2_t key2, int limit)
+{
+    struct symtable_node *node = find_node(symtable, key, key2);
+    while (node != NULL && node->index >= limit) {
+        node = node->older;
+    }
+    return node != NULL ? node->value : NULL;
+}
+
+static void rehash(symtable_t symtable, int capacity)
+{
+    struct symtable_list_node *list_node;
+    jacc_free(symtable->buckets);
+    symtable->capacity = capacity;
+    symtable->buckets = jacc_calloc(capacity, sizeof(*symtable->buckets));
+    for (list_node = symtable->list_head; list_node != NULL; list_node = list_node->next) {
+        struct symtable_node *node = list_node->node;
+        node->next = symtable->buckets[node->hash % capacity];
+        symtable->buckets[node->hash % capacity] = node;
+    }
+}
+
 extern void symtable_set(symtable_t symtable, symtable_key_t key, symtable_key2_t key2, symtable_value_t value)
 {
     struct symtable_node *node = find_node(symtable, key, key2);
     if (node != NULL) {
+        /* keep the replaced value for lookups limited to an older version */
+        struct symtable_node *older = jacc_malloc(sizeof(*older));
+        *older = *node;
+        older->next = NULL;
+        node->older = older;
+        node->index = symtable->version++;
         node->value = value;
         return;
     }
 
     node = jacc_malloc(sizeof(*node));
     node->hash = compute_hash(key);
+    node->index = symtable->version++;
     node->key = key;
     node->key2 = key2;
     node->value = value;
+    node->older = NULL;
     node->next = symtable->buckets[node->hash % symtable->capacity];
     symtable->buckets[node->hash % symtable->capacity] = node;
 
@@ -139,6 +193,9 @@ extern void symtable_set(symtable_t symtable, symtable_key_t key, symtable_key2_
         symtable->list_tail = list_node;
     }
     symtable->size++;
+    if (symtable->size > symtable->capacity * 2) {
+        rehash(symtable, symtable->capacity * 4);
+    }
 }
 
 extern symtable_iter_t symtable_first(symtable_t symtable)
@@ -5,6 +5,7 @@
 #define SF_INCOMPLETE 2
 #define SF_STATIC 4
 #define SF_EXTERN 8
+#define SF_UNUSED 16
 
 enum symbol_type {
     ST_VARIABLE,
@@ -35,31 +36,57 @@ typedef struct {
     const char *name;
 } label_t;
 
+/*
+ * Rarely used symbol data: function bodies, parameter tables, frame sizes,
+ * code labels and the global symbol table version at which a struct or
+ * union tag was completed. Allocated on demand by symbol_ext().
+ */
+struct symbol_ext {
+    struct node *body;
+    symtable_t params;
+    int locals_size;
+    label_t label;
+    label_t return_label;
+    int completed;
+};
+
+/* Kept within a single cache line; see struct symbol_ext for the rest. */
 struct symbol {
     enum symbol_type type;
+    int flags;
+    int size;
+    int offset;
     const char *name;
     struct symbol *base_type;
     struct node *expr;
     symtable_t symtable;
-    int flags;
-    int size;
-    int offset;
-    int locals_size;
-    label_t label;
-    label_t return_label;
+    struct symbol_ext *ext;
 };
 
+struct symbol_stats {
+    int symbols;
+    int exts;
+};
+
+extern struct symbol_stats symbol_stats;
+
 typedef const char *symtable_key_t;
 typedef enum symbol_class symtable_key2_t;
 typedef struct symbol *symtable_value_t;
 typedef struct symtable_list_node *symtable_iter_t;
 
+extern struct symbol_ext *symbol_ext(struct symbol *symbol);
+
 extern symtable_t symtable_create(int capacity);
 extern void symtable_destroy(symtable_t symtable, int free_nodes);
 
 extern int symtable_size(symtable_t symtable);
+/* counts every set, including ones replacing the value of an existing key */
+extern int symtable_version(symtable_t symtable);
 
 extern symtable_value_t symtable_get(symtable_t symtable, symtable_key_t key, symtable_key2_t key2);
+/* like symtable_get, but returns the value as it was at the given version */
+extern symtable_value_t symtable_get_visible(symtable_t symtable, symtable_key_t key, symtable_key2_t key2, int limit);
 extern void symtable_set(symtable_t symtable, symtable_key_t key, symtable_key2_t key2, symtable_value_t value);
 
 extern symtable_iter_t symtable_first(symtable_t symtable);
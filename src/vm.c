@@ -0,0 +1,950 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "memory.h"
+#include "ptrmap.h"
+#include "parser.h"
+#include "ir.h"
+#include "lower.h"
+#include "ssa.h"
+#include "loop.h"
+#include "vm.h"
+
+#define VM_STACK_SIZE (64 << 20)
+#define NATIVE_INT_ARGS 6
+#define NATIVE_DOUBLE_ARGS 8
+#define NATIVE_STACK_ARGS 8
+#define TAIL_CALL_ARGS 16
+
+/* call_native passes arguments the x86-64 System V way */
+#if defined(__x86_64__) && !defined(_WIN32)
+#define NATIVE_CALLS 1
+#else
+#define NATIVE_CALLS 0
+#endif
+
+enum vm_opcode {
+#define VM_OP(name) VM_##name,
+#include "vm.def"
+#undef VM_OP
+};
+
+/* ints are kept sign-extended, so they compare like pointers */
+union vm_value {
+    int64_t i;
+    double d;
+    char *p;
+};
+
+/*
+ * Operands are register slots and a constant. Branches jump to target when
+ * their condition holds and to dst otherwise. Before the first run dispatch
+ * holds the opcode, then the address of its handler.
+ */
+struct vm_insn {
+    union {
+        enum vm_opcode op;
+        const void *handler;
+    } dispatch;
+    int dst;
+    int a;
+    int b;
+    int target;
+    union vm_value imm;
+};
+
+struct vm_function {
+    struct symbol *symbol;
+    int entry;
+    int regs_count;
+    int locals_size;
+    int params_size;
+    int frame_size;
+};
+
+struct vm_arg {
+    int reg;
+    int is_double;
+};
+
+struct vm_call {
+    void *target;
+    enum ir_type type;
+    int args_count;
+    struct vm_arg args[];
+};
+
+struct vm_case {
+    int value;
+    int target;
+};
+
+struct vm_switch {
+    int count;
+    struct vm_case cases[];
+};
+
+struct vm_program {
+    struct vm_insn *code;
+    int count;
+    int capacity;
+    struct vm_function *functions;
+    int functions_count;
+    struct vm_function *main;
+    /* calls, switches, strings and globals referred to by the code */
+    void **owned;
+    int owned_count;
+    int owned_capacity;
+    int threaded;
+};
+
+/* what a call saves to return to the caller, followed by the frame of the callee */
+struct vm_frame {
+    const struct vm_insn *return_pc;
+    struct vm_frame *caller;
+    union vm_value *regs;
+    char *fp;
+    char *top;
+};
+
+struct compiler {
+    vm_program_t program;
+    symtable_t symtable;
+    ptrmap_t functions;
+    ptrmap_t globals;
+    ptrmap_t params;
+    ir_function_t ir;
+    struct vm_function *function;
+    int *uses;
+    int *block_starts;
+    int tail_calls;
+    int error;
+};
+
+static void *own(vm_program_t program, void *data)
+{
+    if (program->owned_count == program->owned_capacity) {
+        program->owned_capacity = program->owned_capacity == 0 ? 16 : program->owned_capacity * 2;
+        program->owned = jacc_realloc(program->owned, program->owned_capacity * sizeof(*program->owned));
+    }
+    program->owned[program->owned_count++] = data;
+    return data;
+}
+
+static struct vm_insn *emit(struct compiler *c, enum vm_opcode op, int dst, int a, int b)
+{
+    vm_program_t program = c->program;
+    struct vm_insn *insn;
+    if (program->count == program->capacity) {
+        program->capacity = program->capacity == 0 ? 256 : program->capacity * 2;
+        program->code = jacc_realloc(program->code, program->capacity * sizeof(*program->code));
+    }
+    insn = &program->code[program->count++];
+    memset(insn, 0, sizeof(*insn));
+    insn->dispatch.op = op;
+    insn->dst = dst;
+    insn->a = a;
+    insn->b = b;
+    return insn;
+}
+
+static int temp_reg(struct compiler *c)
+{
+    return ++c->function->regs_count;
+}
+
+static int local_offset(struct compiler *c, struct ir_value address)
+{
+    struct symbol *symbol = address.symbol;
+    if (symbol->type == ST_PARAMETER) {
+        return (int)ptrmap_get(c->params, symbol) + address.value;
+    }
+    return symbol->offset - symbol->size + address.value;
+}
+
+static char *global_memory(struct compiler *c, struct symbol *symbol)
+{
+    char *memory = (char *)ptrmap_get(c->globals, symbol);
+    if (memory == NULL) {
+        memory = own(c->program, jacc_calloc(1, symbol->size > 0 ? symbol->size : 1));
+        ptrmap_set(c->globals, symbol, (uintptr_t)memory);
+    }
+    return memory;
+}
+
+static void *native_symbol(struct compiler *c, struct symbol *symbol)
+{
+    if (!NATIVE_CALLS) {
+        fprintf(stderr, "cannot call %s, host functions need an x86-64 System V host\n", symbol->name);
+        c->error = 1;
+        return NULL;
+    }
+    void *address = dlsym(RTLD_DEFAULT, symbol->name);
+    if (address == NULL) {
+        fprintf(stderr, "undefined symbol %s\n", symbol->name);
+        c->error = 1;
+    }
+    return address;
+}
+
+/* the translated definition of a function, NULL for a native one; calls before the definition refer to a declaration */
+static struct vm_function *find_function(struct compiler *c, struct symbol *symbol)
+{
+    int index = (int)ptrmap_get(c->functions, symbol);
+    if (index == 0) {
+        struct symbol *definition = symtable_get(c->symtable, symbol->name, SC_NAME);
+        index = definition != NULL ? (int)ptrmap_get(c->functions, definition) : 0;
+    }
+    return index != 0 ? &c->program->functions[index - 1] : NULL;
+}
+
+/* value of a constant or of an address not on the frame */
+static union vm_value constant_value(struct compiler *c, struct ir_value value, enum ir_type type)
+{
+    union vm_value result;
+    result.i = 0;
+    switch (value.kind) {
+    case IRV_INT:
+        if (type == IRT_DOUBLE) {
+            result.d = value.value;
+        } else {
+            result.i = value.value;
+        }
+        break;
+    case IRV_DOUBLE:
+        result.d = value.dvalue;
+        break;
+    case IRV_STRING:
+        result.p = own(c->program, jacc_malloc(strlen(value.string) + 1));
+        strcpy(result.p, value.string);
+        break;
+    case IRV_GLOBAL:
+        if (value.symbol->type != ST_FUNCTION) {
+            result.p = global_memory(c, value.symbol) + value.value;
+        } else if (find_function(c, value.symbol) != NULL) {
+            result.p = (char *)find_function(c, value.symbol);
+        } else {
+            result.p = native_symbol(c, value.symbol);
+        }
+        break;
+    }
+    return result;
+}
+
+/* register holding a value, constants and addresses get a fresh one */
+static int operand(struct compiler *c, struct ir_value value, enum ir_type type)
+{
+    int reg;
+    if (value.kind == IRV_REG) {
+        return value.value;
+    } else if (value.kind == IRV_NONE) {
+        return 0;
+    }
+    reg = temp_reg(c);
+    if (value.kind == IRV_LOCAL) {
+        emit(c, VM_LEAL, reg, 0, 0)->imm.i = local_offset(c, value);
+    } else {
+        emit(c, VM_MOVI, reg, 0, 0)->imm = constant_value(c, value, type);
+    }
+    return reg;
+}
+
+static int is_int_compare(struct ir_insn *insn)
+{
+    return insn->type != IRT_DOUBLE && insn->op >= IR_EQ && insn->op <= IR_GE;
+}
+
+static void compile_memory(struct compiler *c, struct ir_insn *insn, int load)
+{
+    static const enum vm_opcode loads[][3] = {
+        { VM_LD1_R, VM_LD4_R, VM_LD8_R },
+        { VM_LD1_L, VM_LD4_L, VM_LD8_L },
+        { VM_LD1_A, VM_LD4_A, VM_LD8_A },
+    };
+    static const enum vm_opcode stores[][3] = {
+        { VM_ST1_R, VM_ST4_R, VM_ST8_R },
+        { VM_ST1_L, VM_ST4_L, VM_ST8_L },
+        { VM_ST1_A, VM_ST4_A, VM_ST8_A },
+    };
+    struct ir_value address = insn->ops[0];
+    int size = insn->size == 1 ? 0 : insn->size == 4 ? 1 : 2;
+    int mode = address.kind == IRV_REG ? 0 : address.kind == IRV_LOCAL ? 1 : 2;
+    int value = load ? 0 : operand(c, insn->ops[1], insn->type);
+    struct vm_insn *vm_insn = emit(c, load ? loads[mode][size] : stores[mode][size],
+        insn->dst, address.kind == IRV_REG ? address.value : 0, value);
+    if (mode == 1) {
+        vm_insn->imm.i = local_offset(c, address);
+    } else if (mode == 2) {
+        vm_insn->imm = constant_value(c, address, IRT_PTR);
+    }
+}
+
+static void compile_binary(struct compiler *c, struct ir_insn *insn)
+{
+    static const enum vm_opcode int_ops[] = {
+        VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD, VM_AND, VM_OR, VM_XOR, VM_SHL, VM_SAR,
+        VM_EQ, VM_NE, VM_LT, VM_LE, VM_GT, VM_GE,
+    };
+    static const enum vm_opcode immediate_ops[] = {
+        VM_ADDI, VM_SUBI, VM_MULI, VM_DIVI, VM_MODI, VM_ANDI, VM_ORI, VM_XORI, VM_SHLI, VM_SARI,
+        VM_EQI, VM_NEI, VM_LTI, VM_LEI, VM_GTI, VM_GEI,
+    };
+    static const enum vm_opcode double_ops[] = {
+        VM_DADD, VM_DSUB, VM_DMUL, VM_DDIV, 0, 0, 0, 0, 0, 0,
+        VM_DEQ, VM_DNE, VM_DLT, VM_DLE, VM_DGT, VM_DGE,
+    };
+    int index = insn->op - IR_ADD;
+    int a = operand(c, insn->ops[0], insn->type);
+
+    if (insn->type == IRT_DOUBLE && double_ops[index] != 0) {
+        emit(c, double_ops[index], insn->dst, a, operand(c, insn->ops[1], insn->type));
+    } else if (insn->type == IRT_DOUBLE) {
+        c->error = 1;
+    } else if (insn->type == IRT_PTR && (insn->op == IR_ADD || insn->op == IR_SUB)) {
+        if (insn->ops[1].kind == IRV_INT) {
+            emit(c, VM_PADDI, insn->dst, a, 0)->imm.i = insn->op == IR_ADD ? insn->ops[1].value : -insn->ops[1].value;
+        } else {
+            emit(c, insn->op == IR_ADD ? VM_PADD : VM_PSUB, insn->dst, a, operand(c, insn->ops[1], insn->type));
+        }
+    } else if (insn->type == IRT_PTR && !is_int_compare(insn)) {
+        c->error = 1;
+    } else if (insn->ops[1].kind == IRV_INT) {
+        emit(c, immediate_ops[index], insn->dst, a, 0)->imm.i = insn->ops[1].value;
+    } else {
+        emit(c, int_ops[index], insn->dst, a, operand(c, insn->ops[1], insn->type));
+    }
+}
+
+/* a call to a translated function returned right away replaces the frame of the caller */
+static int is_tail_call(struct compiler *c, struct ir_block *block, int index)
+{
+    struct ir_insn *insn = &block->insns[index];
+    return c->tail_calls && ir_is_tail_call(block, index) && insn->args_count <= TAIL_CALL_ARGS
+        && insn->ops[0].kind == IRV_GLOBAL && insn->ops[0].symbol->type == ST_FUNCTION
+        && find_function(c, insn->ops[0].symbol) != NULL;
+}
+
+static void compile_call(struct compiler *c, struct ir_insn *insn, int tail)
+{
+    struct ir_value callee = insn->ops[0];
+    struct vm_call *call = own(c->program, jacc_malloc(sizeof(*call) + insn->args_count * sizeof(*call->args)));
+    int i, ints = 0, doubles = 0, stack = 0;
+    enum vm_opcode op = VM_CALLR;
+    int callee_reg = 0;
+
+    call->type = insn->type;
+    call->args_count = insn->args_count;
+    call->target = NULL;
+    for (i = 0; i < insn->args_count; i++) {
+        enum ir_type type = ir_value_type(c->ir, insn->args[i]);
+        call->args[i].reg = operand(c, insn->args[i], type);
+        call->args[i].is_double = type == IRT_DOUBLE;
+        if (type == IRT_DOUBLE) {
+            stack += ++doubles > NATIVE_DOUBLE_ARGS;
+        } else {
+            stack += ++ints > NATIVE_INT_ARGS;
+        }
+    }
+
+    if (callee.kind == IRV_GLOBAL && callee.symbol->type == ST_FUNCTION) {
+        op = tail ? VM_TAILCALL : find_function(c, callee.symbol) != NULL ? VM_CALL : VM_CALLN;
+        call->target = constant_value(c, callee, IRT_PTR).p;
+    } else {
+        callee_reg = operand(c, callee, IRT_PTR);
+    }
+    if (op == VM_CALLN && stack > NATIVE_STACK_ARGS) {
+        fprintf(stderr, "too many arguments to call a native function\n");
+        c->error = 1;
+    }
+    emit(c, op, insn->dst, callee_reg, 0)->imm.p = (char *)call;
+}
+
+static int compare_cases(const void *a, const void *b)
+{
+    const struct vm_case *x = a, *y = b;
+    if (x->value != y->value) {
+        return x->value < y->value ? -1 : 1;
+    }
+    return x->target - y->target;
+}
+
+/* cases sorted for a binary search, a repeated value keeping its first case */
+static void compile_switch(struct compiler *c, struct ir_insn *insn)
+{
+    struct vm_switch *table = own(c->program, jacc_malloc(sizeof(*table) + insn->args_count * sizeof(*table->cases)));
+    int i, count = 0;
+    for (i = 0; i < insn->args_count; i++) {
+        table->cases[i].value = insn->args[i].value;
+        table->cases[i].target = i;
+    }
+    qsort(table->cases, insn->args_count, sizeof(*table->cases), compare_cases);
+    for (i = 0; i < insn->args_count; i++) {
+        if (count == 0 || table->cases[count - 1].value != table->cases[i].value) {
+            table->cases[count].value = table->cases[i].value;
+            table->cases[count++].target = insn->targets[table->cases[i].target + 1];
+        }
+    }
+    table->count = count;
+    emit(c, VM_SWITCH, insn->targets[0], operand(c, insn->ops[0], IRT_INT), 0)->imm.p = (char *)table;
+}
+
+static int is_local_int(struct ir_insn *insn, enum ir_opcode op)
+{
+    return insn->op == op && insn->type == IRT_INT && insn->size == 4 && insn->ops[0].kind == IRV_LOCAL;
+}
+
+static int is_add_constant(struct ir_insn *insn, int reg)
+{
+    return insn->op == IR_ADD && insn->type == IRT_INT && insn->ops[0].kind == IRV_REG
+        && insn->ops[0].value == reg && insn->ops[1].kind == IRV_INT;
+}
+
+/* instructions of the block consumed by a superinstruction starting at index, 0 if none applies */
+static int compile_fused(struct compiler *c, struct ir_block *block, int index)
+{
+    struct ir_insn *insn = &block->insns[index];
+    struct ir_insn *next = index + 1 < block->count ? &block->insns[index + 1] : NULL;
+    struct ir_insn *third = index + 2 < block->count ? &block->insns[index + 2] : NULL;
+    struct vm_insn *vm_insn;
+
+    if (is_int_compare(insn) && next != NULL && next->op == IR_BR && next->ops[0].kind == IRV_REG
+        && next->ops[0].value == insn->dst && c->uses[insn->dst] == 1) {
+        int a = operand(c, insn->ops[0], insn->type);
+        if (insn->ops[1].kind == IRV_INT) {
+            vm_insn = emit(c, VM_BEQI + (insn->op - IR_EQ), next->targets[1], a, 0);
+            vm_insn->imm.i = insn->ops[1].value;
+        } else {
+            vm_insn = emit(c, VM_BEQ + (insn->op - IR_EQ), next->targets[1], a, operand(c, insn->ops[1], insn->type));
+        }
+        vm_insn->target = next->targets[0];
+        return 2;
+    }
+    if (is_local_int(insn, IR_LOAD) && next != NULL && is_add_constant(next, insn->dst) && c->uses[insn->dst] == 1) {
+        int offset = local_offset(c, insn->ops[0]);
+        if (third != NULL && is_local_int(third, IR_STORE) && local_offset(c, third->ops[0]) == offset
+            && third->ops[0].symbol == insn->ops[0].symbol && third->ops[1].kind == IRV_REG
+            && third->ops[1].value == next->dst && c->uses[next->dst] == 1) {
+            emit(c, VM_ADDL, 0, offset, 0)->imm.i = next->ops[1].value;
+            return 3;
+        }
+        emit(c, VM_LDL_ADDI, next->dst, offset, 0)->imm.i = next->ops[1].value;
+        return 2;
+    }
+    return 0;
+}
+
+static void compile_insn(struct compiler *c, struct ir_block *block, struct ir_insn *insn)
+{
+    struct vm_insn *vm_insn;
+    switch (insn->op) {
+    case IR_MOV:
+    case IR_I2P:
+        emit(c, VM_MOV, insn->dst, operand(c, insn->ops[0], insn->type), 0);
+        break;
+    case IR_NEG:
+        emit(c, insn->type == IRT_DOUBLE ? VM_DNEG : VM_NEG, insn->dst, operand(c, insn->ops[0], insn->type), 0);
+        break;
+    case IR_NOT:
+        emit(c, VM_NOT, insn->dst, operand(c, insn->ops[0], insn->type), 0);
+        break;
+    case IR_I2D:
+    case IR_D2I:
+    case IR_P2I:
+        emit(c, insn->op == IR_I2D ? VM_I2D : insn->op == IR_D2I ? VM_D2I : VM_P2I,
+            insn->dst, operand(c, insn->ops[0], insn->type), 0);
+        break;
+    case IR_LOAD:
+    case IR_STORE:
+        compile_memory(c, insn, insn->op == IR_LOAD);
+        break;
+    case IR_CALL:
+        compile_call(c, insn, is_tail_call(c, block, insn - block->insns));
+        break;
+    case IR_JMP:
+        if (insn->targets[0] != block->id + 1) {
+            emit(c, VM_JMP, 0, 0, 0)->target = insn->targets[0];
+        }
+        break;
+    case IR_BR:
+        vm_insn = emit(c, VM_BR, insn->targets[1], operand(c, insn->ops[0], insn->type), 0);
+        vm_insn->target = insn->targets[0];
+        break;
+    case IR_SWITCH:
+        compile_switch(c, insn);
+        break;
+    case IR_RET:
+        if (insn > block->insns && is_tail_call(c, block, insn - block->insns - 1)) {
+            break;
+        }
+        emit(c, VM_RET, 0, operand(c, insn->ops[0], insn->type), 0);
+        break;
+    case IR_PHI:
+        c->error = 1;
+        break;
+    default:
+        compile_binary(c, insn);
+    }
+}
+
+static int is_branch(enum vm_opcode op)
+{
+    return op == VM_JMP || op == VM_BR || (op >= VM_BEQ && op <= VM_BGEI);
+}
+
+/* block numbers of the jumps become instruction indices */
+static void link_blocks(struct compiler *c, int first)
+{
+    int i, j;
+    for (i = first; i < c->program->count; i++) {
+        struct vm_insn *insn = &c->program->code[i];
+        if (is_branch(insn->dispatch.op)) {
+            insn->target = c->block_starts[insn->target];
+            insn->dst = c->block_starts[insn->dst];
+        } else if (insn->dispatch.op == VM_SWITCH) {
+            struct vm_switch *table = (struct vm_switch *)insn->imm.p;
+            insn->dst = c->block_starts[insn->dst];
+            for (j = 0; j < table->count; j++) {
+                table->cases[j].target = c->block_starts[table->cases[j].target];
+            }
+        }
+    }
+}
+
+static void count_uses(struct compiler *c, struct ir_value value)
+{
+    if (value.kind == IRV_REG) {
+        c->uses[value.value]++;
+    }
+}
+
+/* parameters get 8-byte slots above the locals, in their order */
+static int assign_parameter_slots(struct compiler *c, struct symbol *func)
+{
+    int size = 0;
+    symtable_iter_t iter = symtable_first(func->ext->params);
+    for (; iter != NULL; iter = symtable_iter_next(iter), size += 8) {
+        ptrmap_set(c->params, symtable_iter_value(iter), size);
+    }
+    return size;
+}
+
+static void compile_function(struct compiler *c, struct vm_function *function, int opt_level)
+{
+    int i, j, k, first = c->program->count;
+    ir_function_t ir = lower_function(function->symbol);
+    if (ir == NULL) {
+        c->error = 1;
+        return;
+    }
+    if (opt_level > 0) {
+        ssa_construct(ir);
+        loop_optimize(ir);
+    }
+    ssa_destruct(ir);
+
+    c->ir = ir;
+    c->function = function;
+    c->tail_calls = opt_level > 0 && !ir_frame_escapes(ir);
+    c->params = ptrmap_create();
+    c->uses = jacc_calloc(ir->regs_count + 1, sizeof(*c->uses));
+    c->block_starts = jacc_malloc(ir->blocks_count * sizeof(*c->block_starts));
+    function->entry = first;
+    function->regs_count = ir->regs_count;
+    function->locals_size = (ir->locals_size + 7) & ~7;
+    function->params_size = assign_parameter_slots(c, function->symbol);
+
+    for (i = 0; i < ir->blocks_count; i++) {
+        struct ir_block *block = ir->blocks[i];
+        for (j = 0; j < block->count; j++) {
+            count_uses(c, block->insns[j].ops[0]);
+            count_uses(c, block->insns[j].ops[1]);
+            for (k = 0; k < block->insns[j].args_count; k++) {
+                count_uses(c, block->insns[j].args[k]);
+            }
+        }
+    }
+    for (i = 0; i < ir->blocks_count; i++) {
+        struct ir_block *block = ir->blocks[i];
+        c->block_starts[i] = c->program->count;
+        for (j = 0; j < block->count; ) {
+            int fused = compile_fused(c, block, j);
+            if (fused == 0) {
+                compile_insn(c, block, &block->insns[j]);
+                fused = 1;
+            }
+            j += fused;
+        }
+    }
+    link_blocks(c, first);
+    function->frame_size = sizeof(struct vm_frame) + (function->regs_count + 1) * sizeof(union vm_value)
+        + function->locals_size + function->params_size;
+
+    jacc_free(c->block_starts);
+    jacc_free(c->uses);
+    ptrmap_destroy(c->params);
+    ir_function_destroy(ir);
+}
+
+static int is_compiled(struct symbol *symbol)
+{
+    return symbol->type == ST_FUNCTION && symbol->ext != NULL && symbol->ext->body != NULL
+        && (symbol->flags & (SF_EXTERN | SF_UNUSED)) == 0;
+}
+
+extern vm_program_t vm_compile(symtable_t symtable, int opt_level)
+{
+    struct compiler c;
+    vm_program_t program = jacc_calloc(1, sizeof(*program));
+    symtable_iter_t iter;
+    int i;
+
+    memset(&c, 0, sizeof(c));
+    c.program = program;
+    c.symtable = symtable;
+    c.functions = ptrmap_create();
+    c.globals = ptrmap_create();
+
+    /* every function has its place before any call to it is translated */
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter)) {
+        program->functions_count += is_compiled(symtable_iter_value(iter));
+    }
+    program->functions = jacc_calloc(program->functions_count + 1, sizeof(*program->functions));
+    i = 0;
+    for (iter = symtable_first(symtable); iter != NULL; iter = symtable_iter_next(iter)) {
+        struct symbol *symbol = symtable_iter_value(iter);
+        if (is_compiled(symbol)) {
+            program->functions[i].symbol = symbol;
+            ptrmap_set(c.functions, symbol, ++i);
+            if (strcmp(symbol->name, "main") == 0) {
+                program->main = &program->functions[i - 1];
+            }
+        }
+    }
+    for (i = 0; i < program->functions_count && !c.error; i++) {
+        compile_function(&c, &program->functions[i], opt_level);
+    }
+
+    ptrmap_destroy(c.functions);
+    ptrmap_destroy(c.globals);
+    if (c.error || program->main == NULL) {
+        fprintf(stderr, c.error ? "cannot translate to bytecode\n" : "no main function\n");
+        vm_free(program);
+        return NULL;
+    }
+    return program;
+}
+
+typedef int64_t (*native_int_t)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+    double, double, double, double, double, double, double, double, ...);
+typedef double (*native_double_t)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+    double, double, double, double, double, double, double, double, ...);
+
+/*
+ * Calls a host function the System V way: every int and double register
+ * gets a value, the arguments left over go on the stack in their order, so
+ * the callee finds its parameters whether it is variadic or not.
+ */
+static union vm_value call_native(void *target, struct vm_call *call, union vm_value *regs)
+{
+    int64_t ints[NATIVE_INT_ARGS] = { 0 }, stack[NATIVE_STACK_ARGS] = { 0 };
+    double doubles[NATIVE_DOUBLE_ARGS] = { 0 };
+    int i, int_count = 0, double_count = 0, stack_count = 0;
+    union vm_value result;
+
+    for (i = 0; i < call->args_count; i++) {
+        union vm_value arg = regs[call->args[i].reg];
+        if (call->args[i].is_double && double_count < NATIVE_DOUBLE_ARGS) {
+            doubles[double_count++] = arg.d;
+        } else if (!call->args[i].is_double && int_count < NATIVE_INT_ARGS) {
+            ints[int_count++] = arg.i;
+        } else {
+            stack[stack_count++] = arg.i;
+        }
+    }
+
+#define NATIVE_ARGS ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], \
+    doubles[0], doubles[1], doubles[2], doubles[3], doubles[4], doubles[5], doubles[6], doubles[7], \
+    stack[0], stack[1], stack[2], stack[3], stack[4], stack[5], stack[6], stack[7]
+    if (call->type == IRT_DOUBLE) {
+        result.d = ((native_double_t)target)(NATIVE_ARGS);
+    } else {
+        result.i = ((native_int_t)target)(NATIVE_ARGS);
+        if (call->type == IRT_INT) {
+            result.i = (int32_t)result.i;
+        }
+    }
+#undef NATIVE_ARGS
+    return result;
+}
+
+static int is_function(vm_program_t program, const char *address)
+{
+    return address >= (char *)program->functions && address < (char *)(program->functions + program->functions_count);
+}
+
+#define DISPATCH() goto *pc->dispatch.handler
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+#define A regs[pc->a]
+#define B regs[pc->b]
+#define DST regs[pc->dst]
+#define LOCAL (fp + pc->imm.i)
+#define INT_OP(name, expr) op_##name: DST.i = (int32_t)(expr); NEXT();
+#define COMPARE(name, expr) op_##name: DST.i = (expr); NEXT();
+#define BRANCH(name, expr) op_##name: pc = code + ((expr) ? pc->target : pc->dst); DISPATCH();
+#define LOAD(name, type, address) op_##name: { type value; memcpy(&value, address, sizeof(value)); DST.i = value; } NEXT();
+#define STORE(name, type, address) op_##name: { type value = B.i; memcpy(address, &value, sizeof(value)); } NEXT();
+
+/* both the int and the unsigned forms wrap around like the machine does */
+#define WRAP(op) ((uint32_t)A.i op (uint32_t)B.i)
+#define WRAPI(op) ((uint32_t)A.i op (uint32_t)pc->imm.i)
+
+extern int vm_run(vm_program_t program)
+{
+    static const void *handlers[] = {
+#define VM_OP(name) &&op_##name,
+#include "vm.def"
+#undef VM_OP
+    };
+    const struct vm_insn *code = program->code, *pc = NULL;
+    char *stack = jacc_malloc(VM_STACK_SIZE), *fp = NULL, *top = stack;
+    struct vm_frame *frame = NULL, *callee_frame;
+    struct vm_function *callee = program->main;
+    struct vm_call *call = NULL;
+    union vm_value *regs = NULL, result, tail_args[TAIL_CALL_ARGS];
+    int tail_count = 0;
+    char *target;
+    int i;
+
+    if (!program->threaded) {
+        for (i = 0; i < program->count; i++) {
+            program->code[i].dispatch.handler = handlers[program->code[i].dispatch.op];
+        }
+        program->threaded = 1;
+    }
+
+enter:
+    callee_frame = (struct vm_frame *)top;
+    if (top + callee->frame_size > stack + VM_STACK_SIZE) {
+        fprintf(stderr, "bytecode stack overflow\n");
+        jacc_free(stack);
+        return EXIT_FAILURE;
+    }
+    callee_frame->return_pc = pc;
+    callee_frame->caller = frame;
+    callee_frame->regs = regs;
+    callee_frame->fp = fp;
+    callee_frame->top = top;
+    frame = callee_frame;
+    {
+        union vm_value *callee_regs = (union vm_value *)(frame + 1);
+        char *callee_fp = (char *)(callee_regs + callee->regs_count + 1) + callee->locals_size;
+        for (i = 0; call != NULL && i < call->args_count; i++) {
+            memcpy(callee_fp + i * 8, &regs[call->args[i].reg], 8);
+        }
+        if (call == NULL) {
+            memcpy(callee_fp, tail_args, tail_count * sizeof(*tail_args));
+        }
+        regs = callee_regs;
+        fp = callee_fp;
+        top = fp + callee->params_size;
+    }
+    regs[0].i = 0;
+    pc = code + callee->entry;
+    DISPATCH();
+
+op_MOV: DST = A; NEXT();
+op_MOVI: DST = pc->imm; NEXT();
+op_LEAL: DST.p = LOCAL; NEXT();
+
+INT_OP(ADD, WRAP(+))
+INT_OP(SUB, WRAP(-))
+INT_OP(MUL, WRAP(*))
+INT_OP(DIV, (int32_t)A.i / (int32_t)B.i)
+INT_OP(MOD, (int32_t)A.i % (int32_t)B.i)
+INT_OP(AND, A.i & B.i)
+INT_OP(OR, A.i | B.i)
+INT_OP(XOR, A.i ^ B.i)
+INT_OP(SHL, (uint32_t)A.i << (B.i & 31))
+INT_OP(SAR, (int32_t)A.i >> (B.i & 31))
+INT_OP(ADDI, WRAPI(+))
+INT_OP(SUBI, WRAPI(-))
+INT_OP(MULI, WRAPI(*))
+INT_OP(DIVI, (int32_t)A.i / (int32_t)pc->imm.i)
+INT_OP(MODI, (int32_t)A.i % (int32_t)pc->imm.i)
+INT_OP(ANDI, A.i & pc->imm.i)
+INT_OP(ORI, A.i | pc->imm.i)
+INT_OP(XORI, A.i ^ pc->imm.i)
+INT_OP(SHLI, (uint32_t)A.i << (pc->imm.i & 31))
+INT_OP(SARI, (int32_t)A.i >> (pc->imm.i & 31))
+INT_OP(NEG, -(uint32_t)A.i)
+INT_OP(NOT, ~A.i)
+
+op_PADD: DST.p = A.p + B.i; NEXT();
+op_PSUB: DST.i = A.p - B.p; NEXT();
+op_PADDI: DST.p = A.p + pc->imm.i; NEXT();
+
+op_DADD: DST.d = A.d + B.d; NEXT();
+op_DSUB: DST.d = A.d - B.d; NEXT();
+op_DMUL: DST.d = A.d * B.d; NEXT();
+op_DDIV: DST.d = A.d / B.d; NEXT();
+op_DNEG: DST.d = -A.d; NEXT();
+
+COMPARE(EQ, A.i == B.i)
+COMPARE(NE, A.i != B.i)
+COMPARE(LT, A.i < B.i)
+COMPARE(LE, A.i <= B.i)
+COMPARE(GT, A.i > B.i)
+COMPARE(GE, A.i >= B.i)
+COMPARE(EQI, A.i == pc->imm.i)
+COMPARE(NEI, A.i != pc->imm.i)
+COMPARE(LTI, A.i < pc->imm.i)
+COMPARE(LEI, A.i <= pc->imm.i)
+COMPARE(GTI, A.i > pc->imm.i)
+COMPARE(GEI, A.i >= pc->imm.i)
+COMPARE(DEQ, A.d == B.d)
+COMPARE(DNE, A.d != B.d)
+COMPARE(DLT, A.d < B.d)
+COMPARE(DLE, A.d <= B.d)
+COMPARE(DGT, A.d > B.d)
+COMPARE(DGE, A.d >= B.d)
+
+op_I2D: DST.d = A.i; NEXT();
+INT_OP(D2I, A.d)
+INT_OP(P2I, A.i)
+
+LOAD(LD1_R, signed char, A.p + pc->imm.i)
+LOAD(LD4_R, int32_t, A.p + pc->imm.i)
+LOAD(LD8_R, int64_t, A.p + pc->imm.i)
+LOAD(LD1_L, signed char, LOCAL)
+LOAD(LD4_L, int32_t, LOCAL)
+LOAD(LD8_L, int64_t, LOCAL)
+LOAD(LD1_A, signed char, pc->imm.p)
+LOAD(LD4_A, int32_t, pc->imm.p)
+LOAD(LD8_A, int64_t, pc->imm.p)
+STORE(ST1_R, signed char, A.p + pc->imm.i)
+STORE(ST4_R, int32_t, A.p + pc->imm.i)
+STORE(ST8_R, int64_t, A.p + pc->imm.i)
+STORE(ST1_L, signed char, LOCAL)
+STORE(ST4_L, int32_t, LOCAL)
+STORE(ST8_L, int64_t, LOCAL)
+STORE(ST1_A, signed char, pc->imm.p)
+STORE(ST4_A, int32_t, pc->imm.p)
+STORE(ST8_A, int64_t, pc->imm.p)
+
+op_LDL_ADDI:
+    {
+        int32_t value;
+        memcpy(&value, fp + pc->a, sizeof(value));
+        DST.i = (int32_t)((uint32_t)value + (uint32_t)pc->imm.i);
+    }
+    NEXT();
+op_ADDL:
+    {
+        int32_t value;
+        memcpy(&value, fp + pc->a, sizeof(value));
+        value = (uint32_t)value + (uint32_t)pc->imm.i;
+        memcpy(fp + pc->a, &value, sizeof(value));
+    }
+    NEXT();
+
+op_JMP: pc = code + pc->target; DISPATCH();
+BRANCH(BR, A.i != 0)
+BRANCH(BEQ, A.i == B.i)
+BRANCH(BNE, A.i != B.i)
+BRANCH(BLT, A.i < B.i)
+BRANCH(BLE, A.i <= B.i)
+BRANCH(BGT, A.i > B.i)
+BRANCH(BGE, A.i >= B.i)
+BRANCH(BEQI, A.i == pc->imm.i)
+BRANCH(BNEI, A.i != pc->imm.i)
+BRANCH(BLTI, A.i < pc->imm.i)
+BRANCH(BLEI, A.i <= pc->imm.i)
+BRANCH(BGTI, A.i > pc->imm.i)
+BRANCH(BGEI, A.i >= pc->imm.i)
+op_SWITCH:
+    {
+        const struct vm_switch *table = (const struct vm_switch *)pc->imm.p;
+        int low = 0, high = table->count, value = A.i;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (table->cases[middle].value < value) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        pc = code + (low < table->count && table->cases[low].value == value ? table->cases[low].target : pc->dst);
+    }
+    DISPATCH();
+
+op_CALL:
+    call = (struct vm_call *)pc->imm.p;
+    callee = call->target;
+    goto enter;
+op_TAILCALL:
+    call = (struct vm_call *)pc->imm.p;
+    callee = call->target;
+    for (i = 0; i < call->args_count; i++) {
+        tail_args[i] = regs[call->args[i].reg];
+    }
+    tail_count = call->args_count;
+    call = NULL;
+    pc = frame->return_pc;
+    regs = frame->regs;
+    fp = frame->fp;
+    top = frame->top;
+    frame = frame->caller;
+    goto enter;
+op_CALLN:
+    call = (struct vm_call *)pc->imm.p;
+    result = call_native(call->target, call, regs);
+    if (pc->dst != 0) {
+        DST = result;
+    }
+    NEXT();
+op_CALLR:
+    call = (struct vm_call *)pc->imm.p;
+    target = A.p;
+    if (is_function(program, target)) {
+        callee = (struct vm_function *)target;
+        goto enter;
+    }
+    result = call_native(target, call, regs);
+    if (pc->dst != 0) {
+        DST = result;
+    }
+    NEXT();
+op_RET:
+    result = A;
+    pc = frame->return_pc;
+    regs = frame->regs;
+    fp = frame->fp;
+    top = frame->top;
+    frame = frame->caller;
+    if (pc == NULL) {
+        jacc_free(stack);
+        return result.i;
+    }
+    if (pc->dst != 0) {
+        DST = result;
+    }
+    NEXT();
+}
+
+extern void vm_free(vm_program_t program)
+{
+    int i;
+    if (program == NULL) {
+        return;
+    }
+    for (i = 0; i < program->owned_count; i++) {
+        jacc_free(program->owned[i]);
+    }
+    jacc_free(program->owned);
+    jacc_free(program->functions);
+    jacc_free(program->code);
+    jacc_free(program);
+}
@@ -0,0 +1,24 @@
+#ifndef JACC_VM_H
+#define JACC_VM_H
+
+#include "symtable.h"
+
+/*
+ * Register bytecode run by a threaded interpreter, for executing programs
+ * where no assembler or x86 host is at hand. Functions are translated from
+ * their three-address code with every virtual register becoming a slot of
+ * the frame, and common pairs are fused into single instructions: compare
+ * and branch, operations with a constant, loading a local and adding to it.
+ * Functions without a body are called in the host process, which needs an
+ * x86-64 System V host; elsewhere only self-contained programs translate.
+ */
+
+typedef struct vm_program *vm_program_t;
+
+/* NULL after printing the reason when the program cannot be translated */
+extern vm_program_t vm_compile(symtable_t symtable, int opt_level);
+/* the value main returns */
+extern int vm_run(vm_program_t program);
+extern void vm_free(vm_program_t program);
+
+#endif
@@ -3,19 +3,87 @@ from __future__ import with_statement
 import glob
 import os
 import difflib
+import shutil
+import tempfile
 import time
 
 jacc_cmd = lambda x: 'jacc %s "%%(input)s" > "%%(output)s" 2>&1' % x
 
 tests = {
     #'lexer': jacc_cmd('lex'),
-    #'expressions': jacc_cmd('parse_expr'),
+    'expressions': jacc_cmd('parse_expr'),
     #'statements': jacc_cmd('parse_stmt'),
-    #'declarations': jacc_cmd('parse'),
-    #'semantic': jacc_cmd('parse'),
+    'declarations': jacc_cmd('parse'),
+    'semantic': jacc_cmd('parse'),
+    'json': jacc_cmd('json'),
+    'ir': jacc_cmd('ir'),
+    'lazy': jacc_cmd('ir -lazy'),
+    'image': 'jacc serialize "%(input)s" > "%(image_output)s" && "%(jacc)s" inspect "%(image_output)s" > "%(output)s" 2>&1',
+    'prologue': 'jacc serialize "%(dir)s/prologue.h" > "%(image_output)s" && "%(jacc)s" parse -P"%(image_output)s" "%(input)s" > "%(output)s" 2>&1',
+    # an i386 prologue must be refused by the x86-64 target
+    'prologue_x86_64': 'jacc serialize "%(dir)s/prologue.h" > "%(image_output)s" && ! "%(jacc)s" parse --target=x86_64-linux -P"%(image_output)s" "%(input)s" > "%(output)s" 2>&1',
     'generator': 'jacc compile "%(input)s" > "%(asm_output)s" 2>&1 && fasm "%(asm_output)s" "%(exe_output)s" 2>&1 > "%(output)s" && "%(exe_output)s" > "%(output)s"',
+    'generator_sse2': 'jacc compile -msse2 "%(input)s" > "%(asm_output)s" 2>&1 && fasm "%(asm_output)s" "%(exe_output)s" 2>&1 > "%(output)s" && "%(exe_output)s" > "%(output)s"',
+    'generator_x86_64': 'jacc compile --target=x86_64-linux "%(input)s" > "%(asm_output)s" 2>&1 && cc -x assembler -o "%(exe_output)s" "%(asm_output)s" > "%(output)s" 2>&1 && "%(exe_output)s" > "%(output)s"',
+    'generator_elf': 'jacc object --target=x86_64-linux "%(input)s" > "%(asm_output)s" && cc -o "%(exe_output)s" "%(asm_output)s" > "%(output)s" 2>&1 && "%(exe_output)s" > "%(output)s"',
+    'generator_run': 'jacc run "%(input)s" > "%(output)s"',
+    'generator_O0': 'jacc run -O0 "%(input)s" > "%(output)s"',
+    'generator_O2': 'jacc run -O2 "%(input)s" > "%(output)s"',
+    'generator_vm': 'jacc vm "%(input)s" > "%(output)s"',
 }
 
+# suites sharing the programs of another one, a <name>.<suite>.answer overrides the common answer
+test_dirs = {
+    'prologue_x86_64': 'prologue',
+    'generator_sse2': 'generator',
+    'generator_x86_64': 'generator',
+    'generator_elf': 'generator',
+    'generator_run': 'generator',
+    'generator_O0': 'generator',
+    'generator_O2': 'generator',
+    'generator_vm': 'generator',
+}
+
+STRESS_DEPTH = 100000
+
+def nested_parens(depth):
+    return '(' * depth + '1' + ')' * depth
+
+def else_if_chain(depth):
+    chain = ''.join('    else if (x == %d) x = %d;\n' % (i, i + 1) for i in range(depth))
+    return 'void main()\n{\n    int x;\n    x = 0;\n    if (x) x = 1;\n%s}\n' % chain
+
+def nested_ifs(depth):
+    return 'void main()\n{\n    int x;\n    x = 1;\n    %sx = 2;\n}\n' % ('if (x) ' * depth)
+
+def nested_blocks(depth):
+    return 'void main()\n{\n    int x;\n    %sx = 2;%s\n}\n' % ('{' * depth, '}' * depth)
+
+def nested_expr(depth):
+    return 'void main()\n{\n    int x;\n    x = %s1%s;\n}\n' % ('1 + (' * depth, ')' * depth)
+
+def many_globals(count):
+    globals = ''.join('int g%d;\n' % i for i in range(count))
+    return '%svoid main()\n{\n    g%d = 1;\n}\n' % (globals, count - 1)
+
+stress_tests = {
+    'parens': (nested_parens, jacc_cmd('parse_expr')),
+    'else_if_chain': (else_if_chain, jacc_cmd('compile')),
+    'nested_ifs': (nested_ifs, jacc_cmd('compile')),
+    'nested_blocks': (nested_blocks, jacc_cmd('compile')),
+    'nested_expr': (nested_expr, jacc_cmd('compile')),
+    'nested_expr_jobs': (nested_expr, jacc_cmd('compile -j4')),
+    'many_globals': (many_globals, jacc_cmd('compile')),
+}
+
+# a parallel or lazy parse must produce exactly the output of a serial one
+jobs_tests = [
+    ('declarations', 'parse'),
+    ('semantic', 'parse'),
+    ('generator', 'ir'),
+    ('ir', 'ir'),
+]
+
 tester_dir = os.path.dirname(os.path.abspath(__file__))
 tests_dir = os.path.join(tester_dir, 'tests')
 
@@ -32,7 +100,7 @@ def read_file(name):
     return [line.strip() for line in lines if len(line.strip()) > 0]
 
 def run_tests(dir, cmd_template):
-    path = os.path.join(tests_dir, dir)
+    path = os.path.join(tests_dir, test_dirs.get(dir, dir))
     total = 0
     failed = []
 
@@ -44,6 +112,8 @@ def run_tests(dir, cmd_template):
         asm_output_file = change_ext(test, '.asm')
         exe_output_file = change_ext(test, '.exe')
         answer_file = change_ext(test, '.answer')
+        if os.path.exists(change_ext(test, '.%s.answer' % dir)):
+            answer_file = change_ext(test, '.%s.answer' % dir)
         diff_file = change_ext(test, '.diff')
 
         cmd = cmd_template % {
@@ -51,6 +121,9 @@ def run_tests(dir, cmd_template):
             'output': output_file,
             'exe_output': exe_output_file,
             'asm_output': asm_output_file,
+            'image_output': change_ext(test, '.img'),
+            'dir': path,
+            'jacc': os.path.join(tester_dir, 'jacc'),
         }
 
         unlink(output_file)
@@ -79,12 +152,72 @@ def run_tests(dir, cmd_template):
             continue
         else:
             unlink(output_file)
+            unlink(change_ext(test, '.img'))
 
     return {
         'total': total,
         'failed': sorted(failed),
     }
 
+def run_stress_tests():
+    work_dir = tempfile.mkdtemp(prefix='jacc_stress')
+    failed = []
+
+    try:
+        for name, (generator, cmd_template) in sorted(stress_tests.items()):
+            input_file = os.path.join(work_dir, name + '.in')
+            output_file = os.path.join(work_dir, name + '.out')
+            with open(input_file, 'w') as f:
+                f.write(generator(STRESS_DEPTH))
+
+            cmd = os.path.join(tester_dir, cmd_template) % {
+                'input': input_file,
+                'output': output_file,
+            }
+            ret_code = os.system(cmd)
+            if ret_code != 0:
+                failed.append('%s (%d returned)' % (name, ret_code))
+                continue
+
+            output = read_file(output_file)
+            if not output or [line for line in output if 'error: ' in line]:
+                failed.append(name)
+    finally:
+        shutil.rmtree(work_dir)
+
+    return {
+        'total': len(stress_tests),
+        'failed': sorted(failed),
+    }
+
+def run_jobs_tests():
+    work_dir = tempfile.mkdtemp(prefix='jacc_jobs')
+    total = 0
+    failed = []
+
+    try:
+        for dir, command in jobs_tests:
+            for test in sorted(glob.glob(os.path.join(tests_dir, dir, '*.in'))):
+                total += 1
+                test_name = '%s/%s' % (dir, os.path.basename(test))
+                outputs = []
+                for option in ['', ' -j4', ' -lazy']:
+                    output_file = os.path.join(work_dir, 'output%s.out' % option.strip())
+                    os.system(os.path.join(tester_dir, jacc_cmd(command + option)) % {
+                        'input': test,
+                        'output': output_file,
+                    })
+                    outputs.append(read_file(output_file))
+                if outputs[1:] != [outputs[0]] * (len(outputs) - 1):
+                    failed.append(test_name)
+    finally:
+        shutil.rmtree(work_dir)
+
+    return {
+        'total': total,
+        'failed': failed,
+    }
+
 def get_status(failed):
     return "FAIL" if failed else "OK"
 
@@ -92,8 +225,12 @@ if __name__ == '__main__':
     total = 0
     total_failed = 0
     started_at = time.time()
-    for dir, cmd in sorted(tests.items()):
-        stats = run_tests(dir, os.path.join(tester_dir, cmd))
+    suites = [(dir, lambda dir=dir, cmd=cmd: run_tests(dir, os.path.join(tester_dir, cmd)))
+              for dir, cmd in sorted(tests.items())]
+    suites.append(('jobs', run_jobs_tests))
+    suites.append(('stress', run_stress_tests))
+    for dir, run_suite in suites:
+        stats = run_suite()
 
         total += stats['total']
         total_failed += len(stats['failed'])
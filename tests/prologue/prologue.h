@@ -0,0 +1,15 @@
+typedef int size_t;
+struct pair {
+    int first;
+    double second;
+};
+typedef struct pair pair_t;
+enum color { RED, GREEN, BLUE };
+struct {
+    char tag;
+} anonymous;
+int table[BLUE + 1];
+int limit = 10 * 2;
+char *banner = "jacc";
+int min(int a, int b);
+extern int abs_value(int x);